@@ -1,8 +1,14 @@
+// the board goes without the mpu for now, as firmware.ino's PILOT_DEBUG
+// has it. define WITH_MPU to build this anyway (the host's mpubench does)
+#ifndef WITH_MPU
 #define PILOT_DEBUG
+#endif
 
 #ifndef PILOT_DEBUG
 #include "ahrs.h"
+#include "imu.h"
 #include "logger.h"
+#include "profile.h"
 // Arduino Wire library is required if I2Cdev I2CDEV_ARDUINO_WIRE implementation
 // is used in I2Cdev.h
 #include "Wire.h"
@@ -12,26 +18,29 @@
 #include "I2Cdev.h"
 
 #include "MPU6050_9Axis_MotionApps41.h"
-#include <EEPROM.h>
+
+#include "magcal.h"
+
+#ifdef AHRS_FUSION
+#include "mahony.h"
+#endif
 
 MPU6050 mpu;
 
-#define MPU_LOOPS 2
-#define MPU_PAUSES 1
+#define MPU_INTERRUPT 0
 #define DEVICE_ORIENTATION 1.0
 #define TOTAL_CALIBRATION_STEPS 300
 #define CALIBRATION_WAIT 5
 
 int16_t calibrationSteps = 0;
-// mag parameters; todo: should be moved to flash
-//static const float b_field     = 61.2088;
-//static const float offset[3]   = { 2.0848, -33.8208, 28.5815 };
-////static const float b_inv[3][3] = {{ 1, 0, 0 },
-////                                  { 0, 1, 0 },
-////                                  { 0, 0, 1 }};
-//static const float b_inv[3][3] = {{ 0.9745, 0.0240, 0.0054 },
-//                                  { 0.0240, 1.0463, -0.0089 },
-//                                  { 0.0054, -0.0089, 0.9814 }};
+
+// the last ellipsoid fit
+MagCal mag_cal;
+bool mag_cal_valid = false;
+
+// the next one's sums, on calibrateMag()'s stack while it runs: they're
+// too big to keep around
+MagCalSums *mag_sums = NULL;
 
 // MPU control/status vars
 bool dmpReady = false;  // set true if DMP init was successful
@@ -44,6 +53,7 @@ uint8_t fifoBuffer[64]; // FIFO storage buffer
 float current_pitch = 0;
 float current_roll = 0;
 float mag_offset = 0;
+uint32_t heading_time = 0;
 
 // orientation/motion vars
 Quaternion q;           // [w, x, y, z]         quaternion container
@@ -65,32 +75,82 @@ float heading(vector a, vector m);
 void vector_cross(const vector *a, const vector *b, vector *out);
 float vector_dot(const vector *a, const vector *b);
 void vector_normalize(vector *a);
-int readFIFOPacket();
 
 vector_i16t m_min, m_max, running_min, running_max;
 
 // Sets the relative orientation of the MPU
 vector from = {1, 0, 0};
 
-int16_t _settingsAddress = 0;
+Config *_settings = NULL;
+
+#ifdef AHRS_FUSION
+// raw accel, gyro and mag through the fifo at a fixed rate, fused by mahony.h.
+// the mag is the ak8975 on the mpu's aux bus: slave 0 reads its data into
+// the fifo after each sample, slave 1 then starts its next measurement
+#define FUSION_RATE 100
+#define FUSION_PACKET 18
+#define AK8975_ADDRESS 0x0C
+#define AK8975_DATA 0x03
+#define AK8975_CONTROL 0x0A
+#define AK8975_SINGLE 0x01
+
+Mahony fusion;
+
+static uint8_t fusionInit() {
+	mpu.setDLPFMode(MPU6050_DLPF_BW_42);
+	mpu.setRate(1000 / FUSION_RATE - 1);    // 1kHz with the dlpf on
+	mpu.setFullScaleGyroRange(MPU6050_GYRO_FS_250);
+	mpu.setFullScaleAccelRange(MPU6050_ACCEL_FS_2);
+
+	mpu.setI2CBypassEnabled(false);
+	mpu.setSlaveAddress(0, 0x80 | AK8975_ADDRESS);
+	mpu.setSlaveRegister(0, AK8975_DATA);
+	mpu.setSlaveDataLength(0, 6);
+	mpu.setSlaveEnabled(0, true);
+	mpu.setSlaveAddress(1, AK8975_ADDRESS);
+	mpu.setSlaveRegister(1, AK8975_CONTROL);
+	mpu.setSlaveOutputByte(1, AK8975_SINGLE);
+	mpu.setSlaveDataLength(1, 1);
+	mpu.setSlaveEnabled(1, true);
+	mpu.setI2CMasterModeEnabled(true);
+
+	mpu.setAccelFIFOEnabled(true);
+	mpu.setXGyroFIFOEnabled(true);
+	mpu.setYGyroFIFOEnabled(true);
+	mpu.setZGyroFIFOEnabled(true);
+	mpu.setSlave0FIFOEnabled(true);
+	mpu.setFIFOEnabled(true);
+	mpu.setIntDataReadyEnabled(true);
+
+	mahonyInit(&fusion, FUSION_RATE, 1 / 131.0);
+
+	return 0;
+}
+
+static int16_t bigEndian(const uint8_t *b) {
+	return (int16_t) ((b[0] << 8) | b[1]);
+}
+#endif
 
-int mpuInit(int16_t settingsAddress) {
-    _settingsAddress = settingsAddress;
-    
-    logln(F("Reading calibration data at location %d"), _settingsAddress);
+int mpuInit(Config *settings) {
+    _settings = settings;
 
-    EEPROM.get(_settingsAddress, m_min);
-    EEPROM.get(_settingsAddress + sizeof(vector_i16t), m_max);
-//    m_min.x = -70;
-//    m_min.y = -26;
-//    m_min.z = -97;
-//    m_max.x = +60;
-//    m_max.y = +87;
-//    m_max.z = +43;
+    memcpy(&m_min, settings->mag_range.min, sizeof(m_min));
+    memcpy(&m_max, settings->mag_range.max, sizeof(m_max));
+
+    if (settings->loaded & bit(CONFIG_MAG_FIT)) {
+        mag_cal = settings->mag_fit;
+        mag_cal_valid = true;
+    }
 
     logln(F("Starting values min: {%+6d, %+6d, %+6d}\tmax: {%+6d, %+6d, %+6d}"),
         m_min.x, m_min.y, m_min.z,
         m_max.x, m_max.y, m_max.z);
+    if (mag_cal_valid) {
+        logln(F("Ellipsoid offset: {%+6d, %+6d, %+6d}, field %d"),
+            (int) lround(mag_cal.offset[0]), (int) lround(mag_cal.offset[1]), (int) lround(mag_cal.offset[2]),
+            (int) lround(mag_cal.field));
+    }
 
 	// initialize device
 	logln(F("Initializing I2C devices..."));
@@ -101,27 +161,43 @@ int mpuInit(int16_t settingsAddress) {
 	logln(F("Testing device connections..."));
 	mpu.testConnection() ? logln(F("MPU6050 connection successful")) : logln(F("MPU6050 connection failed"));
 
+#ifdef AHRS_FUSION
+	logln(F("Setting up raw samples at %dHz..."), FUSION_RATE);
+	devStatus = fusionInit();
+#else
 	// load and configure the DMP
 	logln(F("Initializing DMP..."));
 	devStatus = mpu.dmpInitialize();
+#endif
 
 	// make sure it worked (returns 0 if so)
 	if (devStatus == 0) {
+#ifdef AHRS_FUSION
+		packetSize = FUSION_PACKET;
+#else
 		// turn on the DMP, now that it's ready
 		logln(F("Enabling DMP..."));
 		mpu.setDMPEnabled(true);
 
+		// get expected DMP packet size for later comparison
+		packetSize = mpu.dmpGetFIFOPacketSize();
+#endif
+
 		// enable Arduino interrupt detection
-		//        Serial.println(F("Enabling interrupt detection (Arduino external interrupt 0)..."));
-		//        attachInterrupt(0, dmpDataReady, RISING);
+		logln(F("Enabling interrupt detection (Arduino external interrupt %d)..."), MPU_INTERRUPT);
+		imuInit();
+		attachInterrupt(MPU_INTERRUPT, imuDataReady, RISING);
+		mpu.resetFIFO();
 		mpuIntStatus = mpu.getIntStatus();
 
 		// set our DMP Ready flag so the main loop() function knows it's okay to use it
 		logln(F("DMP ready! Waiting for first interrupt..."));
 		dmpReady = true;
 
-		// get expected DMP packet size for later comparison
-		packetSize = mpu.dmpGetFIFOPacketSize();
+		// so there's a heading from the start
+		uint32_t start = millis();
+		while (!imuQueued() && millis() - start < 100)
+			mpuPoll();
 
 		return 0;
 	} else {
@@ -136,10 +212,21 @@ int mpuInit(int16_t settingsAddress) {
 }
 
 void calibrationLoop() {
-    if (!readFIFOPacket())
-        return 0;
-    
-    mpu.dmpGetMag(mag, fifoBuffer);
+    ImuSample s;
+
+    // the next sample, waited for as mpuInit() does the first
+    uint32_t start = millis();
+    while (!imuQueued() && millis() - start < 100)
+        mpuPoll();
+
+    if (!imuPop(&s))
+        return;
+
+    // the latest only, it's 100ms between steps
+    while (imuPop(&s))
+        ;
+
+    memcpy(mag, s.mag, sizeof(mag));
     
     running_min.x = min(running_min.x, mag[0]);
     running_min.y = min(running_min.y, mag[1]);
@@ -148,6 +235,9 @@ void calibrationLoop() {
     running_max.x = max(running_max.x, mag[0]);
     running_max.y = max(running_max.y, mag[1]);
     running_max.z = max(running_max.z, mag[2]);
+
+    if (mag_sums)
+        magCalAdd(mag_sums, mag);
     
     delay(100);
     
@@ -163,10 +253,30 @@ void calibrateMag(bool waitForSetup) {
   logln(F("Calibration start. Initial values min: {%+6d, %+6d, %+6d}    max: {%+6d, %+6d, %+6d}"),
         m_min.x, m_min.y, m_min.z,
         m_max.x, m_max.y, m_max.z);
+
+  // the fit starts from the last one, or from min/max with nothing known
+  // about soft iron or the field
+  MagCal last = mag_cal;
+  if (!mag_cal_valid) {
+      memset(&last, 0, sizeof(last));
+      last.offset[0] = (m_min.x + m_max.x) / 2.0;
+      last.offset[1] = (m_min.y + m_max.y) / 2.0;
+      last.offset[2] = (m_min.z + m_max.z) / 2.0;
+      for (uint8_t i = 0; i < 3; i++)
+          last.matrix[i][i] = 1;
+  }
+  MagCalSums sums;
+  magCalBegin(&sums, &last);
+  mag_sums = &sums;
+
+  running_min.x = running_min.y = running_min.z = 32767;
+  running_max.x = running_max.y = running_max.z = -32768;
+  calibrationSteps = 0;
         
   while (calibrationSteps < TOTAL_CALIBRATION_STEPS)
     calibrationLoop();
 
+  mag_sums = NULL;
   logln(F("Calibration complete"));
     
   m_min = running_min;
@@ -176,22 +286,53 @@ void calibrateMag(bool waitForSetup) {
         m_min.x, m_min.y, m_min.z,
         m_max.x, m_max.y, m_max.z);
 
-  logln(F("Writing to eeprom at location %d"), _settingsAddress);
+  MagCal cal;
+  uint8_t got = magCalSolve(&sums, &last, &cal);
+  if (got == MAGCAL_FAILED)
+      logln(F("No ellipsoid fit, keeping min/max"));
+  else {
+      mag_cal = cal;
+      mag_cal_valid = true;
+      logln(F("%s ellipsoid offset: {%+6d, %+6d, %+6d}, field %d"),
+          got == MAGCAL_FULL ? "Full" : "Held",
+          (int) lround(cal.offset[0]), (int) lround(cal.offset[1]), (int) lround(cal.offset[2]),
+          (int) lround(cal.field));
+  }
 
-  EEPROM.put(_settingsAddress, m_min);
-  EEPROM.put(_settingsAddress + sizeof(vector_i16t), m_max);
+  logln(F("Writing to eeprom"));
+
+  memcpy(_settings->mag_range.min, &m_min, sizeof(m_min));
+  memcpy(_settings->mag_range.max, &m_max, sizeof(m_max));
+  configSave(_settings, CONFIG_MAG_RANGE);
+  if (mag_cal_valid) {
+      _settings->mag_fit = mag_cal;
+      configSave(_settings, CONFIG_MAG_FIT);
+  }
 }
 
 void normalize_mpu(int16_t mag_val[3], float normalized[3]) {
+    float m[3];
+
+    if (mag_cal_valid)
+        magCalApply(&mag_cal, mag_val, m);
+    else {
+        m[0] = mag_val[0] - (m_min.x + m_max.x) / 2.0;
+        m[1] = mag_val[1] - (m_min.y + m_max.y) / 2.0;
+        m[2] = mag_val[2];
+    }
+
     // normalize *and* re-align axes (because, you know, having all sensors be the same is too much to ask for).
-    normalized[1] =   mag_val[0] - (m_min.x + m_max.x) / 2.0;
-    normalized[0] =   mag_val[1] - (m_min.y + m_max.y) / 2.0;
-    normalized[2] = -(mag_val[2]);
+    normalized[1] =   m[0];
+    normalized[0] =   m[1];
+    normalized[2] = -(m[2]);
 }
 
-int readFIFOPacket() {
+// moves whatever packets the mpu has for us into imu.h's queue. no waiting:
+// with no interrupt since last time there's nothing to read
+void mpuPoll() {
     // if programming failed, don't try to do anything
-    if (!dmpReady) return 0;
+    if (!dmpReady || !imuPending())
+        return;
 
     // reset interrupt flag and get INT_STATUS byte
     mpuIntStatus = mpu.getIntStatus();
@@ -199,95 +340,139 @@ int readFIFOPacket() {
     // get current FIFO count
     fifoCount = mpu.getFIFOCount();
 
-    // check for overflow (this should never happen unless our code is too inefficient)
-    while ((mpuIntStatus & 0x10) || fifoCount == 1024) {
-        // reset so we can continue cleanly
+    // check for overflow (this should never happen unless our code is too
+    // inefficient). what's there may be half a packet, so it all goes. raw
+    // packets are small enough that the fifo holds more of them than there
+    // are interrupt times, so they're let go that far at most
+#ifdef AHRS_FUSION
+    if ((mpuIntStatus & 0x10) || fifoCount / packetSize > IMU_STAMPS_SIZE) {
+#else
+    if ((mpuIntStatus & 0x10) || fifoCount == 1024) {
+#endif
         mpu.resetFIFO();
-
-        // do this again.
-        // reset interrupt flag and get INT_STATUS byte
-        mpuIntStatus = mpu.getIntStatus();
-
-        // get current FIFO count
-        fifoCount = mpu.getFIFOCount();
+        imuFifoReset();
+        logln(F("MPU FIFO overflow"));
+        return;
     }
 
-    while (!(mpuIntStatus & 0x02)) {
-        mpuIntStatus = mpu.getIntStatus();
+    // a full queue leaves the rest in the fifo for next time
+    for (uint8_t waiting = fifoCount / packetSize; waiting && imuQueued() < IMU_QUEUE_SIZE; waiting--) {
+        ImuSample s;
+
+        s.time = imuPacketTime(waiting);
+        mpu.getFIFOBytes(fifoBuffer, packetSize);
+
+#ifdef AHRS_FUSION
+        // accel and gyro big endian, the ak8975's data little endian
+        for (uint8_t i = 0; i < 3; i++) {
+            s.acc[i] = bigEndian(fifoBuffer + 2 * i);
+            s.gyro[i] = bigEndian(fifoBuffer + 6 + 2 * i);
+            s.mag[i] = (int16_t) (fifoBuffer[12 + 2 * i] | (fifoBuffer[13 + 2 * i] << 8));
+        }
+#else
+        mpu.dmpGetQuaternion(s.quat, fifoBuffer);
+        mpu.dmpGetMag(s.mag, fifoBuffer);
+        mpu.dmpGetAccel(s.acc, fifoBuffer);
+#endif
 
-        // get current FIFO count
-        fifoCount = mpu.getFIFOCount();
+        imuPush(&s);
     }
+}
 
-    // wait for correct available data length, should be a VERY short wait
-    while (fifoCount < packetSize) fifoCount = mpu.getFIFOCount();
+#ifdef AHRS_FUSION
+// every sample goes through the filter, in order
+static void fuse(const ImuSample *s) {
+	float mpu_mag_out[3];
+	int16_t m[3];
 
-    // read a packet from FIFO
-    mpu.getFIFOBytes(fifoBuffer, packetSize);
+	memcpy(mag, s->mag, sizeof(mag));
+	memcpy(acc, s->acc, sizeof(acc));
 
-    return 1;
-}
+	normalize_mpu(mag, mpu_mag_out);
+	for (uint8_t i = 0; i < 3; i++)
+		m[i] = lround(mpu_mag_out[i]);
 
-int readHeading(float f_ypr[3], bool calibration) {
-    if (!readFIFOPacket())
-        return 0;
-	
-	// track FIFO count here in case there is > 1 packet available
-	// (this lets us immediately read more without waiting for an interrupt)
-	fifoCount -= packetSize;
+	mahonyUpdate(&fusion, s->gyro, s->acc, m);
+}
 
-	mpu.dmpGetMag(mag, fifoBuffer);
-    mpu.dmpGetAccel(acc, fifoBuffer);
+// the filter's attitude, as of the last sample through it
+void readHeading(const ImuSample *s, float f_ypr[3]) {
+	Bam yaw, pitch, roll;
+	(void) s;
 
-	if (!calibration) {
-		mpu.dmpGetQuaternion(&q, fifoBuffer);
-		mpu.dmpGetGravity(&gravity, &q);
-		mpu.dmpGetYawPitchRoll(ypr, &q, &gravity);
+	mahonyAngles(&fusion, &yaw, &pitch, &roll);
+	f_ypr[0] = bamToRad(yaw);
+	f_ypr[1] = (int16_t) pitch.v * (TWO_PI / 65536.0);
+	f_ypr[2] = (int16_t) roll.v * (TWO_PI / 65536.0);
+}
+#else
+void readHeading(const ImuSample *s, float f_ypr[3]) {
+	q.w = s->quat[0] / 16384.0;
+	q.x = s->quat[1] / 16384.0;
+	q.y = s->quat[2] / 16384.0;
+	q.z = s->quat[3] / 16384.0;
 
-		float mpu_mag_out[3];
-		normalize_mpu(mag, mpu_mag_out);
+	mpu.dmpGetGravity(&gravity, &q);
+	mpu.dmpGetYawPitchRoll(ypr, &q, &gravity);
 
-		float magnetom[3];
-		for (int i=0; i<3; i++)
-			magnetom[i] = mpu_mag_out[i];
+	memcpy(mag, s->mag, sizeof(mag));
+	memcpy(acc, s->acc, sizeof(acc));
 
-        vector m = { magnetom[0], magnetom[1], magnetom[2] };
-        vector a = { gravity.x, gravity.y, gravity.z };
+	float mpu_mag_out[3];
+	normalize_mpu(mag, mpu_mag_out);
 
-		f_ypr[0] = heading(a, m);
-		f_ypr[1] = -ypr[1];
-		f_ypr[2] = ypr[2];
-	} else
-		logln(F("%d, %d, %d"), mag[0], mag[1], mag[2]);
+	vector m = { mpu_mag_out[0], mpu_mag_out[1], mpu_mag_out[2] };
+	vector a = { gravity.x, gravity.y, gravity.z };
 
-	return 1;
+	f_ypr[0] = heading(a, m);
+	f_ypr[1] = -ypr[1];
+	f_ypr[2] = ypr[2];
 }
+#endif
 
 void writeCalibrationLine() {
-	float f_ypr[3];
-	readHeading(f_ypr, true);
+	ImuSample s;
+
+	mpuPoll();
+	while (imuPop(&s))
+		logln(F("%d, %d, %d"), s.mag[0], s.mag[1], s.mag[2]);
 }
 
+// the heading from the newest sample, or the last one if nothing's come in
 float readSteadyHeading() {
-	float f_ypr[3];
-	float heading = 0;
+	PROFILE_SCOPE(PROF_HEADING);
 
-	for (uint8_t i=0; i<MPU_LOOPS;) {
-		i += readHeading(f_ypr, false);
-		heading += f_ypr[0];
-		delay(MPU_PAUSES);
-	}
+	static float heading = 0;
+	ImuSample s, newest;
+	bool fresh = false;
+
+	// a full queue may have left packets in the fifo, so poll until it's dry
+	for (mpuPoll(); imuQueued(); mpuPoll())
+		while (imuPop(&s)) {
+#ifdef AHRS_FUSION
+			fuse(&s);
+#endif
+			newest = s;
+			fresh = true;
+		}
+
+	if (!fresh)
+		return heading;
+
+	float f_ypr[3];
+	readHeading(&newest, f_ypr);
 
-	heading /= ((float)MPU_LOOPS);
-	heading = toCircle(heading + (DEVICE_ORIENTATION * PI) + mag_offset);
+	heading = toCircle(f_ypr[0] + (DEVICE_ORIENTATION * PI) + mag_offset);
+	heading_time = newest.time;
 
 	current_pitch = f_ypr[1] * 180.0 / PI;
 	current_roll = f_ypr[2] * 180.0 / PI;
 	// heading = (-heading) - (PI / 2.0);
-	logln(F("AHRS (y,p,r): %d, %d, %d"),
+	logln(F("AHRS (y,p,r): %d, %d, %d (%dus old)"),
 			((int16_t) (heading * 180.0 / PI)),
 			((int16_t) (current_pitch)),
-			((int16_t) (current_roll))
+			((int16_t) (current_roll)),
+			(int16_t) min(micros() - heading_time, 32767UL)
 		);
 
 	return heading;
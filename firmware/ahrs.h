@@ -2,17 +2,23 @@
 #define ahrs_h
 
 #include "Arduino.h"
+#include "config.h"
 
-#ifndef PILOT_DEBUG
 // reporting value
 extern float current_pitch;
 extern float current_roll;
 extern float mag_offset;
 
+// micros() when the sample readSteadyHeading() last used was taken
+extern uint32_t heading_time;
+
+#ifndef PILOT_DEBUG
 typedef unsigned char prog_uchar;
 
 float readSteadyHeading();
-int mpuInit(int16_t settingsAddress);
+// the compass calibration from settings, saved back there by calibrateMag()
+int mpuInit(Config *settings);
+void mpuPoll();
 void calibrateMag(bool waitForSetup);
 
 float toCircle(float value);
@@ -0,0 +1,68 @@
+#ifndef __bam_h
+#define __bam_h
+
+#include "Arduino.h"
+
+// binary angles: a full turn in 16 bits, the 2*PI/2^16 units trig_fix.h
+// takes and returns. uint16_t arithmetic wraps the way the angle does, so
+// sums and differences need no correcting, and no float work on the avr.
+//
+// a struct rather than a bare uint16_t so an angle can't be mixed up with a
+// count or a servo position; Bam.v goes straight to _cos_fix()
+
+struct Bam {
+	uint16_t v;
+};
+
+// whole degrees, for constants
+#define BAM_DEG(d) ((uint16_t) ((int32_t) (d) * 8192 / 45))
+
+inline Bam bamRaw(uint16_t v) {
+	Bam a = { v };
+	return a;
+}
+
+// any number of turns either way
+inline Bam bamDeg(float deg) {
+	return bamRaw((uint16_t) lround(deg * (65536.0 / 360.0)));
+}
+
+inline Bam bamRad(float rad) {
+	return bamRaw((uint16_t) lround(rad * (65536.0 / TWO_PI)));
+}
+
+// [0, 360)
+inline float bamToDeg(Bam a) {
+	return a.v * (360.0 / 65536.0);
+}
+
+// [0, 2*PI)
+inline float bamToRad(Bam a) {
+	return a.v * (TWO_PI / 65536.0);
+}
+
+inline Bam operator+(Bam a, Bam b) { return bamRaw(a.v + b.v); }
+inline Bam operator-(Bam a, Bam b) { return bamRaw(a.v - b.v); }
+inline Bam operator-(Bam a) { return bamRaw(-a.v); }
+inline Bam &operator+=(Bam &a, Bam b) { a.v += b.v; return a; }
+inline Bam &operator-=(Bam &a, Bam b) { a.v -= b.v; return a; }
+inline bool operator==(Bam a, Bam b) { return a.v == b.v; }
+inline bool operator!=(Bam a, Bam b) { return a.v != b.v; }
+
+// the short way from one angle to another, positive clockwise. half a turn
+// comes out as -32768
+inline int16_t bamDiff(Bam from, Bam to) {
+	return (int16_t) (to.v - from.v);
+}
+
+// how far apart, either way: [0, 32768]
+inline uint16_t bamDist(Bam a, Bam b) {
+	int16_t d = bamDiff(a, b);
+	return d < 0 ? -(uint16_t) d : d;
+}
+
+inline float bamDiffDeg(Bam from, Bam to) {
+	return bamDiff(from, to) * (360.0 / 65536.0);
+}
+
+#endif
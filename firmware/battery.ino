@@ -8,9 +8,13 @@ void batteryInit() {
     digitalWrite(BATT_V_EN, LOW);
 }
 
-float measureVoltage() {
+// the divider needs BATT_SETTLE ms switched in before batterySample()
+void batteryPowerUp() {
     digitalWrite(BATT_V_EN, HIGH);
-    delay(10);
+}
+
+float batterySample() {
+    PROFILE_SCOPE(PROF_VOLTAGE);
 
     float voltage = ((float)analogRead(BATT_VAL)) / 1023.0 * 3.3;
 
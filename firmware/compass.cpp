@@ -0,0 +1,164 @@
+#include "compass.h"
+
+// compass noise, degrees sd a sample
+#define COMPASS_NOISE 3.0
+
+// how fast the turn rate may change: white noise in the yaw acceleration,
+// (degrees/s^2)^2 per Hz. the rudder hard over takes a second or so
+#define COMPASS_YAW_NOISE 100.0
+
+// gps course noise and whatever else is in compass - course, degrees sd
+#define COURSE_NOISE 4.0
+
+// before any fixes: a, b and c within about 10 degrees, leeway within about
+// 0.3 degrees per degree of heel, and the current within about a knot
+#define DEV_PRIOR 10.0
+#define LEEWAY_PRIOR 0.3
+#define CURRENT_PRIOR 1.0
+
+// how far they may wander per fix, sd: over an hour of fixes a, b and c
+// about a degree and a half, the current about a tenth of a knot. leeway
+// stays
+#define DEV_WALK 0.05
+#define CURRENT_WALK 0.003
+
+// no learning while turning faster than this, degrees/s: the course is
+// behind the heading
+#define LEARN_MAX_RATE 5.0
+
+// a fix this far off what's expected is left out, in sds
+#define LEARN_GATE 4.0
+
+// no carrying the heading forward by more than this, seconds
+#define MAX_EXTRAPOLATE 0.5
+
+// index into a packed lower triangle, i >= j
+static uint8_t tri(uint8_t i, uint8_t j) {
+	return i * (i + 1) / 2 + j;
+}
+
+static float wrap180(float v) {
+	return v - 360 * floor((v + 180) / 360);
+}
+
+static float wrap360(float v) {
+	return v - 360 * floor(v / 360);
+}
+
+// each term's prior variance, and how far it wanders per fix
+static float prior(uint8_t i) {
+	return i < 3 ? DEV_PRIOR * DEV_PRIOR : (i == 3 ? LEEWAY_PRIOR * LEEWAY_PRIOR : CURRENT_PRIOR * CURRENT_PRIOR);
+}
+
+static float walk(uint8_t i) {
+	return i < 3 ? DEV_WALK * DEV_WALK : (i == 3 ? 0 : CURRENT_WALK * CURRENT_WALK);
+}
+
+void compassInit(Compass *c) {
+	memset(c, 0, sizeof(*c));
+
+	for (uint8_t i = 0; i < COMPASS_DEV_TERMS; i++)
+		c->dev_p[tri(i, i)] = prior(i);
+}
+
+float compassDeviation(const Compass *c, float heading) {
+	float h = heading * DEG_TO_RAD;
+
+	return c->dev[0] + c->dev[1] * sin(h) + c->dev[2] * cos(h);
+}
+
+void compassUpdate(Compass *c, Bam reading, uint32_t time) {
+	float z = bamToDeg(reading);
+
+	if (!c->started) {
+		c->heading = wrap360(z - compassDeviation(c, z));
+		c->rate = 0;
+		c->p[0] = COMPASS_NOISE * COMPASS_NOISE;
+		c->p[1] = 0;
+		c->p[2] = 30 * 30;
+		c->time = time;
+		c->started = true;
+		return;
+	}
+
+	if (time == c->time)
+		return;
+
+	float dt = (time - c->time) / 1e6;
+	c->time = time;
+
+	// carried forward at the turn rate, more unsure the longer it's been
+	float q = COMPASS_YAW_NOISE;
+	c->heading += c->rate * dt;
+	c->p[0] += dt * (2 * c->p[1] + dt * c->p[2]) + q * dt * dt * dt / 3;
+	c->p[1] += dt * c->p[2] + q * dt * dt / 2;
+	c->p[2] += q * dt;
+
+	// the sample, less the deviation where we're pointing
+	float y = wrap180(z - compassDeviation(c, c->heading) - c->heading);
+	float s = c->p[0] + COMPASS_NOISE * COMPASS_NOISE;
+	float k0 = c->p[0] / s, k1 = c->p[1] / s;
+
+	c->heading = wrap360(c->heading + k0 * y);
+	c->rate += k1 * y;
+
+	c->p[2] -= k1 * c->p[1];
+	c->p[1] -= k1 * c->p[0];
+	c->p[0] -= k0 * c->p[0];
+}
+
+bool compassCourse(Compass *c, Bam course, float speed, float heel) {
+	if (!c->started || fabs(c->rate) > LEARN_MAX_RATE)
+		return false;
+
+	// through the water the boat's going the heading plus leeway, w. over
+	// the ground it's also set by the current, so what's across w of the
+	// ground speed is what's across w of the current:
+	//
+	//   speed sin(course - w) = east cos(w) - north sin(w)
+	//
+	// with w = compass - deviation + l * heel. as learned so far, the
+	// compass less the deviation is the filtered heading
+	float h = c->heading * DEG_TO_RAD;
+	float w = h + c->dev[3] * heel * DEG_TO_RAD;
+	float across = bamToRad(course) - w;
+	float cw = cos(w), sw = sin(w);
+	float e = -(speed * sin(across) - c->dev[4] * cw + c->dev[5] * sw);
+
+	// how that changes with each term, a little way from here
+	float dw = (-speed * cos(across) + c->dev[4] * sw + c->dev[5] * cw) * DEG_TO_RAD;
+	float x[COMPASS_DEV_TERMS] = { -dw, -dw * sin(h), -dw * cos(h), dw * heel, -cw, sw };
+
+	// they may have wandered since the last fix. no further than the prior,
+	// or they'd run away along a leg that tells nothing about them
+	for (uint8_t i = 0; i < COMPASS_DEV_TERMS; i++)
+		if (c->dev_p[tri(i, i)] < prior(i))
+			c->dev_p[tri(i, i)] += walk(i);
+
+	float noise = speed * COURSE_NOISE * DEG_TO_RAD;
+	float px[COMPASS_DEV_TERMS], s = noise * noise;
+	for (uint8_t i = 0; i < COMPASS_DEV_TERMS; i++) {
+		px[i] = 0;
+		for (uint8_t j = 0; j < COMPASS_DEV_TERMS; j++)
+			px[i] += c->dev_p[i >= j ? tri(i, j) : tri(j, i)] * x[j];
+		s += x[i] * px[i];
+	}
+
+	if (!(s > 0) || e * e > LEARN_GATE * LEARN_GATE * s)
+		return false;
+
+	for (uint8_t i = 0; i < COMPASS_DEV_TERMS; i++) {
+		c->dev[i] += px[i] * e / s;
+		for (uint8_t j = 0; j <= i; j++)
+			c->dev_p[tri(i, j)] -= px[i] * px[j] / s;
+	}
+
+	c->fixes++;
+	return true;
+}
+
+Bam compassHeading(const Compass *c, uint32_t now) {
+	float dt = min((now - c->time) / 1e6, (double) MAX_EXTRAPOLATE);
+
+	return bamDeg(c->heading + c->rate * dt);
+}
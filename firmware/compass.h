@@ -0,0 +1,59 @@
+#ifndef __compass_h
+#define __compass_h
+
+#include "Arduino.h"
+#include "bam.h"
+
+// heading and turn rate from the compass, with its deviation learned off the
+// gps course.
+//
+// a two state kalman filter (heading, turn rate) takes each compass sample
+// as it comes, corrected for deviation, so the heading keeps up with a turn
+// instead of lagging it the way an average does, and can be carried forward
+// to when it's used.
+//
+// the deviation is taken as a + b sin(h) + c cos(h), what's left of the
+// boat's iron after calibration. each gps fix at speed and not turning gives
+// the course over ground against the compass, which is off from it by that,
+// leeway and the current setting the boat sideways. leeway is taken as
+// l * heel: heel changes sides with the tack, so it's told apart from a. the
+// current's angle goes with heading too, but over the speed: as the boat's
+// speed changes with the point of sail it's told apart from b and c, and
+// it's let wander faster than they do. the six are a second, slow (extended)
+// kalman filter of their own.
+//
+// degrees and degrees per second throughout, the current in knots. float:
+// the second filter only runs once a fix
+
+#define COMPASS_DEV_TERMS 6
+
+struct Compass {
+	float heading;      // [0, 360)
+	float rate;         // clockwise
+	float p[3];         // covariance: heading, cross, rate
+	uint32_t time;      // micros() of the last sample
+	bool started;
+
+	float dev[COMPASS_DEV_TERMS];    // a, b, c, l, current east and north
+	float dev_p[COMPASS_DEV_TERMS * (COMPASS_DEV_TERMS + 1) / 2];  // lower triangle, by rows
+	uint16_t fixes;     // that have gone into the deviation
+};
+
+void compassInit(Compass *c);
+
+// a compass sample, taken at time (micros()). the same time twice is the
+// same sample, and left out
+void compassUpdate(Compass *c, Bam reading, uint32_t time);
+
+// a gps fix's course and speed (knots) over ground, with the heel (degrees,
+// to starboard) at the time: learns the deviation. false if the fix wasn't
+// used
+bool compassCourse(Compass *c, Bam course, float speed, float heel);
+
+// the heading carried forward to now (micros())
+Bam compassHeading(const Compass *c, uint32_t now);
+
+// what the compass reads over true at a heading, as learned
+float compassDeviation(const Compass *c, float heading);
+
+#endif
@@ -0,0 +1,166 @@
+#include "config.h"
+#include "telemetry.h"
+#include <EEPROM.h>
+#include <stddef.h>
+
+// the layout before this one: the mag's min and max, then a marker ahead
+// of its fit, and 256 on a marker ahead of the gains, as doubles
+#define LEGACY_FIT 12
+#define LEGACY_FIT_MARKER 'e'
+#define LEGACY_PID 256
+#define LEGACY_PID_MARKER 'w'
+
+struct ConfigLayout {
+	uint8_t version;
+	uint8_t slots;
+	uint8_t size;
+	uint8_t offset;       // in Config
+};
+
+static const ConfigLayout layout[CONFIG_RECORDS] = {
+	{ CONFIG_MAG_RANGE_VERSION, CONFIG_MAG_RANGE_SLOTS, sizeof(ConfigMagRange), offsetof(Config, mag_range) },
+	{ CONFIG_MAG_FIT_VERSION, CONFIG_MAG_FIT_SLOTS, sizeof(MagCal), offsetof(Config, mag_fit) },
+	{ CONFIG_PID_VERSION, CONFIG_PID_SLOTS, 3 * sizeof(float), offsetof(Config, pid) },
+	{ CONFIG_MAG_OFFSET_VERSION, CONFIG_MAG_OFFSET_SLOTS, sizeof(float), offsetof(Config, mag_offset) }
+};
+
+// the biggest record
+#define CONFIG_DATA_MAX sizeof(MagCal)
+
+uint16_t configSize(uint8_t record) {
+	if (record < CONFIG_RECORDS)
+		return layout[record].slots * (CONFIG_HEADER + layout[record].size);
+
+	uint16_t size = 0;
+	for (uint8_t i = 0; i < CONFIG_RECORDS; i++)
+		size += configSize(i);
+
+	return size;
+}
+
+uint16_t configAddress(const Config *c, uint8_t record) {
+	uint16_t at = c->address;
+
+	for (uint8_t i = 0; i < record && i < CONFIG_RECORDS; i++)
+		at += configSize(i);
+
+	return at;
+}
+
+static uint16_t slotAddress(const Config *c, uint8_t record, uint8_t slot) {
+	return configAddress(c, record) + slot * (CONFIG_HEADER + layout[record].size);
+}
+
+static uint16_t slotCrc(uint8_t record, uint8_t seq, uint8_t version, const uint8_t *data) {
+	uint16_t crc = telemetryCrc(telemetryCrc(telemetryCrc(0xffff, record), seq), version);
+
+	for (uint8_t i = 0; i < layout[record].size; i++)
+		crc = telemetryCrc(crc, data[i]);
+
+	return crc;
+}
+
+void configInit(Config *c, uint16_t address) {
+	memset(c, 0, sizeof(*c));
+	c->address = address;
+
+	// so the first save's to slot 0
+	for (uint8_t i = 0; i < CONFIG_RECORDS; i++) {
+		c->slot[i] = layout[i].slots - 1;
+		c->seq[i] = 0xff;
+	}
+}
+
+// what there is of the layout before this one, over c
+static uint8_t loadLegacy(Config *c) {
+	uint8_t found = 0;
+	ConfigMagRange range;
+
+	EEPROM.get(c->address, range);
+
+	// it was read whether or not it had been calibrated: blank, it's all -1
+	boolean calibrated = true;
+	for (uint8_t i = 0; i < 3; i++)
+		calibrated = calibrated && range.min[i] < range.max[i];
+
+	if (calibrated) {
+		c->mag_range = range;
+		found |= bit(CONFIG_MAG_RANGE);
+	}
+
+	if (EEPROM.read(c->address + LEGACY_FIT) == LEGACY_FIT_MARKER) {
+		EEPROM.get(c->address + LEGACY_FIT + 1, c->mag_fit);
+		found |= bit(CONFIG_MAG_FIT);
+	}
+
+	if (EEPROM.read(c->address + LEGACY_PID) == LEGACY_PID_MARKER) {
+		double gain;
+
+		for (uint8_t i = 0; i < 3; i++)
+			c->pid[i] = EEPROM.get(c->address + LEGACY_PID + 1 + i * sizeof(double), gain);
+		found |= bit(CONFIG_PID);
+	}
+
+	return found;
+}
+
+uint8_t configLoad(Config *c) {
+	uint8_t data[CONFIG_DATA_MAX];
+	uint16_t at = c->address;
+
+	c->loaded = 0;
+
+	for (uint8_t r = 0; r < CONFIG_RECORDS; r++) {
+		const ConfigLayout *l = &layout[r];
+
+		for (uint8_t s = 0; s < l->slots; s++) {
+			uint8_t seq = EEPROM.read(at);
+			uint8_t version = EEPROM.read(at + 1);
+			uint16_t crc = EEPROM.read(at + 2) | (EEPROM.read(at + 3) << 8);
+
+			for (uint8_t i = 0; i < l->size; i++)
+				data[i] = EEPROM.read(at + CONFIG_HEADER + i);
+			at += CONFIG_HEADER + l->size;
+
+			if (version != l->version || crc != slotCrc(r, seq, version, data))
+				continue;
+
+			if (!(c->loaded & bit(r)) || (int8_t) (seq - c->seq[r]) > 0) {
+				memcpy((uint8_t *) c + l->offset, data, l->size);
+				c->loaded |= bit(r);
+				c->slot[r] = s;
+				c->seq[r] = seq;
+			}
+		}
+	}
+
+	if (!c->loaded) {
+		uint8_t found = loadLegacy(c);
+
+		for (uint8_t r = 0; r < CONFIG_RECORDS; r++)
+			if (found & bit(r))
+				configSave(c, r);
+	}
+
+	return c->loaded;
+}
+
+void configSave(Config *c, uint8_t record) {
+	const ConfigLayout *l = &layout[record];
+	const uint8_t *data = (const uint8_t *) c + l->offset;
+	uint8_t slot = (c->slot[record] + 1) % l->slots;
+	uint8_t seq = c->seq[record] + 1;
+	uint16_t at = slotAddress(c, record, slot);
+	uint16_t crc = slotCrc(record, seq, l->version, data);
+
+	EEPROM.update(at, seq);
+	EEPROM.update(at + 1, l->version);
+	for (uint8_t i = 0; i < l->size; i++)
+		EEPROM.update(at + CONFIG_HEADER + i, data[i]);
+	EEPROM.update(at + 2, crc);
+	EEPROM.update(at + 3, crc >> 8);
+
+	c->slot[record] = slot;
+	c->seq[record] = seq;
+	c->loaded |= bit(record);
+}
@@ -0,0 +1,88 @@
+#ifndef __config_h
+#define __config_h
+
+#include "Arduino.h"
+#include "magcal.h"
+
+// the boat's settings, kept in eeprom: the compass calibration, the
+// steering gains and the mag offset. each is a record, typed here and
+// read into a Config once at boot; the firmware uses the Config, and
+// configSave() writes a record back when it changes.
+//
+// each record has its own run of slots from the address given, one after
+// another in ConfigRecord's order. a save goes to the slot after the
+// newest, so a record saved often (the gains, by every autotune) wears
+// its slots in turn rather than the one. a slot:
+//
+//   seq(1) version(1) crc(2) data
+//
+// seq is one on from the newest slot's, wrapping; version is the
+// record's, below; crc is telemetry.h's crc16-ccitt over the record's
+// number, seq, version and data, and is written last, so a save cut off
+// part way doesn't check out and the one before it stands. the data's
+// the record's struct as it is in memory, little endian.
+//
+// configLoad() takes each record's newest slot that checks out at the
+// version it's built with. a record with none keeps its defaults: bump
+// its version whenever its struct changes, and the old saves are passed
+// over rather than read wrong. with nothing at all that checks out, the
+// layout before this one (the mpu's at the address, the gains 256 on)
+// is read, and saved in this one if it's there.
+
+enum ConfigRecord {
+	CONFIG_MAG_RANGE,     // the mag's min and max, from calibrateMag()
+	CONFIG_MAG_FIT,       // its ellipsoid fit, if there's been one
+	CONFIG_PID,           // the steering gains
+	CONFIG_MAG_OFFSET,    // added to the heading
+	CONFIG_RECORDS
+};
+
+#define CONFIG_MAG_RANGE_VERSION 1
+#define CONFIG_MAG_FIT_VERSION 1
+#define CONFIG_PID_VERSION 1
+#define CONFIG_MAG_OFFSET_VERSION 1
+
+// slots each. two is enough to survive a save cut off
+#define CONFIG_MAG_RANGE_SLOTS 2
+#define CONFIG_MAG_FIT_SLOTS 2
+#define CONFIG_PID_SLOTS 8
+#define CONFIG_MAG_OFFSET_SLOTS 4
+
+#define CONFIG_HEADER 4
+
+struct ConfigMagRange {
+	int16_t min[3];
+	int16_t max[3];
+};
+
+struct Config {
+	ConfigMagRange mag_range;
+	MagCal mag_fit;
+	float pid[3];         // kp, ki, kd: floats, as avr doubles are
+	float mag_offset;     // radians
+
+	uint16_t address;
+	uint8_t loaded;       // bit(record) of each that checked out, or was saved
+
+	// each record's newest slot, and its seq
+	uint8_t slot[CONFIG_RECORDS];
+	uint8_t seq[CONFIG_RECORDS];
+};
+
+// the defaults (all zero, and nothing loaded), from address. set any
+// others before configLoad()
+void configInit(Config *c, uint16_t address);
+
+// every record's newest save over its default, in one pass over the
+// eeprom. bit(record) of each that was found
+uint8_t configLoad(Config *c);
+
+// writes a record to its next slot, waiting on the eeprom
+void configSave(Config *c, uint8_t record);
+
+// where a record's slots start, and how much they take. CONFIG_RECORDS
+// for the end of them all
+uint16_t configAddress(const Config *c, uint8_t record);
+uint16_t configSize(uint8_t record);
+
+#endif
@@ -4,7 +4,6 @@
 #include <Servo.h>
 #include "servo_ctl.h"
 
-//#include "LowPower.h"
 #include "ahrs.h"
 
 #ifndef NO_SD
@@ -14,21 +13,72 @@
 #endif
 
 #include "Wire.h"
-#include "I2Cdev.h"
 
+#ifndef PILOT_DEBUG
+#include "I2Cdev.h"
 #include "MPU6050.h"
+#endif
 
 #include "trig_fix.h"
+#include "bam.h"
+#include "telemetry.h"
+#include "rc_cmd.h"
+#include "trail.h"
+#include "compass.h"
+#include "sched.h"
+#include "tasks.h"
+#include "profile.h"
+#include "route.h"
+#include "learn.h"
+#include "power.h"
+#include "config.h"
 
 #define GPS_BAUDRATE 9600
 #define STATUS_LED 32
 
-#define SCAN_RATE_NORMAL 30000
-#define SCAN_RATE_FAST 500
+// main loop tasks, highest priority first: how often each runs and the
+// longest it should take, us. the heading's read just before the pilot
+// steers by it
+#define AHRS_PERIOD 50000
+#define AHRS_BUDGET 4000
+#define PILOT_PERIOD 50000
+#define PILOT_BUDGET 10000
+#define WIND_PERIOD 50000           // then the plan's, with the sensor warmed up ahead
+#define WIND_BUDGET 2000
+#define GPS_PERIOD 50000
+#define GPS_BUDGET 5000
+#define MENU_PERIOD 100000
+#define MENU_BUDGET 2000
+#define TRIM_PERIOD 500000
+#define TRIM_BUDGET 2000
+#define DATA_BUDGET 5000            // period's dataFreq()
+#define BATTERY_PERIOD 1000000      // the divider warmed up ahead
+#define BATTERY_BUDGET 1000
+#define REPORT_PERIOD 60000000
+#define REPORT_BUDGET 5000
+
+// with nothing due, sleep at most this long (us) before looking again, so
+// the servos and the mpu's queue are still seen to
+#define IDLE_MAX 5000
+
+// how long the wind sensor and the battery divider need powered up before
+// they're read, ms
+#define WIND_SETTLE 50
+#define BATT_SETTLE 10
 
 #define GPS_WARNING 15000
 #define HIGH_RES_GPS_DEFAULT true
 
+// ms the gps takes from power up to a fix, so it's turned on that far ahead
+// of when the next is wanted
+#define GPS_WARMUP 1500
+
+// plan how often the gps, the wind and the pilot run (power.h); without,
+// everything runs flat out
+#define POWER_SAVING_DEFAULT true
+
+// with serial logging on, after so many menu checks of it going out, the
+// serial log goes quiet for so many ms, to leave a gap for a command
 #define WAIT_FOR_COMMAND_EVERY 10
 #define WAIT_FOR_COMMAND_FOR 1000
 
@@ -38,11 +88,19 @@
 
 #define RC_DATA_FREQ 500
 
+// binary telemetry instead of the text data line, at this rate
+#define BINARY_TELEMETRY_DEFAULT false
+#define TELEMETRY_FREQ 250
+#define TELEMETRY_FIELDS TM_ALL_FIELDS
+
 // #define SHOW_MENU_ON_START
 
 #define RAD(v) ((v) * PI / 180.0)
 #define DEG(v) ((v) * 180.0 / PI)
 
+// knots to gps_speed's units
+#define KNOTS(v) ((uint16_t) ((v) * 100))
+
 // lets you do a logln of a float like so -> logln("blah %d.%d", FP(d))
 #define FP(f) (int16_t)f, fracPart(f)
 #define FP32(f) (int32_t)f, fracPart(f)
@@ -61,13 +119,15 @@ int fracPart(float f, int precision = 2);
 uint32_t last_gps_time = 0;
 
 // self-explanatory
-float gps_lat = 0;
-float gps_lon = 0;
+int32_t gps_lat = 0;        // degrees * 1e6
+int32_t gps_lon = 0;        // degrees * 1e6
 char gps_aprs_lat[9];
 char gps_aprs_lon[10];
-float gps_course = 0;
-float gps_speed = 0;
-float gps_altitude = 0;
+Bam gps_course = { 0 };
+uint16_t gps_speed = 0;     // knots * 100
+int32_t gps_altitude = 0;   // meters * 10
+uint16_t gps_hdop = 0;      // * 100
+uint8_t gps_satellites = 0;
 float ahrs_heading = 0;
 
 // winch adjustment to spill extra air if we're heeling too much
@@ -80,6 +140,13 @@ float heel_adjust = 0;
 uint16_t wind = 0;
 float trailing_wind = 0;
 
+// the smoothed heading and wind as binary angles, for the pilot's angle math
+Bam heading_angle = { 0 };
+
+// the compass, filtered and corrected for deviation: what the pilot steers by
+Compass compass;
+Bam wind_angle = { 0 };
+
 // current loop() count
 uint32_t cycle = 0;
 
@@ -89,13 +156,33 @@ boolean adjustment_made = false;
 // whether we need high-res gps (drives refresh frequency)
 boolean high_res_gps = HIGH_RES_GPS_DEFAULT;
 
-uint32_t last_data_update = 0;
+// where the battery's gone, and the plan for making it go further
+Power power;
+boolean power_saving = POWER_SAVING_DEFAULT;
+
+// the wind sensor and the battery divider, powered up ahead of a reading
+boolean wind_powered = false;
+boolean battery_powered = false;
+
+// manual override: the sensors have been asked for ('i'), and are logged
+// once the wind task's read the wind
+boolean sensors_wanted = false;
+
 float voltage = 0;
 
 // here so we can log easier
 double wp_heading = 0;
 float wp_distance = 0;
 
+// the waypoints sailed, and which is next (pilot.ino)
+Route route;
+
+// the polar as it's learned (pilot.ino)
+Learn learn;
+
+// the settings kept in eeprom, read at boot
+Config config;
+
 // what the PID will steer to
 double requested_heading = 0;
 
@@ -106,19 +193,31 @@ boolean manual_override = false;
 boolean serial_logging = SERIAL_LOGGING_DEFAULT;
 boolean remote_control = false;
 
+// data lines as binary telemetry frames, and the fields they carry
+boolean binary_telemetry = BINARY_TELEMETRY_DEFAULT;
+uint16_t telemetry_fields = TELEMETRY_FIELDS;
+
 // are we tuning the PID
 boolean tuningPID = false;
 
+// samples averaged into the heading and wind. an update costs the same
+// whatever the length
 #define AHRS_TRAIL 10
 #define WIND_TRAIL 10
 
-#define MPU_PARAM_ADDRESS 0
-#define PILOT_PARAM_ADDRESS 256
+// average with trig_fix's fixed point sin/cos/atan2 instead of float
+// #define FIXED_TRAIL
+
+#define CONFIG_PARAM_ADDRESS 0
+#define ROUTE_PARAM_ADDRESS 512
+#define LEARN_PARAM_ADDRESS 1024
 
-#ifdef PILOT_DEBUG
+// the host build gets these from the boat simulation
+#if defined(PILOT_DEBUG) && !defined(SIMULATOR)
 float current_pitch;
 float current_roll;
 float mag_offset;
+uint32_t heading_time;
 
 long sample = 0;
 long _heading = 0;
@@ -130,23 +229,66 @@ float readSteadyHeading() {
   _heading = toCircleDeg(_heading + turn_speed * delta_t + random(-5, 5));
   
   sample = millis();
+  heading_time = micros();
 
-  delay(10);
   return RAD(_heading);
 }
 
-int mpuInit(int16_t settingsAddress) { return 0; }
+int mpuInit(Config *settings) { return 0; }
+void mpuPoll() {}
 void calibrateMag(bool waitForSetup) {}
 
 void windInit() {}
+void windPowerUp() {}
+float windSample() { return 0; }
 float readSteadyWind() { return 0; }
 #endif
 
-AngleCmp ahrs_trail[AHRS_TRAIL];
-AngleCmp wind_trail[WIND_TRAIL];
+void ahrsTask();
+void pilotTask();
+void windTask();
+void gpsTask();
+void menuTask();
+void trimTask();
+void dataTask();
+void batteryTask();
+void reportTask();
+
+// in TaskId's order (tasks.h)
+SchedTask tasks[] = {
+	SCHED_TASK(ahrsTask, AHRS_PERIOD, AHRS_BUDGET),
+	SCHED_TASK(pilotTask, PILOT_PERIOD, PILOT_BUDGET),
+	SCHED_TASK(windTask, WIND_PERIOD, WIND_BUDGET),
+	SCHED_TASK(gpsTask, GPS_PERIOD, GPS_BUDGET),
+	SCHED_TASK(menuTask, MENU_PERIOD, MENU_BUDGET),
+	SCHED_TASK(trimTask, TRIM_PERIOD, TRIM_BUDGET),
+	SCHED_TASK(dataTask, (uint32_t) DATA_FREQ * 1000, DATA_BUDGET),
+	SCHED_TASK(batteryTask, BATTERY_PERIOD, BATTERY_BUDGET),
+	SCHED_TASK(reportTask, REPORT_PERIOD, REPORT_BUDGET)
+};
+
+static_assert(sizeof(tasks) / sizeof(tasks[0]) == TASK_COUNT, "a task for each TaskId");
+
+Sched sched;
+
+#ifdef FIXED_TRAIL
+AngleCmpFix ahrs_samples[AHRS_TRAIL];
+AngleCmpFix wind_samples[WIND_TRAIL];
+AngleTrailFix ahrs_trail;
+AngleTrailFix wind_trail;
+#define trailInit trailFixInit
+#define trailAdd trailFixAdd
+#else
+AngleCmp ahrs_samples[AHRS_TRAIL];
+AngleCmp wind_samples[WIND_TRAIL];
+AngleTrail ahrs_trail;
+AngleTrail wind_trail;
+#endif
 
 void setup()
 {
+	powerInit(&power, micros());
+
 	pinMode(STATUS_LED, OUTPUT);
 	digitalWrite(STATUS_LED, HIGH);
 
@@ -158,15 +300,16 @@ void setup()
 	logln(F("ArduSailor Starting..."));
 	Serial2.begin(GPS_BAUDRATE);
 
-	// config value
-	mag_offset = 0;// RAD(-15.0);
+	configInit(&config, CONFIG_PARAM_ADDRESS);
+	logln(F("Read settings %x, a bit each found"), configLoad(&config));
+	mag_offset = config.mag_offset;
 
 	logln(F("Initializing servos..."));
 	servoInit();
 	logln(F("Initializing wind sensor..."));
 	windInit();
 	logln(F("Initializing MPU..."));
-	mpuInit(MPU_PARAM_ADDRESS);
+	mpuInit(&config);
 	logln(F("Enabling GPS..."));
 	gpsInit();
 	logln(F("Starting battery monitor..."));
@@ -175,7 +318,8 @@ void setup()
 	initTrail();
 
 	logln(F("Starting pilot..."));
-	pilotInit(PILOT_PARAM_ADDRESS);
+	pilotInit(ROUTE_PARAM_ADDRESS, LEARN_PARAM_ADDRESS);
+	uploadInit(ROUTE_PARAM_ADDRESS);
 
 	blink(STATUS_LED, 100, 10, HIGH);
 	logln(F("Enabling GPS..."));
@@ -189,54 +333,61 @@ void setup()
 #ifdef SHOW_MENU_ON_START
 	doMenu();
 #endif
+
+	schedInit(&sched, tasks, TASK_COUNT, micros());
 }
 
 void initTrail() {
-	ahrs_heading = readSteadyHeading() * 180.0 / PI;
-	wind = readSteadyWind() * 180.0 / PI;
+	float heading = readSteadyHeading();
+	float wind_dir = readSteadyWind();
 
-	for (int i=0; i<AHRS_TRAIL; i++) {
-		ahrs_trail[i].s = sin(ahrs_heading);
-		ahrs_trail[i].c = cos(ahrs_heading);
-	}
+	trailInit(&ahrs_trail, ahrs_samples, AHRS_TRAIL, heading);
+	trailInit(&wind_trail, wind_samples, WIND_TRAIL, wind_dir);
 
-	for (int i=0; i<WIND_TRAIL; i++) {
-		wind_trail[i].s = sin(wind);
-		wind_trail[i].c = cos(wind);
-	}
-}
+	heading_angle = bamRad(heading);
+	wind_angle = bamRad(wind_dir);
 
-void newTrailingHeadingValue(float new_val, int count, float *target_val, AngleCmp *trail) {
-	trail[cycle % count].s = sin(new_val);
-	trail[cycle % count].c = cos(new_val);
+	compassInit(&compass);
+	compassUpdate(&compass, heading_angle, heading_time);
 
-	float x = 0;
-	float y = 0;
+	ahrs_heading = bamToDeg(heading_angle);
+	wind = DEG(wind_dir);
+}
 
-	for (int i=0; i<count; i++) {
-		x += trail[i].c;
-		y += trail[i].s;
-	}
+void updateHeading() {
+	float heading = readSteadyHeading();
+	heading_angle = trailAdd(&ahrs_trail, heading);
+	compassUpdate(&compass, bamRad(heading), heading_time);
 
-	(*target_val) = DEG(toCircle(atan2(y, x)));
+	// most of this will be used in human comparison stuff, no need to keep in radians.
+	ahrs_heading = bamToDeg(heading_angle);
 }
 
-void newTrailingValue(float new_val, int count, float *target_val, float *trail) {
-	trail[cycle % count] = new_val;
+void updateWind(float wind_dir) {
+	wind_angle = trailAdd(&wind_trail, wind_dir);
+	trailing_wind = bamToDeg(wind_angle);
 
-	float v = 0;
-	for (int i=0; i<count; i++)
-		v += trail[i];
+	wind = round(trailing_wind);
+}
 
-	(*target_val) = v / (float)count;
+void logPosition() {
+	uint16_t gps_elapsed = millis() - last_gps_time;
+	logln(F("Position: %s, %s (%dms old, %d sats, HDOP %d.%d), Speed: %d.%d, Direction: %d.%d, Wind: %d, Battery %d.%d"),
+	gps_aprs_lat,
+	gps_aprs_lon,
+	gps_elapsed,
+	gps_satellites,
+	FP(gps_hdop / 100.0),
+	FP(gps_speed / 100.0),
+	FP(bamToDeg(gps_course)),
+	wind,
+	FP(voltage));
 }
 
+// all of it at once: the heading's read now, the wind and the battery are
+// as their tasks last read them
 void updateSensors(boolean skip_gps) {
-	// most of this will be used in human comparison stuff, no need to keep in radians.
-	newTrailingHeadingValue(readSteadyHeading(), AHRS_TRAIL, &ahrs_heading, ahrs_trail);
-	newTrailingHeadingValue(readSteadyWind(), WIND_TRAIL, &trailing_wind, wind_trail);
-
-	wind = round(trailing_wind);
+	updateHeading();
 
 #ifdef SLEEP_GPS
 	if (!skip_gps && (high_res_gps || (last_gps_time == 0) || ((millis() - last_gps_time) > GPS_REFRESH))) {
@@ -246,21 +397,22 @@ void updateSensors(boolean skip_gps) {
 		gps_updated = true;
 	} else
 		gps_updated = false;
+#else
+	// the gps task keeps it up to date
+	(void) skip_gps;
 #endif
 
 	if (!high_res_gps && (millis() - last_gps_time > GPS_WARNING))
 		warnGPS();
 
-	uint16_t gps_elapsed = millis() - last_gps_time;
-	voltage = measureVoltage();
-	logln(F("Position: %s, %s (%dms old), Speed: %d.%d, Direction: %d.%d, Wind: %d, Battery %d.%d"),
-	gps_aprs_lat,
-	gps_aprs_lon,
-	gps_elapsed,
-	FP(gps_speed),
-	FP(gps_course),
-	wind,
-	FP(voltage));
+	logPosition();
+}
+
+// under manual override: the wind task's woken to power the sensor up and
+// read it, and updateSensors() follows
+void requestSensors() {
+	sensors_wanted = true;
+	tasks[TASK_WIND].release = micros();
 }
 
 void getMagOffset() {
@@ -278,19 +430,24 @@ void getMagOffset() {
 	Serial.println(mag_offset_d, 4);
 	mag_offset = RAD(mag_offset_d);
 
+	config.mag_offset = mag_offset;
+	configSave(&config, CONFIG_MAG_OFFSET);
+
 	Serial.println("Stored.");
 
 	serial_logging = current_sl;
 }
 
 void printDataLine() {
+	PROFILE_SCOPE(PROF_DATA_LINE);
+
 	Serial.print(gps_aprs_lat); Serial.print(", ");
 	Serial.print(gps_aprs_lon); Serial.print(", ");
-	Serial.print(gps_lat, 6); Serial.print(", ");
-	Serial.print(gps_lon, 6); Serial.print(", ");
+	Serial.print(gps_lat / 1e6, 6); Serial.print(", ");
+	Serial.print(gps_lon / 1e6, 6); Serial.print(", ");
 	Serial.print(millis() - last_gps_time); Serial.print(", ");
-	Serial.print(gps_speed); Serial.print(", ");
-	Serial.print(gps_course); Serial.print(", ");
+	Serial.print(gps_speed / 100.0); Serial.print(", ");
+	Serial.print(bamToDeg(gps_course)); Serial.print(", ");
 
 	Serial.print(ahrs_heading); Serial.print(", ");
 	Serial.print(requested_heading); Serial.print(", ");
@@ -305,22 +462,201 @@ void printDataLine() {
 	Serial.print(cycle); Serial.println();
 }
 
-void loop()
-{
+void sendTelemetry() {
+	PROFILE_SCOPE(PROF_DATA_LINE);
+
+	int32_t values[TM_FIELD_COUNT];
+
+	values[TM_LAT] = gps_lat;
+	values[TM_LON] = gps_lon;
+	values[TM_GPS_AGE] = millis() - last_gps_time;
+	values[TM_SPEED] = gps_speed;
+	values[TM_COURSE] = ((uint32_t) gps_course.v * 3600 + 32768) >> 16;
+	values[TM_HEADING] = round(ahrs_heading * 10);
+	values[TM_REQUESTED] = round(requested_heading * 10);
+	values[TM_ROLL] = round(current_roll * 10);
+	values[TM_HEEL_ADJUST] = round(heel_adjust * 10);
+	values[TM_WIND] = wind;
+	values[TM_WP_HEADING] = round(wp_heading * 10);
+	values[TM_WP_DISTANCE] = round(wp_distance * 10);
+	values[TM_RUDDER] = current_rudder;
+	values[TM_WINCH] = current_winch;
+	values[TM_VOLTAGE] = round(voltage * 100);
+	values[TM_CYCLE] = cycle;
+
+	telemetrySend(Serial, values, telemetry_fields);
+}
+
+uint16_t dataFreq() {
+	if (binary_telemetry)
+		return TELEMETRY_FREQ;
+
+	return remote_control ? RC_DATA_FREQ : DATA_FREQ;
+}
+
+//
+// main loop tasks. under manual override the sensors are only read on
+// request, and the pilot hands the rudder and winch to processManualCommands()
+//
+void ahrsTask() {
+	if (!manual_override)
+		updateHeading();
+}
+
+void pilotTask() {
 	if (!manual_override) {
 		logln(F("[Cycle %d start]"), cycle);
 		cycle++;
-		updateSensors(false);
+		logPosition();
+	}
+
+	doPilot();
+
+	if (power_saving && !manual_override) {
+		powerPlan(&power, wp_distance, voltage, current_roll, millis());
+		tasks[TASK_PILOT].period = (uint32_t) power.pilot * 1000;
+	}
+}
+
+// powered up WIND_SETTLE before each reading, which come round as often as
+// the plan wants. under manual override, only when they've been asked for
+void windTask() {
+	if (manual_override && !sensors_wanted)
+		return;
+
+	if (wind_powered) {
+		updateWind(windSample());
+		tasks[TASK_WIND].period = (uint32_t) (power.wind - WIND_SETTLE) * 1000;
+
+		if (sensors_wanted) {
+			sensors_wanted = false;
+			updateSensors(false);
+		}
+	} else {
+		windPowerUp();
+		tasks[TASK_WIND].period = (uint32_t) WIND_SETTLE * 1000;
+	}
 
+	wind_powered = !wind_powered;
+}
+
+// ms after a fix the gps is wanted on again, when it's not on all the time
+uint32_t gpsDue() {
+	if (!power_saving)
+		return GPS_WARNING;
+
+	return power.gps > GPS_WARMUP ? power.gps - GPS_WARMUP : 0;
+}
+
+void gpsTask() {
+	// the core drains the gps between passes through loop() too; this
+	// keeps it to a rate, and its time accounted for
+	serialEvent2();
+
+	// it turns itself off after a fix (serialEvent2()), and it's back on in
+	// time for the next
+	if (!high_res_gps && !gpsPowered() && (millis() - last_gps_time > gpsDue()))
+		warnGPS();
+}
+
+void menuTask() {
+	if (!manual_override)
 		checkInput();
-		doPilot();
-	} else
-		// the actual steering commands are handled by doPilot for now
-		doPilot();
+}
+
+void trimTask() {
+	if (!manual_override)
+		trimSails();
+}
 
-	if (!serial_logging && (millis() - last_data_update > (remote_control ? RC_DATA_FREQ : DATA_FREQ))) {
-		printDataLine();
+void dataTask() {
+	if (!serial_logging) {
+		if (binary_telemetry)
+			sendTelemetry();
+		else
+			printDataLine();
+
+	}
+
+	// comes round at whatever rate the mode wants
+	tasks[TASK_DATA].period = (uint32_t) dataFreq() * 1000;
+}
+
+// the divider's switched in BATT_SETTLE before each reading
+void batteryTask() {
+	if (battery_powered) {
+		voltage = batterySample();
+		tasks[TASK_BATTERY].period = BATTERY_PERIOD - (uint32_t) BATT_SETTLE * 1000;
+	} else {
+		batteryPowerUp();
+		tasks[TASK_BATTERY].period = (uint32_t) BATT_SETTLE * 1000;
+	}
+
+	battery_powered = !battery_powered;
+}
+
+void reportTask() {
+	uint32_t now = micros();
+
+	logln(F("Load %d%% over %ds"),
+		(int16_t) ((uint64_t) sched.busy * 100 / (now - sched.since)),
+		(int16_t) ((now - sched.since) / 1000000));
+
+	for (uint8_t i = 0; i < TASK_COUNT; i++)
+		logln(F("Task %d: %lu runs, %u missed, %u overran, late by up to %luus, took up to %luus"),
+			i, (unsigned long) tasks[i].runs, tasks[i].misses, tasks[i].overruns,
+			(unsigned long) tasks[i].max_late, (unsigned long) tasks[i].max_time);
+
+	logln(F("Power %d.%dmA mean, gps every %ums, wind %ums, pilot %ums, sea %d.%d"),
+		FP(powerMean(&power)), power.gps, power.wind, power.pilot, FP(power.sea));
+
+	schedClearStats(&sched, now);
+}
+
+// what's drawing now, for powerSpend()
+uint16_t powerLoads(boolean awake) {
+	uint16_t on = bit(awake ? POWER_AWAKE : POWER_ASLEEP) | bit(POWER_IMU);
+
+	if (gpsPowered())
+		on |= bit(POWER_GPS);
+	if (wind_powered)
+		on |= bit(POWER_WIND);
+	if (battery_powered)
+		on |= bit(POWER_BATTERY);
+	if (railPowered())
+		on |= bit(POWER_RAIL);
+	if (rudderPowered())
+		on |= bit(POWER_RUDDER);
+	if (winchPowered())
+		on |= bit(POWER_WINCH);
+#ifdef NO_SAIL
+	if (motorRunning())
+		on |= bit(POWER_MOTOR);
+#endif
+
+	return on;
+}
+
+void loop()
+{
+	uint32_t idle;
+
+	{
+		PROFILE_SCOPE(PROF_LOOP);
+
+		servoTick();
+		logTick();
+		mpuPoll();
+		uploadTick();
+		checkpointPolar();
+
+		idle = schedRun(&sched);
+	}
 
-		last_data_update = millis();
+	// awake till now, then asleep with whatever's powered left on
+	if (idle) {
+		powerSpend(&power, powerLoads(true), micros());
+		powerSleep(min(idle, (uint32_t) IDLE_MAX));
+		powerSpend(&power, powerLoads(false), micros());
 	}
 }
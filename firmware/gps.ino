@@ -9,25 +9,60 @@ typedef void (*t_nmea_parser)(const char *token);
 enum t_sentence_type {
     SENTENCE_UNK,
     SENTENCE_GGA,
-    SENTENCE_RMC
+    SENTENCE_RMC,
+    SENTENCE_VTG,
+    SENTENCE_GSA
 };
 
+// three letter sentence ids packed into an int, so dispatch is a compare of
+// those rather than a strcmp per sentence. the talker ($GP, $GN, $GL...) is
+// ignored
+#define NMEA_ID(a, b, c) (((uint32_t) (a) << 16) | ((uint16_t) (b) << 8) | (c))
+
+// what a sentence carries, so only those fields are taken from it
+#define FIX_TIME       0x01
+#define FIX_STATUS     0x02
+#define FIX_POSITION   0x04
+#define FIX_SPEED      0x08
+#define FIX_COURSE     0x10
+#define FIX_ALTITUDE   0x20
+#define FIX_HDOP       0x40
+#define FIX_SATELLITES 0x80
+
+// one fix's worth of values, in the units of the gps_* globals
+struct t_fix {
+    uint8_t fields;
+    char time[7];
+    uint32_t ms;                // of the day, to pair up rmc and gga
+    bool active;
+    int32_t lat, lon;
+    char aprs_lat[9];
+    char aprs_lon[10];
+    uint16_t speed;
+    Bam course;
+    int32_t altitude;
+    uint16_t hdop;
+    uint8_t satellites;
+};
 
-// Module constants
-static const t_nmea_parser unk_parsers[] = {
-    parse_sentence_type,        // $GPxxx
+struct t_sentence {
+    uint32_t id;
+    t_sentence_type type;
+    const t_nmea_parser *parsers;
+    uint8_t count;
 };
 
+// Module constants
 static const t_nmea_parser gga_parsers[] = {
     NULL,                        // $GPGGA
     parse_time,                  // Time
-    NULL,                        // Latitude
-    NULL,                        // N/S
-    NULL,                        // Longitude
-    NULL,                        // E/W
+    parse_lat,                   // Latitude
+    parse_lat_hemi,              // N/S
+    parse_lon,                   // Longitude
+    parse_lon_hemi,              // E/W
     NULL,                        // Fix quality
-    NULL,                        // Number of satellites
-    NULL,                        // Horizontal dilution of position
+    parse_satellites,            // Number of satellites
+    parse_hdop,                  // Horizontal dilution of position
     parse_altitude,              // Altitude
     NULL,                        // "M" (mean sea level)
     NULL,                        // Height of GEOID (MSL) above WGS84 ellipsoid
@@ -38,42 +73,74 @@ static const t_nmea_parser gga_parsers[] = {
 
 static const t_nmea_parser rmc_parsers[] = {
     NULL,                        // $GPRMC
-    parse_time,          // Time
-    parse_status,        // A=active, V=void
-    parse_lat,              // Latitude,
-    parse_lat_hemi,  // N/S
-    parse_lon,              // Longitude
-    parse_lon_hemi,  // E/W
-    parse_speed,            // Speed over ground in knots
-    parse_course,        // Track angle in degrees (true)
+    parse_time,                  // Time
+    parse_status,                // A=active, V=void
+    parse_lat,                   // Latitude,
+    parse_lat_hemi,              // N/S
+    parse_lon,                   // Longitude
+    parse_lon_hemi,              // E/W
+    parse_speed,                 // Speed over ground in knots
+    parse_course,                // Track angle in degrees (true)
     NULL,                        // Date (DDMMYY)
     NULL,                        // Magnetic variation
-    NULL                            // E/W
+    NULL                         // E/W
+};
+
+static const t_nmea_parser vtg_parsers[] = {
+    NULL,                        // $GPVTG
+    parse_course,                // Track angle in degrees (true)
+    NULL,                        // "T"
+    NULL,                        // Track angle in degrees (magnetic)
+    NULL,                        // "M"
+    parse_speed,                 // Speed over ground in knots
+    NULL,                        // "N"
+    NULL,                        // Speed over ground in km/h
+    NULL                         // "K"
+};
+
+static const t_nmea_parser gsa_parsers[] = {
+    NULL,                        // $GPGSA
+    NULL,                        // A=automatic, M=manual 2D/3D
+    NULL,                        // 1=no fix, 2=2D, 3=3D
+    NULL, NULL, NULL, NULL,      // PRNs of the satellites used
+    NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, NULL,
+    NULL,                        // PDOP
+    parse_hdop,                  // HDOP
+    NULL                         // VDOP
+};
+
+#define PARSERS(p) p, (sizeof(p) / sizeof(t_nmea_parser))
+
+static const t_sentence sentences[] = {
+    { NMEA_ID('G', 'G', 'A'), SENTENCE_GGA, PARSERS(gga_parsers) },
+    { NMEA_ID('R', 'M', 'C'), SENTENCE_RMC, PARSERS(rmc_parsers) },
+    { NMEA_ID('V', 'T', 'G'), SENTENCE_VTG, PARSERS(vtg_parsers) },
+    { NMEA_ID('G', 'S', 'A'), SENTENCE_GSA, PARSERS(gsa_parsers) }
 };
 
-static const int NUM_OF_UNK_PARSERS = (sizeof(unk_parsers) / sizeof(t_nmea_parser));
-static const int NUM_OF_GGA_PARSERS = (sizeof(gga_parsers) / sizeof(t_nmea_parser));
-static const int NUM_OF_RMC_PARSERS = (sizeof(rmc_parsers) / sizeof(t_nmea_parser));
+static const int NUM_OF_SENTENCES = (sizeof(sentences) / sizeof(t_sentence));
 
 // Module variables
-static t_sentence_type sentence_type = SENTENCE_UNK;
+static const t_sentence *sentence = NULL;
 static bool at_checksum = false;
-static unsigned char our_checksum = '$';
+static uint8_t checksum_digits = 0;
+static unsigned char our_checksum = 0;
 static unsigned char their_checksum = 0;
 static char token[16];
 static int num_tokens = 0;
 static unsigned int offset = 0;
-static bool active = false;
-static char gga_time[7] = "", rmc_time[7] = "";
-static char new_time[7];
-static uint32_t new_seconds;
-static float new_lat;
-static float new_lon;
-static char new_aprs_lat[9];
-static char new_aprs_lon[10];
-static float new_course;
-static float new_speed;
-static float new_altitude;
+static bool overrun = false;
+
+// the sentence being parsed, and what the good ones so far add up to
+static t_fix scratch;
+static t_fix pending;
+
+// times of the last good rmc and gga. different to start with, so nothing
+// is merged until one of each has come in
+static uint32_t rmc_ms = 0xffffffff;
+static uint32_t gga_ms = 0xfffffffe;
+
 static bool gps_on = false;
 
 
@@ -90,99 +157,230 @@ unsigned char from_hex(char a)
         return 0;
 }
 
-void parse_sentence_type(const char *token)
+// digits with an optional sign and decimal point, times 10^decimals: "12.345"
+// with 2 decimals is 1234. decimals past those are dropped
+int32_t parse_fixed(const char *token, uint8_t decimals)
 {
-    if (strcmp(token, "$GPGGA") == 0) {
-        sentence_type = SENTENCE_GGA;
-    } else if (strcmp(token, "$GPRMC") == 0) {
-        sentence_type = SENTENCE_RMC;
-    } else {
-        sentence_type = SENTENCE_UNK;
+    bool negative = *token == '-';
+    if (negative)
+        token++;
+
+    // unsigned, so a run of digits too long for it wraps rather than overflows
+    uint32_t v = 0;
+    bool fraction = false;
+
+    for (; *token; token++) {
+        if (*token == '.' && !fraction) {
+            fraction = true;
+            continue;
+        }
+        if (*token < '0' || *token > '9' || (fraction && decimals == 0))
+            break;
+
+        v = v * 10 + (*token - '0');
+        if (fraction)
+            decimals--;
     }
+
+    for (; decimals; decimals--)
+        v *= 10;
+
+    return negative ? -(int32_t) v : (int32_t) v;
+}
+
+static bool digits(const char *token, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++)
+        if (token[i] < '0' || token[i] > '9')
+            return false;
+
+    return true;
+}
+
+void parse_sentence_type(const char *token)
+{
+    sentence = NULL;
+
+    // "$" + two letter talker + three letter sentence; proprietary ($P...)
+    // sentences have no talker, and none we want
+    if (offset != 6 || token[0] != '$' || token[1] == 'P')
+        return;
+
+    uint32_t id = NMEA_ID(token[3], token[4], token[5]);
+    for (int i = 0; i < NUM_OF_SENTENCES; i++)
+        if (sentences[i].id == id) {
+            sentence = &sentences[i];
+            break;
+        }
 }
 
 void parse_time(const char *token)
 {
-    // Time can have decimals (fractions of a second), but we only take HHMMSS
-    strncpy(new_time, token, 6);
+    // Time can have decimals (fractions of a second), kept for pairing
+    // sentences up, but gps_time only takes HHMMSS
+    if (!digits(token, 6))
+        return;
+
+    strncpy(scratch.time, token, 6);
     // Terminate string
-    new_time[6] = '\0';
+    scratch.time[6] = '\0';
+
+    uint32_t seconds =
+        ((token[0] - '0') * 10 + (token[1] - '0')) * 60 * 60UL +
+        ((token[2] - '0') * 10 + (token[3] - '0')) * 60 +
+        ((token[4] - '0') * 10 + (token[5] - '0'));
 
-    new_seconds =
-        ((new_time[0] - '0') * 10 + (new_time[1] - '0')) * 60 * 60UL +
-        ((new_time[2] - '0') * 10 + (new_time[3] - '0')) * 60 +
-        ((new_time[4] - '0') * 10 + (new_time[5] - '0'));
+    scratch.ms = seconds * 1000 + (token[6] == '.' ? parse_fixed(token + 6, 3) : 0);
+    scratch.fields |= FIX_TIME;
 }
 
 void parse_status(const char *token)
 {
     // "A" = active, "V" = void. We shoud disregard void sentences
-    if (strcmp(token, "A") == 0)
-        active = true;
-    else
-        active = false;
+    scratch.active = token[0] == 'A' && token[1] == '\0';
+    scratch.fields |= FIX_STATUS;
+}
+
+// "DD" (or "DDD") + "MM" (+ ".M{...}M") to micro-degrees
+static bool parse_coordinate(const char *token, uint8_t degree_digits, int32_t *out)
+{
+    if (strlen(token) < degree_digits + 2u || !digits(token, degree_digits + 2))
+        return false;
+
+    int32_t degrees = 0;
+    for (uint8_t i = 0; i < degree_digits; i++)
+        degrees = degrees * 10 + (token[i] - '0');
+
+    // minutes to 1e-6, then sixtieths of those are micro-degrees
+    int32_t minutes = parse_fixed(token + degree_digits, 6);
+    *out = degrees * 1000000L + (minutes + 30) / 60;
+
+    return true;
 }
 
 void parse_lat(const char *token)
 {
-    // Parses latitude in the format "DD" + "MM" (+ ".M{...}M")
-    char degs[3];
-    if (strlen(token) >= 4) {
-        degs[0] = token[0];
-        degs[1] = token[1];
-        degs[2] = '\0';
-        new_lat = atof(degs) + atof(token + 2) / 60;
-    }
+    if (parse_coordinate(token, 2, &scratch.lat))
+        scratch.fields |= FIX_POSITION;
+
     // APRS-ready latitude
-    strncpy(new_aprs_lat, token, 7);
-    new_aprs_lat[7] = '\0';
+    strncpy(scratch.aprs_lat, token, 7);
+    scratch.aprs_lat[7] = '\0';
 }
 
 void parse_lat_hemi(const char *token)
 {
     if (token[0] == 'S')
-        new_lat = -new_lat;
-    new_aprs_lat[7] = token[0];
-    new_aprs_lon[8] = '\0';
+        scratch.lat = -scratch.lat;
+    scratch.aprs_lat[7] = token[0];
+    scratch.aprs_lat[8] = '\0';
 }
 
 void parse_lon(const char *token)
 {
-    // Longitude is in the format "DDD" + "MM" (+ ".M{...}M")
-    char degs[4];
-    if (strlen(token) >= 5) {
-        degs[0] = token[0];
-        degs[1] = token[1];
-        degs[2] = token[2];
-        degs[3] = '\0';
-        new_lon = atof(degs) + atof(token + 3) / 60;
-    }
+    if (!parse_coordinate(token, 3, &scratch.lon))
+        scratch.fields &= ~FIX_POSITION;
+
     // APRS-ready longitude
-    strncpy(new_aprs_lon, token, 8);
-    new_aprs_lon[8] = '\0';
+    strncpy(scratch.aprs_lon, token, 8);
+    scratch.aprs_lon[8] = '\0';
 }
 
 void parse_lon_hemi(const char *token)
 {
     if (token[0] == 'W')
-        new_lon = -new_lon;
-    new_aprs_lon[8] = token[0];
-    new_aprs_lon[9] = '\0';
+        scratch.lon = -scratch.lon;
+    scratch.aprs_lon[8] = token[0];
+    scratch.aprs_lon[9] = '\0';
 }
 
 void parse_speed(const char *token)
 {
-    new_speed = atof(token);
+    if (!token[0] || token[0] == '-')
+        return;
+
+    scratch.speed = parse_fixed(token, 2);
+    scratch.fields |= FIX_SPEED;
 }
 
 void parse_course(const char *token)
 {
-    new_course = atof(token);
+    // left empty by some receivers when there's no speed to tell it by
+    if (!token[0])
+        return;
+
+    uint32_t centi = parse_fixed(token, 2) % 36000;
+    scratch.course = bamRaw((centi * 65536 + 18000) / 36000);
+    scratch.fields |= FIX_COURSE;
 }
 
 void parse_altitude(const char *token)
 {
-    new_altitude = atof(token);
+    if (!token[0])
+        return;
+
+    scratch.altitude = parse_fixed(token, 1);
+    scratch.fields |= FIX_ALTITUDE;
+}
+
+void parse_hdop(const char *token)
+{
+    if (!token[0])
+        return;
+
+    scratch.hdop = parse_fixed(token, 2);
+    scratch.fields |= FIX_HDOP;
+}
+
+void parse_satellites(const char *token)
+{
+    if (!token[0])
+        return;
+
+    scratch.satellites = parse_fixed(token, 0);
+    scratch.fields |= FIX_SATELLITES;
+}
+
+// the fields a good sentence carried, into what we have so far
+static void accept_sentence()
+{
+    uint8_t f = scratch.fields;
+
+    if (f & FIX_TIME) {
+        strcpy(pending.time, scratch.time);
+        pending.ms = scratch.ms;
+    }
+    if (f & FIX_STATUS)
+        pending.active = scratch.active;
+    if (f & FIX_POSITION) {
+        pending.lat = scratch.lat;
+        pending.lon = scratch.lon;
+        strcpy(pending.aprs_lat, scratch.aprs_lat);
+        strcpy(pending.aprs_lon, scratch.aprs_lon);
+    }
+    if (f & FIX_SPEED)
+        pending.speed = scratch.speed;
+    if (f & FIX_COURSE)
+        pending.course = scratch.course;
+    if (f & FIX_ALTITUDE)
+        pending.altitude = scratch.altitude;
+    if (f & FIX_HDOP)
+        pending.hdop = scratch.hdop;
+    if (f & FIX_SATELLITES)
+        pending.satellites = scratch.satellites;
+}
+
+static void reset_sentence()
+{
+    at_checksum = false;
+    checksum_digits = 0;
+    our_checksum = 0;
+    their_checksum = 0;
+    offset = 0;
+    num_tokens = 0;
+    overrun = false;
+    sentence = NULL;
+    scratch.fields = 0;
 }
 
 
@@ -204,25 +402,35 @@ bool gps_decode(char c)
     int ret = false;
 
     switch(c) {
+        case '$':
+            // Start of sentence, wherever the last one got to
+            reset_sentence();
+            token[offset++] = c;
+            break;
+
         case '\r':
         case '\n':
             // End of sentence
 
-            if (num_tokens && our_checksum == their_checksum) {
+            if (sentence && at_checksum && checksum_digits == 2 && our_checksum == their_checksum && !overrun) {
 #ifdef DEBUG_GPS
                 log(" (OK!) ");
                 log(millis());
 #endif
-                // Return a valid position only when we've got two rmc and gga
+                accept_sentence();
+
+                // Return a valid position only when we've got rmc and gga
                 // messages with the same timestamp.
-                switch (sentence_type) {
-                    case SENTENCE_UNK:
-                        break;      // Keeps gcc happy
+                switch (sentence->type) {
                     case SENTENCE_GGA:
-                        strcpy(gga_time, new_time);
+                        if (scratch.fields & FIX_TIME)
+                            gga_ms = scratch.ms;
                         break;
                     case SENTENCE_RMC:
-                        strcpy(rmc_time, new_time);
+                        if (scratch.fields & FIX_TIME)
+                            rmc_ms = scratch.ms;
+                        break;
+                    default:
                         break;
                 }
 
@@ -230,10 +438,9 @@ bool gps_decode(char c)
                 //
                 // 1. The timestamps of the two previous GGA/RMC sentences must match.
                 //
-                // 2. We just processed a known (GGA/RMC) sentence. Suppose the
-                //      contrary: after starting up this module, gga_time and rmc_time
-                //      are both equal (they're both initialized to ""), so (1) holds
-                //      and we wrongly report a valid position.
+                // 2. We just processed a GGA/RMC sentence, so a fix is only merged
+                //      once, when the second of the pair comes in. VTG and GSA carry
+                //      no time, and go out with the next pair.
                 //
                 // 3. The GPS has a valid fix. For some reason, the Venus 634FLPX
                 //      reports 24 deg N, 121 deg E (the middle of Taiwan) until a valid
@@ -244,19 +451,21 @@ bool gps_decode(char c)
                 //      $GPRMC,120003.000,V,2400.0000,N,12100.0000,E,000.0,000.0,280606,,,N*78 (OK!)
                 //      $GPVTG,000.0,T,,M,000.0,N,000.0,K,N*02 (OK!)
 
-                if (sentence_type != SENTENCE_UNK &&            // Known sentence?
-                        strcmp(gga_time, rmc_time) == 0 &&      // RMC/GGA times match?
-                        active) {                                                        // Valid fix?
-                    // Atomically merge data from the two sentences
-                    strcpy(gps_time, new_time);
-                    gps_seconds = new_seconds;
-                    gps_lat = new_lat;
-                    gps_lon = new_lon;
-                    strcpy(gps_aprs_lat, new_aprs_lat);
-                    strcpy(gps_aprs_lon, new_aprs_lon);
-                    gps_course = new_course;
-                    gps_speed = new_speed;
-                    gps_altitude = new_altitude;
+                if ((sentence->type == SENTENCE_GGA || sentence->type == SENTENCE_RMC) &&
+                        rmc_ms == gga_ms &&                        // RMC/GGA times match?
+                        pending.active) {                          // Valid fix?
+                    // Atomically merge data from the sentences
+                    strcpy(gps_time, pending.time);
+                    gps_seconds = pending.ms / 1000;
+                    gps_lat = pending.lat;
+                    gps_lon = pending.lon;
+                    strcpy(gps_aprs_lat, pending.aprs_lat);
+                    strcpy(gps_aprs_lon, pending.aprs_lon);
+                    gps_course = pending.course;
+                    gps_speed = pending.speed;
+                    gps_altitude = pending.altitude;
+                    gps_hdop = pending.hdop;
+                    gps_satellites = pending.satellites;
                     ret = true;
                 }
             }
@@ -264,18 +473,14 @@ bool gps_decode(char c)
             if (num_tokens)
                 logln("");
 #endif
-            at_checksum = false;                // CR/LF signals the end of the checksum
-            our_checksum = '$';              // Reset checksums
-            their_checksum = 0;
-            offset = 0;                              // Prepare for the next incoming sentence
-            num_tokens = 0;
-            sentence_type = SENTENCE_UNK;
+            reset_sentence();
             break;
 
         case '*':
             // Handle as ',', but prepares to receive checksum (ie. do not break)
             at_checksum = true;
             our_checksum ^= c;
+            // fall through
 
         case ',':
             // Process token
@@ -283,20 +488,10 @@ bool gps_decode(char c)
             our_checksum ^= c;  // Checksum the ',', undo the '*'
 
             // Parse token
-            switch (sentence_type) {
-                case SENTENCE_UNK:
-                    if (num_tokens < NUM_OF_UNK_PARSERS && unk_parsers[num_tokens])
-                        unk_parsers[num_tokens](token);
-                    break;
-                case SENTENCE_GGA:
-                    if (num_tokens < NUM_OF_GGA_PARSERS && gga_parsers[num_tokens])
-                        gga_parsers[num_tokens](token);
-                    break;
-                case SENTENCE_RMC:
-                    if (num_tokens < NUM_OF_RMC_PARSERS && rmc_parsers[num_tokens])
-                        rmc_parsers[num_tokens](token);
-                    break;
-            }
+            if (num_tokens == 0)
+                parse_sentence_type(token);
+            else if (sentence && num_tokens < sentence->count && sentence->parsers[num_tokens])
+                sentence->parsers[num_tokens](token);
 
             // Prepare for next token
             num_tokens++;
@@ -311,13 +506,15 @@ bool gps_decode(char c)
             if (at_checksum) {
                 // Checksum value
                 their_checksum = their_checksum * 16 + from_hex(c);
+                checksum_digits++;
             } else {
                 // Regular NMEA data
                 if (offset < 15) {  // Avoid buffer overrun (tokens can't be > 15 chars)
                     token[offset] = c;
                     offset++;
                     our_checksum ^= c;
-                }
+                } else
+                    overrun = true;
             }
 #ifdef DEBUG_GPS
             log(c);
@@ -331,6 +528,10 @@ void warnGPS() {
     gps_on = true;
 }
 
+boolean gpsPowered() {
+    return gps_on;
+}
+
 // NOTE: This works well enough on an ATMega2560, with HardwareSerial.cpp hacked to increase the SERIAL_BUFFER_SIZE to 512 (up from 64).
 //       This implies that serial buffers now take up half the RAM of a mega (4 serial ports x 2 buffers per port x 512 = 3072). For now,
 //       we seem to be ok with the remaining ram. If that changes, the un-lazy thing to do is modify the HarwareSerial code to only
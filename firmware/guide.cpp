@@ -0,0 +1,72 @@
+#include "guide.h"
+#include "trig_fix.h"
+
+// a fix more than this long after the last (ms) isn't carried forward to
+#define MAX_CARRY 5000
+
+// v * u / 2^14 for a unit vector component u, without a 64 bit product.
+// good to about 100km of v
+static int32_t mulUnit(int32_t v, int16_t u) {
+	return (v >> 14) * u + (((v & 0x3fff) * (int32_t) u) >> 14);
+}
+
+static void setCourse(Guide *g, Bam course) {
+	g->course = course;
+	g->along_n = _cos_fix(course.v);
+	g->along_e = _cos_fix(course.v + 0xc000);
+}
+
+// cross-track and along-track from the waypoint, unfiltered
+static int32_t across(const Guide *g, int32_t north, int32_t east) {
+	return mulUnit(east, g->along_n) - mulUnit(north, g->along_e);
+}
+
+static int32_t along(const Guide *g, int32_t north, int32_t east) {
+	return -(mulUnit(north, g->along_n) + mulUnit(east, g->along_e));
+}
+
+void guideLeg(Guide *g, Bam course, Bam bearing, int32_t north, int32_t east) {
+	setCourse(g, course);
+
+	int32_t xte = across(g, north, east);
+	if (abs(xte) > GUIDE_REJOIN * 100L || along(g, north, east) < 0)
+		setCourse(g, bearing);
+
+	g->xte = across(g, north, east);
+	g->to_go = along(g, north, east);
+	g->time = 0;
+}
+
+void guideFix(Guide *g, int32_t north, int32_t east, Bam course, uint16_t speed, uint32_t time) {
+	if (time == g->time)
+		return;
+
+	int32_t xte = across(g, north, east);
+	g->to_go = along(g, north, east);
+
+	uint32_t dt = time - g->time;
+	if (!g->time || dt > MAX_CARRY)
+		g->xte = xte;
+	else {
+		// the speed across the line, cm/s, over the time since
+		int32_t cross = ((int32_t) speed * _cos_fix((course - g->course).v + 0xc000)) >> 14;
+
+		g->xte += cross * (int32_t) dt / 1000;
+		g->xte += (xte - g->xte) >> GUIDE_FILTER_SHIFT;
+	}
+
+	g->time = time;
+}
+
+Bam guideCourse(const Guide *g, uint16_t lookahead) {
+	int32_t y = g->xte;
+	int32_t x = lookahead * 100L;
+
+	while (abs(y) > 32767 || x > 32767) {
+		y >>= 1;
+		x >>= 1;
+	}
+
+	// to port of the course when to starboard of the line
+	return g->course - bamRaw(_atan2_fix(y, max(x, 1L)));
+}
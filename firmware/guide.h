@@ -0,0 +1,52 @@
+#ifndef __guide_h
+#define __guide_h
+
+#include "Arduino.h"
+#include "bam.h"
+
+// steering along the leg into a waypoint, rather than straight for it.
+//
+// line of sight guidance: the course asked for is the leg's, turned towards
+// the line by atan(xte / lookahead), as if for a point on the line lookahead
+// further along. far off the line that's straight at it, on it it's the
+// leg's course, and in between the boat's brought in on a curve that doesn't
+// overshoot. set sideways by current or leeway, it settles off the line by
+// just enough to crab back against it. a waypoint's bearing swings round as
+// it's passed close by; this doesn't, and the waypoint can be taken as
+// reached once it's abeam.
+//
+// the cross-track error is filtered from fix to fix: carried forward by the
+// speed across the line, each fix pulling it a fraction of the way back. a
+// fix's noise, a couple of metres, would otherwise swing the course by
+// atan(2 / lookahead), and the rudder with it.
+//
+// cm, cm/s and binary angles, integer math
+
+// m off the leg, when it's taken up, past which the line's drawn from where
+// the boat is instead
+#define GUIDE_REJOIN 20
+
+// how far each fix pulls the cross-track error, 1/2^n of the way
+#define GUIDE_FILTER_SHIFT 2
+
+struct Guide {
+	Bam course;           // the line's, into the waypoint
+	int16_t along_n;      // the course as a unit vector, 1/2^14
+	int16_t along_e;
+	int32_t xte;          // cm to starboard of the line, looking along it
+	int32_t to_go;        // cm along the line to abeam the waypoint, - once past
+	uint32_t time;        // millis() of the last fix
+};
+
+// a new leg on course, with the boat north,east (cm) of its waypoint, which
+// bears bearing from it
+void guideLeg(Guide *g, Bam course, Bam bearing, int32_t north, int32_t east);
+
+// a fix at time (millis()): the boat north,east (cm) of the waypoint, going
+// course at speed (cm/s) over the ground. the same time twice is the same fix
+void guideFix(Guide *g, int32_t north, int32_t east, Bam course, uint16_t speed, uint32_t time);
+
+// the course over the ground to steer, lookahead in m
+Bam guideCourse(const Guide *g, uint16_t lookahead);
+
+#endif
@@ -0,0 +1,121 @@
+#include "imu.h"
+
+#define STAMPS_MASK (IMU_STAMPS_SIZE - 1)
+#define QUEUE_MASK (IMU_QUEUE_SIZE - 1)
+
+// keeps the compiler from moving the buffer accesses past the index update
+// that hands them to the other side
+#define BARRIER() __asm__ __volatile__("" ::: "memory")
+
+ImuStats imu_stats;
+
+// written by the isr
+static uint32_t stamps[IMU_STAMPS_SIZE];
+static volatile uint8_t stamp_head = 0;
+// written by the main loop
+static volatile uint8_t stamp_tail = 0;
+
+// a uint32_t count would tear if the isr came in while the main loop read
+// it, so the isr counts in a byte, and the main loop adds up how far that's
+// moved. it's read far more often than it could wrap
+static volatile uint8_t isr_count = 0;
+static uint8_t isr_counted = 0;
+
+// both written by the main loop today, but kept apart so the reading could
+// move to a timer interrupt
+static ImuSample samples[IMU_QUEUE_SIZE];
+static volatile uint8_t sample_head = 0;
+static volatile uint8_t sample_tail = 0;
+
+void imuInit() {
+	stamp_tail = stamp_head;
+	sample_tail = sample_head;
+	isr_counted = isr_count;
+	memset(&imu_stats, 0, sizeof(imu_stats));
+}
+
+void imuDataReady() {
+	uint8_t head = stamp_head;
+
+	isr_count++;
+
+	// full means the main loop has stopped reading. the packet is stamped
+	// late when it does
+	if ((uint8_t) (head - stamp_tail) == IMU_STAMPS_SIZE)
+		return;
+
+	stamps[head & STAMPS_MASK] = micros();
+	BARRIER();
+	stamp_head = head + 1;
+}
+
+uint8_t imuPending() {
+	uint8_t count = isr_count;
+
+	imu_stats.interrupts += (uint8_t) (count - isr_counted);
+	isr_counted = count;
+
+	return stamp_head - stamp_tail;
+}
+
+uint32_t imuPacketTime(uint8_t waiting) {
+	uint8_t head = stamp_head;
+	uint8_t tail = stamp_tail;
+
+	// one time more than there are packets is an interrupt that came in after
+	// the fifo count was read. more than that are for packets that never got
+	// here, and would put every time after them out by a packet
+	if ((uint8_t) (head - tail) > waiting + 1)
+		tail = head - waiting - 1;
+
+	// fewer, and it's the oldest packet that's missing its time: it came in
+	// between a fifo reset and the times being cleared
+	if ((uint8_t) (head - tail) < waiting) {
+		stamp_tail = tail;
+		imu_stats.unstamped++;
+		return micros();
+	}
+
+	uint32_t time = stamps[tail & STAMPS_MASK];
+	BARRIER();
+	stamp_tail = tail + 1;
+
+	return time;
+}
+
+void imuFifoReset() {
+	stamp_tail = stamp_head;
+	imu_stats.overflows++;
+}
+
+bool imuPush(const ImuSample *s) {
+	uint8_t head = sample_head;
+
+	if ((uint8_t) (head - sample_tail) == IMU_QUEUE_SIZE)
+		return false;
+
+	samples[head & QUEUE_MASK] = *s;
+	BARRIER();
+	sample_head = head + 1;
+	imu_stats.queued++;
+
+	return true;
+}
+
+uint8_t imuQueued() {
+	return sample_head - sample_tail;
+}
+
+bool imuPop(ImuSample *s) {
+	uint8_t tail = sample_tail;
+
+	if (tail == sample_head)
+		return false;
+
+	*s = samples[tail & QUEUE_MASK];
+	BARRIER();
+	sample_tail = tail + 1;
+	imu_stats.taken++;
+
+	return true;
+}
@@ -0,0 +1,73 @@
+#ifndef __imu_h
+#define __imu_h
+
+#include "Arduino.h"
+
+// samples from the mpu's dmp, timestamped by its data-ready interrupt.
+//
+// the interrupt only notes the time: the packet itself stays in the mpu's
+// fifo until the main loop reads it over i2c (Wire can't be used from an
+// isr), pairs it with its time and queues it here. the consumer takes
+// samples off in order, and neither side ever waits for the other.
+//
+// both the interrupt times and the samples are single producer, single
+// consumer rings: each index is only written by one side, and a uint8_t
+// store is atomic on the avr, so there's nothing to lock
+
+// define AHRS_FUSION to take raw gyro, accel and mag from the mpu and do the
+// fusion here (mahony.h), instead of the dmp's quaternion
+// #define AHRS_FUSION
+
+// a power of two each. more interrupt times than the mpu's fifo has packets
+// (1024 bytes of 42), so times are never lost before packets are
+#define IMU_QUEUE_SIZE 8
+#define IMU_STAMPS_SIZE 32
+
+struct ImuSample {
+	uint32_t time;        // micros() at the data-ready interrupt
+#ifdef AHRS_FUSION
+	int16_t gyro[3];
+#else
+	int16_t quat[4];      // w, x, y, z; 1.0 = 16384
+#endif
+	int16_t mag[3];
+	int16_t acc[3];
+};
+
+// counts since imuInit(), all kept by the main loop, so they can be read
+// without turning interrupts off
+struct ImuStats {
+	uint32_t interrupts;   // as of the last imuPending()
+	uint32_t queued;
+	uint32_t taken;
+	uint16_t overflows;    // times the mpu's fifo filled up and was reset
+	uint16_t unstamped;    // packets read whose interrupt was missed
+};
+
+extern ImuStats imu_stats;
+
+void imuInit();
+
+// the data-ready isr
+void imuDataReady();
+
+// producer side: interrupts not yet paired with a packet. none, and there's
+// nothing new in the mpu's fifo. brings imu_stats.interrupts up to date
+uint8_t imuPending();
+
+// the interrupt time of the oldest packet in the mpu's fifo,
+// given how many are waiting there (it included) as of the last fifo count.
+// a packet whose interrupt was missed gets the time now
+uint32_t imuPacketTime(uint8_t waiting);
+
+// after the mpu's fifo has been reset: none of the times are for packets
+// that are still there
+void imuFifoReset();
+
+bool imuPush(const ImuSample *s);
+uint8_t imuQueued();
+
+// consumer side: the oldest sample, false if there's none
+bool imuPop(ImuSample *s);
+
+#endif
@@ -0,0 +1,259 @@
+#include "learn.h"
+#include "servo_ctl.h"
+#include "telemetry.h"
+#include <EEPROM.h>
+
+#define LIVE_0 'L'
+#define LIVE_1 'M'
+
+// bytes of a checkpoint compared a learnTick(), at most, looking for one
+// that's changed
+#define TICK_COMPARES 16
+
+static float wrap180(float v) {
+	return v - 360 * floor((v + 180) / 360);
+}
+
+static uint8_t angleBin(float angle) {
+	return min((uint8_t) (fabs(angle) / POLAR_STEP + 0.5), POLAR_BINS - 1);
+}
+
+static uint8_t sheetWinch(uint8_t sheet) {
+	return WINCH_MAX + (2 * sheet + 1) * (WINCH_MIN - WINCH_MAX) / (2 * LEARN_SHEETS);
+}
+
+static LearnCell *cell(Learn *l, uint8_t bin, uint8_t band, uint8_t sheet) {
+	return &l->cells[(bin * LEARN_STRENGTHS + band) * LEARN_SHEETS + sheet];
+}
+
+const LearnCell *learnCell(const Learn *l, uint8_t bin, uint8_t band, uint8_t sheet) {
+	return &l->cells[(bin * LEARN_STRENGTHS + band) * LEARN_SHEETS + sheet];
+}
+
+uint8_t learnBand(float strength) {
+	return min((uint16_t) (strength / LEARN_STRENGTH_STEP), LEARN_STRENGTHS - 1);
+}
+
+uint8_t learnSheetBand(uint8_t winch) {
+	return constrain(((int16_t) winch - WINCH_MAX) * LEARN_SHEETS / (WINCH_MIN - WINCH_MAX), 0, LEARN_SHEETS - 1);
+}
+
+void learnInit(Learn *l, uint16_t address) {
+	memset(l, 0, sizeof(*l));
+	l->address = address;
+
+	for (uint8_t b = 0; b < LEARN_STRENGTHS; b++)
+		l->strength[b] = b * LEARN_STRENGTH_STEP + LEARN_STRENGTH_STEP / 2;
+}
+
+void learnAdd(Learn *l, float angle, float strength, uint8_t winch, uint16_t speed, uint32_t now) {
+	// a turn or a trim: the boat's speed has to catch up
+	if (winch != l->winch || fabs(wrap180(angle - l->angle)) > LEARN_STEADY) {
+		l->winch = winch;
+		l->angle = angle;
+		l->steady = now;
+		return;
+	}
+
+	if (now - l->steady < LEARN_SETTLE || strength <= 0)
+		return;
+
+	uint8_t band = learnBand(strength);
+	l->strength[band] = round(l->strength[band] + (strength - l->strength[band]) / LEARN_WINDOW);
+
+	LearnCell *c = cell(l, angleBin(angle), band, learnSheetBand(winch));
+	if (c->samples < LEARN_WINDOW)
+		c->samples++;
+
+	c->speed = constrain(round(c->speed + (speed * 10.0 - c->speed) / c->samples), 0, 65535);
+	c->dev = constrain(round(c->dev + (fabs(speed - c->speed / 10.0) - c->dev) / c->samples), 0, 255);
+}
+
+// the band in a row that's gone fastest, -1 if none's learned enough
+static int8_t fastest(const LearnCell *row) {
+	int8_t best = -1;
+
+	for (uint8_t s = 0; s < LEARN_SHEETS; s++)
+		if (row[s].samples >= LEARN_MIN && (best < 0 || row[s].speed > row[best].speed))
+			best = s;
+
+	return best;
+}
+
+uint8_t learnSheet(const Learn *l, float angle, float strength, uint8_t fallback) {
+	if (strength <= 0)
+		return fallback;
+
+	const LearnCell *row = learnCell(l, angleBin(angle), learnBand(strength), 0);
+	int8_t best = fastest(row);
+
+	if (best < 0)
+		return fallback;
+
+	// the bands either side, till they've been tried: the best moves along
+	// to whichever's faster
+	if (best > 0 && row[best - 1].samples < LEARN_MIN)
+		return sheetWinch(best - 1);
+	if (best < LEARN_SHEETS - 1 && row[best + 1].samples < LEARN_MIN)
+		return sheetWinch(best + 1);
+
+	return sheetWinch(best);
+}
+
+uint8_t learnPolar(const Learn *l, float strength, const uint8_t *reference, const uint8_t *sailed, uint8_t *speed) {
+	uint8_t band = learnBand(strength);
+	uint8_t learned = 0;
+
+	for (uint8_t i = 0; i < POLAR_BINS; i++) {
+		const LearnCell *row = learnCell(l, i, band, 0);
+		const LearnCell *ref = &row[learnSheetBand(reference[i])];
+		int8_t best = sailed ? learnSheetBand(sailed[i]) : fastest(row);
+
+		if (best < 0 || row[best].samples < LEARN_MIN || ref->samples < LEARN_MIN || !ref->speed)
+			continue;
+
+		speed[i] = min((float) speed[i] * row[best].speed / ref->speed, 255);
+		learned++;
+	}
+
+	return learned;
+}
+
+//
+// checkpoints
+//
+
+// byte i of a slot, and back
+static uint8_t slotByte(const Learn *l, uint16_t i) {
+	if (i == 0)
+		return LEARN_VERSION;
+	if (i < LEARN_HEADER)
+		return l->crc >> (8 * (i - 1));
+
+	i -= LEARN_HEADER;
+	if (i < LEARN_STRENGTHS * 2)
+		return l->strength[i / 2] >> (8 * (i % 2));
+
+	i -= LEARN_STRENGTHS * 2;
+	const LearnCell *c = &l->cells[i / 4];
+	switch (i % 4) {
+		case 0: return c->speed;
+		case 1: return c->speed >> 8;
+		case 2: return c->dev;
+		default: return c->samples;
+	}
+}
+
+static void setSlotByte(Learn *l, uint16_t i, uint8_t b) {
+	i -= LEARN_HEADER;
+	if (i < LEARN_STRENGTHS * 2) {
+		l->strength[i / 2] = (l->strength[i / 2] & ~(0xff << (8 * (i % 2)))) | (b << (8 * (i % 2)));
+		return;
+	}
+
+	i -= LEARN_STRENGTHS * 2;
+	LearnCell *c = &l->cells[i / 4];
+	switch (i % 4) {
+		case 0: c->speed = (c->speed & 0xff00) | b; break;
+		case 1: c->speed = (c->speed & 0xff) | (b << 8); break;
+		case 2: c->dev = b; break;
+		default: c->samples = b; break;
+	}
+}
+
+static uint16_t slotAddress(const Learn *l, uint8_t slot) {
+	return l->address + 1 + slot * LEARN_SLOT;
+}
+
+boolean learnLoad(Learn *l) {
+	uint8_t live = EEPROM.read(l->address);
+	if (live != LIVE_0 && live != LIVE_1)
+		return false;
+
+	uint8_t slot = live == LIVE_0 ? 0 : 1;
+	uint16_t at = slotAddress(l, slot);
+
+	if (EEPROM.read(at) != LEARN_VERSION)
+		return false;
+
+	uint16_t crc = 0xffff;
+	for (uint16_t i = LEARN_HEADER; i < LEARN_SLOT; i++)
+		crc = telemetryCrc(crc, EEPROM.read(at + i));
+
+	if (crc != (EEPROM.read(at + 1) | (EEPROM.read(at + 2) << 8)))
+		return false;
+
+	for (uint16_t i = LEARN_HEADER; i < LEARN_SLOT; i++)
+		setSlotByte(l, i, EEPROM.read(at + i));
+
+	l->slot = 1 - slot;
+	return true;
+}
+
+void learnSave(Learn *l) {
+	if (l->saving)
+		return;
+
+	l->saving = true;
+	l->at = LEARN_HEADER;
+	l->crc = 0xffff;
+}
+
+// the order a checkpoint's written in: the table, then the crc over what
+// was written of it, then the version, then it's made live
+static boolean nextByte(Learn *l, uint16_t *address, uint8_t *b) {
+	uint16_t at = slotAddress(l, l->slot);
+
+	if (l->at < LEARN_SLOT) {
+		*b = slotByte(l, l->at);
+		*address = at + l->at;
+		l->crc = telemetryCrc(l->crc, *b);
+	} else if (l->at < LEARN_SLOT + LEARN_HEADER) {
+		uint16_t i = (l->at - LEARN_SLOT + 1) % LEARN_HEADER;
+		*b = slotByte(l, i);
+		*address = at + i;
+	} else if (l->at == LEARN_SLOT + LEARN_HEADER) {
+		*b = l->slot ? LIVE_1 : LIVE_0;
+		*address = l->address;
+	} else
+		return false;
+
+	l->at++;
+	return true;
+}
+
+boolean learnTick(Learn *l) {
+	if (!l->saving)
+		return true;
+
+	uint16_t address;
+	uint8_t b;
+
+	for (uint8_t i = 0; i < TICK_COMPARES && eeprom_is_ready(); i++) {
+		if (!nextByte(l, &address, &b)) {
+			l->saving = false;
+			l->slot = 1 - l->slot;
+			return true;
+		}
+
+		if (EEPROM.read(address) != b) {
+			EEPROM.write(address, b);
+			break;
+		}
+	}
+
+	return false;
+}
+
+void learnStore(Learn *l) {
+	uint16_t address;
+	uint8_t b;
+
+	learnSave(l);
+
+	while (nextByte(l, &address, &b))
+		EEPROM.update(address, b);
+
+	l->saving = false;
+	l->slot = 1 - l->slot;
+}
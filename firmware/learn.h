@@ -0,0 +1,121 @@
+#ifndef __learn_h
+#define __learn_h
+
+#include "Arduino.h"
+#include "tactics.h"
+
+// the boat's polar, learned as it sails.
+//
+// with the boat steady (no turn, and the sheet left alone, for LEARN_SETTLE)
+// each gps fix's speed goes into a cell of a table by true wind angle (every
+// POLAR_STEP degrees, as the polar), the wind's strength (bands of
+// LEARN_STRENGTH_STEP) and the sheet (LEARN_SHEETS bands, hauled in to let
+// out). a cell keeps a running mean of the speed, the mean deviation from
+// it, and how many samples it's seen, up to LEARN_WINDOW: past that the
+// older ones count for less, so the table follows the boat as it changes.
+//
+// there's no wind speed sensor: the strength is tactics.h's, worked back
+// from the boat's speed. it only sorts the samples into light, medium and
+// heavy air, each band keeping the mean strength of the samples in it.
+//
+// from the table come the sheet for an angle (the band that's gone
+// fastest, once its neighbours have been tried), and the polar. the
+// strength's only worked out from the polar, so it can't say what fraction
+// of the wind the boat makes: the polar's scaled instead, at each angle, by
+// how much faster the fastest sheet's gone than the one the polar was
+// made with.
+//
+// it's checkpointed to eeprom a byte a learnTick(), so nothing waits on
+// it. from the address given:
+//
+//   live:   'L' slot 0, 'M' slot 1, anything else none
+//   slot:   version(1) crc(2) strengths(2 each) cells(4 each)
+//   cell:   speed(2) dev(1) samples(1)
+//
+// little endian, crc16-ccitt (telemetry.h) over the strengths and cells. a
+// checkpoint goes to the slot that isn't live, which is only made live once
+// it's all there
+
+#define LEARN_SHEETS 6
+#define LEARN_STRENGTHS 3
+#define LEARN_CELLS (POLAR_BINS * LEARN_STRENGTHS * LEARN_SHEETS)
+
+// cm/s of wind a band (5kt)
+#define LEARN_STRENGTH_STEP 257
+
+// samples a cell's mean is over, at most; and how many before it's used
+#define LEARN_WINDOW 32
+#define LEARN_MIN 8
+
+// ms the sheet and the true wind angle have to have held, and how far the
+// angle can wander (degrees), before the speed's taken
+#define LEARN_SETTLE 10000
+#define LEARN_STEADY 10
+
+#define LEARN_VERSION 1
+#define LEARN_HEADER 3
+#define LEARN_SLOT (LEARN_HEADER + LEARN_STRENGTHS * 2 + LEARN_CELLS * 4)
+
+// all of it, from the address given
+#define LEARN_EEPROM (1 + 2 * LEARN_SLOT)
+
+struct LearnCell {
+	uint16_t speed;         // mm/s
+	uint8_t dev;            // cm/s
+	uint8_t samples;
+};
+
+struct Learn {
+	LearnCell cells[LEARN_CELLS];
+	uint16_t strength[LEARN_STRENGTHS];     // cm/s
+
+	// steady since, at this sheet and angle
+	uint32_t steady;
+	uint8_t winch;
+	float angle;
+
+	// the checkpoint: the slot it's going to, and the next byte of it
+	uint16_t address;
+	uint8_t slot;
+	boolean saving;
+	uint16_t at;
+	uint16_t crc;
+};
+
+// empty, checkpointed from address
+void learnInit(Learn *l, uint16_t address);
+
+// the live checkpoint, if there's one that checks out
+boolean learnLoad(Learn *l);
+
+// a gps fix: speed (cm/s) at true wind angle (degrees, [-180, 180]) in a
+// wind of strength (cm/s, 0 for not known), with the winch at winch
+void learnAdd(Learn *l, float angle, float strength, uint8_t winch, uint16_t speed, uint32_t now);
+
+// the cell for an angle, strength and sheet band
+const LearnCell *learnCell(const Learn *l, uint8_t bin, uint8_t band, uint8_t sheet);
+uint8_t learnBand(float strength);
+uint8_t learnSheetBand(uint8_t winch);
+
+// the winch position to try at angle in strength: fallback until its
+// row's learned anything
+uint8_t learnSheet(const Learn *l, float angle, float strength, uint8_t fallback);
+
+// speed (POLAR_BINS, as polarInit's) scaled, at each angle, by the speed
+// at sailed's sheet over reference's (the winch positions it's sailed at and
+// it was made at, each angle) in the band for strength. sailed NULL takes
+// the fastest sheet. angles without both learned are left as they are
+uint8_t learnPolar(const Learn *l, float strength, const uint8_t *reference, const uint8_t *sailed, uint8_t *speed);
+
+// starts a checkpoint, unless one's still being written
+void learnSave(Learn *l);
+
+// writes the next byte of a checkpoint, if the eeprom's ready. true when
+// there's nothing left to write
+boolean learnTick(Learn *l);
+
+// the whole table, written at once as the live checkpoint, waiting on the
+// eeprom: for setting one up, not for under way
+void learnStore(Learn *l);
+
+#endif
@@ -1,4 +1,5 @@
 #include "logger.h"
+#include "profile.h"
 #include <stdarg.h>
 
 #ifndef NO_SD
@@ -10,6 +11,22 @@
 SdCard card;
 Fat16 file;
 
+// sd writes are gathered here, a block of the file at a time; every sync
+// costs at least a full sector write. log_used is where the file's end is
+// in the block, log_sent how much of it a timed flush has already written
+uint8_t log_buf[LOG_BUFFER_SIZE];
+uint16_t log_used = 0;
+uint16_t log_sent = 0;
+uint32_t last_sync = 0;
+
+#ifdef LOG_BINARY
+// direct-mapped cache of the formats already defined in the file. a miss only
+// costs a repeated FORMAT record
+#define LOG_FORMAT_SLOTS 32
+const char *log_formats[LOG_FORMAT_SLOTS];
+char log_time[6];
+#endif
+
 #endif
 
 char gps_time[7];       // HHMMSS
@@ -17,25 +34,69 @@ uint32_t gps_seconds = 0;   // seconds after midnight
 
 uint8_t fileReady = 0;
 
-void do_log(char *fmt, va_list args, bool println);
+// the serial log's held off till quiet_until (logQuiet())
+uint32_t quiet_until = 0;
+boolean quiet = false;
+
+void do_log(const char *fmt, bool progmem, va_list args, bool println);
+
+#ifndef NO_SD
+// writes out what's in the block and hasn't been, and syncs
+void logFlush() {
+	if (log_used > log_sent) {
+		file.write(log_buf + log_sent, log_used - log_sent);
+		log_sent = log_used;
+	}
+
+	file.sync();
+	last_sync = millis();
+}
+
+// fills the block up to its end, writes it whole and carries on into the
+// next: the card only gets whole blocks, bar the tail a timed flush syncs
+void logAppend(const uint8_t *data, uint16_t len) {
+#ifdef LOG_UNBUFFERED
+	file.write(data, len);
+#else
+	while (len) {
+		uint16_t n = min(len, (uint16_t) (LOG_BUFFER_SIZE - log_used));
+
+		memcpy(log_buf + log_used, data, n);
+		log_used += n;
+		data += n;
+		len -= n;
+
+		if (log_used == LOG_BUFFER_SIZE) {
+			file.write(log_buf + log_sent, LOG_BUFFER_SIZE - log_sent);
+			log_used = 0;
+			log_sent = 0;
+		}
+	}
+#endif
+}
+#endif
 
 void logInit() {
 #ifndef NO_SD
 	// initialize the SD card
-	if (!card.init()) { 
+	if (!card.init()) {
 		Serial.print("Error initializing card - ");
 		Serial.println(card.errorCode, HEX);
 		return;
 	}
-    
+
 	// initialize a FAT16 volume
 	if (!Fat16::init(&card)) {
 		Serial.println("Can't initialize volume.");
 		return;
 	}
-    
+
 	// create a new file
+#ifdef LOG_BINARY
+	char name[] = "LOGGER00.BIN";
+#else
 	char name[] = "LOGGER00.TXT";
+#endif
 	for (uint8_t i = 0; i < 100; i++) {
 		name[6] = i/10 + '0';
 		name[7] = i%10 + '0';
@@ -49,91 +110,270 @@ void logInit() {
 		Serial.println("Error creating log file.");
 		return;
 	}
-    
+
 	Serial.print("Logging to: ");
 	Serial.println(name);
 
 	// write data header
-    
+
 	// clear write error
 	file.writeError = false;
-	file.println("Started log.");
-	file.sync();
-    
+	// through the block, so it stays lined up with the file's
+	log_used = 0;
+	log_sent = 0;
+#ifdef LOG_BINARY
+	logAppend((const uint8_t *)LOG_MAGIC, 4);
+#else
+	logAppend((const uint8_t *)"Started log.\r\n", 14);
+#endif
+	logFlush();
+
 	fileReady = 1;
 #else
 	Serial.println("Started log.");
 #endif
 }
 
+// pushes buffered log data out to the card once it's been sitting for a while
+void logTick() {
+#ifndef NO_SD
+	if (fileReady && log_used > log_sent && millis() - last_sync > LOG_FLUSH_INTERVAL)
+		logFlush();
+#endif
+}
+
+#if !defined(NO_SD) && defined(LOG_BINARY)
+inline uint8_t put16(uint8_t *out, uint8_t n, uint16_t v) {
+	out[n++] = v;
+	out[n++] = v >> 8;
+	return n;
+}
+
+inline uint8_t put32(uint8_t *out, uint8_t n, uint32_t v) {
+	n = put16(out, n, v);
+	return put16(out, n, v >> 16);
+}
+
+inline bool isFlag(char c) {
+	return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == ' ' || c == '#' || c == '.' || c == 'h';
+}
+
+// raw arguments, as the avr passes them: ints are 2 bytes, longs 4, strings
+// length-prefixed. returns the bytes used, stopping early if out runs out
+uint8_t encodeArgs(const char *fmt, va_list args, uint8_t *out, uint8_t size) {
+	uint8_t n = 0;
+	char c;
+
+	while ((c = pgm_read_byte(fmt++))) {
+		if (c != '%')
+			continue;
+
+		bool is_long = false;
+		while ((c = pgm_read_byte(fmt++))) {
+			if (c == '*') {
+				if (n + 2 > size)
+					return n;
+				n = put16(out, n, va_arg(args, int));
+			} else if (c == 'l')
+				is_long = true;
+			else if (!isFlag(c))
+				break;
+		}
+
+		switch (c) {
+			case 0:
+				return n;
+
+			case '%':
+				break;
+
+			case 's': {
+				const char *s = va_arg(args, const char *);
+				uint8_t len = strnlen(s, MAX_STRING);
+
+				if (n + 1 + len > size)
+					return n;
+
+				out[n++] = len;
+				memcpy(out + n, s, len);
+				n += len;
+				break;
+			}
+
+			case 'e': case 'E': case 'f': case 'g': case 'G': {
+				float f = va_arg(args, double);
+				uint32_t bits;
+
+				if (n + 4 > size)
+					return n;
+
+				memcpy(&bits, &f, 4);
+				n = put32(out, n, bits);
+				break;
+			}
+
+			default:
+				if (n + (is_long ? 4 : 2) > size)
+					return n;
+
+				if (is_long)
+					n = put32(out, n, va_arg(args, long));
+				else
+					n = put16(out, n, va_arg(args, int));
+				break;
+		}
+	}
+
+	return n;
+}
+
+void logTimeRecord() {
+	if (!memcmp(log_time, gps_time, 6))
+		return;
+
+	memcpy(log_time, gps_time, 6);
+
+	uint8_t rec[7] = { LOG_REC_TIME };
+	memcpy(rec + 1, log_time, 6);
+	logAppend(rec, sizeof(rec));
+}
+
+void logFormatRecord(const char *fmt, uint16_t id) {
+	size_t len = strlen_P(fmt);
+	if (len > MAX_STRING)
+		len = MAX_STRING;
+
+	uint8_t rec[4 + MAX_STRING] = { LOG_REC_FORMAT };
+	put16(rec, 1, id);
+	rec[3] = len;
+	memcpy_P(rec + 4, fmt, len);
+	logAppend(rec, 4 + len);
+}
+
+void logRecord(const char *fmt, va_list args) {
+	uint16_t id = (uintptr_t)fmt;
+	uint8_t slot = (id ^ (id >> 5)) % LOG_FORMAT_SLOTS;
+
+	logTimeRecord();
+
+	if (log_formats[slot] != fmt) {
+		logFormatRecord(fmt, id);
+		log_formats[slot] = fmt;
+	}
+
+	uint8_t rec[8 + MAX_STRING] = { LOG_REC_LINE };
+	put16(rec, 1, id);
+	put32(rec, 3, millis());
+	rec[7] = encodeArgs(fmt, args, rec + 8, MAX_STRING);
+	logAppend(rec, 8 + rec[7]);
+}
+
+// lines from ram format strings have no stable id; they're stored as text
+void logTextRecord(uint32_t now, const char *buf, bool println) {
+	uint8_t len = strnlen(buf, MAX_STRING);
+	uint8_t rec[7] = { LOG_REC_TEXT };
+
+	logTimeRecord();
+
+	put32(rec, 1, now);
+	rec[5] = println;
+	rec[6] = len;
+	logAppend(rec, sizeof(rec));
+	logAppend((const uint8_t *)buf, len);
+}
+#endif
+
+void logQuiet(uint16_t ms) {
+	quiet_until = millis() + ms;
+	quiet = true;
+}
+
+boolean logQuieted() {
+	if (quiet && (int32_t) (millis() - quiet_until) >= 0)
+		quiet = false;
+
+	return quiet;
+}
+
 void logln(const __FlashStringHelper *ifsh, ...) {
-    const char PROGMEM *p = (const char PROGMEM *)ifsh;
-	char * fmt = (char*)malloc(MAX_STRING);
-	
-    size_t n = 0;
-	uint16_t count = 0;
-    while (1) {
-      unsigned char c = pgm_read_byte(p++);
-      fmt[n++] = c;
-
-	  // we want the 0 byte in there
-      if (c == 0) break;
-	  
-	  if (count++ >= MAX_STRING) {
-		  Serial.println("Malformed PROGMEM string - no null terminator found.");
-		  free(fmt);
-		  
-		  return;
-	  }
-    }
-	
 	va_list args;
 	va_start (args, ifsh);
-	do_log(fmt, args, true);
+	do_log((const char *)ifsh, true, args, true);
 	va_end (args);
-	
-	free(fmt);
 }
 
 void logln(char *fmt, ... ) {
 	va_list args;
 	va_start (args, fmt );
-	do_log(fmt, args, true);
+	do_log(fmt, false, args, true);
 	va_end (args);
 }
 
 void log(char *fmt, ... ) {
 	va_list args;
 	va_start (args, fmt );
-	do_log(fmt, args, false);
+	do_log(fmt, false, args, false);
 	va_end (args);
 }
 
-void do_log(char *fmt, va_list args, bool println) {
+void do_log(const char *fmt, bool progmem, va_list args, bool println) {
+	PROFILE_SCOPE(PROF_LOG);
+
+#if !defined(NO_SD) && defined(LOG_BINARY)
+	if (fileReady && progmem) {
+		va_list copy;
+		va_copy(copy, args);
+		logRecord(fmt, copy);
+		va_end(copy);
+	}
+
+	bool to_file = fileReady && !progmem;
+#elif !defined(NO_SD)
+	bool to_file = fileReady;
+#else
+	bool to_file = false;
+#endif
+
+	bool to_serial = serial_logging && !logQuieted();
+
+	// nothing to format for
+	if (!to_serial && !to_file)
+		return;
+
 	char buf[144]; // resulting string limited to 128 chars
-	vsnprintf(buf, 144, fmt, args);
+	if (progmem)
+		vsnprintf_P(buf, 144, fmt, args);
+	else
+		vsnprintf(buf, 144, fmt, args);
+
+	uint32_t now = millis();
 
-	if (serial_logging) {
+	if (to_serial) {
 		Serial.print(gps_time);
 		Serial.print(':');
-		Serial.print(millis());
+		Serial.print(now);
 		Serial.print(' ');
 		Serial.print(buf);
 		if (println)
 			Serial.println();
 	}
-    
+
 #ifndef NO_SD
-	if (fileReady) {
-		file.print(gps_time);
-		file.print(':');
-		file.print(millis());
-		file.print(' ');
-		file.print(buf);
+	if (to_file) {
+#ifdef LOG_BINARY
+		logTextRecord(now, buf, println);
+#else
+		char prefix[20];
+		uint8_t len = snprintf(prefix, sizeof(prefix), "%s:%lu ", gps_time, (unsigned long)now);
+		logAppend((const uint8_t *)prefix, len);
+		logAppend((const uint8_t *)buf, strlen(buf));
 		if (println)
-			file.println();
-		
-		file.sync();
+			logAppend((const uint8_t *)"\r\n", 2);
+#endif
+#ifdef LOG_UNBUFFERED
+		if (println)
+			logFlush();
+#endif
 	}
 #endif
 }
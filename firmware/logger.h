@@ -3,9 +3,37 @@
 
 #include "Arduino.h"
 
+// no sd card on the current board. define WITH_SD to log to one
+#ifndef WITH_SD
 #define NO_SD
+#endif
+
+// define LOG_BINARY to log compact binary records to the sd card instead of
+// text. the serial log stays text. decode with the host build's ardusailor_logdump
+// #define LOG_BINARY
+
 #define MAX_STRING 128
 
+// sd writes are collected into a block this size, lined up with the file's,
+// and written when it's full. what's been written is synced, along with any
+// of the block there is, LOG_FLUSH_INTERVAL ms after the last sync
+#define LOG_BUFFER_SIZE 512
+#define LOG_FLUSH_INTERVAL 5000
+
+// define LOG_UNBUFFERED to write each text line as it's logged and sync it,
+// as the log used to: ardusailor_logbench compares the two
+// #define LOG_UNBUFFERED
+
+// binary log: file header, then a stream of records starting with one of these.
+// a line's format string is sent once in a FORMAT record, lines after that only
+// carry its id (the format's progmem address) and the raw arguments
+#define LOG_MAGIC "ASL1"
+
+#define LOG_REC_FORMAT 0x01  // id(2) len(1) format(len)
+#define LOG_REC_TIME   0x02  // gps_time(6)
+#define LOG_REC_LINE   0x03  // id(2) millis(4) len(1) args(len)
+#define LOG_REC_TEXT   0x04  // millis(4) newline(1) len(1) text(len)
+
 extern char gps_time[7];        // HHMMSS
 extern uint32_t gps_seconds;    // seconds after midnight
 extern boolean serial_logging;
@@ -14,5 +42,10 @@ void log(char *fmt, ... );
 void logln(char *fmt, ... );
 void logln(const __FlashStringHelper *ifsh, ...);
 void logInit();
+void logTick();
+
+// nothing goes to serial for the next ms, the sd card log carries on
+void logQuiet(uint16_t ms);
+boolean logQuieted();
 
 #endif
@@ -0,0 +1,324 @@
+#include "magcal.h"
+
+// readings are scaled down by this before they go into the sums, so the
+// terms are all about 1 and none of them swamps the others
+#define MAGCAL_SCALE 128.0
+
+// a pivot this small, against the sum it came from, and the readings don't
+// tell that term from the others: round in circles they're about 3e-5, all
+// round about 0.05 or more
+#define MAGCAL_MIN_PIVOT 1e-3
+
+// how hard a held fit keeps the field's strength, against the readings'
+#define MAGCAL_FIELD_WEIGHT 1.0
+
+// passes of a held fit, each keeping the field's strength about the centre
+// the last one found
+#define MAGCAL_HELD_PASSES 3
+
+// index into a packed lower triangle, i >= j
+static uint8_t tri(uint8_t i, uint8_t j) {
+	return i * (i + 1) / 2 + j;
+}
+
+void magCalBegin(MagCalSums *s, const MagCal *last) {
+	memset(s, 0, sizeof(*s));
+	for (uint8_t i = 0; i < 3; i++)
+		s->ref[i] = lround(last->offset[i]);
+}
+
+void magCalAdd(MagCalSums *s, const int16_t m[3]) {
+	float x = (m[0] - s->ref[0]) / MAGCAL_SCALE;
+	float y = (m[1] - s->ref[1]) / MAGCAL_SCALE;
+	float z = (m[2] - s->ref[2]) / MAGCAL_SCALE;
+	float d[MAGCAL_TERMS] = {
+		x * x + y * y - 2 * z * z, x * x + z * z - 2 * y * y,
+		2 * x * y, 2 * x * z, 2 * y * z, 2 * x, 2 * y, 2 * z, 1
+	};
+	float r = x * x + y * y + z * z;
+
+	uint8_t k = 0;
+	for (uint8_t i = 0; i < MAGCAL_TERMS; i++) {
+		for (uint8_t j = 0; j <= i; j++)
+			s->ata[k++] += d[i] * d[j];
+		s->atb[i] += d[i] * r;
+	}
+
+	s->n++;
+}
+
+// normal equations by cholesky, in place in the packed triangle l, with b
+// turned into the solution. false if any term's hardly told from the others
+static bool solve(float *l, float *b, uint8_t terms) {
+	for (uint8_t i = 0; i < terms; i++)
+		for (uint8_t j = 0; j <= i; j++) {
+			float sum = l[tri(i, j)];
+			for (uint8_t k = 0; k < j; k++)
+				sum -= l[tri(i, k)] * l[tri(j, k)];
+
+			if (i == j) {
+				if (!(sum > l[tri(i, i)] * MAGCAL_MIN_PIVOT))
+					return false;
+				l[tri(i, i)] = sqrt(sum);
+			} else
+				l[tri(i, j)] = sum / l[tri(j, j)];
+		}
+
+	for (uint8_t i = 0; i < terms; i++) {
+		for (uint8_t k = 0; k < i; k++)
+			b[i] -= l[tri(i, k)] * b[k];
+		b[i] /= l[tri(i, i)];
+	}
+
+	for (int8_t i = terms - 1; i >= 0; i--) {
+		for (uint8_t k = i + 1; k < terms; k++)
+			b[i] -= l[tri(k, i)] * b[k];
+		b[i] /= l[tri(i, i)];
+	}
+
+	return true;
+}
+
+// a's inverse, false if there's none
+static bool invert(const float a[3][3], float inv[3][3]) {
+	for (uint8_t i = 0; i < 3; i++)
+		for (uint8_t j = 0; j < 3; j++) {
+			uint8_t r0 = (j + 1) % 3, r1 = (j + 2) % 3, c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+			inv[i][j] = a[r0][c0] * a[r1][c1] - a[r0][c1] * a[r1][c0];
+		}
+
+	float det = a[0][0] * inv[0][0] + a[0][1] * inv[1][0] + a[0][2] * inv[2][0];
+	if (det == 0)
+		return false;
+
+	for (uint8_t i = 0; i < 3; i++)
+		for (uint8_t j = 0; j < 3; j++)
+			inv[i][j] /= det;
+
+	return true;
+}
+
+// eigenvalues (left on the diagonal) and eigenvectors (v's columns) of a
+// symmetric 3x3, by jacobi rotations
+static void eigen(float a[3][3], float v[3][3]) {
+	for (uint8_t i = 0; i < 3; i++)
+		for (uint8_t j = 0; j < 3; j++)
+			v[i][j] = i == j;
+
+	for (uint8_t sweep = 0; sweep < 10; sweep++) {
+		float off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+		float diag = a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2];
+		if (off <= diag * 1e-14)
+			return;
+
+		for (uint8_t p = 0; p < 2; p++)
+			for (uint8_t q = p + 1; q < 3; q++) {
+				if (a[p][q] == 0)
+					continue;
+
+				float theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+				float t = 1 / (fabs(theta) + sqrt(theta * theta + 1));
+				if (theta < 0)
+					t = -t;
+				float c = 1 / sqrt(t * t + 1), s = t * c;
+
+				for (uint8_t k = 0; k < 3; k++) {
+					float kp = a[k][p], kq = a[k][q];
+					a[k][p] = c * kp - s * kq;
+					a[k][q] = s * kp + c * kq;
+				}
+				for (uint8_t k = 0; k < 3; k++) {
+					float pk = a[p][k], qk = a[q][k];
+					a[p][k] = c * pk - s * qk;
+					a[q][k] = s * pk + c * qk;
+				}
+				for (uint8_t k = 0; k < 3; k++) {
+					float kp = v[k][p], kq = v[k][q];
+					v[k][p] = c * kp - s * kq;
+					v[k][q] = s * kp + c * kq;
+				}
+			}
+	}
+}
+
+// sums of x_i and x_i x_j over the readings, out of the fit's: its last
+// three terms are 2x, 2y and 2z, and the last of all 1
+static float first(const MagCalSums *s, uint8_t i) {
+	return s->ata[tri(8, 5 + i)] / 2;
+}
+
+static float second(const MagCalSums *s, uint8_t i, uint8_t j) {
+	return s->ata[i >= j ? tri(5 + i, 5 + j) : tri(5 + j, 5 + i)] / 4;
+}
+
+// the sum of x' q x x_c over the readings, out of the fit's: the shape terms
+// times 2x_c, and |x|^2 times 2x_c on the right hand side
+static float third(const MagCalSums *s, const float q[3][3], uint8_t c) {
+	float d0 = s->ata[tri(5 + c, 0)] / 2, d1 = s->ata[tri(5 + c, 1)] / 2, r = s->atb[5 + c] / 2;
+	float zz = (r - d0) / 3, yy = (r - d1) / 3, xx = r - yy - zz;
+
+	return q[0][0] * xx + q[1][1] * yy + q[2][2] * zz +
+		(q[0][1] * s->ata[tri(5 + c, 2)] + q[0][2] * s->ata[tri(5 + c, 3)] + q[1][2] * s->ata[tri(5 + c, 4)]) / 2;
+}
+
+// the full ellipsoid, from the readings alone
+static uint8_t full(const MagCalSums *s, MagCal *cal) {
+	float l[sizeof(s->ata) / sizeof(s->ata[0])], p[MAGCAL_TERMS];
+	memcpy(l, s->ata, sizeof(l));
+	memcpy(p, s->atb, sizeof(p));
+
+	if (!solve(l, p, MAGCAL_TERMS))
+		return MAGCAL_FAILED;
+
+	// back to a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g.x + j = 0
+	float a[3][3] = {
+		{ p[0] + p[1] - 1, p[2], p[3] },
+		{ p[2], p[0] - 2 * p[1] - 1, p[4] },
+		{ p[3], p[4], p[1] - 2 * p[0] - 1 }
+	};
+	float *g = p + 5;
+
+	// the centre, -a^-1 g
+	float inv[3][3];
+	if (!invert(a, inv))
+		return MAGCAL_FAILED;
+
+	float centre[3], k = -p[8];
+	for (uint8_t i = 0; i < 3; i++) {
+		centre[i] = -(inv[i][0] * g[0] + inv[i][1] * g[1] + inv[i][2] * g[2]);
+		k -= centre[i] * g[i];
+	}
+
+	// (x - centre)' a (x - centre) = k. with a + b + c at -3 both come out
+	// negative: it's a / k that has to be positive definite
+	if (k == 0)
+		return MAGCAL_FAILED;
+
+	for (uint8_t i = 0; i < 3; i++)
+		for (uint8_t j = 0; j < 3; j++)
+			a[i][j] /= k;
+
+	float v[3][3];
+	eigen(a, v);
+
+	// the ellipsoid's radii, from its axes' eigenvalues
+	float radius[3], lo = 0, hi = 0, mean = 1;
+	for (uint8_t i = 0; i < 3; i++) {
+		if (!(a[i][i] > 0))
+			return MAGCAL_FAILED;
+
+		radius[i] = 1 / sqrt(a[i][i]);
+		lo = i == 0 ? radius[i] : min(lo, radius[i]);
+		hi = i == 0 ? radius[i] : max(hi, radius[i]);
+		mean *= radius[i];
+	}
+
+	if (hi > lo * MAGCAL_MAX_RATIO)
+		return MAGCAL_FAILED;
+
+	// each axis scaled to the mean radius: a sphere of the same volume
+	mean = pow(mean, 1 / 3.0);
+	for (uint8_t i = 0; i < 3; i++) {
+		cal->offset[i] = centre[i] * MAGCAL_SCALE + s->ref[i];
+
+		for (uint8_t j = 0; j < 3; j++) {
+			float sum = 0;
+			for (uint8_t e = 0; e < 3; e++)
+				sum += v[i][e] * (mean / radius[e]) * v[j][e];
+			cal->matrix[i][j] = sum;
+		}
+	}
+	cal->field = mean * MAGCAL_SCALE;
+
+	return MAGCAL_FULL;
+}
+
+// the last calibration's soft iron and field strength, and only the offset
+// from the readings: a sphere through them once corrected, y = matrix x,
+//
+//   |y|^2 = 2 centre.y + field^2 - |centre|^2
+//
+// with the field's strength held to the last one's, which is what tells the
+// offset across the band from the field's size
+static uint8_t held(const MagCalSums *s, const MagCal *last, MagCal *cal) {
+	const float (*w)[3] = last->matrix;
+	float q[3][3], m1[3], y1[3], y2[3][3], y3[3], t[3], yy = 0;
+
+	if (!(last->field > 0))
+		return MAGCAL_FAILED;
+
+	// q = w' w, so |y|^2 = x' q x
+	for (uint8_t i = 0; i < 3; i++)
+		for (uint8_t j = 0; j < 3; j++)
+			q[i][j] = w[0][i] * w[0][j] + w[1][i] * w[1][j] + w[2][i] * w[2][j];
+
+	// the sums of y, y y', |y|^2 y and |y|^2, from x's
+	for (uint8_t i = 0; i < 3; i++) {
+		m1[i] = first(s, i);
+		t[i] = third(s, q, i);
+		for (uint8_t j = 0; j < 3; j++)
+			yy += q[i][j] * second(s, i, j);
+	}
+
+	for (uint8_t i = 0; i < 3; i++) {
+		y1[i] = w[i][0] * m1[0] + w[i][1] * m1[1] + w[i][2] * m1[2];
+		y3[i] = w[i][0] * t[0] + w[i][1] * t[1] + w[i][2] * t[2];
+
+		for (uint8_t j = 0; j < 3; j++) {
+			y2[i][j] = 0;
+			for (uint8_t a = 0; a < 3; a++)
+				for (uint8_t b = 0; b < 3; b++)
+					y2[i][j] += w[i][a] * second(s, a, b) * w[j][b];
+		}
+	}
+
+	float field = last->field / MAGCAL_SCALE, c[4] = { 0, 0, 0, 0 };
+	float weight = s->n * MAGCAL_FIELD_WEIGHT;
+
+	for (uint8_t pass = 0; pass < MAGCAL_HELD_PASSES; pass++) {
+		// terms 2y and 1, for the centre and field^2 - |centre|^2, the last
+		// pulled to what it'd be with the field as it was
+		float l[10], b[4];
+		for (uint8_t i = 0; i < 3; i++) {
+			for (uint8_t j = 0; j <= i; j++)
+				l[tri(i, j)] = 4 * y2[i][j];
+			l[tri(3, i)] = 2 * y1[i];
+			b[i] = 2 * y3[i];
+		}
+		l[tri(3, 3)] = s->n + weight;
+		b[3] = yy + weight * (field * field - c[0] * c[0] - c[1] * c[1] - c[2] * c[2]);
+
+		if (!solve(l, b, 4))
+			return MAGCAL_FAILED;
+		memcpy(c, b, sizeof(c));
+	}
+
+	// back through the soft iron to the raw readings' centre
+	float inv[3][3];
+	if (!invert(w, inv))
+		return MAGCAL_FAILED;
+
+	memcpy(cal->matrix, w, sizeof(cal->matrix));
+	for (uint8_t i = 0; i < 3; i++)
+		cal->offset[i] = (inv[i][0] * c[0] + inv[i][1] * c[1] + inv[i][2] * c[2]) * MAGCAL_SCALE + s->ref[i];
+	cal->field = sqrt(max(0.0f, c[3] + c[0] * c[0] + c[1] * c[1] + c[2] * c[2])) * MAGCAL_SCALE;
+
+	return MAGCAL_PARTIAL;
+}
+
+uint8_t magCalSolve(const MagCalSums *s, const MagCal *last, MagCal *cal) {
+	if (s->n < MAGCAL_TERMS)
+		return MAGCAL_FAILED;
+
+	uint8_t got = full(s, cal);
+	return got == MAGCAL_FAILED ? held(s, last, cal) : got;
+}
+
+void magCalApply(const MagCal *cal, const int16_t m[3], float out[3]) {
+	float d[3];
+	for (uint8_t i = 0; i < 3; i++)
+		d[i] = m[i] - cal->offset[i];
+
+	for (uint8_t i = 0; i < 3; i++)
+		out[i] = cal->matrix[i][0] * d[0] + cal->matrix[i][1] * d[1] + cal->matrix[i][2] * d[2];
+}
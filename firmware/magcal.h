@@ -0,0 +1,62 @@
+#ifndef __magcal_h
+#define __magcal_h
+
+#include "Arduino.h"
+
+// magnetometer calibration: a least squares ellipsoid through the raw
+// readings, for the hard iron offset and the soft iron correction.
+//
+// each reading goes into the sums of the fit's normal equations as it comes,
+// so it takes the same memory however many there are and nothing's kept of
+// the readings themselves. solving fits
+//
+//   a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z + j = 0
+//
+// with a + b + c held at -3, which unlike j = -1 stays well posed wherever
+// the ellipsoid is (petrov's fit), and turns it into its centre and the
+// symmetric matrix that makes it a sphere of the same volume, so corrected
+// readings stay in mag lsb.
+//
+// readings from the boat going round in circles only cover a band round the
+// ellipsoid, which doesn't pin down the rest of it. then the fit is held to
+// the last calibration: the soft iron and the field's strength stay as they
+// were, and only the offset, which is what moves when something aboard
+// does, comes from the readings. float: it's done once, at the end of a
+// calibration
+
+#define MAGCAL_TERMS 9
+
+// the fit is given up on if the corrected axes would differ by more than
+// this: real soft iron is far less
+#define MAGCAL_MAX_RATIO 1.5
+
+// what magCalSolve() made of the readings
+#define MAGCAL_FAILED 0
+#define MAGCAL_PARTIAL 1    // held to the last calibration
+#define MAGCAL_FULL 2
+
+struct MagCalSums {
+	float ata[MAGCAL_TERMS * (MAGCAL_TERMS + 1) / 2];  // lower triangle, by rows
+	float atb[MAGCAL_TERMS];
+	int16_t ref[3];   // taken off every reading, to keep the sums well conditioned
+	uint16_t n;
+};
+
+struct MagCal {
+	float offset[3];
+	float matrix[3][3];
+	float field;      // corrected readings' strength, 0 if not known
+};
+
+// last is the calibration so far (min/max's midpoint, no soft iron and no
+// field will do): the closer its offset to the middle, the better conditioned the sums
+void magCalBegin(MagCalSums *s, const MagCal *last);
+void magCalAdd(MagCalSums *s, const int16_t m[3]);
+
+// MAGCAL_FAILED if the readings don't make an ellipsoid, or not a
+// believable one
+uint8_t magCalSolve(const MagCalSums *s, const MagCal *last, MagCal *cal);
+
+void magCalApply(const MagCal *cal, const int16_t m[3], float out[3]);
+
+#endif
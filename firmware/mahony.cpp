@@ -0,0 +1,290 @@
+#include "mahony.h"
+#include "trig_fix.h"
+
+#define ONE_Q30 (1L << 30)
+
+// seconds in a row with the mag left out before taking the field as it is
+// now: the boat may have come up with the motor running
+#define MAG_PATIENCE_SECONDS 30
+
+// ...and the seconds it's then taken as good whatever it does, while the
+// attitude comes round to it
+#define MAG_SETTLE_SECONDS 5
+
+// the field follows good readings 1/64th of the way
+#define MAG_TRACK_SHIFT 6
+
+// gyro bias the integral term may take up, degrees per second
+#define MAX_BIAS 10
+
+// q * d / 2^19, without a 64 bit product
+static int32_t mulStep(int32_t q, int16_t d) {
+	int32_t hi = (q >> 16) * d;
+	int32_t lo = (int32_t) (uint16_t) q * d;
+
+	return (hi >> 3) + ((lo + ((hi & 7) << 16)) >> 19);
+}
+
+// v * s / 2^16
+static int32_t mulFrac(int32_t v, uint16_t s) {
+	uint32_t u = v < 0 ? -v : v;
+	uint32_t r = (u >> 16) * s + (((u & 0xffff) * s) >> 16);
+
+	return v < 0 ? -(int32_t) r : r;
+}
+
+static int32_t mul15(int32_t a, int32_t b) {
+	return (a * b) >> 15;
+}
+
+static int16_t sat16(int32_t v) {
+	return v > 32767 ? 32767 : (v < -32767 ? -32767 : v);
+}
+
+static uint16_t isqrt(uint32_t v) {
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+
+	while (bit > v)
+		bit >>= 2;
+
+	while (bit) {
+		if (v >= root + bit) {
+			v -= root + bit;
+			root = (root >> 1) + bit;
+		} else
+			root >>= 1;
+		bit >>= 2;
+	}
+
+	return root;
+}
+
+// to Q15 unit length. false if it's all zero
+static bool normalize(const int16_t v[3], int16_t out[3], uint16_t *norm) {
+	uint32_t sum = (uint32_t) ((int32_t) v[0] * v[0]) + (uint32_t) ((int32_t) v[1] * v[1]) +
+		(uint32_t) ((int32_t) v[2] * v[2]);
+
+	*norm = isqrt(sum);
+	if (*norm == 0)
+		return false;
+
+	for (uint8_t i = 0; i < 3; i++)
+		out[i] = sat16(((int32_t) v[i] << 15) / *norm);
+
+	return true;
+}
+
+// the rotation from the mpu's axes to north, west and up, Q15
+static void rotation(const int32_t q[4], int32_t r[3][3]) {
+	int16_t w = sat16(q[0] >> 15), x = sat16(q[1] >> 15);
+	int16_t y = sat16(q[2] >> 15), z = sat16(q[3] >> 15);
+
+	r[0][0] = 32768 - (((int32_t) y * y + (int32_t) z * z) >> 14);
+	r[0][1] = ((int32_t) x * y - (int32_t) w * z) >> 14;
+	r[0][2] = ((int32_t) x * z + (int32_t) w * y) >> 14;
+	r[1][0] = ((int32_t) x * y + (int32_t) w * z) >> 14;
+	r[1][1] = 32768 - (((int32_t) x * x + (int32_t) z * z) >> 14);
+	r[1][2] = ((int32_t) y * z - (int32_t) w * x) >> 14;
+	r[2][0] = ((int32_t) x * z - (int32_t) w * y) >> 14;
+	r[2][1] = ((int32_t) y * z + (int32_t) w * x) >> 14;
+	r[2][2] = 32768 - (((int32_t) x * x + (int32_t) y * y) >> 14);
+}
+
+static uint16_t atan2Fix(int32_t y, int32_t x) {
+	return x == 0 && y == 0 ? 0 : _atan2_fix(sat16(y), sat16(x));
+}
+
+// the first attitude, straight from accel and mag. once, so float is fine
+static void attitude(Mahony *f, const int16_t acc[3], const int16_t mag[3]) {
+	float up[3], north[3], west[3];
+	float a = 0, m = 0, n = 0;
+
+	for (uint8_t i = 0; i < 3; i++)
+		a += (float) acc[i] * acc[i];
+	for (uint8_t i = 0; i < 3; i++) {
+		up[i] = acc[i] / sqrt(a);
+		m += mag[i] * up[i];
+	}
+
+	// the horizontal part of the field
+	for (uint8_t i = 0; i < 3; i++) {
+		north[i] = mag[i] - m * up[i];
+		n += north[i] * north[i];
+	}
+	for (uint8_t i = 0; i < 3; i++)
+		north[i] /= sqrt(n);
+
+	west[0] = up[1] * north[2] - up[2] * north[1];
+	west[1] = up[2] * north[0] - up[0] * north[2];
+	west[2] = up[0] * north[1] - up[1] * north[0];
+
+	// rows of the rotation matrix, to a quaternion
+	float r00 = north[0], r11 = west[1], r22 = up[2];
+	float q[4];
+
+	if (r00 + r11 + r22 > 0) {
+		float s = 2 * sqrt(1 + r00 + r11 + r22);
+		q[0] = s / 4;
+		q[1] = (up[1] - west[2]) / s;
+		q[2] = (north[2] - up[0]) / s;
+		q[3] = (west[0] - north[1]) / s;
+	} else if (r00 > r11 && r00 > r22) {
+		float s = 2 * sqrt(1 + r00 - r11 - r22);
+		q[0] = (up[1] - west[2]) / s;
+		q[1] = s / 4;
+		q[2] = (north[1] + west[0]) / s;
+		q[3] = (north[2] + up[0]) / s;
+	} else if (r11 > r22) {
+		float s = 2 * sqrt(1 + r11 - r00 - r22);
+		q[0] = (north[2] - up[0]) / s;
+		q[1] = (north[1] + west[0]) / s;
+		q[2] = s / 4;
+		q[3] = (west[2] + up[1]) / s;
+	} else {
+		float s = 2 * sqrt(1 + r22 - r00 - r11);
+		q[0] = (west[0] - north[1]) / s;
+		q[1] = (north[2] + up[0]) / s;
+		q[2] = (west[2] + up[1]) / s;
+		q[3] = s / 4;
+	}
+
+	for (uint8_t i = 0; i < 4; i++)
+		f->q[i] = q[i] * ONE_Q30;
+}
+
+void mahonyInit(Mahony *f, uint16_t rate, float gyro_lsb) {
+	float lsb = gyro_lsb * PI / 180;
+
+	memset(f, 0, sizeof(*f));
+	f->q[0] = ONE_Q30;
+
+	f->kp = MAHONY_KP / lsb * 256 / 32768 * 256;
+	f->ki = MAHONY_KI / rate / lsb * 65536 / 32768 * 256;
+	f->gyro_step = min(65535.0, 0.5 / rate * lsb * 65536.0 * 524288.0);
+	f->max_bias = MAX_BIAS / gyro_lsb * 65536;
+	f->mag_patience = min(65535UL, (uint32_t) MAG_PATIENCE_SECONDS * rate);
+	f->mag_settle = min(65535UL, (uint32_t) MAG_SETTLE_SECONDS * rate);
+}
+
+void mahonyUpdate(Mahony *f, const int16_t gyro[3], const int16_t acc[3], const int16_t mag[3]) {
+	int16_t a[3], m[3];
+	uint16_t a_norm, m_norm;
+	bool have_acc = normalize(acc, a, &a_norm);
+	bool have_mag = normalize(mag, m, &m_norm);
+
+	if (!f->ready) {
+		if (!have_acc || !have_mag)
+			return;
+
+		attitude(f, acc, mag);
+		f->ready = true;
+
+		// and the field is taken as it is
+		f->mag_rejected = f->mag_patience;
+	}
+
+	int32_t r[3][3];
+	rotation(f->q, r);
+
+	// up, as the attitude has it. the accel should agree
+	int32_t *v = r[2];
+	int32_t e[3] = { 0, 0, 0 };
+
+	if (have_acc) {
+		e[0] = mul15(a[1], v[2]) - mul15(a[2], v[1]);
+		e[1] = mul15(a[2], v[0]) - mul15(a[0], v[2]);
+		e[2] = mul15(a[0], v[1]) - mul15(a[1], v[0]);
+	}
+
+	if (have_mag) {
+		// the field in earth axes, Q15, and how strong it is across the
+		// horizon
+		int32_t h[3];
+		for (uint8_t i = 0; i < 3; i++)
+			h[i] = mul15(r[i][0], m[0]) + mul15(r[i][1], m[1]) + mul15(r[i][2], m[2]);
+
+		int32_t bx = isqrt((uint32_t) (h[0] * h[0]) + (uint32_t) (h[1] * h[1]));
+
+		// in mag lsb. it should be all north and up, but what counts is that
+		// it's where it's been: a disturbance across the field hardly changes
+		// its strength, but it does swing it round. a heading that's off only
+		// drifts it, and the correction brings that back
+		int16_t field[3];
+		for (uint8_t i = 0; i < 3; i++)
+			field[i] = (h[i] * m_norm) >> 15;
+
+		int16_t was[3], off = 0;
+		for (uint8_t i = 0; i < 3; i++) {
+			was[i] = f->mag_field[i] >> MAG_TRACK_SHIFT;
+			off = max(off, (int16_t) abs(field[i] - was[i]));
+		}
+
+		bool good = off <= (max(abs(was[0]), abs(was[1])) >> MAHONY_MAG_SHIFT);
+
+		if (!good && ++f->mag_rejected >= f->mag_patience) {
+			for (uint8_t i = 0; i < 3; i++)
+				f->mag_field[i] = (int32_t) field[i] << MAG_TRACK_SHIFT;
+			f->mag_settling = f->mag_settle;
+		}
+
+		if (f->mag_settling) {
+			f->mag_settling--;
+			good = true;
+		}
+
+		if (good) {
+			f->mag_rejected = 0;
+			for (uint8_t i = 0; i < 3; i++)
+				f->mag_field[i] += field[i] - was[i];
+
+			// how far the field's swung off north, sin of it, as a turn about
+			// up. over the horizontal strength rather than by it, or the
+			// correction would be weakened by the dip
+			int32_t yaw = bx ? sat16(-(h[1] << 15) / bx) : 0;
+			for (uint8_t i = 0; i < 3; i++)
+				e[i] += mul15(yaw, v[i]);
+		}
+	}
+
+	// corrected rates, gyro lsb in 1/256ths, and half the turn they make
+	// over this update
+	int16_t d[3];
+
+	for (uint8_t i = 0; i < 3; i++) {
+		f->bias[i] = constrain(f->bias[i] + ((e[i] * f->ki) >> 8), -f->max_bias, f->max_bias);
+
+		int32_t rate = ((int32_t) gyro[i] << 8) + (f->bias[i] >> 8) + ((e[i] * f->kp) >> 8);
+		d[i] = sat16(mulFrac(rate, f->gyro_step) >> 8);
+	}
+
+	// q += q * (0, d)
+	int32_t q0 = f->q[0], q1 = f->q[1], q2 = f->q[2], q3 = f->q[3];
+
+	f->q[0] -= mulStep(q1, d[0]) + mulStep(q2, d[1]) + mulStep(q3, d[2]);
+	f->q[1] += mulStep(q0, d[0]) + mulStep(q2, d[2]) - mulStep(q3, d[1]);
+	f->q[2] += mulStep(q0, d[1]) - mulStep(q1, d[2]) + mulStep(q3, d[0]);
+	f->q[3] += mulStep(q0, d[2]) + mulStep(q1, d[1]) - mulStep(q2, d[0]);
+
+	// back to unit length: one newton step of 1/sqrt, which is all it takes
+	// this close to 1
+	uint32_t n2 = 0;
+	for (uint8_t i = 0; i < 4; i++) {
+		int32_t s = f->q[i] >> 15;
+		n2 += s * s;
+	}
+
+	int16_t fix = sat16(((int32_t) (ONE_Q30 - n2)) >> 12);
+	for (uint8_t i = 0; i < 4; i++)
+		f->q[i] += mulStep(f->q[i], fix);
+}
+
+void mahonyAngles(const Mahony *f, Bam *heading, Bam *pitch, Bam *roll) {
+	int32_t r[3][3];
+	rotation(f->q, r);
+
+	// the mpu's x axis is (r00, r10, r20) in north, west and up
+	*heading = bamRaw(atan2Fix(-r[1][0], r[0][0]));
+	*pitch = bamRaw(atan2Fix(r[2][0], isqrt((uint32_t) (r[0][0] * r[0][0]) + (uint32_t) (r[1][0] * r[1][0]))));
+	*roll = bamRaw(atan2Fix(r[2][1], r[2][2]));
+}
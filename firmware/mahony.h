@@ -0,0 +1,61 @@
+#ifndef __mahony_h
+#define __mahony_h
+
+#include "Arduino.h"
+#include "bam.h"
+
+// attitude from raw gyro, accel and mag: Mahony's complementary filter, in
+// fixed point, at a fixed rate.
+//
+// the gyro is integrated into the attitude quaternion every update, and the
+// accel and mag pull it back with a proportional and integral correction
+// (the integral soaks up the gyro's bias). the mag's correction only ever
+// turns the heading, so a disturbed compass can't tilt the horizon, and it's
+// left out altogether while the field, in earth axes, is off from where it's
+// been: the heading carries on on the gyro until the motor's off.
+//
+// axes are the mpu's, x forward, y to port and z up, with the mag already
+// aligned to them and hard-iron corrected. the quaternion is Q2.30, vectors
+// Q15, and the products are 32 by 16 bits, no 64 bit math
+
+// correction gains: rad/s per unit of error, and rad/s per unit of error
+// per second
+#define MAHONY_KP 1.0
+#define MAHONY_KI 0.02
+
+// the mag is left out while the field is off where it's been by more than
+// 1/8th of its horizontal strength (about 7 degrees across it)
+#define MAHONY_MAG_SHIFT 3
+
+struct Mahony {
+	int32_t q[4];         // w, x, y, z; 1.0 = 2^30
+	int32_t bias[3];      // integral correction, gyro lsb in 1/2^16ths
+	int32_t max_bias;
+
+	// per Q15 of error, in 1/256ths: kp in gyro lsb in 1/256ths, ki in gyro
+	// lsb in 1/2^16ths per update
+	int16_t kp, ki;
+
+	// half the turn 1 gyro lsb makes over one update, in 1/2^19 rad, 1/2^16ths
+	uint16_t gyro_step;
+
+	int32_t mag_field[3];   // north, west and up, mag lsb in 1/64ths
+	uint16_t mag_rejected;  // updates in a row the mag's been left out
+	uint16_t mag_patience;  // ...after which the field is taken as it is now
+	uint16_t mag_settling;  // updates left taking it whatever it does
+	uint16_t mag_settle;
+	bool ready;
+};
+
+// rate in Hz, at least 35 at +-250 degrees/s; gyro_lsb in degrees per second
+// per lsb (1/131 at +-250)
+void mahonyInit(Mahony *f, uint16_t rate, float gyro_lsb);
+
+// one update. the first one sets the attitude from accel and mag alone
+void mahonyUpdate(Mahony *f, const int16_t gyro[3], const int16_t acc[3], const int16_t mag[3]);
+
+// heading clockwise from north (of the mpu's x axis), pitch bow up and roll
+// to starboard
+void mahonyAngles(const Mahony *f, Bam *heading, Bam *pitch, Bam *roll);
+
+#endif
@@ -1,39 +1,100 @@
 // seconds
 #define MENU_TIMEOUT 10
 
+rc_decoder rc;
+RouteUpload upload;
+
+// feeds a byte to the rc decoder, acting on completed commands. false if it wasn't part of one
+boolean rcInput(uint8_t c) {
+    rc_command cmd;
+    uint8_t r = rcFeed(&rc, c, millis(), &cmd);
+
+    if (r == RC_COMMAND) {
+        rudderFromCenter(cmd.rudder);
+        normalizedWinchTo(cmd.winch);
+    }
+
+    return r != RC_NONE;
+}
+
+void uploadInit(int16_t routeAddress) {
+    routeUploadInit(&upload, routeAddress);
+}
+
+// what came of a route upload frame, for the sender
+void uploadReply(uint8_t r) {
+    switch (r) {
+        case ROUTE_BEGUN:
+        case ROUTE_INCOMPLETE:
+            Serial.print(F("route missing "));
+            Serial.println(routeMissing(&upload), HEX);
+            break;
+
+        case ROUTE_WRITTEN:
+            Serial.print(F("route written "));
+            Serial.println(upload.index);
+            break;
+
+        case ROUTE_COMMITTED:
+            newRoute();
+            Serial.print(F("route live "));
+            Serial.println(route.count);
+            break;
+
+        case ROUTE_BUSY:
+            Serial.println(F("route busy"));
+            break;
+
+        case ROUTE_REFUSED:
+            Serial.println(F("route refused"));
+            break;
+    }
+}
+
+// feeds a byte to the route upload decoder. false if it wasn't part of a frame
+boolean uploadInput(uint8_t c) {
+    uint8_t r = routeFeed(&upload, c, millis());
+    uploadReply(r);
+
+    return r != ROUTE_NONE;
+}
+
+// from loop(): an upload's eeprom writes, one at a time as the eeprom's ready
+void uploadTick() {
+    uploadReply(routeTick(&upload));
+}
+
 void processRCCommands() {
-    if (!Serial.available())
-        return;
-    
-    char c = 0;
-    
-    // read out the buffer until we get a command start
-    while (Serial.available() && c != '[')
-        c = (char)Serial.read();
-    
-    // command format : "[RRR;WW]" where RR is a signed two digit rudder position and WW is a two-digit winch position
-    
-    if (c != '[')
-        return;
-    
-    int rudder = Serial.parseInt();
-    int winch = Serial.parseInt();
-    
-    rudderFromCenter(rudder);
-    normalizedWinchTo(winch);
+    // anything between commands and uploads is dropped
+    while (Serial.available()) {
+        uint8_t c = Serial.read();
+
+        if (upload.framing || !rcInput(c))
+            uploadInput(c);
+    }
 }
 
 void checkInput() {
-    // in case we're going too fast. only needed when serial_logging is on
-    if (serial_logging && (cycle % WAIT_FOR_COMMAND_EVERY == 0))
-        delay(WAIT_FOR_COMMAND_FOR);
+    // in case we're going too fast: the serial log's held off now and then, so
+    // there's a gap to send a command in. only needed when serial_logging is
+    // on, and not under remote control
+    static uint16_t checks = 0;
+
+    if (serial_logging && !remote_control && !logQuieted() && (++checks % WAIT_FOR_COMMAND_EVERY == 0))
+        logQuiet(WAIT_FOR_COMMAND_FOR);
 
     while (Serial.available()) {
-        // a '[' signals the start of an RC command
-        if (remote_control && (char)Serial.peek() == '[')
-            return;
+        uint8_t c = Serial.read();
 
-        switch ((char)Serial.read()) {
+        // rc commands and route uploads can arrive split over several loops;
+        // the decoders keep the pieces
+        if (remote_control && !upload.framing && rcInput(c))
+            continue;
+
+        if (uploadInput(c))
+            continue;
+
+        switch ((char)c) {
             case 'o':
             logln(F("Entering manual override"));
             manual_override = true;
@@ -44,6 +105,10 @@ void checkInput() {
             serial_logging = !serial_logging;
             break;
 
+            case 'b':
+            binary_telemetry = !binary_telemetry;
+            break;
+
             case 'm':
             doMenu();
             break;
@@ -55,7 +120,7 @@ void processManualCommands() {
     while (Serial.available()) {
         switch ((char)Serial.read()) {
             case 'i':
-                updateSensors(false);
+                requestSensors();
                 break;
             case 'a':
                 toPort(10);
@@ -70,11 +135,11 @@ void processManualCommands() {
                 logln(F("Center rudder"));
                 break;
             case 'q':
-                winchTo(current_winch + 5);
+                winchTo(target_winch + 5);
                 logln(F("Sheet out"));
                 break;
             case 'e':
-                winchTo(current_winch - 5);
+                winchTo(target_winch - 5);
                 logln(F("Sheet in"));
                 break;
             case 'w':
@@ -137,6 +202,89 @@ void getPIDTunings() {
     serial_logging = current_sl;
 }
 
+void getTelemetryFields() {
+    Serial.print(F("Telemetry fields are 0x"));
+    Serial.println(telemetry_fields, HEX);
+
+    Serial.print(F("New field mask: "));
+    if (!waitForData(5000))
+        return;
+
+    telemetry_fields = Serial.parseInt();
+    Serial.println(telemetry_fields, HEX);
+}
+
+void showRoute() {
+    Serial.print(F("Route of "));
+    Serial.print(route.count);
+    Serial.print(F(" waypoints, "));
+    if (route.mode == ROUTE_LOOP)
+        Serial.println(F("looped"));
+    else if (route.mode == ROUTE_PINGPONG)
+        Serial.println(F("back and forth"));
+    else
+        Serial.println(F("once"));
+
+    for (uint8_t i = 0; i < route.count; i++) {
+        const RouteLeg *l = &route.legs[i];
+
+        Serial.print(i == route.target ? '*' : ' ');
+        Serial.print(i); Serial.print(F(": "));
+        Serial.print(l->to.lat / 1e6, 6); Serial.print(F(", "));
+        Serial.print(l->to.lon / 1e6, 6); Serial.print(F(" within "));
+        Serial.print(arrivalRadius(i)); Serial.print(F("m, leg "));
+        Serial.print(bamToDeg(l->course), 0); Serial.print(F(" for "));
+        Serial.print(l->length / 100); Serial.println('m');
+    }
+
+    Serial.print(F("Sail to waypoint: "));
+    if (!waitForData(5000))
+        return;
+
+    routeStart(&route, Serial.parseInt());
+    waypointSelected();
+    Serial.println(route.target);
+}
+
+// what's been learned of the polar, as csv: the angle and the band's
+// strength (cm/s), the sheet band (0 hauled in), and the cell
+void exportPolar() {
+    Serial.println(F("angle,strength,sheet,samples,speed,dev"));
+
+    for (uint8_t i = 0; i < POLAR_BINS; i++)
+        for (uint8_t b = 0; b < LEARN_STRENGTHS; b++)
+            for (uint8_t s = 0; s < LEARN_SHEETS; s++) {
+                const LearnCell *c = learnCell(&learn, i, b, s);
+                if (!c->samples)
+                    continue;
+
+                Serial.print(i * POLAR_STEP); Serial.print(',');
+                Serial.print(learn.strength[b]); Serial.print(',');
+                Serial.print(s); Serial.print(',');
+                Serial.print(c->samples); Serial.print(',');
+                Serial.print(c->speed / 10.0, 1); Serial.print(',');
+                Serial.println(c->dev);
+            }
+}
+
+// where the battery's gone, as csv: the load (power.h's PowerLoad), the
+// seconds it's been on and its charge; then the mean draw and the plan
+void showPower() {
+    Serial.println(F("load,seconds,mAh"));
+
+    for (uint8_t i = 0; i < POWER_LOADS; i++) {
+        Serial.print(i); Serial.print(',');
+        Serial.print(power.ms[i] / 1000); Serial.print(',');
+        Serial.println(powerUsed(&power, i), 2);
+    }
+
+    Serial.print(F("mean mA: ")); Serial.println(powerMean(&power));
+    Serial.print(F("gps every ")); Serial.print(power.gps);
+    Serial.print(F("ms, wind ")); Serial.print(power.wind);
+    Serial.print(F("ms, pilot ")); Serial.print(power.pilot);
+    Serial.print(F("ms, sea ")); Serial.println(power.sea);
+}
+
 void doMenu() {
     Serial.print(F("Welcome to ArduSailor. Menu timeout is "));
     Serial.println(MENU_TIMEOUT);
@@ -152,11 +300,15 @@ void doMenu() {
     Serial.println(F("(o) Auto-calibrate compass."));
     Serial.println(F("(c) Calibrate compass."));
     Serial.println(F("(r) Remote control."));
-    Serial.println(F("(w) Change waypoints <NOT IMPLEMENTED>."));
+    Serial.println(F("(w) Show the route, pick a waypoint."));
     Serial.println(F("(t) Tune PID."));
     Serial.println(F("(y) Auto-tune PID."));
     Serial.println(F("(u) Stop PID auto-tune."));
     Serial.println(F("(m) Set mag offset."));
+    Serial.println(F("(f) Set telemetry fields."));
+    Serial.println(F("(p) Show and clear the profile."));
+    Serial.println(F("(e) Export the learned polar."));
+    Serial.println(F("(b) Show where the power's gone."));
     Serial.print(F("\n>"));
 
     long t = millis();
@@ -176,10 +328,15 @@ void doMenu() {
             break;
 
             case 'o':
+#ifdef NO_SAIL
             runMotor();
+#endif
             rudderFromCenter(30);
+            waitForServos();
             calibrateMag(false);
+#ifdef NO_SAIL
             stopMotor();
+#endif
             centerRudder();
             break;
 
@@ -189,7 +346,7 @@ void doMenu() {
             break;
 
             case 'w':
-            // todo
+            showRoute();
             break;
 
             case 't':
@@ -207,6 +364,22 @@ void doMenu() {
             case 'm':
             getMagOffset();
             break;
+
+            case 'f':
+            getTelemetryFields();
+            break;
+
+            case 'p':
+            profDump(Serial);
+            break;
+
+            case 'e':
+            exportPolar();
+            break;
+
+            case 'b':
+            showPower();
+            break;
         }
 
         Serial.print(' ');
@@ -0,0 +1,84 @@
+#include "nav.h"
+#include "trig_fix.h"
+
+// centimeters per 1/16th micro-degree of latitude (0.69497) in 1/2^16, for a
+// 6371km earth
+#define CM_PER_STEP 45545
+
+// u * s / 2^16, without a 64 bit product
+static uint32_t mulFrac(uint32_t u, uint16_t s) {
+	return (u >> 16) * s + (((u & 0xffff) * s) >> 16);
+}
+
+static int32_t mulFracSigned(int32_t v, uint16_t s) {
+	return v < 0 ? -(int32_t) mulFrac(-v, s) : mulFrac(v, s);
+}
+
+static uint16_t isqrt(uint32_t v) {
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+
+	while (bit > v)
+		bit >>= 2;
+
+	while (bit) {
+		if (v >= root + bit) {
+			v -= root + bit;
+			root = (root >> 1) + bit;
+		} else
+			root >>= 1;
+		bit >>= 2;
+	}
+
+	return root;
+}
+
+void navInit(NavFrame *f, int32_t lat, int32_t lon) {
+	f->lat = lat;
+	f->lon = lon;
+
+	// once per waypoint, so float is fine here
+	f->lon_scale = min(65535L, lround(cos(lat * (PI / 180e6)) * 65536));
+}
+
+void navLeg(const NavFrame *f, int32_t lat, int32_t lon, Bam *bearing, uint32_t *range) {
+	// north and east to the waypoint, in 1/16ths of a micro-degree of
+	// latitude so the longitude scaling keeps its fraction. good to 134
+	// degrees either way
+	int32_t y = (f->lat - lat) * 16;
+	int32_t x = mulFracSigned((f->lon - lon) * 16, f->lon_scale);
+
+	if (x == 0 && y == 0) {
+		*range = 0;
+		return;
+	}
+
+	// bring the larger of the two to 14-15 bits: small enough for _atan2_fix
+	// and for the sum of squares, big enough to keep the angle fine near the
+	// mark
+	int8_t shift = 0;
+	while (abs(x) > 32767 || abs(y) > 32767) {
+		x >>= 1;
+		y >>= 1;
+		shift++;
+	}
+	while (abs(x) < 16384 && abs(y) < 16384) {
+		x <<= 1;
+		y <<= 1;
+		shift--;
+	}
+
+	// with north as _atan2_fix's x axis and east as its y, the angle comes
+	// out clockwise from north
+	*bearing = bamRaw(_atan2_fix(x, y));
+
+	uint32_t r = isqrt((uint32_t) (x * x) + (uint32_t) (y * y));
+	r = shift >= 0 ? r << shift : (r + (1UL << (-shift - 1))) >> -shift;
+
+	*range = mulFrac(r, CM_PER_STEP);
+}
+
+void navOffset(const NavFrame *f, int32_t lat, int32_t lon, int32_t *north, int32_t *east) {
+	*north = mulFracSigned((lat - f->lat) * 16, CM_PER_STEP);
+	*east = mulFracSigned(mulFracSigned((lon - f->lon) * 16, f->lon_scale), CM_PER_STEP);
+}
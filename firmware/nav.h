@@ -0,0 +1,34 @@
+#ifndef __nav_h
+#define __nav_h
+
+#include "Arduino.h"
+#include "bam.h"
+
+// bearing and range to a waypoint in integer math, from positions in
+// micro-degrees (degrees * 1e6, about 11cm of latitude).
+//
+// a local flat (equirectangular) projection anchored at the waypoint: a
+// longitude difference is scaled by the cosine of the waypoint's latitude,
+// worked out once when the waypoint changes, and after that it's a multiply,
+// _atan2_fix and an integer square root. within a few km of the waypoint
+// that's as good as the haversine, and the float haversine couldn't tell
+// sub-metre positions apart anyway
+
+// degrees to micro-degrees
+#define NAV_UDEG(deg) ((int32_t) lround((deg) * 1e6))
+
+struct NavFrame {
+	int32_t lat, lon;     // the waypoint
+	uint16_t lon_scale;   // cos(lat) in 1/2^16
+};
+
+void navInit(NavFrame *f, int32_t lat, int32_t lon);
+
+// from lat,lon to the waypoint: bearing clockwise from north, range in cm.
+// on the waypoint itself the bearing is left as it was
+void navLeg(const NavFrame *f, int32_t lat, int32_t lon, Bam *bearing, uint32_t *range);
+
+// where lat,lon is from the waypoint, cm north and east
+void navOffset(const NavFrame *f, int32_t lat, int32_t lon, int32_t *north, int32_t *east);
+
+#endif
@@ -1,25 +1,34 @@
+#ifndef WITH_SAIL
 #define NO_SAIL
+#endif
 
 #include <PID_v1.h>
 #include <PID_AutoTune_v0.h>
-#include <EEPROM.h>
-
-// radius of Earth in m
-#define R 6371000
+#include "config.h"
+#include "guide.h"
+#include "nav.h"
+#include "route.h"
+#include "tactics.h"
+#include "trim.h"
 
 // minimum speed needed to establish course (knots)
 #define MIN_SPEED 1.0
 #define MIN_TACK_SPEED 1.0
 
-// how close you have to get to the waypoint to consider it hit
+// how close you have to get to the waypoint to consider it hit, m, where
+// the route doesn't say
 #define GET_WITHIN 5
 
+// how far ahead on the leg to aim, m: the line's closed on at atan(xte /
+// LOOKAHEAD). 0 steers straight for the waypoint
+#define LOOKAHEAD 15
+
 // adjust sails when we're more than this much off-plan
 #define SAIL_ADJUST_ON 10
 
 // either side of 0 for "in irons"
 #define IRONS 40
-#define IN_IRONS(v) (((v) < IRONS || (v) > (360 - IRONS)))
+#define IN_IRONS(v) (((v) < irons || (v) > (360 - irons)))
 
 // either side of 180 for "running"
 #define ON_RUN 20
@@ -39,8 +48,28 @@
 
 #define SERVO_ORIENTATION -1
 
-// how often to change tacks when beating up-wind
-#define TACK_EVERY 30000
+// how often to change tacks when beating up-wind, ms, the old way: on a
+// timer, close hauled at irons. 0 leaves it to the tactics (tactics.h)
+#define TACK_EVERY 0
+
+// seconds a tack or gybe is reckoned to lose
+#define TACK_COST 10
+
+// the boat's top speed, knots
+#define HULL_SPEED 3.0
+
+// learn the polar as we go, and trim and plan off it (learn.h). false
+// keeps to the default polar, trimmed by the wind angle alone
+#define LEARNING true
+
+// trim the sheet by what makes the boat go fastest (trim.h). false sets it
+// by the wind angle, easing it a little when heeled
+#define TRIMMING true
+
+// how often what's been learned is taken into the polar, and checkpointed
+// to eeprom, ms
+#define LEARN_POLAR_EVERY 30000
+#define LEARN_SAVE_EVERY 300000
 
 // if we're at more than this heel, start easing the mainsheet
 #define START_HEEL_COMP 30
@@ -49,8 +78,11 @@
 // if heel compensation drops below this amount, zero it out
 #define MIN_HEEL_COMP 5
 
-// we're going decrease the amount of heel adjust by this factor to bring things back slowly
-#define HEEL_COMP_DECAY 0.1
+// we're going decrease the amount of heel adjust by this factor every
+// HEEL_COMP_DECAY_TIME ms, however often the trim's checked, to bring things
+// back slowly: from the most to MIN_HEEL_COMP takes about 17s
+#define HEEL_COMP_DECAY 0.9
+#define HEEL_COMP_DECAY_TIME 1000
 
 // how close we can get to our waypoint before we switch to High Res GPS
 #define HRG_THRESHOLD 50
@@ -60,41 +92,72 @@
 
 #define EEPROM_START_ADDR 0
 
-// # of waypoints below
-#define WP_COUNT 4
-
-// lat,lon pairs
-float wp_list[] =
+// the route sailed when there's none in eeprom: lat,lon in micro-degrees,
+// back and forth
+RouteWaypoint default_route[] =
   {
-	41.920708, -87.630361,
-	41.921237, -87.630292,
-	41.921202, -87.630787,
-	41.920902, -87.630388
-	//
-	// 41.923584, -87.631463,
-	// 41.923004, -87.631139,
-	//     41.9207923576838 ,-87.63011004661024,
-	//     41.92040355439754,-87.63045132003815,
-	//     41.92024341159895,-87.63004258543924,
-	//     41.91948366250413,-87.62996748502381,
-	//     41.91848868180579,-87.62960748575088,
-	//     41.91771524159618,-87.62928507512221,
-	//     41.91665396400703,-87.62889035219517 // end of circuit
+    { 41920708, -87630361, GET_WITHIN },
+    { 41921237, -87630292, GET_WITHIN },
+    { 41921202, -87630787, GET_WITHIN },
+    { 41920902, -87630388, GET_WITHIN }
+    //
+    // 41.923584, -87.631463,
+    // 41.923004, -87.631139,
+    //     41.9207923576838 ,-87.63011004661024,
+    //     41.92040355439754,-87.63045132003815,
+    //     41.92024341159895,-87.63004258543924,
+    //     41.91948366250413,-87.62996748502381,
+    //     41.91848868180579,-87.62960748575088,
+    //     41.91771524159618,-87.62928507512221,
+    //     41.91665396400703,-87.62889035219517 // end of circuit
   };
-int8_t direction = 1;
+uint8_t default_route_count = sizeof(default_route) / sizeof(default_route[0]);
+
+// fraction of the true wind's speed, 1/256, every POLAR_STEP degrees off it.
+// what the simulated boat makes with the sheet set by the wind angle (windSheet)
+uint8_t default_polar[POLAR_BINS] = { 0, 0, 8, 59, 79, 92, 97, 97, 102, 102, 97, 92, 84 };
+
+int16_t _routeAddress = 0;
+int16_t _learnAddress = 0;
+
+// tunables, initialized from the constants above. variables so simulation runs can sweep them
+int16_t irons = IRONS;
+uint32_t tack_every = TACK_EVERY;
+uint16_t lookahead = LOOKAHEAD;
+uint16_t tack_cost = TACK_COST;
+boolean learning = LEARNING;
+boolean trimming = TRIMMING;
 
-// current lat,lon
-float wp_lat, wp_lon;
-int target_wp = 0;
+Polar polar;
+Tactics tactics;
+Trim trim;
 
-uint32_t last_turn = 0;
+// the winch position the default polar's made at, each angle
+uint8_t polar_sheet[POLAR_BINS];
 
-float ahrs_offset = 0;
-uint8_t offset_set = 0;
+// last_gps_time of the last fix learned from, and millis() of the last
+// polar update and checkpoint
+uint32_t learn_fix_time = 0;
+uint32_t learn_updated = 0;
+uint32_t learn_saved = 0;
 
-// not real fusion for now
+// the compass filter's heading
 double fused_heading = 0;
 
+// the steering pid's input and setpoint: the heading unwrapped, turns and
+// all, and the requested heading the short way from it. in [0, 360) a
+// request across north would have it turn the long way round
+double steer_heading = 0;
+double steer_to = 0;
+
+// following the leg into the target waypoint. it's taken up at the first fix
+// after the waypoint's selected
+Guide guide;
+boolean leg_taken = false;
+
+// last_gps_time of the last fix the compass learned from
+uint32_t course_fix_time = 0;
+
 int16_t turning_by = 0;
 boolean turning = false;
 boolean tacking = false;
@@ -102,68 +165,204 @@ boolean stalled = true;
 
 double new_rudder = 0;
 
-int16_t _pilotSettingsAddress = 0;
+// from center, as last sent to the rudder
+int16_t steered_rudder = 0;
+
 double aTuneStep=5, aTuneNoise=1, aTuneStartValue=100;
 unsigned int aTuneLookBack=20;
 
 // Specify the links and initial tuning parameters
-PID steeringPID(&fused_heading, &new_rudder, &requested_heading, 0.1, 0.001, 2.8, P_ON_E, DIRECT);
-PID_ATune pidTune(&fused_heading, &new_rudder);
+PID steeringPID(&steer_heading, &new_rudder, &steer_to, 0.1, 0.001, 2.8, P_ON_E, DIRECT);
+PID_ATune pidTune(&steer_heading, &new_rudder);
+
+// knots * 100 to cm/s
+inline uint16_t speedCm() {
+    return ((uint32_t) gps_speed * 33715) >> 16;
+}
 
 inline void toPort(int amt) {
-    rudderTo(current_rudder + (SERVO_ORIENTATION * amt));
+    rudderTo(target_rudder + (SERVO_ORIENTATION * amt));
 }
 
 inline void toSbord(int amt) {
-    rudderTo(current_rudder - (SERVO_ORIENTATION * amt));
+    rudderTo(target_rudder - (SERVO_ORIENTATION * amt));
 }
 
 inline void fuseHeading() {
-    // no fusion for now. todo: add gps-based mag calibration compensation
-    fused_heading = ahrs_heading;
+    // each new fix at speed teaches the compass its deviation
+    if (last_gps_time != course_fix_time && gps_speed > KNOTS(MIN_SPEED)) {
+        course_fix_time = last_gps_time;
+
+        if (compassCourse(&compass, gps_course, gps_speed / 100.0, current_roll))
+            logln(F("Deviation %d + %d sin + %d cos, leeway %d/10 per degree of heel, from %d fixes"),
+                    (int16_t) compass.dev[0], (int16_t) compass.dev[1], (int16_t) compass.dev[2],
+                    (int16_t) (compass.dev[3] * 10), compass.fixes);
+    }
+
+    Bam heading = compassHeading(&compass, micros());
+
+    steer_heading += bamDiffDeg(bamDeg(fused_heading), heading);
+    fused_heading = bamToDeg(heading);
+}
+
+// the true wind off the bow, clockwise
+float trueWindAngle() {
+    return bamDiffDeg(bamDeg(fused_heading), bamDeg(tactics.wind));
+}
+
+// the default polar, scaled by what's been learned in this wind. trimmed,
+// the sheet's wherever the trim's found best, not the band the table's
+// gone fastest at, and the bands either side are only seen in passing:
+// it's scaled by the speed at the trimmed sheet instead
+void updatePolar() {
+    uint8_t speed[POLAR_BINS];
+    uint8_t sailed[POLAR_BINS];
+
+    memcpy(speed, default_polar, POLAR_BINS);
+    for (uint8_t i = 0; i < POLAR_BINS; i++)
+        sailed[i] = constrain(polar_sheet[i] + trim.offset[i], WINCH_MAX, WINCH_MIN);
+
+    if (learnPolar(&learn, tactics.strength, polar_sheet, trimming ? sailed : NULL, speed)) {
+        polarInit(&polar, speed, HULL_SPEED * 51.44);
+        tacticsPolar(&tactics, &polar);
+    }
+}
+
+// from loop(): every so often, what's been learned is taken into the polar
+// and checkpointed. the checkpoint's written a byte at a time
+void checkpointPolar() {
+    if (!learning)
+        return;
+
+    if (millis() - learn_updated >= LEARN_POLAR_EVERY) {
+        learn_updated = millis();
+        updatePolar();
+    }
+
+    if (millis() - learn_saved >= LEARN_SAVE_EVERY) {
+        learn_saved = millis();
+        learnSave(&learn);
+    }
+
+    learnTick(&learn);
+}
+
+// the live route from eeprom, else the one built in
+void loadRoute() {
+    if (routeLoad(&route, _routeAddress))
+        logln(F("Read a route of %d waypoints, mode %d"), route.count, route.mode);
+    else
+        routeSet(&route, default_route, default_route_count, ROUTE_PINGPONG);
 }
 
-// lat/lon and result in radians
-float computeBearing(float i_lat, float i_lon, float f_lat, float f_lon) {
-    float y = sin(f_lon-i_lon) * cos(f_lat);
-    float x = cos(i_lat)*sin(f_lat) - sin(i_lat)*cos(f_lat)*cos(f_lon-i_lon);
-    return atan2(y, x);
+// wp_heading, wp_distance and the cross-track error from where we are now
+void updateWaypointLeg() {
+    const NavFrame *to = &route.legs[route.target].to;
+    Bam bearing = bamDeg(wp_heading);
+    uint32_t range;
+
+    navLeg(to, gps_lat, gps_lon, &bearing, &range);
+
+    wp_heading = bamToDeg(bearing);
+    wp_distance = range / 100.0;
+
+    if (gps_lat == 0 && gps_lon == 0)
+        return;
+
+    int32_t north, east;
+    navOffset(to, gps_lat, gps_lon, &north, &east);
+
+    if (!leg_taken) {
+        Bam course;
+        uint32_t length;
+        routeLeg(&route, &course, &length);
+
+        guideLeg(&guide, course, bearing, north, east);
+        leg_taken = true;
+    }
+
+    guideFix(&guide, north, east, gps_course, speedCm(), last_gps_time);
 }
 
-// lat/lon in radians. returns distance in meters
-float computeDistance(float i_lat, float i_lon, float f_lat, float f_lon) {
-    float a = sin((f_lat - i_lat)/2) * sin((f_lat - i_lat)/2) +
-                        cos(i_lat) * cos(f_lat) *
-                        sin((f_lon - i_lon)/2) * sin((f_lon - i_lon)/2);
-    float c = 2 * atan2(sqrt(a), sqrt(1-a));
+// along the leg, or straight for the waypoint once it's behind us (and
+// always, without a lookahead)
+Bam legCourse() {
+    if (lookahead && leg_taken && guide.to_go > 0)
+        return guideCourse(&guide, lookahead);
+
+    return bamDeg(wp_heading);
+}
 
-    return R * c;
+// abeam of the waypoint, close enough that it's not been missed by much
+boolean passedWaypoint() {
+    return lookahead && leg_taken && guide.to_go < 0 && wp_distance < lookahead;
 }
 
+// eased in proportion to how far the apparent wind is off the bow
+uint8_t windSheet(Bam apparent) {
+    // how far the wind is from dead astern, in binary angle units
+    long off_run = bamDist(apparent, bamRaw(BAM_DEG(180)));
+    return map(constrain(off_run, BAM_DEG(irons), BAM_DEG(180)), BAM_DEG(irons), BAM_DEG(180), WINCH_MIN, WINCH_MAX);
+}
+
+// when the heel compensation was last worked out
+uint32_t heel_adjust_time = 0;
+
 void adjustSails() {
 #ifdef NO_SAIL
     return;
 #endif
 
     logln(F("Checking sail trim"));
+    if (trimming) {
+        uint8_t sheet = windSheet(wind_angle);
+
+        // with the gps only on now and then there's no speed to go by, so
+        // the trim's held where it's got to, and only followed as far off
+        // as the map would be, or to ease for the heel
+        uint16_t speed = high_res_gps ? speedCm() : 0;
+        uint8_t to = trimSheet(&trim, sheet, trueWindAngle(), current_roll, speed, last_gps_time, current_winch, millis());
+        boolean move = high_res_gps || abs(to - target_winch) > SAIL_ADJUST_ON || target_winch < ceil(trim.limit);
+
+        // eased off the wind angle's sheet, as the heel compensation is
+        heel_adjust = (int16_t) to - sheet;
+
+        if (to != target_winch && move) {
+            logln(F("Trimming to %d (%d out from the wind angle's, %d pairs)."), to, (int16_t) heel_adjust, trim.pairs);
+            adjustment_made = true;
+            winchTo(to);
+        }
+        return;
+    }
+
+    uint32_t elapsed = millis() - heel_adjust_time;
+    heel_adjust_time += elapsed;
+
     if (abs(current_roll) > START_HEEL_COMP)
         heel_adjust = min(MAX_HEEL_COMP, 2 * (abs(current_roll) - START_HEEL_COMP));
     else if (heel_adjust > MIN_HEEL_COMP)
-        heel_adjust = heel_adjust * HEEL_COMP_DECAY;
+        heel_adjust = heel_adjust * pow(HEEL_COMP_DECAY, (float) elapsed / HEEL_COMP_DECAY_TIME);
     else
         heel_adjust = 0;
 
-    float new_winch = map(constrain(abs(wind - 180), IRONS, 180), IRONS, 180, WINCH_MIN, WINCH_MAX) - heel_adjust;
+    float new_winch = windSheet(wind_angle);
+
+    // what's gone fastest at this angle, once there's anything to go on
+    if (learning)
+        new_winch = learnSheet(&learn, trueWindAngle(), tactics.strength, new_winch);
+
+    // eased, towards WINCH_MIN
+    new_winch = min(new_winch + heel_adjust, WINCH_MIN);
 
-    if (abs(new_winch - current_winch) > SAIL_ADJUST_ON) {
-        logln(F("New winch position of %d is more than %d off from %d. Adjusting trim."), (int16_t) new_winch, SAIL_ADJUST_ON, current_winch);
+    if (abs(new_winch - target_winch) > SAIL_ADJUST_ON) {
+        logln(F("New winch position of %d is more than %d off from %d. Adjusting trim."), (int16_t) new_winch, SAIL_ADJUST_ON, target_winch);
         adjustment_made = true;
         winchTo(new_winch);
     } else
         logln(F("No trim adjustment needed"));
 }
 
-long time_since_tack_change = 0;
+uint32_t time_since_tack_change = 0;
 bool beat_to_port = false;
 bool was_beating = false;
 
@@ -176,90 +375,136 @@ void autotune() {
     }
 }
 
+// beating close hauled at irons, tacking every tack_every ms
+void beatOnTimer() {
+    Bam world_wind = bamDeg(fused_heading) + wind_angle;
+    Bam target = legCourse();
+    Bam close_hauled = bamRaw(BAM_DEG(irons));
+
+    // starbord tack: world wind + irons
+    // port tack: world wind - irons
+
+    // cyclomatic complexity is a tad high, but more readable this way
+    if (bamDist(world_wind, target) < close_hauled.v) {
+        if (was_beating) {
+            if (millis() - time_since_tack_change > tack_every) {
+                beat_to_port = !beat_to_port;
+                time_since_tack_change = millis();
+            }
+        } else {
+            was_beating = true;
+
+            // pick the closer direction when we start beating
+            // if sbord tack is farther, go to port
+            beat_to_port = bamDist(world_wind + close_hauled, target) > bamDist(world_wind - close_hauled, target);
+            time_since_tack_change = millis();
+        }
+
+        requested_heading = bamToDeg(beat_to_port ? world_wind - close_hauled : world_wind + close_hauled);
+    } else {
+        was_beating = false;
+
+        requested_heading = bamToDeg(target);
+    }
+
+    logln(F("World wind: %d.%d. Was beating: %d. Beat to port: %d, Time since change: %d. Requested heading %d.%d"),
+        FP(bamToDeg(world_wind)),
+        was_beating,
+        beat_to_port,
+        millis() - time_since_tack_change,
+        FP(requested_heading));
+}
+
 void adjustHeading() {
+    PROFILE_SCOPE(PROF_ADJUST);
+
 #ifndef NO_SAIL
-	float world_wind = toCircleDeg(fused_heading + wind);
-
-	// starbord tack: world wind + irons
-	// port tack: world wind - irons
-
-	// cyclomatic complexity is a tad high, but more readable this way
-	if (angleDiff(world_wind, wp_heading, false) < IRONS) {
-		if (was_beating) {
-			if (time_since_tack_change + TACK_EVERY < millis()) {
-				beat_to_port = !beat_to_port;
-				time_since_tack_change = millis();
-			}
-		} else {
-			was_beating = true;
-
-			// pick the closer direction when we start beating
-			// if sbord tack is farther, go to port
-			beat_to_port = angleDiff(world_wind + IRONS, wp_heading, false) > angleDiff(world_wind - IRONS, wp_heading, false);
-			time_since_tack_change = millis();
-		}
-
-		requested_heading = toCircleDeg(world_wind + (beat_to_port ? -IRONS : IRONS));
-	} else {
-		was_beating = false;
-
-		requested_heading = wp_heading;
-	}
-
-	logln(F("World wind: %d.%d. Was beating: %d. Beat to port: %d, Time since change: %d. Requested heading %d.%d"),
-		FP(world_wind),
-		was_beating,
-		beat_to_port,
-		millis() - time_since_tack_change,
-		FP(requested_heading));
+    tacticsWind(&tactics, &polar, bamDeg(fused_heading), wind_angle, speedCm(), millis());
+
+    // each new fix says how fast the boat goes like this, once it's steady
+    if (learning && last_gps_time != learn_fix_time) {
+        learn_fix_time = last_gps_time;
+        learnAdd(&learn, trueWindAngle(), tactics.strength, current_winch, speedCm(), millis());
+    }
+
+    if (tack_every)
+        beatOnTimer();
+    else {
+        uint16_t turns = tactics.turns;
+
+        requested_heading = bamToDeg(tacticsCourse(&tactics, bamDeg(fused_heading), bamDeg(wp_heading), wp_distance, legCourse(),
+            leg_taken && lookahead ? &guide : NULL, speedCm(), tack_cost, millis()));
+
+        if (tactics.turns != turns)
+            logln(F("Turning: %d (1 layline, 2 shift, 3 corridor). True wind %d, mean %d, %d.%dkts"),
+                tactics.reason,
+                (int16_t) tactics.wind,
+                (int16_t) tactics.mean_wind,
+                FP(tactics.strength / 51.44));
+
+        logln(F("True wind: %d. Leg: %d (0 reach, 1 beat, 2 run). Side: %d. Requested heading %d.%d"),
+            (int16_t) tactics.wind,
+            tactics.leg,
+            tactics.side,
+            FP(requested_heading));
+    }
 
 #else
-    requested_heading = wp_heading;
+    requested_heading = bamToDeg(legCourse());
 
     logln(F("Requested heading %d.%d, Actual heading %d.%d"),
-    	  FP(requested_heading),
-    	  FP(fused_heading));
+          FP(requested_heading),
+          FP(fused_heading));
 #endif
 
     if (tuningPID)
         autotune();
-	else
-	    steeringPID.Compute();
+    else {
+        PROFILE_SCOPE(PROF_PID);
+        steer_to = steer_heading + bamDiffDeg(bamDeg(fused_heading), bamDeg(requested_heading));
+        steeringPID.Compute();
+    }
 
-	rudderFromCenter(round(new_rudder));
+    // moves too small to matter aren't worth powering the servo up for
+    int16_t rudder = round(new_rudder);
+
+    if (abs(rudder - steered_rudder) >= power.rudder) {
+        rudderFromCenter(rudder);
+        steered_rudder = rudder;
+    }
 }
 
-void pilotInit(int16_t pilotSettingsAddress) {
-    _pilotSettingsAddress = pilotSettingsAddress;
+void pilotInit(int16_t routeAddress, int16_t learnAddress) {
+    _routeAddress = routeAddress;
+    _learnAddress = learnAddress;
 
     centerRudder();
     centerWinch();
 
-    wp_lat = wp_list[0];
-    wp_lon = wp_list[1];
+    loadRoute();
+
+    polarInit(&polar, default_polar, HULL_SPEED * 51.44);
+    tacticsInit(&tactics, &polar);
+    trimInit(&trim);
 
-	steeringPID.SetMode(AUTOMATIC);
-	steeringPID.SetOutputLimits(-45, 45);
+    for (uint8_t i = 0; i < POLAR_BINS; i++)
+        polar_sheet[i] = windSheet(bamDeg(polar.apparent[i]));
+
+    learnInit(&learn, _learnAddress);
+    if (learnLoad(&learn))
+        logln(F("Read the learned polar"));
+
+    steeringPID.SetMode(AUTOMATIC);
+    steeringPID.SetOutputLimits(-45, 45);
     
     pidTune.SetNoiseBand(aTuneNoise);
     pidTune.SetOutputStep(aTuneStep);
     pidTune.SetLookbackSec((int)aTuneLookBack);
 
-	 // check if PID values are stored
-    if ((char)EEPROM.read(_pilotSettingsAddress) == 'w') {
-    	int addr = _pilotSettingsAddress + 1;
-    	double kp, ki, kd;
-
-    	EEPROM.get(addr, kp);
-    	addr += sizeof(double);
-
-    	EEPROM.get(addr, ki);
-    	addr += sizeof(double);
-
-    	EEPROM.get(addr, kd);
-
-    	logln(F("Read stored PID tuning values of %d.%d, %d.%d, %d.%d"), FP(kp), FP(ki), FP(kd));
-    	steeringPID.SetTunings(kp, ki, kd);
+    // the stored gains, if there are any (config.h)
+    if (config.loaded & bit(CONFIG_PID)) {
+        logln(F("Read stored PID tuning values of %d.%d, %d.%d, %d.%d"), FP(config.pid[0]), FP(config.pid[1]), FP(config.pid[2]));
+        steeringPID.SetTunings(config.pid[0], config.pid[1], config.pid[2]);
     }
 }
 
@@ -275,67 +520,78 @@ void updateCurrentPIDTunings(double* tunings) {
     steeringPID.SetTunings(tunings[0], tunings[1], tunings[2]);
 
     logln(F("New PID tuning values are %d.%d, %d.%d, %d.%d"), FP(steeringPID.GetKp()), FP(steeringPID.GetKi()), FP(steeringPID.GetKd()));
-    int addr = _pilotSettingsAddress + 1;
 
-    EEPROM.put(addr, tunings[0]);
-    addr += sizeof(double);
+    for (uint8_t i = 0; i < 3; i++)
+        config.pid[i] = tunings[i];
+    configSave(&config, CONFIG_PID);
 
-    EEPROM.put(addr, tunings[1]);
-    addr += sizeof(double);
+    logln(F("New PID tunings stored."));
+}
+
+// after the target's changed
+void waypointSelected() {
+    // wp changed, need to recompute
+    leg_taken = false;
+    updateWaypointLeg();
 
-    EEPROM.put(addr, tunings[2]);
-    EEPROM.write(_pilotSettingsAddress, 'w');
+    // a new mark: tacks are allowed straight away, and the side's chosen afresh
+    tacticsMark(&tactics);
 
-    logln(F("New PID tunings stored."));
+    Bam course;
+    uint32_t length;
+    routeLeg(&route, &course, &length);
+
+    logln(F("Waypoint %d selected, HTW: %d, DTW: %dm, leg %d for %dm"),
+            route.target,
+            ((int16_t) wp_heading),
+            ((int16_t) wp_distance),
+            ((int16_t) bamToDeg(course)),
+            ((int16_t) (length / 100)));
 }
 
 void setNextWaypoint() {
-    logln(F("Waypoint %d reached."), target_wp);
+    logln(F("Waypoint %d reached."), route.target);
 
-    if ((target_wp == 0 && direction == -1) || (target_wp + 1 == WP_COUNT && direction == 1))
-        direction *= -1;
+    routeNext(&route);
 
-    target_wp += direction;
-    wp_lat = wp_list[target_wp * 2];
-    wp_lon = wp_list[target_wp * 2 + 1];
+    if (route.done)
+        logln(F("Route done. Holding at waypoint %d"), route.target);
+    else
+        waypointSelected();
+}
 
-    // wp changed, need to recompute
-    wp_distance = computeDistance(RAD(gps_lat), RAD(gps_lon), RAD(wp_lat), RAD(wp_lon));
-    wp_heading = DEG(toCircle(computeBearing(RAD(gps_lat), RAD(gps_lon), RAD(wp_lat), RAD(wp_lon))));
+// a new route's gone live: sail it from the start
+void newRoute() {
+    loadRoute();
+    waypointSelected();
+}
 
-    // we should allow tacks now, as this mechanism is just to space out zig zags
-    // also can just zero it out as there's no inherent value in the time
-    last_turn = 0;
+// how close to a waypoint counts as there, m
+uint8_t arrivalRadius(uint8_t wp) {
+    uint8_t radius = route.legs[wp].radius;
 
-    logln(F("Waypoint %d selected, HTW: %d, DTW: %dm"),
-            target_wp,
-            ((int16_t) wp_heading),
-            ((int16_t) wp_distance));
+    return radius ? radius : GET_WITHIN;
 }
 
 void updateSituation() {
-    stalled = gps_speed < STALL_SPEED;
+    PROFILE_SCOPE(PROF_SITUATION);
 
-    // still want to check this
-    if (gps_speed > MIN_SPEED) {
-        ahrs_offset = angleDiff(ahrs_heading, gps_course, true);
-        logln(F("GPS vs AHRS difference is %d"), (int16_t) ahrs_offset * 10);
-    }
+    stalled = gps_speed < KNOTS(STALL_SPEED);
 
     fuseHeading();
 
     // check if we've hit the waypoint
-    wp_distance = computeDistance(RAD(gps_lat), RAD(gps_lon), RAD(wp_lat), RAD(wp_lon));
-    wp_heading = DEG(toCircle(computeBearing(RAD(gps_lat), RAD(gps_lon), RAD(wp_lat), RAD(wp_lon))));
+    updateWaypointLeg();
     adjustment_made = false;
 
-    logln(F("GPS heading: %d, GPS speed (x10): %dkts, HTW: %d, DTW: %dm"),
-            ((int16_t) gps_course),
-            ((int16_t) (gps_speed * 10.0)),
+    logln(F("GPS heading: %d, GPS speed (x10): %dkts, HTW: %d, DTW: %dm, XTE: %dm"),
+            ((int16_t) bamToDeg(gps_course)),
+            ((int16_t) (gps_speed / 10)),
             ((int16_t) wp_heading),
-            ((int16_t) wp_distance));
+            ((int16_t) wp_distance),
+            ((int16_t) (guide.xte / 100)));
 
-    if (wp_distance < GET_WITHIN)
+    if ((wp_distance < arrivalRadius(route.target) || passedWaypoint()) && !route.done)
         setNextWaypoint();
 
     if (wp_distance < HRG_THRESHOLD) {
@@ -343,10 +599,13 @@ void updateSituation() {
         warnGPS();
         logln(F("Within high-res gps threshold. Switching to HRG"));
     } else {
-        if (!high_res_gps && HIGH_RES_GPS_DEFAULT)
+        // otherwise as often as the power plan wants a fix
+        boolean continuous = power_saving ? power.gps == 0 : HIGH_RES_GPS_DEFAULT;
+
+        if (!high_res_gps && continuous)
             warnGPS();
 
-        high_res_gps = HIGH_RES_GPS_DEFAULT;
+        high_res_gps = continuous;
     }
 }
 
@@ -359,7 +618,7 @@ void doPilot() {
 
 #ifdef NO_SAIL
   // run the motor
-    if (gps_lat != 0.0 && gps_lon != 0.0)
+    if (gps_lat != 0 && gps_lon != 0)
         runMotor();
     else
         stopMotor();
@@ -367,10 +626,14 @@ void doPilot() {
 
     updateSituation();
 
-	if (remote_control)
-		processRCCommands();
-	else {
-		adjustHeading();
-		adjustSails();
-	}
+    if (remote_control)
+        processRCCommands();
+    else
+        adjustHeading();
+}
+
+// the sails change slower than the heading, so they're trimmed on their own
+void trimSails() {
+    if (!remote_control)
+        adjustSails();
 }
@@ -0,0 +1,103 @@
+#include "power.h"
+
+#ifdef __AVR__
+#include <avr/sleep.h>
+#endif
+
+const uint32_t power_draw[POWER_LOADS] = {
+	28000,        // the board, 16MHz: the mega, its usb chip and regulator
+	14000,        // the same asleep, the clocks still going
+	3900,         // mpu6050, dmp running
+	29000,        // venus634, tracking
+	12000,        // wind vane
+	30,           // battery divider, 12V over 424k
+	5000,         // servo regulator, no load
+	200000,       // rudder servo, powered: moving, then holding to settle
+	600000,       // sail winch servo, powered
+	2000000       // motor (NO_SAIL)
+};
+
+void powerInit(Power *p, uint32_t now) {
+	memset(p, 0, sizeof(*p));
+	p->time = now;
+	p->gps = 0;
+	p->wind = POWER_WIND_ROUGH;
+	p->pilot = POWER_PILOT_NEAR;
+	p->rudder = 1;
+}
+
+void powerSpend(Power *p, uint16_t on, uint32_t now) {
+	uint32_t us = now - p->time;
+	p->time = now;
+
+	for (uint8_t i = 0; i < POWER_LOADS; i++) {
+		if (!(on & bit(i)))
+			continue;
+
+		uint32_t total = p->us[i] + us;
+
+		p->ms[i] += total / 1000;
+		p->us[i] = total % 1000;
+	}
+}
+
+float powerUsed(const Power *p, uint8_t load) {
+	return (float) p->ms[load] * (power_draw[load] / 1000.0) / 3600000.0;
+}
+
+float powerMean(const Power *p) {
+	uint32_t ms = p->ms[POWER_AWAKE] + p->ms[POWER_ASLEEP];
+
+	if (!ms)
+		return 0;
+
+	float used = 0;
+	for (uint8_t i = 0; i < POWER_LOADS; i++)
+		used += powerUsed(p, i);
+
+	return used * 3600000.0 / ms;
+}
+
+void powerPlan(Power *p, float distance, float voltage, float roll, uint32_t now) {
+	float dt = p->seen ? (now - p->seen) / 1000.0 : POWER_SEA_TIME;
+	p->seen = now;
+
+	p->level += (roll - p->level) * min(dt / POWER_LEVEL_TIME, 1.0);
+	p->sea += (fabs(roll - p->level) - p->sea) * min(dt / POWER_SEA_TIME, 1.0);
+
+	if (voltage > 0 && voltage < POWER_LOW_VOLTAGE)
+		p->low = true;
+	else if (voltage > POWER_LOW_VOLTAGE + POWER_RECOVERED)
+		p->low = false;
+
+	boolean rough = p->sea > POWER_ROUGH;
+
+	uint32_t gps = min(distance * POWER_GPS_SPACING * (p->low ? 2 : 1), (float) POWER_GPS_MAX);
+	p->gps = gps < POWER_GPS_MIN ? 0 : gps;
+
+	if (p->low)
+		p->wind = rough ? POWER_WIND_CALM : POWER_WIND_LOW;
+	else
+		p->wind = rough ? POWER_WIND_ROUGH : POWER_WIND_CALM;
+
+	p->pilot = p->gps ? POWER_PILOT_FAR : POWER_PILOT_NEAR;
+	p->rudder = rough ? POWER_RUDDER_ROUGH : POWER_RUDDER_CALM;
+}
+
+void powerSleep(uint32_t us) {
+#ifdef __AVR__
+	// idle, not power down: that'd stop the clock millis() runs off, and the
+	// servo pulses. the clock's overflow wakes it every 1024us, so it's
+	// up to that early rather than late
+	uint32_t start = micros();
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	while (micros() - start + 1024 < us) {
+		sleep_enable();
+		sleep_cpu();
+		sleep_disable();
+	}
+#else
+	delayMicroseconds(us);
+#endif
+}
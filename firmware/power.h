@@ -0,0 +1,121 @@
+#ifndef __power_h
+#define __power_h
+
+#include "Arduino.h"
+
+// where the battery goes, and how to make it go further.
+//
+// each load (the mcu awake or asleep, the sensors, the servos) has its draw
+// here, and the time it's been on is added up as the main loop goes round:
+// the charge each has taken is that times its draw. the draws are from the
+// parts' data sheets, rounded up; measure the boat's own and put them in.
+//
+// the plan is how often the gps, the wind sensor and the pilot are wanted,
+// and how far the rudder's let be off, from how far there is to go, the
+// battery's voltage and the sea state:
+//
+//   gps:    on all the time close to the mark, otherwise a fix every
+//           POWER_GPS_SPACING ms for each m there is to go, up to
+//           POWER_GPS_MAX. twice as long apart with the battery low
+//   wind:   every POWER_WIND_ROUGH ms in a sea, where the vane swings with
+//           the mast, POWER_WIND_CALM out of one, POWER_WIND_LOW with the
+//           battery low
+//   pilot:  every POWER_PILOT_NEAR ms close to the mark, otherwise
+//           POWER_PILOT_FAR. the steering's own rate is the pid's
+//   rudder: moved once it's wanted POWER_RUDDER_CALM degrees from where it
+//           is, POWER_RUDDER_ROUGH in a sea: the waves push the bow back as
+//           often as they push it off
+//
+// the sea state's the mean deviation of the roll from its recent mean, so
+// a gusty breeze counts for some of it. the gps is warmed up ahead of each
+// fix, and the wind sensor and the battery divider ahead of each reading,
+// by the tasks that read them: the plan only says how often
+
+// what's drawing. bit(load) of each that's on goes to powerSpend()
+enum PowerLoad {
+	POWER_AWAKE,
+	POWER_ASLEEP,
+	POWER_IMU,
+	POWER_GPS,
+	POWER_WIND,
+	POWER_BATTERY,
+	POWER_RAIL,
+	POWER_RUDDER,
+	POWER_WINCH,
+	POWER_MOTOR,
+	POWER_LOADS
+};
+
+// each load's draw, uA
+extern const uint32_t power_draw[POWER_LOADS];
+
+// volts the battery's low under (a 3s lipo at 3.7V a cell, about a third
+// left), and back over once it's this much higher
+#define POWER_LOW_VOLTAGE 11.1
+#define POWER_RECOVERED 0.2
+
+// degrees of roll deviation that's a sea, and the seconds it's averaged
+// over. it's from the roll's mean over POWER_LEVEL_TIME, which the heel
+// follows, but not the waves
+#define POWER_ROUGH 3
+#define POWER_SEA_TIME 30
+#define POWER_LEVEL_TIME 5
+
+// ms between gps fixes per m to go, the most, and the least worth turning
+// it off for (a fix sooner than that and it's left on)
+#define POWER_GPS_SPACING 10
+#define POWER_GPS_MAX 30000
+#define POWER_GPS_MIN 5000
+
+// ms between wind readings and pilot passes
+#define POWER_WIND_ROUGH 100
+#define POWER_WIND_CALM 250
+#define POWER_WIND_LOW 500
+#define POWER_PILOT_NEAR 50
+#define POWER_PILOT_FAR 100
+
+// degrees the rudder has to be wanted to move before it's powered up
+#define POWER_RUDDER_ROUGH 4
+#define POWER_RUDDER_CALM 2
+
+struct Power {
+	// how long each load's been on, ms and the us over
+	uint32_t ms[POWER_LOADS];
+	uint16_t us[POWER_LOADS];
+	uint32_t time;        // last powerSpend(), micros()
+
+	// the roll's slow mean and the mean deviation from it, degrees
+	float level;
+	float sea;
+	uint32_t seen;        // last powerPlan(), millis()
+
+	boolean low;
+
+	// the plan: ms between gps fixes (0 for on all the time), wind readings
+	// and pilot passes, and the least the rudder's moved by
+	uint16_t gps;
+	uint16_t wind;
+	uint16_t pilot;
+	uint8_t rudder;
+};
+
+// nothing spent yet, everything at its fastest. now is micros()
+void powerInit(Power *p, uint32_t now);
+
+// on (bit(load) of each) has been on since the last call, till now
+// (micros())
+void powerSpend(Power *p, uint16_t on, uint32_t now);
+
+// mAh a load's taken, and the mean draw of them all (mA) since powerInit()
+float powerUsed(const Power *p, uint8_t load);
+float powerMean(const Power *p);
+
+// the plan for distance (m) to go, the battery's voltage (0 for not known)
+// and the roll (degrees) now (millis())
+void powerPlan(Power *p, float distance, float voltage, float roll, uint32_t now);
+
+// the mcu asleep for us, waking for interrupts: the clock, the serial
+// ports and the servo pulses keep going
+void powerSleep(uint32_t us);
+
+#endif
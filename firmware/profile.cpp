@@ -0,0 +1,91 @@
+#include "profile.h"
+
+#ifdef PROFILE
+
+ProfStats prof_stats[PROF_STAGES];
+
+void profAdd(uint8_t stage, uint32_t us) {
+	ProfStats *s = &prof_stats[stage];
+
+	if (!s->count || us < s->min)
+		s->min = us;
+	if (us > s->max)
+		s->max = us;
+
+	s->count++;
+	s->total += us;
+
+	uint8_t b = 0;
+	while (b < PROF_BUCKETS - 1 && (us >> (b + 1)))
+		b++;
+
+	if (s->buckets[b] < 0xffff)
+		s->buckets[b]++;
+}
+
+static const __FlashStringHelper *stageName(uint8_t stage) {
+	switch (stage) {
+		case PROF_LOOP: return F("loop");
+		case PROF_HEADING: return F("heading");
+		case PROF_WIND: return F("wind");
+		case PROF_VOLTAGE: return F("voltage");
+		case PROF_SITUATION: return F("situation");
+		case PROF_ADJUST: return F("adjust");
+		case PROF_PID: return F("pid");
+		case PROF_RUDDER: return F("rudder");
+		case PROF_LOG: return F("logln");
+		case PROF_DATA_LINE: return F("data line");
+	}
+
+	return F("?");
+}
+
+void profClear() {
+	memset(prof_stats, 0, sizeof(prof_stats));
+}
+
+void profDump(Print &out) {
+	// copied first: logln() is timed, and printing can end up in it
+	ProfStats s;
+
+	out.println(F("stage: count, min/mean/max us, then count per us from"));
+
+	for (uint8_t i = 0; i < PROF_STAGES; i++) {
+		s = prof_stats[i];
+
+		out.print(stageName(i));
+		out.print(F(": "));
+		out.print(s.count);
+
+		if (s.count) {
+			out.print(F(", "));
+			out.print(s.min);
+			out.print('/');
+			out.print((uint32_t) (s.total / s.count));
+			out.print('/');
+			out.print(s.max);
+
+			for (uint8_t b = 0; b < PROF_BUCKETS; b++)
+				if (s.buckets[b]) {
+					out.print(' ');
+					out.print(1UL << b);
+					out.print(':');
+					out.print(s.buckets[b]);
+				}
+		}
+
+		out.println();
+	}
+
+	profClear();
+}
+
+#else
+
+void profDump(Print &out) {
+	out.println(F("Not built with PROFILE"));
+}
+
+void profClear() {}
+
+#endif
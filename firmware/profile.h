@@ -0,0 +1,71 @@
+#ifndef __profile_h
+#define __profile_h
+
+#include "Arduino.h"
+
+// where the time in loop() goes: scoped timers on its stages, each keeping
+// its count, min, max and mean, and a log2 histogram, in fixed ram.
+//
+// a stage is timed from PROFILE_SCOPE() to the end of the block it's in,
+// including anything it calls that's timed too (logln, mostly). micros()
+// throughout, so to 4us on the mega; the host build times virtual us.
+//
+// define PROFILE (or configure the host build WITH_PROFILE) to build it in.
+// without it the timers compile to nothing and the stats take no ram
+// #define PROFILE
+
+enum ProfStage {
+	PROF_LOOP,          // a pass through loop(), less waiting for a task
+	PROF_HEADING,       // readSteadyHeading()
+	PROF_WIND,          // windSample()
+	PROF_VOLTAGE,       // batterySample()
+	PROF_SITUATION,     // updateSituation()
+	PROF_ADJUST,        // adjustHeading()
+	PROF_PID,           // steeringPID.Compute()
+	PROF_RUDDER,        // rudderTo()
+	PROF_LOG,           // logln()
+	PROF_DATA_LINE,     // printDataLine() or sendTelemetry()
+	PROF_STAGES
+};
+
+// bucket i counts times of 2^i to 2^(i+1) us, the last anything longer
+#define PROF_BUCKETS 18
+
+#ifdef PROFILE
+
+struct ProfStats {
+	uint32_t count;
+	uint32_t min, max;
+	uint64_t total;
+	uint16_t buckets[PROF_BUCKETS];     // stick at 65535
+};
+
+extern ProfStats prof_stats[PROF_STAGES];
+
+void profAdd(uint8_t stage, uint32_t us);
+
+class ProfScope {
+public:
+	ProfScope(uint8_t stage) : _stage(stage), _start(micros()) {}
+	~ProfScope() { profAdd(_stage, micros() - _start); }
+
+private:
+	uint8_t _stage;
+	uint32_t _start;
+};
+
+#define PROFILE_CAT(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_CAT(_prof_, line)
+#define PROFILE_SCOPE(stage) ProfScope PROFILE_NAME(__LINE__)(stage)
+
+#else
+
+#define PROFILE_SCOPE(stage)
+
+#endif
+
+// a table of the stages, to out. then starts them over
+void profDump(Print &out);
+void profClear();
+
+#endif
@@ -0,0 +1,109 @@
+#include "rc_cmd.h"
+#include "telemetry.h"
+
+void rcReset(rc_decoder *d) {
+	d->state = RC_IDLE;
+	d->value = 0;
+	d->negative = false;
+	d->digits = false;
+	d->len = 0;
+}
+
+uint8_t rcStart(rc_decoder *d, uint8_t c, uint32_t now) {
+	rcReset(d);
+
+	if (c == '[')
+		d->state = RC_TEXT_RUDDER;
+	else if (c == RC_SYNC)
+		d->state = RC_BINARY;
+	else
+		return RC_NONE;
+
+	d->started = now;
+	return RC_PARTIAL;
+}
+
+uint8_t rcFeed(rc_decoder *d, uint8_t c, uint32_t now, rc_command *cmd);
+
+uint8_t rcBinary(rc_decoder *d, uint8_t c, uint32_t now, rc_command *cmd) {
+	d->buf[d->len++] = c;
+	if (d->len < 4)
+		return RC_PARTIAL;
+
+	uint16_t crc = telemetryCrc(telemetryCrc(0xffff, d->buf[0]), d->buf[1]);
+
+	if (crc == (d->buf[2] | (d->buf[3] << 8))) {
+		rcReset(d);
+		cmd->rudder = (int8_t)d->buf[0];
+		cmd->winch = d->buf[1];
+		return RC_COMMAND;
+	}
+
+	// the sync byte wasn't a frame's; the next one may start in what came
+	// after it. too short to finish one, so they're only ever partial
+	uint8_t rest[4];
+	memcpy(rest, d->buf, sizeof(rest));
+	rcReset(d);
+
+	for (uint8_t i = 0; i < sizeof(rest); i++)
+		rcFeed(d, rest[i], now, cmd);
+
+	return RC_PARTIAL;
+}
+
+uint8_t rcText(rc_decoder *d, uint8_t c, uint32_t now, rc_command *cmd) {
+	if (c >= '0' && c <= '9') {
+		d->value = d->value * 10 + (c - '0');
+		d->digits = true;
+
+		// nothing sensible is this long
+		if (d->value > 999)
+			rcReset(d);
+
+		return RC_PARTIAL;
+	}
+
+	if (c == '-' && !d->digits && !d->negative) {
+		d->negative = true;
+		return RC_PARTIAL;
+	}
+
+	int16_t v = d->negative ? -d->value : d->value;
+
+	if (d->state == RC_TEXT_RUDDER && d->digits && (c == ';' || c == ',' || c == ' ')) {
+		d->rudder = v;
+		d->state = RC_TEXT_WINCH;
+		d->value = 0;
+		d->negative = false;
+		d->digits = false;
+		return RC_PARTIAL;
+	}
+
+	if (d->state == RC_TEXT_WINCH && d->digits && c == ']') {
+		cmd->rudder = d->rudder;
+		cmd->winch = v;
+		rcReset(d);
+		return RC_COMMAND;
+	}
+
+	// a broken frame. the byte may start the next one, or be a menu key
+	return rcStart(d, c, now);
+}
+
+// never blocks: partial frames are kept until the rest arrives, or dropped
+// after RC_FRAME_TIMEOUT
+uint8_t rcFeed(rc_decoder *d, uint8_t c, uint32_t now, rc_command *cmd) {
+	if (d->state != RC_IDLE && now - d->started > RC_FRAME_TIMEOUT)
+		rcReset(d);
+
+	switch (d->state) {
+		case RC_IDLE:
+			return rcStart(d, c, now);
+
+		case RC_BINARY:
+			return rcBinary(d, c, now, cmd);
+
+		default:
+			return rcText(d, c, now, cmd);
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef __rc_cmd_h
+#define __rc_cmd_h
+
+#include "Arduino.h"
+
+// remote control commands, decoded a byte at a time as they arrive:
+//
+//   text:   [RRR;WW]  signed rudder from center, winch 0-90 (any of ; , or
+//                     space between them)
+//   binary: sync(1) rudder(1, signed) winch(1) crc(2)
+//
+// crc is telemetry.h's crc16-ccitt over rudder and winch, little endian
+
+#define RC_SYNC 0xa6
+
+// a frame not finished within this many ms is dropped
+#define RC_FRAME_TIMEOUT 1000
+
+// what rcFeed() made of a byte
+#define RC_NONE 0       // not part of a command; the decoder is idle
+#define RC_PARTIAL 1    // taken as part of a command in progress
+#define RC_COMMAND 2    // completed a command
+
+enum rc_state {
+	RC_IDLE,
+	RC_TEXT_RUDDER,
+	RC_TEXT_WINCH,
+	RC_BINARY
+};
+
+struct rc_decoder {
+	rc_state state;
+	uint32_t started;
+	int16_t value;
+	boolean negative;
+	boolean digits;
+	int16_t rudder;
+	uint8_t len;
+	uint8_t buf[4];
+};
+
+struct rc_command {
+	int16_t rudder;
+	int16_t winch;
+};
+
+uint8_t rcFeed(rc_decoder *d, uint8_t c, uint32_t now, rc_command *cmd);
+
+#endif
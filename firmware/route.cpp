@@ -0,0 +1,357 @@
+#include "route.h"
+#include "telemetry.h"
+#include <EEPROM.h>
+
+#define FRAME_BEGIN 'B'
+#define FRAME_WAYPOINT 'W'
+#define FRAME_COMMIT 'C'
+
+// slot offsets
+#define AT_COUNT 0
+#define AT_MODE 1
+#define AT_CRC 2
+#define AT_MISSING 4
+
+static uint16_t slotAddress(uint16_t address, uint8_t slot) {
+	return address + 1 + slot * ROUTE_SLOT;
+}
+
+static uint16_t recordAddress(uint16_t address, uint8_t slot, uint8_t i) {
+	return slotAddress(address, slot) + ROUTE_HEADER + i * ROUTE_RECORD;
+}
+
+static uint16_t allMissing(uint8_t count) {
+	return count >= 16 ? 0xffff : (1U << count) - 1;
+}
+
+static int32_t get32(const uint8_t *p) {
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t eepromGet16(uint16_t at) {
+	return EEPROM.read(at) | (EEPROM.read(at + 1) << 8);
+}
+
+static void pack(const RouteWaypoint *wp, uint8_t *out) {
+	for (uint8_t i = 0; i < 4; i++) {
+		out[i] = wp->lat >> (8 * i);
+		out[4 + i] = wp->lon >> (8 * i);
+	}
+	out[8] = wp->radius;
+}
+
+static void unpack(const uint8_t *in, RouteWaypoint *wp) {
+	wp->lat = get32(in);
+	wp->lon = get32(in + 4);
+	wp->radius = in[8];
+}
+
+static void readRecord(uint16_t at, RouteWaypoint *wp) {
+	uint8_t b[ROUTE_RECORD];
+
+	for (uint8_t i = 0; i < ROUTE_RECORD; i++)
+		b[i] = EEPROM.read(at + i);
+
+	unpack(b, wp);
+}
+
+uint16_t routeCrc(uint16_t crc, const RouteWaypoint *wp) {
+	uint8_t b[ROUTE_RECORD];
+	pack(wp, b);
+
+	for (uint8_t i = 0; i < ROUTE_RECORD; i++)
+		crc = telemetryCrc(crc, b[i]);
+
+	return crc;
+}
+
+//
+// sailing it
+//
+void routeSet(Route *r, const RouteWaypoint *wps, uint8_t count, uint8_t mode) {
+	r->count = min(count, ROUTE_MAX_WAYPOINTS);
+	r->mode = mode;
+
+	for (uint8_t i = 0; i < r->count; i++) {
+		navInit(&r->legs[i].to, wps[i].lat, wps[i].lon);
+		r->legs[i].radius = wps[i].radius;
+	}
+
+	// each leg from the waypoint before: the one trig call per waypoint is
+	// navInit()'s, here, and nothing sailing them needs another
+	for (uint8_t i = 0; i < r->count; i++) {
+		const NavFrame *from = &r->legs[i ? i - 1 : r->count - 1].to;
+
+		r->legs[i].course = bamRaw(0);
+		navLeg(&r->legs[i].to, from->lat, from->lon, &r->legs[i].course, &r->legs[i].length);
+	}
+
+	routeStart(r, 0);
+}
+
+boolean routeLoad(Route *r, uint16_t address) {
+	uint8_t live = EEPROM.read(address) - ROUTE_LIVE;
+	if (live > 1)
+		return false;
+
+	uint16_t at = slotAddress(address, live);
+	uint8_t count = EEPROM.read(at + AT_COUNT);
+	uint8_t mode = EEPROM.read(at + AT_MODE);
+
+	if (!count || count > ROUTE_MAX_WAYPOINTS || mode > ROUTE_ONCE || eepromGet16(at + AT_MISSING))
+		return false;
+
+	RouteWaypoint wps[ROUTE_MAX_WAYPOINTS];
+	uint16_t crc = telemetryCrc(telemetryCrc(0xffff, count), mode);
+
+	for (uint8_t i = 0; i < count; i++) {
+		readRecord(recordAddress(address, live, i), &wps[i]);
+		crc = routeCrc(crc, &wps[i]);
+	}
+
+	if (crc != eepromGet16(at + AT_CRC))
+		return false;
+
+	routeSet(r, wps, count, mode);
+	return true;
+}
+
+void routeStart(Route *r, uint8_t target) {
+	r->target = target < r->count ? target : 0;
+	r->direction = 1;
+	r->done = false;
+}
+
+void routeNext(Route *r) {
+	if (r->count < 2 || r->done)
+		return;
+
+	bool last = r->direction > 0 ? r->target + 1 == r->count : r->target == 0;
+
+	if (!last) {
+		r->target += r->direction;
+		return;
+	}
+
+	switch (r->mode) {
+		case ROUTE_LOOP:
+			r->target = 0;
+			break;
+
+		case ROUTE_PINGPONG:
+			r->direction = -r->direction;
+			r->target += r->direction;
+			break;
+
+		default:
+			r->done = true;
+	}
+}
+
+void routeLeg(const Route *r, Bam *course, uint32_t *length) {
+	// back the way it came, it's the leg from here the other way round
+	if (r->direction < 0 && r->target + 1 < r->count) {
+		const RouteLeg *l = &r->legs[r->target + 1];
+
+		*course = l->course + bamRaw(BAM_DEG(180));
+		*length = l->length;
+		return;
+	}
+
+	*course = r->legs[r->target].course;
+	*length = r->legs[r->target].length;
+}
+
+void routeStore(uint16_t address, const RouteWaypoint *wps, uint8_t count, uint8_t mode) {
+	uint16_t at = slotAddress(address, 0);
+	uint16_t crc = telemetryCrc(telemetryCrc(0xffff, count), mode);
+
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t b[ROUTE_RECORD];
+		pack(&wps[i], b);
+
+		for (uint8_t j = 0; j < ROUTE_RECORD; j++)
+			EEPROM.update(recordAddress(address, 0, i) + j, b[j]);
+
+		crc = routeCrc(crc, &wps[i]);
+	}
+
+	EEPROM.update(at + AT_COUNT, count);
+	EEPROM.update(at + AT_MODE, mode);
+	EEPROM.update(at + AT_CRC, crc);
+	EEPROM.update(at + AT_CRC + 1, crc >> 8);
+	EEPROM.update(at + AT_MISSING, 0);
+	EEPROM.update(at + AT_MISSING + 1, 0);
+	EEPROM.update(address, ROUTE_LIVE);
+}
+
+//
+// uploading it
+//
+void routeUploadInit(RouteUpload *u, uint16_t address) {
+	u->address = address;
+	u->begun = false;
+	u->framing = false;
+	u->writes = 0;
+	u->written = 0;
+}
+
+uint16_t routeMissing(const RouteUpload *u) {
+	return eepromGet16(slotAddress(u->address, u->slot) + AT_MISSING);
+}
+
+static void queueWrite(RouteUpload *u, uint16_t at, uint8_t value) {
+	u->write_at[u->writes] = at;
+	u->write_value[u->writes] = value;
+	u->writes++;
+}
+
+static uint8_t begin(RouteUpload *u, const uint8_t *p) {
+	uint8_t count = p[0], mode = p[1];
+	uint16_t crc = p[2] | (p[3] << 8);
+
+	if (!count || count > ROUTE_MAX_WAYPOINTS || mode > ROUTE_ONCE)
+		return ROUTE_REFUSED;
+
+	// whichever slot isn't live
+	u->slot = EEPROM.read(u->address) == ROUTE_LIVE ? 1 : 0;
+	u->count = count;
+	u->begun = true;
+
+	uint16_t at = slotAddress(u->address, u->slot);
+	if (EEPROM.read(at + AT_COUNT) == count && EEPROM.read(at + AT_MODE) == mode &&
+			eepromGet16(at + AT_CRC) == crc)
+		return ROUTE_BEGUN;
+
+	// everything missing before anything else, so a reset part way
+	// through can't leave it looking like another route's half there
+	uint16_t missing = allMissing(count);
+	queueWrite(u, at + AT_MISSING, missing);
+	queueWrite(u, at + AT_MISSING + 1, missing >> 8);
+	queueWrite(u, at + AT_COUNT, count);
+	queueWrite(u, at + AT_MODE, mode);
+	queueWrite(u, at + AT_CRC, crc);
+	queueWrite(u, at + AT_CRC + 1, crc >> 8);
+
+	u->on_written = ROUTE_BEGUN;
+	return ROUTE_PARTIAL;
+}
+
+static uint8_t waypoint(RouteUpload *u, const uint8_t *p) {
+	uint8_t i = p[0];
+
+	if (!u->begun || i >= u->count)
+		return ROUTE_REFUSED;
+
+	uint16_t at = recordAddress(u->address, u->slot, i);
+	for (uint8_t j = 0; j < ROUTE_RECORD; j++)
+		queueWrite(u, at + j, p[1 + j]);
+
+	// its bit's cleared once the rest of it is there
+	uint16_t missing = slotAddress(u->address, u->slot) + AT_MISSING + i / 8;
+	queueWrite(u, missing, EEPROM.read(missing) & ~(1 << (i % 8)));
+
+	u->index = i;
+	u->on_written = ROUTE_WRITTEN;
+	return ROUTE_PARTIAL;
+}
+
+static uint8_t commit(RouteUpload *u) {
+	if (!u->begun)
+		return ROUTE_REFUSED;
+
+	if (routeMissing(u))
+		return ROUTE_INCOMPLETE;
+
+	uint16_t at = slotAddress(u->address, u->slot);
+	uint16_t crc = telemetryCrc(telemetryCrc(0xffff, EEPROM.read(at + AT_COUNT)), EEPROM.read(at + AT_MODE));
+
+	for (uint8_t i = 0; i < u->count; i++) {
+		RouteWaypoint wp;
+		readRecord(recordAddress(u->address, u->slot, i), &wp);
+		crc = routeCrc(crc, &wp);
+	}
+
+	// not what was sent: all of it again
+	if (crc != eepromGet16(at + AT_CRC)) {
+		uint16_t missing = allMissing(u->count);
+		queueWrite(u, at + AT_MISSING, missing);
+		queueWrite(u, at + AT_MISSING + 1, missing >> 8);
+
+		u->on_written = ROUTE_REFUSED;
+		return ROUTE_PARTIAL;
+	}
+
+	queueWrite(u, u->address, ROUTE_LIVE + u->slot);
+
+	u->begun = false;
+	u->on_written = ROUTE_COMMITTED;
+	return ROUTE_PARTIAL;
+}
+
+static uint8_t frame(RouteUpload *u) {
+	uint8_t type = u->buf[0], len = u->buf[1];
+	const uint8_t *p = u->buf + 2;
+
+	uint16_t crc = 0xffff;
+	for (uint8_t i = 0; i < 2 + len; i++)
+		crc = telemetryCrc(crc, u->buf[i]);
+
+	if (crc != (p[len] | (p[len + 1] << 8)))
+		return ROUTE_PARTIAL;
+
+	if (u->writes)
+		return ROUTE_BUSY;
+
+	if (type == FRAME_BEGIN && len == 4)
+		return begin(u, p);
+	if (type == FRAME_WAYPOINT && len == 1 + ROUTE_RECORD)
+		return waypoint(u, p);
+	if (type == FRAME_COMMIT && len == 0)
+		return commit(u);
+
+	return ROUTE_REFUSED;
+}
+
+uint8_t routeFeed(RouteUpload *u, uint8_t c, uint32_t now) {
+	if (u->framing && now - u->started > ROUTE_FRAME_TIMEOUT)
+		u->framing = false;
+
+	if (!u->framing) {
+		if (c != ROUTE_SYNC)
+			return ROUTE_NONE;
+
+		u->framing = true;
+		u->started = now;
+		u->len = 0;
+		return ROUTE_PARTIAL;
+	}
+
+	u->buf[u->len++] = c;
+
+	// a length that can't be right: whatever follows may be the next frame
+	if (u->len == 2 && c > ROUTE_FRAME_MAX - 4) {
+		u->framing = false;
+		return ROUTE_PARTIAL;
+	}
+
+	if (u->len < 2 || u->len < 2 + u->buf[1] + 2)
+		return ROUTE_PARTIAL;
+
+	u->framing = false;
+	return frame(u);
+}
+
+uint8_t routeTick(RouteUpload *u) {
+	if (!u->writes || !eeprom_is_ready())
+		return ROUTE_NONE;
+
+	EEPROM.update(u->write_at[u->written], u->write_value[u->written]);
+
+	if (++u->written < u->writes)
+		return ROUTE_NONE;
+
+	u->writes = 0;
+	u->written = 0;
+	return u->on_written;
+}
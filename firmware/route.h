@@ -0,0 +1,146 @@
+#ifndef __route_h
+#define __route_h
+
+#include "Arduino.h"
+#include "bam.h"
+#include "nav.h"
+
+// the waypoints sailed, kept in eeprom and replaced over the serial link
+// without a reflash.
+//
+// eeprom, from the address given: a byte saying which of two slots holds
+// the live route, then the slots. an upload goes to the other slot, so the
+// live route's sailed until the new one's all there and checks out:
+//
+//   live:      'R' slot 0, 'S' slot 1, anything else none
+//   slot:      count(1) mode(1) crc(2) missing(2) waypoints(9 each)
+//   waypoint:  lat(4) lon(4) radius(1)
+//
+// lat and lon in micro-degrees, radius how close counts as there, m. crc
+// is telemetry.h's crc16-ccitt over count, mode and the waypoints. missing
+// has a bit per waypoint not written yet, cleared as each one is, so an
+// upload cut off (or a reset) part way carries on where it stopped.
+//
+// upload frames, a byte at a time as they arrive, little endian:
+//
+//   sync(1) type(1) len(1) payload(len) crc(2)
+//
+//   'B' begin:     count(1) mode(1) route crc(2). carries on with an upload
+//                  of the same route, else starts over
+//   'W' waypoint:  index(1) lat(4) lon(4) radius(1)
+//   'C' commit:    makes the upload live once it's all there and its crc,
+//                  read back, checks out
+//
+// the frame crc is over type through payload; a bad one's dropped, to be
+// sent again. one frame at a time, waiting for its reply: eeprom takes
+// 3.3ms a byte, written one per routeTick() so nothing waits on it
+
+#define ROUTE_MAX_WAYPOINTS 16
+
+#define ROUTE_LOOP 0        // back to the first after the last
+#define ROUTE_PINGPONG 1    // back the way it came after the last
+#define ROUTE_ONCE 2        // stays at the last
+
+#define ROUTE_LIVE 'R'
+#define ROUTE_HEADER 6
+#define ROUTE_RECORD 9
+#define ROUTE_SLOT (ROUTE_HEADER + ROUTE_MAX_WAYPOINTS * ROUTE_RECORD)
+
+// all of it, from the address given
+#define ROUTE_EEPROM (1 + 2 * ROUTE_SLOT)
+
+#define ROUTE_SYNC 0xa7
+
+// a frame not finished within this many ms is dropped
+#define ROUTE_FRAME_TIMEOUT 1000
+
+// type, len, the longest payload (a waypoint) and crc
+#define ROUTE_FRAME_MAX (2 + 1 + ROUTE_RECORD + 2)
+
+// what routeFeed() made of a byte, and routeTick() of a write
+#define ROUTE_NONE 0        // not part of a frame; the decoder is idle
+#define ROUTE_PARTIAL 1     // taken as part of a frame in progress
+#define ROUTE_BEGUN 2       // begin frame: the upload's set up
+#define ROUTE_WRITTEN 3     // waypoint frame: it's written
+#define ROUTE_COMMITTED 4   // commit frame: the upload's live
+#define ROUTE_INCOMPLETE 5  // commit frame: there's more to send
+#define ROUTE_BUSY 6        // still writing the last frame; send it again
+#define ROUTE_REFUSED 7     // nothing begun, out of range, or a bad crc
+
+struct RouteWaypoint {
+	int32_t lat, lon;       // micro-degrees
+	uint8_t radius;         // m
+};
+
+// a waypoint as sailed to: worked out once, when the route's loaded
+struct RouteLeg {
+	NavFrame to;            // the waypoint, and the projection around it
+	Bam course;             // from the waypoint before, the last for the first
+	uint32_t length;        // cm
+	uint8_t radius;         // m
+};
+
+struct Route {
+	RouteLeg legs[ROUTE_MAX_WAYPOINTS];
+	uint8_t count;
+	uint8_t mode;
+	uint8_t target;
+	int8_t direction;
+	boolean done;           // one way, and the last is reached
+};
+
+// sets the route up to start at its first waypoint
+void routeSet(Route *r, const RouteWaypoint *wps, uint8_t count, uint8_t mode);
+
+// the live route in eeprom, if there is one that checks out
+boolean routeLoad(Route *r, uint16_t address);
+
+// sails to the waypoint from here, as if it had come from the one before
+void routeStart(Route *r, uint8_t target);
+
+// on to the next waypoint, as the mode has it
+void routeNext(Route *r);
+
+// the leg being sailed, to the target, whichever way round
+void routeLeg(const Route *r, Bam *course, uint32_t *length);
+
+// the whole route, written at once as the live one, waiting on the eeprom:
+// for setting one up, not for under way
+void routeStore(uint16_t address, const RouteWaypoint *wps, uint8_t count, uint8_t mode);
+
+uint16_t routeCrc(uint16_t crc, const RouteWaypoint *wp);
+
+#define ROUTE_WRITES (ROUTE_RECORD + 1)
+
+struct RouteUpload {
+	uint16_t address;
+	uint8_t slot;           // being uploaded to
+	boolean begun;
+	uint8_t count;
+
+	boolean framing;
+	uint32_t started;
+	uint8_t len;
+	uint8_t buf[ROUTE_FRAME_MAX];
+
+	// eeprom writes still to make, and what to report once they're made
+	uint16_t write_at[ROUTE_WRITES];
+	uint8_t write_value[ROUTE_WRITES];
+	uint8_t writes, written;
+	uint8_t on_written;
+	uint8_t index;          // the waypoint written
+};
+
+void routeUploadInit(RouteUpload *u, uint16_t address);
+
+// never blocks. what a finished frame asks for may take routeTick()s
+uint8_t routeFeed(RouteUpload *u, uint8_t c, uint32_t now);
+
+// makes an eeprom write, if one's waiting and the eeprom's ready. what the
+// frame that wanted them comes to once they're all made, else ROUTE_NONE
+uint8_t routeTick(RouteUpload *u);
+
+// waypoints not written yet, a bit each
+uint16_t routeMissing(const RouteUpload *u);
+
+#endif
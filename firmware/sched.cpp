@@ -0,0 +1,84 @@
+#include "sched.h"
+
+void schedInit(Sched *s, SchedTask *tasks, uint8_t count, uint32_t now) {
+	s->tasks = tasks;
+	s->count = count;
+	s->trace = NULL;
+
+	for (uint8_t i = 0; i < count; i++) {
+		tasks[i].release = now;
+		tasks[i].runs = 0;
+		tasks[i].misses = 0;
+		tasks[i].overruns = 0;
+	}
+
+	schedClearStats(s, now);
+}
+
+void schedClearStats(Sched *s, uint32_t now) {
+	for (uint8_t i = 0; i < s->count; i++) {
+		s->tasks[i].max_late = 0;
+		s->tasks[i].max_time = 0;
+	}
+
+	s->busy = 0;
+	s->since = now;
+}
+
+static void run(Sched *s, uint8_t i) {
+	SchedTask *t = &s->tasks[i];
+
+	uint32_t start = micros();
+	t->run();
+	uint32_t end = micros();
+
+	uint32_t late = start - t->release, time = end - start;
+
+	t->runs++;
+	if (late > t->max_late)
+		t->max_late = late;
+	if (time > t->max_time)
+		t->max_time = time;
+	if (time > t->budget)
+		t->overruns++;
+	s->busy += time;
+
+	if (s->trace)
+		s->trace(i, t->release, start, end);
+
+	// due again a period on. if that's gone by already it's been missed,
+	// and any whole periods after it are skipped
+	uint32_t next = t->release + t->period;
+	if ((int32_t) (end - next) > 0) {
+		uint32_t skipped = (end - next) / t->period;
+
+		next += skipped * t->period;
+		t->misses += 1 + skipped;
+	}
+
+	t->release = next;
+}
+
+uint32_t schedRun(Sched *s) {
+	uint32_t now = micros();
+	uint32_t wait = 0xffffffff;
+
+	// until the next release of anything above the task looked at
+	int32_t room = 0x7fffffff;
+
+	for (uint8_t i = 0; i < s->count; i++) {
+		int32_t due = (int32_t) (s->tasks[i].release - now);
+
+		if (due <= 0 && (int32_t) s->tasks[i].budget <= room) {
+			run(s, i);
+			return 0;
+		}
+
+		if (due > 0 && (uint32_t) due < wait)
+			wait = due;
+		if (due < room)
+			room = due;
+	}
+
+	return wait;
+}
@@ -0,0 +1,58 @@
+#ifndef __sched_h
+#define __sched_h
+
+#include "Arduino.h"
+
+// a cooperative fixed rate scheduler for the main loop.
+//
+// each task runs every period, in priority order: the caller's table is
+// highest priority first. nothing's preempted, so a task only starts if it
+// fits, by its budget, before the next release of every task above it. then
+// the ones at the top run on time however slow the rest are, as long as
+// everything keeps to its budget: slow work is split into steps that do.
+//
+// a task that's started after its release is late by that much. one that's
+// still running, or hasn't started, by its next release has missed its
+// deadline, and a whole period missed is skipped rather than made up. one
+// that takes longer than its budget has overrun. micros() throughout
+
+typedef void (*SchedFn)();
+
+struct SchedTask {
+	SchedFn run;
+	uint32_t period;
+	uint32_t budget;    // the longest it should take
+
+	uint32_t release;   // when it's next due
+	uint32_t runs;
+	uint16_t misses;
+	uint16_t overruns;
+	uint32_t max_late;  // since the stats were last cleared
+	uint32_t max_time;
+};
+
+// for watching it run: each task as it finishes, and when it was due
+typedef void (*SchedTraceFn)(uint8_t task, uint32_t release, uint32_t start, uint32_t end);
+
+struct Sched {
+	SchedTask *tasks;
+	uint8_t count;
+	uint32_t busy;      // in tasks, since the stats were last cleared
+	uint32_t since;
+	SchedTraceFn trace;
+};
+
+// a task for the table: the rest's set by schedInit()
+#define SCHED_TASK(run, period, budget) { run, period, budget, 0, 0, 0, 0, 0, 0 }
+
+// all tasks are first due at now. a task may change its own period as it
+// runs: the next release is from the new one
+void schedInit(Sched *s, SchedTask *tasks, uint8_t count, uint32_t now);
+
+// runs the first task that's due and fits, if any. 0 if it ran one, or
+// how long until one could run
+uint32_t schedRun(Sched *s);
+
+void schedClearStats(Sched *s, uint32_t now);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <Servo.h>
 #include "logger.h"
+#include "profile.h"
 
 #define WINCH_PORT 11
 #define RUDDER_PORT 10
@@ -12,18 +13,57 @@
 #define SP_EN 25
 
 // degrees per second
-#define RUDDER_SPEED 300.0
-#define WINCH_SPEED 25.0
+#define RUDDER_SPEED 300
+#define WINCH_SPEED 25
+
+// ms to wait for the servo rail / servo enable line to come up
+#define POWER_UP_TIME 10
+
+// ms to keep a servo powered after it reaches its target
+#define SETTLE_TIME 150
 
 int heel_offset = 0;
 uint8_t current_rudder = 0;
 uint8_t current_winch = 0;
+uint8_t target_rudder = 0;
+uint8_t target_winch = 0;
 
 bool motor_running = false;
+bool rail_on = false;
+
+// the motor's brought up as a servo is, through SERVO_RAIL_UP: SERVO_ENABLE
+// is running. wanted by runMotor(), till stopMotor()
+servo_state motor_state = SERVO_IDLE;
+bool motor_wanted = false;
+uint32_t motor_since = 0;
 
 Servo sv_winch, sv_rudder;
 
+struct servo_channel {
+	Servo *servo;
+	uint8_t en_pin;
+	uint16_t speed;
+	uint8_t *position;
+	uint8_t *target;
+	servo_state state;
+	uint32_t since;
+	// the last step finished carry / speed ms after since
+	uint16_t carry;
+	uint16_t hold;
+};
+
+servo_channel rudder_ch = { &sv_rudder, RUDDER_EN, RUDDER_SPEED, &current_rudder, &target_rudder, SERVO_IDLE, 0, 0, SETTLE_TIME };
+servo_channel winch_ch = { &sv_winch, WINCH_EN, WINCH_SPEED, &current_winch, &target_winch, SERVO_IDLE, 0, 0, SETTLE_TIME };
+
 void servoInit() {
+	// from nothing powered, as after a reset; the host runs setup() again
+	rudder_ch.state = SERVO_IDLE;
+	winch_ch.state = SERVO_IDLE;
+	rail_on = false;
+	motor_state = SERVO_IDLE;
+	motor_wanted = false;
+	motor_running = false;
+
 	pinMode(SP_EN, OUTPUT);
 	digitalWrite(SP_EN, LOW);
 
@@ -40,25 +80,214 @@ void servoInit() {
 	sv_rudder.attach(RUDDER_PORT);
 }
 
+// the rail stays up while anything (servo or motor) still needs it
+void releaseRail() {
+	if (motor_state != SERVO_IDLE || rudder_ch.state != SERVO_IDLE || winch_ch.state != SERVO_IDLE)
+		return;
+
+	digitalWrite(SP_EN, LOW);
+	rail_on = false;
+}
+
+void enterState(servo_channel *ch, servo_state state, uint32_t now) {
+	ch->state = state;
+	ch->since = now;
+	ch->carry = 0;
+}
+
+void tickChannel(servo_channel *ch, uint32_t now) {
+	switch (ch->state) {
+		case SERVO_IDLE:
+			if (*ch->position == *ch->target)
+				return;
+
+			if (rail_on) {
+				digitalWrite(ch->en_pin, HIGH);
+				enterState(ch, SERVO_ENABLE, now);
+			} else {
+				digitalWrite(SP_EN, HIGH);
+				rail_on = true;
+				enterState(ch, SERVO_RAIL_UP, now);
+			}
+			break;
+
+		case SERVO_RAIL_UP:
+			if (now - ch->since < POWER_UP_TIME)
+				return;
+
+			digitalWrite(ch->en_pin, HIGH);
+			enterState(ch, SERVO_ENABLE, now);
+			break;
+
+		case SERVO_ENABLE:
+			if (now - ch->since < POWER_UP_TIME)
+				return;
+
+			// slew from when it was up, not from when we saw it
+			enterState(ch, SERVO_SLEWING, ch->since + POWER_UP_TIME);
+			break;
+
+		case SERVO_SLEWING: {
+			// first move after boot; we don't know where the servo is, so jump and wait out the full travel
+			if (*ch->position == 0) {
+				ch->servo->write(*ch->target);
+				ch->hold = SETTLE_TIME + 1000UL * *ch->target / ch->speed;
+				*ch->position = *ch->target;
+				enterState(ch, SERVO_SETTLING, now);
+				break;
+			}
+
+			int16_t remaining = *ch->target - *ch->position;
+			int32_t elapsed = (now - ch->since) * ch->speed - ch->carry;
+
+			if (elapsed < 1000)
+				return;
+
+			int16_t allowed = min(elapsed / 1000, (int32_t) 255);
+
+			int16_t step = min(abs(remaining), allowed);
+			*ch->position += remaining > 0 ? step : -step;
+			ch->servo->write(*ch->position);
+
+			if (*ch->position == *ch->target) {
+				ch->hold = SETTLE_TIME;
+				enterState(ch, SERVO_SETTLING, now);
+			} else {
+				// advance by exactly the steps taken, so the rate doesn't drift fast
+				uint32_t taken = 1000UL * step + ch->carry;
+				ch->since += taken / ch->speed;
+				ch->carry = taken % ch->speed;
+			}
+			break;
+		}
+
+		case SERVO_SETTLING:
+			// re-commanded before we powered down
+			if (*ch->position != *ch->target) {
+				enterState(ch, SERVO_SLEWING, now);
+				break;
+			}
+
+			if (now - ch->since < ch->hold)
+				return;
+
+			digitalWrite(ch->en_pin, LOW);
+			enterState(ch, SERVO_IDLE, now);
+			releaseRail();
+			break;
+	}
+}
+
+#ifdef NO_SAIL
+void tickMotor(uint32_t now) {
+	switch (motor_state) {
+		case SERVO_IDLE:
+			if (!motor_wanted)
+				return;
+
+			if (rail_on) {
+				digitalWrite(WINCH_EN, HIGH);
+				motor_running = true;
+				motor_state = SERVO_ENABLE;
+			} else {
+				digitalWrite(SP_EN, HIGH);
+				rail_on = true;
+				motor_state = SERVO_RAIL_UP;
+				motor_since = now;
+			}
+			break;
+
+		case SERVO_RAIL_UP:
+			if (now - motor_since < POWER_UP_TIME)
+				return;
+
+			digitalWrite(WINCH_EN, HIGH);
+			motor_running = true;
+			motor_state = SERVO_ENABLE;
+			break;
+
+		default:
+			break;
+	}
+}
+#endif
+
+void servoTick() {
+	uint32_t now = millis();
+
+	tickChannel(&rudder_ch, now);
+	tickChannel(&winch_ch, now);
+#ifdef NO_SAIL
+	tickMotor(now);
+#endif
+}
+
+boolean rudderSettled() {
+	return rudder_ch.state == SERVO_IDLE && current_rudder == target_rudder;
+}
+
+boolean winchSettled() {
+	return winch_ch.state == SERVO_IDLE && current_winch == target_winch;
+}
+
+boolean servosSettled() {
+	return rudderSettled() && winchSettled();
+}
+
+boolean railPowered() {
+	return rail_on;
+}
+
+// the enable line's up from SERVO_ENABLE till it's back to SERVO_IDLE
+boolean channelPowered(const servo_channel *ch) {
+	return ch->state != SERVO_IDLE && ch->state != SERVO_RAIL_UP;
+}
+
+boolean rudderPowered() {
+	return channelPowered(&rudder_ch);
+}
+
+boolean winchPowered() {
 #ifdef NO_SAIL
+	// the winch's enable line runs the motor
+	return false;
+#else
+	return channelPowered(&winch_ch);
+#endif
+}
+
+// blocks until all moves are done, and the motor's running if it's wanted.
+// only for the menu's paths that need them in place, never from loop()
+void waitForServos() {
+	while (!servosSettled() || motor_wanted != motor_running)
+		servoTick();
+}
+
+#ifdef NO_SAIL
+// it's running once servoTick() has the rail up, POWER_UP_TIME if it wasn't
 void runMotor() {
-	if (motor_running)
+	if (motor_wanted)
 		return;
 
-	digitalWrite(SP_EN, HIGH);
-	delay(10);
-	digitalWrite(WINCH_EN, HIGH);
-	motor_running = true;
+	motor_wanted = true;
+	servoTick();
 }
 
 void stopMotor() {
-	if (!motor_running)
+	if (!motor_wanted)
 		return;
 
-	digitalWrite(WINCH_EN, LOW);
-	digitalWrite(SP_EN, LOW);
+	motor_wanted = false;
+	if (motor_running)
+		digitalWrite(WINCH_EN, LOW);
 
 	motor_running = false;
+	motor_state = SERVO_IDLE;
+	releaseRail();
+}
+
+boolean motorRunning() {
+	return motor_running;
 }
 #endif
 
@@ -79,19 +308,11 @@ void winchTo(int value) {
 
 	logln(F("Winch to %d, constrained to %d"), value, v);
 
-	if (current_winch == v)
+	if (target_winch == v)
 		return;
 
-	digitalWrite(SP_EN, HIGH);
-	delay(10);
-	digitalWrite(WINCH_EN, HIGH);
-	delay(10);
-	sv_winch.write(v);
-	delay(1000 * (abs((current_winch - v))/WINCH_SPEED) + 150);
-	digitalWrite(WINCH_EN, LOW);
-	digitalWrite(SP_EN, LOW);
-
-	current_winch = v;
+	target_winch = v;
+	servoTick();
 }
 
 void normalizedWinchTo(int value) {
@@ -107,27 +328,15 @@ void rudderFromCenter(int value) {
 }
 
 void rudderTo(int value) {
+	PROFILE_SCOPE(PROF_RUDDER);
+
 	logln(F("Rudder to %d"), value);
 
 	int v = constrain(value + heel_offset, RUDDER_MIN, RUDDER_MAX);
 
-	if (current_rudder == v)
+	if (target_rudder == v)
 		return;
 
-	digitalWrite(SP_EN, HIGH);
-	delay(10);
-	digitalWrite(RUDDER_EN, HIGH);
-	delay(10);
-	sv_rudder.write(v);
-	delay(1000 * (abs((current_rudder - v))/RUDDER_SPEED) + 150);
-	digitalWrite(RUDDER_EN, LOW);
-
-#ifndef NO_SAIL
-	digitalWrite(SP_EN, LOW);
-#else
-	if (!motor_running)
-		digitalWrite(SP_EN, LOW);
-#endif
-
-	current_rudder = v;
+	target_rudder = v;
+	servoTick();
 }
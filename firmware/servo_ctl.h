@@ -1,7 +1,10 @@
 #ifndef __servo_ctl
 #define __servo_ctl
 
+// motor-only rig. define WITH_SAIL to build for the sail winch
+#ifndef WITH_SAIL
 #define NO_SAIL
+#endif
 
 #include "Arduino.h"
 
@@ -11,11 +14,36 @@
 #define WINCH_MAX 56
 #define WINCH_MIN 120
 
+// servo motion states. servos are moved asynchronously, driven by servoTick()
+enum servo_state {
+	SERVO_IDLE,      // unpowered, at target
+	SERVO_RAIL_UP,   // servo rail enabled, waiting for it to come up
+	SERVO_ENABLE,    // servo enabled, waiting for it to come up
+	SERVO_SLEWING,   // stepping towards target at the servo's speed
+	SERVO_SETTLING   // at target, holding power until it settles
+};
+
 extern int heel_offset;
+
+// position last written to the servo (follows the slew profile)
 extern uint8_t current_rudder;
 extern uint8_t current_winch;
 
+// commanded positions
+extern uint8_t target_rudder;
+extern uint8_t target_winch;
+
 void servoInit();
+void servoTick();
+boolean rudderSettled();
+boolean winchSettled();
+boolean servosSettled();
+
+// what's powered up, for the power's accounting (power.h)
+boolean railPowered();
+boolean rudderPowered();
+boolean winchPowered();
+void waitForServos();
 void centerWinch();
 void centerRudder();
 void winchTo(int value);
@@ -27,6 +55,7 @@ void rudderTo(int value);
 #ifdef NO_SAIL
 void runMotor();
 void stopMotor();
+boolean motorRunning();
 #endif
 
 #endif
@@ -0,0 +1,238 @@
+#include "tactics.h"
+
+// steps the best angles are looked for in, degrees
+#define BEST_STEP 2
+
+// they're looked for again when the wind's strength is this fraction off
+// what they were worked out for
+#define BEST_AGAIN 0.1
+
+// the polar's too steep, where the boat makes less than this fraction of
+// the wind, for its strength to be read off it
+#define STRENGTH_FROM 0.2
+
+static float wrap180(float v) {
+	return v - 360 * floor((v + 180) / 360);
+}
+
+static float wrap360(float v) {
+	return v - 360 * floor(v / 360);
+}
+
+void polarInit(Polar *p, const uint8_t *speed, uint16_t hull) {
+	memcpy(p->speed, speed, POLAR_BINS);
+	p->hull = hull;
+
+	for (uint8_t i = 0; i < POLAR_BINS; i++) {
+		float t = radians(i * POLAR_STEP);
+
+		p->apparent[i] = degrees(atan2(sin(t), cos(t) + speed[i] / 256.0));
+	}
+}
+
+float polarSpeed(const Polar *p, float angle) {
+	angle = constrain(angle, 0, 180);
+
+	uint8_t i = angle / POLAR_STEP;
+	if (i >= POLAR_BINS - 1)
+		return p->speed[POLAR_BINS - 1] / 256.0;
+
+	float f = (angle - i * POLAR_STEP) / POLAR_STEP;
+	return (p->speed[i] * (1 - f) + p->speed[i + 1] * f) / 256.0;
+}
+
+float polarTrue(const Polar *p, float apparent) {
+	for (uint8_t i = 0; i < POLAR_BINS - 1; i++) {
+		float a = p->apparent[i], b = p->apparent[i + 1];
+
+		if (apparent <= b && b > a)
+			return (i + constrain((apparent - a) / (b - a), 0, 1)) * POLAR_STEP;
+	}
+
+	return 180;
+}
+
+// boat speed at angle in the wind, fraction of the wind's, capped by the hull
+static float boatSpeed(const Polar *p, float angle, float strength) {
+	float f = polarSpeed(p, angle);
+
+	return strength > 0 ? min(f, p->hull / strength) : f;
+}
+
+void polarBest(const Polar *p, float strength, float *upwind, float *downwind) {
+	float up = 0, down = 0;
+
+	*upwind = 90;
+	*downwind = 180;
+
+	for (uint8_t a = BEST_STEP; a <= 180; a += BEST_STEP) {
+		float vmg = boatSpeed(p, a, strength) * cos(radians(a));
+
+		if (a <= 90 && vmg > up) {
+			up = vmg;
+			*upwind = a;
+		} else if (a > 90 && -vmg >= down) {
+			down = -vmg;
+			*downwind = a;
+		}
+	}
+}
+
+void tacticsInit(Tactics *t, const Polar *p) {
+	memset(t, 0, sizeof(*t));
+
+	polarBest(p, 0, &t->upwind, &t->downwind);
+}
+
+void tacticsPolar(Tactics *t, const Polar *p) {
+	polarBest(p, t->strength, &t->upwind, &t->downwind);
+	t->best_for = t->strength;
+}
+
+void tacticsMark(Tactics *t) {
+	t->leg = TACTICS_REACH;
+	t->last_turn = 0;
+}
+
+void tacticsWind(Tactics *t, const Polar *p, Bam heading, Bam apparent, uint16_t speed, uint32_t now) {
+	// the boat's still getting going after a turn
+	if (t->last_turn && now - t->last_turn < TACTICS_SETTLE)
+		return;
+
+	float off = wrap180(bamToDeg(apparent));
+	float beta = fabs(off);
+	float angle;
+
+	if (t->strength > 0) {
+		// the boat's motion taken back out of the apparent wind
+		float r = speed / t->strength;
+		angle = beta + degrees(asin(constrain(r * sin(radians(beta)), -1, 1)));
+		angle = min(angle, 180);
+	} else
+		angle = polarTrue(p, beta);
+
+	float wind = wrap360(bamToDeg(heading) + (off < 0 ? -angle : angle));
+	float dt = now - t->time;
+
+	if (!t->started) {
+		t->wind = wind;
+		t->mean_wind = wind;
+		t->started = true;
+	} else {
+		t->wind = wrap360(t->wind + min(dt / TACTICS_WIND_TIME, 1) * wrap180(wind - t->wind));
+		t->mean_wind = wrap360(t->mean_wind + min(dt / TACTICS_MEAN_TIME, 1) * wrap180(t->wind - t->mean_wind));
+	}
+
+	t->time = now;
+
+	// the wind's strength, from how fast the polar says the boat should go.
+	// at the hull's speed, it's only at least that
+	float f = polarSpeed(p, angle);
+	if (speed >= TACTICS_STALL_SPEED && f >= STRENGTH_FROM) {
+		float strength = speed / f;
+
+		if (!t->strength)
+			t->strength = strength;
+		else if (speed < p->hull * 0.9 || strength > t->strength)
+			t->strength += min(dt / TACTICS_STRENGTH_TIME, 1) * (strength - t->strength);
+	}
+
+	if (t->strength > 0 && fabs(t->strength - t->best_for) > t->best_for * BEST_AGAIN) {
+		polarBest(p, t->strength, &t->upwind, &t->downwind);
+		t->best_for = t->strength;
+	}
+}
+
+static void turn(Tactics *t, uint8_t reason, uint32_t now) {
+	t->side = -t->side;
+	t->reason = reason;
+	t->last_turn = now;
+	t->turns++;
+}
+
+Bam tacticsCourse(Tactics *t, Bam heading, Bam bearing, float distance, Bam leg, const Guide *g,
+	uint16_t speed, uint16_t cost, uint32_t now) {
+	if (!t->started)
+		return leg;
+
+	// where the mark is, off the wind, and the bow
+	float mark = wrap180(bamToDeg(bearing) - t->wind);
+	float off = fabs(mark);
+	float bow = wrap180(bamToDeg(heading) - t->wind);
+	int8_t bow_side = bow < 0 ? -1 : 1;
+
+	// not in the middle of a turn, and not going fast enough to start one
+	boolean settled = !t->last_turn || now - t->last_turn >= TACTICS_SETTLE;
+	boolean slow = speed < TACTICS_MIN_TACK_SPEED;
+
+	uint8_t was = t->leg;
+
+	if (off < t->upwind + (was == TACTICS_BEAT ? TACTICS_OVERSTAND : 0))
+		t->leg = TACTICS_BEAT;
+	else if (t->downwind < 180 && off > t->downwind - (was == TACTICS_RUN ? TACTICS_OVERSTAND : 0))
+		t->leg = TACTICS_RUN;
+	else
+		t->leg = TACTICS_REACH;
+
+	// past the layline, but too slow to tack: on till it's going
+	if (was == TACTICS_BEAT && t->leg == TACTICS_REACH && slow && (mark < 0 ? -1 : 1) != t->side)
+		t->leg = TACTICS_BEAT;
+
+	if (t->leg == TACTICS_REACH) {
+		// past the layline: fetching the mark on the other tack
+		if (was != TACTICS_REACH && (mark < 0 ? -1 : 1) != t->side) {
+			turn(t, TACTICS_LAYLINE, now);
+			t->side = 0;
+		}
+
+		// the leg, if it can be sailed; straight for the mark if not
+		Bam to = leg;
+		float course = wrap180(bamToDeg(leg) - t->wind);
+		if (fabs(course) < t->upwind || fabs(course) > t->downwind) {
+			to = bearing;
+			course = mark;
+		}
+
+		// that's through the wind, and it's too slow to get round: off
+		// the wind on the side it's on until it's going
+		if (slow && settled && (course < 0) != (bow < 0) && fabs(course) + fabs(bow) < 180)
+			return bamDeg(t->wind + bow_side * (t->upwind + TACTICS_STALL_BEAR_AWAY));
+
+		return to;
+	}
+
+	float angle = t->leg == TACTICS_BEAT ? t->upwind : t->downwind;
+
+	// whichever side it's on to start with: either will do, and the
+	// layline's soon enough to tack. stopped, the wind may have pushed it
+	// onto the other tack
+	if (was != t->leg)
+		t->side = bow_side;
+	else if (t->leg == TACTICS_BEAT && speed < TACTICS_STALL_SPEED && settled && fabs(bow) < t->upwind)
+		t->side = bow_side;
+	else if (!slow && (!t->last_turn || now - t->last_turn >= TACTICS_MIN_TURN)) {
+		float heading = t->wind + t->side * angle;
+		float vmg = fabs(cos(radians(angle)));
+
+		// how far the wind's swung against this tack: headed beating, lifted
+		// running
+		float shift = wrap180(t->wind - t->mean_wind) * t->side * (t->leg == TACTICS_BEAT ? 1 : -1);
+
+		if (g && labs(g->xte) > TACTICS_CORRIDOR * 100L && (g->xte > 0) == (wrap180(heading - bamToDeg(g->course)) > 0))
+			turn(t, TACTICS_CORRIDOR_EDGE, now);
+		else if (shift > TACTICS_MIN_SHIFT) {
+			// seconds the shift's good for, and the vmg the other tack
+			// gains over this one in that time, per unit of boat speed
+			float horizon = min(distance * 100 / (speed * vmg), TACTICS_HORIZON / 1000.0);
+			float gain = 2 * sin(radians(angle)) * sin(radians(shift)) * horizon;
+
+			if (gain > cost * vmg)
+				turn(t, TACTICS_SHIFT, now);
+		}
+	}
+
+	if (t->leg == TACTICS_BEAT && speed < TACTICS_STALL_SPEED)
+		angle += TACTICS_STALL_BEAR_AWAY;
+
+	return bamDeg(t->wind + t->side * angle);
+}
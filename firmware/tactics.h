@@ -0,0 +1,140 @@
+#ifndef __tactics_h
+#define __tactics_h
+
+#include "Arduino.h"
+#include "bam.h"
+#include "guide.h"
+
+// when to tack and gybe, planned off the boat's polar.
+//
+// the polar is the boat's speed as a fraction of the true wind's, every
+// POLAR_STEP degrees of true wind angle, up to what the hull will do. from
+// it, and the wind's strength, come the angles that make the most good
+// towards the wind and away from it (vmg). with the mark closer to the wind
+// than the upwind angle the boat beats, one tack or the other at that angle;
+// further downwind than the downwind angle, it runs in gybes; in between it
+// sails the leg.
+//
+// beating or running, it stays on the tack it's on until:
+//
+//   - the mark's past the layline: the other tack fetches it, with a little
+//     to spare, and it's sailed straight there
+//   - a shift heads it: the true wind's swung against this tack, away from
+//     its mean, by enough that the other tack's vmg over the time left to
+//     the mark (or TACTICS_HORIZON, whichever's less) pays for the tack
+//   - it's over the side of the corridor either side of the leg, heading
+//     further out
+//
+// but never sooner than TACTICS_MIN_TURN after the last, or too slow to
+// make it round. stalled on a beat, it bears away to build speed.
+//
+// the vane only gives the apparent wind, and there's no wind speed sensor.
+// knowing the wind's strength, the true wind's worked out from the apparent
+// wind and the boat's speed. the wind's strength is worked back from the
+// boat's speed and the polar, while the boat's under its hull speed; at it,
+// it only says the wind's at least that strong. before there's any strength
+// to go on, the apparent wind the polar implies (at true wind angle t, the
+// boat makes p(t) of the wind's speed, so it's atan2(sin t, cos t + p(t)))
+// is read backwards instead. none of that holds while the boat's getting
+// back up to speed, so the wind isn't followed for a while after a turn.
+//
+// degrees and floats: it runs once a pilot pass, off the steering loop
+
+#define POLAR_STEP 15
+#define POLAR_BINS (180 / POLAR_STEP + 1)
+
+// degrees past the layline before the other tack's taken
+#define TACTICS_OVERSTAND 5
+
+// m either side of the leg
+#define TACTICS_CORRIDOR 80
+
+// degrees off its mean the wind has to be before it counts as a shift
+#define TACTICS_MIN_SHIFT 8
+
+// ms: fastest the boat's let tack or gybe again, and how long after one
+// before the true wind's followed again
+#define TACTICS_MIN_TURN 20000
+#define TACTICS_SETTLE 8000
+
+// ms: how long a shift's counted on to last, at most
+#define TACTICS_HORIZON 120000
+
+// ms: how fast the true wind's followed, how slowly its mean and strength
+// move
+#define TACTICS_WIND_TIME 5000
+#define TACTICS_MEAN_TIME 120000
+#define TACTICS_STRENGTH_TIME 30000
+
+// cm/s: below this, no tacking (about 1.5kt); below this, bear away to get going
+#define TACTICS_MIN_TACK_SPEED 75
+#define TACTICS_STALL_SPEED 25
+
+// degrees further off the wind when stalled
+#define TACTICS_STALL_BEAR_AWAY 20
+
+#define TACTICS_REACH 0
+#define TACTICS_BEAT 1
+#define TACTICS_RUN 2
+
+// why the last turn was made
+#define TACTICS_LAYLINE 1
+#define TACTICS_SHIFT 2
+#define TACTICS_CORRIDOR_EDGE 3
+
+struct Polar {
+	uint8_t speed[POLAR_BINS];      // fraction of the true wind's speed, 1/256
+	uint16_t hull;                  // cm/s, the most the boat will do
+	float apparent[POLAR_BINS];     // apparent wind angle at each
+};
+
+struct Tactics {
+	float wind;           // true wind direction, from
+	float mean_wind;
+	float strength;       // cm/s, 0 till it's known
+	float upwind;         // best vmg true wind angles in it
+	float downwind;
+	float best_for;       // the strength they were worked out for
+	uint32_t time;        // millis() the wind was last followed
+	boolean started;
+
+	uint8_t leg;          // TACTICS_REACH, _BEAT or _RUN
+	int8_t side;          // beating or running: the heading's the wind + side * the angle
+	uint32_t last_turn;   // millis() of the last tack or gybe, 0 for none yet
+	uint8_t reason;       // of the last
+	uint16_t turns;
+};
+
+// speed: POLAR_BINS, 1/256 of the true wind's
+void polarInit(Polar *p, const uint8_t *speed, uint16_t hull);
+
+// fraction of the wind's speed at a true wind angle (degrees, [0, 180])
+float polarSpeed(const Polar *p, float angle);
+
+// a true wind angle from an apparent one, both [0, 180], by the polar alone
+float polarTrue(const Polar *p, float apparent);
+
+// the best vmg true wind angles in a wind of strength (cm/s, 0 for not
+// known: as if the hull had no limit)
+void polarBest(const Polar *p, float strength, float *upwind, float *downwind);
+
+void tacticsInit(Tactics *t, const Polar *p);
+
+// the polar's changed: the best angles are worked out from it again
+void tacticsPolar(Tactics *t, const Polar *p);
+
+// a new mark: the next tack's chosen afresh, and can be made straight away
+void tacticsMark(Tactics *t);
+
+// a pilot pass's wind: the boat's heading, the apparent wind off the bow
+// (clockwise, from) and speed (cm/s), at now (millis())
+void tacticsWind(Tactics *t, const Polar *p, Bam heading, Bam apparent, uint16_t speed, uint32_t now);
+
+// the heading to steer, from heading, for a mark bearing bearing, distance
+// (m) off. leg's the course that follows the leg to it, and g the leg (NULL
+// if there's no line to keep near). cost is the seconds a tack or gybe is
+// reckoned to lose
+Bam tacticsCourse(Tactics *t, Bam heading, Bam bearing, float distance, Bam leg, const Guide *g,
+	uint16_t speed, uint16_t cost, uint32_t now);
+
+#endif
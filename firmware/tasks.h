@@ -0,0 +1,20 @@
+#ifndef __tasks_h
+#define __tasks_h
+
+// the scheduler's tasks, in the order of the table in firmware.ino, so they
+// can be looked up by name (tasks[TASK_WIND]) when one changes its period or
+// is run early
+enum TaskId {
+	TASK_AHRS,
+	TASK_PILOT,
+	TASK_WIND,
+	TASK_GPS,
+	TASK_MENU,
+	TASK_TRIM,
+	TASK_DATA,
+	TASK_BATTERY,
+	TASK_REPORT,
+	TASK_COUNT
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "telemetry.h"
+
+// what the receiver holds after the last frame; deltas are taken against it
+int32_t tm_last[TM_FIELD_COUNT];
+uint16_t tm_last_mask = 0;
+uint8_t tm_seq = 0;
+uint8_t tm_since_key = TM_KEYFRAME_EVERY;
+
+uint8_t putVarint(uint8_t *out, uint8_t n, int32_t v) {
+	// zigzag, so small negative deltas stay small
+	uint32_t z = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+
+	while (z >= 0x80) {
+		out[n++] = z | 0x80;
+		z >>= 7;
+	}
+	out[n++] = z;
+
+	return n;
+}
+
+void telemetrySend(Print &out, const int32_t *values, uint16_t mask) {
+	uint8_t frame[TM_MAX_FRAME];
+	bool key = mask != tm_last_mask || tm_since_key >= TM_KEYFRAME_EVERY;
+
+	uint8_t n = 2;
+	frame[n++] = tm_seq++;
+	frame[n++] = key ? TM_KEYFRAME : 0;
+	frame[n++] = mask;
+	frame[n++] = mask >> 8;
+
+	for (uint8_t i = 0; i < TM_FIELD_COUNT; i++) {
+		if (!(mask & (1U << i)))
+			continue;
+
+		n = putVarint(frame, n, key ? values[i] : values[i] - tm_last[i]);
+		tm_last[i] = values[i];
+	}
+
+	frame[0] = TM_SYNC;
+	frame[1] = n - 2;
+
+	uint16_t crc = 0xffff;
+	for (uint8_t i = 1; i < n; i++)
+		crc = telemetryCrc(crc, frame[i]);
+
+	frame[n++] = crc;
+	frame[n++] = crc >> 8;
+
+	out.write(frame, n);
+
+	tm_last_mask = mask;
+	tm_since_key = key ? 1 : tm_since_key + 1;
+}
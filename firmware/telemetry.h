@@ -0,0 +1,61 @@
+#ifndef __telemetry_h
+#define __telemetry_h
+
+#include "Arduino.h"
+
+// binary telemetry frames, an alternative to printDataLine()'s text:
+//
+//   sync(1) len(1) seq(1) flags(1) fields(2) values(...) crc(2)
+//
+// len counts seq through values. fields is a mask of the telemetry_field
+// values that follow, in order, as zigzag varints. keyframes carry the values
+// themselves; other frames the change since the previous frame. crc is
+// crc16-ccitt over len through values, little endian like the rest
+
+#define TM_SYNC 0xa5
+#define TM_KEYFRAME 0x01
+
+// a keyframe at least this often, so a receiver that lost a frame catches up
+#define TM_KEYFRAME_EVERY 16
+
+// sync + len + seq + flags + fields + 16 varints of up to 5 bytes + crc
+#define TM_MAX_FRAME 88
+
+enum telemetry_field {
+	TM_LAT,            // degrees * 1e6
+	TM_LON,            // degrees * 1e6
+	TM_GPS_AGE,        // ms
+	TM_SPEED,          // knots * 100
+	TM_COURSE,         // degrees * 10
+	TM_HEADING,        // degrees * 10
+	TM_REQUESTED,      // degrees * 10
+	TM_ROLL,           // degrees * 10
+	TM_HEEL_ADJUST,    // degrees * 10
+	TM_WIND,           // degrees
+	TM_WP_HEADING,     // degrees * 10
+	TM_WP_DISTANCE,    // meters * 10
+	TM_RUDDER,         // servo degrees
+	TM_WINCH,          // servo degrees
+	TM_VOLTAGE,        // volts * 100
+	TM_CYCLE,
+	TM_FIELD_COUNT
+};
+
+#define TM_ALL_FIELDS 0xffff
+
+// the divisor that takes each field back to its unit
+#define TM_SCALES { 1e6, 1e6, 1, 100, 10, 10, 10, 10, 10, 1, 10, 10, 1, 1, 100, 1 }
+
+inline uint16_t telemetryCrc(uint16_t crc, uint8_t b) {
+	crc ^= (uint16_t)b << 8;
+	for (uint8_t i = 0; i < 8; i++)
+		crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+
+	return crc;
+}
+
+// sends one frame of the fields in mask. values holds all TM_FIELD_COUNT
+// fields, scaled as above
+void telemetrySend(Print &out, const int32_t *values, uint16_t mask);
+
+#endif
@@ -0,0 +1,109 @@
+#include "trail.h"
+#include "trig_fix.h"
+
+static Bam circleMean(float s, float c) {
+	return bamRad(atan2(s, c));
+}
+
+void trailInit(AngleTrail *t, AngleCmp *samples, uint16_t length, float angle) {
+	float s = sin(angle);
+	float c = cos(angle);
+
+	for (uint16_t i = 0; i < length; i++) {
+		samples[i].s = s;
+		samples[i].c = c;
+	}
+
+	t->samples = samples;
+	t->length = length;
+	t->next = 0;
+	t->s = s * length;
+	t->c = c * length;
+	t->fresh_s = 0;
+	t->fresh_c = 0;
+}
+
+Bam trailAdd(AngleTrail *t, float angle) {
+	AngleCmp *old = &t->samples[t->next];
+	float s = sin(angle);
+	float c = cos(angle);
+
+	t->s += s - old->s;
+	t->c += c - old->c;
+	old->s = s;
+	old->c = c;
+
+	t->fresh_s += s;
+	t->fresh_c += c;
+
+	if (++t->next == t->length) {
+		// every sample in the window went in since the last wrap
+		t->next = 0;
+		t->s = t->fresh_s;
+		t->c = t->fresh_c;
+		t->fresh_s = 0;
+		t->fresh_c = 0;
+	}
+
+	return circleMean(t->s, t->c);
+}
+
+void trailFixInit(AngleTrailFix *t, AngleCmpFix *samples, uint16_t length, float angle) {
+	Bam a = bamRad(angle);
+	int16_t s = _cos_fix(a.v + 0xc000);
+	int16_t c = _cos_fix(a.v);
+
+	for (uint16_t i = 0; i < length; i++) {
+		samples[i].s = s;
+		samples[i].c = c;
+	}
+
+	t->samples = samples;
+	t->length = length;
+	t->next = 0;
+	t->mean = a;
+	t->s = (int32_t) s * length;
+	t->c = (int32_t) c * length;
+
+	// _cos_fix is within +-2^14, _atan2_fix wants +-32767
+	t->shift = 0;
+	while ((((int32_t) length << 14) >> t->shift) > 32767)
+		t->shift++;
+}
+
+Bam trailFixAdd(AngleTrailFix *t, float angle) {
+	AngleCmpFix *old = &t->samples[t->next];
+	Bam a = bamRad(angle);
+	int16_t s = _cos_fix(a.v + 0xc000);
+	int16_t c = _cos_fix(a.v);
+
+	t->s += s - old->s;
+	t->c += c - old->c;
+	old->s = s;
+	old->c = c;
+
+	if (++t->next == t->length)
+		t->next = 0;
+
+	int16_t y = t->s >> t->shift;
+	int16_t x = t->c >> t->shift;
+
+	if (x != 0 || y != 0)
+		t->mean = bamRaw(_atan2_fix(y, x));
+
+	return t->mean;
+}
+
+void emaInit(AngleEma *e, float alpha, float angle) {
+	e->alpha = alpha;
+	e->s = sin(angle);
+	e->c = cos(angle);
+}
+
+Bam emaAdd(AngleEma *e, float angle) {
+	// the sums decay rather than accumulate, so there's nothing to drift
+	e->s += e->alpha * (sin(angle) - e->s);
+	e->c += e->alpha * (cos(angle) - e->c);
+
+	return circleMean(e->s, e->c);
+}
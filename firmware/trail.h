@@ -0,0 +1,59 @@
+#ifndef __trail_h
+#define __trail_h
+
+#include "Arduino.h"
+#include "ahrs.h"
+#include "bam.h"
+
+// circular means of the last few angles (radians in, binary angles out),
+// for smoothing heading and wind without tripping over 0/360.
+//
+// the windowed trails keep running sums of the samples' sines and cosines, so
+// an update costs the same whatever the window length: take the oldest sample
+// out, put the new one in. the caller owns the sample buffer.
+
+// float sums. rounding error in the running sums is dropped once per pass
+// round the window, by swapping in sums rebuilt as the samples went in
+struct AngleTrail {
+	AngleCmp *samples;
+	uint16_t length;
+	uint16_t next;
+	float s, c;
+	float fresh_s, fresh_c;
+};
+
+void trailInit(AngleTrail *t, AngleCmp *samples, uint16_t length, float angle);
+Bam trailAdd(AngleTrail *t, float angle);
+
+// fixed point: samples from trig_fix's _cos_fix, integer sums (which don't
+// drift), mean from _atan2_fix
+struct AngleCmpFix {
+	int16_t s;
+	int16_t c;
+};
+
+struct AngleTrailFix {
+	AngleCmpFix *samples;
+	uint16_t length;
+	uint16_t next;
+	uint8_t shift;      // brings the sums into _atan2_fix's 16 bits
+	Bam mean;           // kept for when the samples cancel out
+	int32_t s, c;
+};
+
+void trailFixInit(AngleTrailFix *t, AngleCmpFix *samples, uint16_t length, float angle);
+Bam trailFixAdd(AngleTrailFix *t, float angle);
+
+// exponentially weighted: no buffer, the newest sample weighs alpha.
+// EMA_ALPHA(n) gives about the same lag as a window of n
+#define EMA_ALPHA(n) (2.0 / ((n) + 1))
+
+struct AngleEma {
+	float alpha;
+	float s, c;
+};
+
+void emaInit(AngleEma *e, float alpha, float angle);
+Bam emaAdd(AngleEma *e, float angle);
+
+#endif
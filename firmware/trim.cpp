@@ -0,0 +1,111 @@
+#include "trim.h"
+#include "servo_ctl.h"
+
+static float wrap180(float v) {
+	return v - 360 * floor((v + 180) / 360);
+}
+
+static uint8_t angleBin(float angle) {
+	return min((uint8_t) (fabs(angle) / POLAR_STEP + 0.5), POLAR_BINS - 1);
+}
+
+void trimInit(Trim *t) {
+	memset(t, 0, sizeof(*t));
+	t->limit = WINCH_MAX;
+	t->hold = -1;
+	t->first = 1;
+}
+
+// where the winch goes for the hold it's on
+static void startHold(Trim *t) {
+	int8_t side = t->hold == 0 ? t->first : -t->first;
+
+	t->winch = t->base + side * TRIM_DITHER;
+	t->since = 0;
+	t->sum = 0;
+	t->samples = 0;
+}
+
+static void startPair(Trim *t, uint8_t sheet, float angle) {
+	// both sides inside the limit and the winch's travel
+	int16_t lowest = ceil(t->limit) + TRIM_DITHER;
+
+	t->sheet = sheet;
+	t->bin = angleBin(angle);
+	t->base = constrain(sheet + t->offset[t->bin], min(lowest, WINCH_MIN - TRIM_DITHER), WINCH_MIN - TRIM_DITHER);
+	t->angle = angle;
+	t->hold = 0;
+	startHold(t);
+}
+
+// the pair's done: towards whichever side was faster
+static void endPair(Trim *t) {
+	float eased = t->first > 0 ? t->speed[0] : t->speed[1];
+	float hauled = t->first > 0 ? t->speed[1] : t->speed[0];
+	float step = constrain(TRIM_GAIN * 2 * (eased - hauled) / (eased + hauled), -TRIM_DITHER, TRIM_DITHER);
+
+	t->offset[t->bin] = constrain(t->base + round(step) - t->sheet, -TRIM_RANGE, TRIM_RANGE);
+	t->first = -t->first;
+	t->hold = -1;
+	t->pairs++;
+}
+
+uint8_t trimSheet(Trim *t, uint8_t sheet, float angle, float heel, uint16_t speed, uint32_t fix,
+	uint8_t winch, uint32_t now) {
+	float dt = t->time ? now - t->time : 0;
+	t->time = now;
+
+	t->limit = max(t->limit - TRIM_RELAX * dt / 1000, WINCH_MAX);
+
+	// heeled too far: out from wherever the winch has got to, and no
+	// further in than that for now
+	if (fabs(heel) > TRIM_MAX_HEEL) {
+		t->limit = max(t->limit, min(winch + TRIM_EASE, WINCH_MIN));
+		t->hold = -1;
+	}
+
+	if (fabs(wrap180(angle - t->angle)) > TRIM_STEADY) {
+		t->angle = angle;
+		t->steady = now;
+		t->hold = -1;
+	}
+
+	if (speed < TRIM_STALL_SPEED)
+		t->hold = -1;
+
+	if (t->hold < 0) {
+		if (speed < TRIM_STALL_SPEED || now - t->steady < TRIM_SETTLE)
+			return constrain(sheet + t->offset[angleBin(angle)], ceil(t->limit), WINCH_MIN);
+
+		startPair(t, sheet, angle);
+	}
+
+	if (!t->since) {
+		if (winch == t->winch)
+			t->since = now;
+	} else if (now - t->since >= TRIM_SETTLE) {
+		if (fix != t->fix) {
+			t->fix = fix;
+			t->sum += speed;
+			t->samples++;
+		}
+
+		if (now - t->since >= TRIM_SETTLE + TRIM_MEASURE) {
+			if (!t->samples)
+				t->hold = -1;
+			else {
+				t->speed[t->hold] = t->sum / t->samples;
+
+				if (t->hold == 0) {
+					t->hold = 1;
+					startHold(t);
+				} else {
+					endPair(t);
+					startPair(t, sheet, angle);
+				}
+			}
+		}
+	}
+
+	return t->hold >= 0 ? t->winch : constrain(sheet + t->offset[angleBin(angle)], ceil(t->limit), WINCH_MIN);
+}
@@ -0,0 +1,94 @@
+#ifndef __trim_h
+#define __trim_h
+
+#include "Arduino.h"
+#include "tactics.h"
+
+// the sheet, trimmed by what makes the boat go fastest (extremum seeking).
+//
+// the sheet's held a little either side of where it's trimmed to,
+// TRIM_DITHER each way: eased then hauled in, then hauled in then eased,
+// and so on. each hold waits for the winch to get there and the boat to
+// settle, then takes the mean of the gps speed over TRIM_MEASURE. after
+// each pair, the trim moves towards the faster side, by the difference
+// over the mean speed times TRIM_GAIN, at most TRIM_DITHER. taking the
+// pairs in turns the other way round, a steady rise or fall in the wind
+// counts for one side then the other.
+//
+// the trim's kept as an offset from the sheet the caller would set
+// without it (the wind angle's), one for each of the polar's angles, so
+// it's picked up again on either tack, or coming back to a course. a
+// pair's only started once the true wind angle's held within TRIM_STEADY
+// for TRIM_SETTLE, and dropped if it moves further than that, or the
+// boat's stalled: till then the sheet's left at the trim.
+//
+// the heel's a hard limit: past TRIM_MAX_HEEL, the sheet's eased by
+// TRIM_EASE straight away, and can't be hauled back in past there. the
+// limit's let off again TRIM_RELAX a second.
+//
+// winch positions are WINCH_MAX hauled in to WINCH_MIN eased (servo_ctl.h)
+
+// winch positions either side of the trim
+#define TRIM_DITHER 4
+
+// ms after the winch gets there before the speed's taken, and how long
+// it's taken over
+#define TRIM_SETTLE 6000
+#define TRIM_MEASURE 6000
+
+// winch positions per unit of relative speed difference
+#define TRIM_GAIN 12
+
+// most the trim can be off the sheet it's given, winch positions
+#define TRIM_RANGE 32
+
+// degrees of true wind angle a pair's measured over, at most
+#define TRIM_STEADY 10
+
+// heel, degrees, and winch positions it's eased by past it; and how fast
+// (winch positions a second) it's let back in
+#define TRIM_MAX_HEEL 30
+#define TRIM_EASE 6
+#define TRIM_RELAX 1
+
+// cm/s: too slow for the speed to say anything
+#define TRIM_STALL_SPEED 25
+
+struct Trim {
+	int8_t offset[POLAR_BINS];    // winch positions from the sheet given
+	float limit;          // most hauled in it's let go, winch position
+
+	// the pair under way: the sheet it was given, the trim it's measured
+	// either side of, the hold it's on (0 or 1, -1 for none), and which side
+	// went first (1 eased)
+	uint8_t sheet;
+	uint8_t base;
+	uint8_t bin;
+	int8_t hold;
+	int8_t first;
+	float angle;          // the true wind angle it's measured at
+	uint32_t steady;      // since when it's been near it
+
+	// the hold: what the winch was sent to, since when it's been there (0
+	// for not yet), and the speed over it
+	uint8_t winch;
+	uint32_t since;
+	uint32_t fix;
+	float sum;
+	uint8_t samples;
+	float speed[2];
+
+	uint32_t time;        // last trimSheet()
+	uint16_t pairs;
+};
+
+void trimInit(Trim *t);
+
+// the winch position to send the winch to. sheet is where it'd be without
+// trimming, angle the true wind angle (degrees), heel the roll (degrees),
+// speed the gps speed (cm/s) at fix (millis() of it), winch where the winch
+// is now
+uint8_t trimSheet(Trim *t, uint8_t sheet, float angle, float heel, uint16_t speed, uint32_t fix,
+	uint8_t winch, uint32_t now);
+
+#endif
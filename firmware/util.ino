@@ -1,54 +1,10 @@
+// through a binary angle, so any number of turns comes back into the circle
 float toCircle(float value) {
-    if (value > 2.0 * PI)
-        return value - (2.0 * PI);
-    if (value < 0)
-      return value + 2.0 * PI;
-        
-    return value;
+    return bamToRad(bamRad(value));
 }
 
 float toCircleDeg(float value) {
-    if (value > 360.0)
-        return value - 360.0;
-    if (value < 0)
-      return value + 360.0;
-        
-    return value;
-}
-
-boolean isPast(int start, int amount, int check, boolean clockwise) {
-    float v = angleDiff(start+amount, check, true);
-    
-    if (clockwise)
-        return v > amount;
-    
-    return -v > amount;
-}
-
-// if sign is true, then the value returned will be signed. the sign will be negative if a1 is > a2
-float angleDiff(float a1, float a2, boolean sign) {
-  // 232, 163
-    float larger, smaller, mult;
-    if (a1 > a2) {
-      larger = a1;
-      smaller = a2;
-          mult = -1;
-    } else {
-      larger = a2;
-      smaller = a1;
-          mult = 1;
-    }
-    // 69
-    float d = larger - smaller;
-    if (d > 180.0) {
-        d = 360.0 - d;
-        mult *= -1;
-    }
-
-    if (!sign)
-        mult = 1.0;
-
-    return mult * d;
+    return bamToDeg(bamDeg(value));
 }
 
 void blink(uint8_t pin, uint8_t duration, uint8_t count, uint8_t finalState) {
@@ -70,9 +26,9 @@ int fracPart(float f, int precision)
 }
 
 bool waitForData(int timeout) {
-	long t = millis();
+	uint32_t t = millis();
 	
-	while (!Serial.available() && millis() - t < timeout)
+	while (!Serial.available() && millis() - t < (uint32_t) timeout)
         delay(10);
         
 	if (!Serial.available())
@@ -81,13 +37,8 @@ bool waitForData(int timeout) {
 	return true;
 }
 
+// asleep, but with the clock, the serial ports and the servos still going
+// (power.h)
 void sleepMillis(int amount) {
-#ifdef LOW_POWER_SLEEP
-	int sleeps = amount / 2000; // max sleep time is 2s, so this is the number of times we'll have to sleep
-
-	while (sleeps-- > 0)
-		LowPower.powerDown(SLEEP_2S, ADC_OFF, BOD_OFF);
-#else
-  delay(amount);
-#endif
+	powerSleep((uint32_t) amount * 1000);
 }
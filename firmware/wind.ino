@@ -6,8 +6,8 @@
 #define SIGN_SHIFT 500
 #define SENSOR_OFFSET 180.0
 
+// read back to back, the sensor's settled by then
 #define WIND_ITERATIONS 2
-#define WIND_PAUSES 5
 
 #include "trig_fix.h"
 
@@ -16,9 +16,13 @@ void windInit() {
     digitalWrite(WIND_EN, HIGH);
 }
 
-float readSteadyWind() {
+// the sensor needs WIND_SETTLE ms powered up before windSample()
+void windPowerUp() {
     digitalWrite(WIND_EN, LOW);
-    delay(50);
+}
+
+float windSample() {
+    PROFILE_SCOPE(PROF_WIND);
 
     uint16_t ws1 = 0;
     uint16_t ws2 = 0;
@@ -26,11 +30,18 @@ float readSteadyWind() {
     for (int i=0; i<WIND_ITERATIONS; i++) {
         ws1 += analogRead(WS1);
         ws2 += analogRead(WS2);
-        delay(WIND_PAUSES);
     }
 
     digitalWrite(WIND_EN, HIGH);
 
     return toCircle(-atan2(ws1 / ((float) WIND_ITERATIONS) - SIGN_SHIFT, ws2 / ((float) WIND_ITERATIONS) - SIGN_SHIFT) - (SENSOR_OFFSET * PI / 180.0) + PI);
 }
+
+// waits for it: only for setup()
+float readSteadyWind() {
+    windPowerUp();
+    delay(WIND_SETTLE);
+
+    return windSample();
+}
 #endif
@@ -0,0 +1,560 @@
+/*
+ * ahrsbench.cpp: mahony.h's fixed point attitude filter against the same
+ * filter in double precision, on IMU traces.
+ *
+ * A trace is raw gyro, accel and mag at a fixed rate, in the MPU's axes (x
+ * forward, y to port, z up), with the true attitude after each sample if
+ * it's known. Without -f one is generated: a boat holding a course with
+ * tacks, rolling and pitching in a seaway, seen by a gyro with bias and
+ * noise, an accel shaken by the waves and a noisy mag, with the motor
+ * running for a while every so often and throwing the mag off.
+ *
+ * Each filter's heading, pitch and roll are checked against the truth (rms
+ * and worst, in degrees; heading also just while the motor's running), and
+ * the fixed point filter against the double one. "compass" is heading from
+ * each sample's accel and mag alone, the way ahrs.cpp's heading() does it.
+ * Times are host nanoseconds per update.
+ *
+ * usage: ardusailor_ahrsbench [-t seconds] [-f trace] [-w trace] [-r seed]
+ *   -f trace      run on a recorded trace instead: a csv of time (us), gx,
+ *                 gy, gz, ax, ay, az, mx, my, mz and optionally the true
+ *                 heading, pitch and roll in degrees
+ *   -w trace      write the generated trace out in the same format
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "mahony.h"
+
+#define RATE 100
+#define GYRO_LSB (1 / 131.0)   // +-250 degrees/s
+#define ACC_1G 16384           // +-2g
+
+// the field at the boat: strength in mag lsb, and dip below the horizon
+#define FIELD 170
+#define DIP 70
+
+#define D2R(v) ((v) * M_PI / 180)
+#define R2D(v) ((v) * 180 / M_PI)
+
+// the fixed point filter may be this far from the double one, degrees
+#define MAX_RMS_DIFF 0.25
+#define MAX_DIFF 2.0
+
+struct sample {
+	int16_t gyro[3], acc[3], mag[3];
+	double heading, pitch, roll;   // true, after the sample; nan if not known
+	bool disturbed;
+};
+
+static uint32_t rng_state;
+
+static double rnd() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state & 0xffffff) / (double) 0x1000000;
+}
+
+static double gaussian() {
+	return sqrt(-2 * log(rnd() + 1e-12)) * cos(2 * M_PI * rnd());
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double wrap180(double a) {
+	a = fmod(a + 180, 360);
+	return a < 0 ? a + 180 : a - 180;
+}
+
+static int16_t quantize(double v) {
+	return (int16_t) fmax(-32768, fmin(32767, lround(v)));
+}
+
+//
+// quaternions and rotations, double precision
+//
+struct quat {
+	double w, x, y, z;
+};
+
+static quat qmul(const quat &a, const quat &b) {
+	quat r = {
+		a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+		a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+		a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w
+	};
+	return r;
+}
+
+static quat axis(double angle, int i) {
+	quat q = { cos(angle / 2), 0, 0, 0 };
+	(&q.x)[i] = sin(angle / 2);
+	return q;
+}
+
+// from the mpu's axes to north, west and up
+static quat attitudeOf(double heading, double pitch, double roll) {
+	return qmul(qmul(axis(D2R(-heading), 2), axis(D2R(-pitch), 1)), axis(D2R(roll), 0));
+}
+
+static void matrix(const quat &q, double r[3][3]) {
+	r[0][0] = 1 - 2 * (q.y * q.y + q.z * q.z);
+	r[0][1] = 2 * (q.x * q.y - q.w * q.z);
+	r[0][2] = 2 * (q.x * q.z + q.w * q.y);
+	r[1][0] = 2 * (q.x * q.y + q.w * q.z);
+	r[1][1] = 1 - 2 * (q.x * q.x + q.z * q.z);
+	r[1][2] = 2 * (q.y * q.z - q.w * q.x);
+	r[2][0] = 2 * (q.x * q.z - q.w * q.y);
+	r[2][1] = 2 * (q.y * q.z + q.w * q.x);
+	r[2][2] = 1 - 2 * (q.x * q.x + q.y * q.y);
+}
+
+static void angles(const quat &q, double *heading, double *pitch, double *roll) {
+	double r[3][3];
+	matrix(q, r);
+
+	*heading = R2D(atan2(-r[1][0], r[0][0]));
+	*pitch = R2D(atan2(r[2][0], hypot(r[0][0], r[1][0])));
+	*roll = R2D(atan2(r[2][1], r[2][2]));
+}
+
+// an earth vector in the mpu's axes
+static void toBody(const quat &q, const double e[3], double b[3]) {
+	double r[3][3];
+	matrix(q, r);
+
+	for (int i = 0; i < 3; i++)
+		b[i] = r[0][i] * e[0] + r[1][i] * e[1] + r[2][i] * e[2];
+}
+
+//
+// the trace
+//
+static void generate(std::vector<sample> &trace, double seconds) {
+	double dt = 1.0 / RATE;
+	double heading = 30, turn = 0, tack = 1;
+	double bias[3] = { 1.5, -0.8, 0.6 };  // degrees/s
+	double field[3] = { FIELD * cos(D2R(DIP)), 0, -FIELD * sin(D2R(DIP)) };
+	double up[3] = { 0, 0, 1 };
+
+	// the motor's field at the mpu, in its axes
+	double motor[3] = { 20, -15, 10 };
+
+	size_t n = seconds * RATE;
+	trace.resize(n);
+
+	double t = 0, pitch = 0, roll = 0, heel = -12;
+	quat q = attitudeOf(heading, pitch, roll);
+
+	for (size_t i = 0; i < n; i++, t += dt) {
+		sample &s = trace[i];
+
+		// tack every 90s, 90 degrees over 6s, and wander in between
+		double phase = fmod(t, 90);
+		if (phase >= 60 && phase < 66)
+			turn = 15 * tack;
+		else {
+			if (phase >= 66 && turn * tack > 10)
+				tack = -tack;
+			turn = 0.98 * turn + 0.3 * gaussian();
+		}
+
+		// the heel comes over with the tack
+		heel += (12 * -tack - heel) * dt / 3;
+
+		double next_heading = heading + turn * dt;
+		double next_roll = heel + 7 * sin(2 * M_PI * 0.25 * t) + 2 * sin(2 * M_PI * 0.07 * t);
+		double next_pitch = 4 * sin(2 * M_PI * 0.4 * t + 1);
+		quat next = attitudeOf(next_heading, next_pitch, next_roll);
+
+		// the gyro sees the turn from this sample to the next
+		quat c = { q.w, -q.x, -q.y, -q.z };
+		quat rel = qmul(c, next);
+		double k = rel.w < 0 ? -2 : 2;
+
+		s.disturbed = fmod(t, 150) >= 100 && fmod(t, 150) < 120;
+
+		double acc[3], mag[3];
+		toBody(q, up, acc);
+		toBody(q, field, mag);
+
+		for (int j = 0; j < 3; j++) {
+			bias[j] += 0.002 * gaussian();
+
+			double rate = R2D(k * (&rel.x)[j] / dt);
+			s.gyro[j] = quantize((rate + bias[j] + 0.03 * gaussian()) / GYRO_LSB);
+			s.acc[j] = quantize((acc[j] + 0.04 * gaussian()) * ACC_1G);
+			s.mag[j] = quantize(mag[j] + 1.5 * gaussian() + (s.disturbed ? motor[j] : 0));
+		}
+
+		heading = next_heading;
+		pitch = next_pitch;
+		roll = next_roll;
+		q = next;
+
+		s.heading = wrap180(heading);
+		s.pitch = pitch;
+		s.roll = roll;
+	}
+}
+
+static bool load(const char *path, std::vector<sample> &trace) {
+	FILE *in = fopen(path, "r");
+	if (!in) {
+		perror(path);
+		return false;
+	}
+
+	char line[256];
+	while (fgets(line, sizeof(line), in)) {
+		double v[13];
+		int n = sscanf(line, "%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf",
+			&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10], &v[11], &v[12]);
+		if (n < 10)
+			continue;
+
+		sample s;
+		for (int j = 0; j < 3; j++) {
+			s.gyro[j] = quantize(v[1 + j]);
+			s.acc[j] = quantize(v[4 + j]);
+			s.mag[j] = quantize(v[7 + j]);
+		}
+		s.heading = n == 13 ? v[10] : NAN;
+		s.pitch = n == 13 ? v[11] : NAN;
+		s.roll = n == 13 ? v[12] : NAN;
+		s.disturbed = false;
+
+		trace.push_back(s);
+	}
+
+	fclose(in);
+	return true;
+}
+
+static bool save(const char *path, const std::vector<sample> &trace) {
+	FILE *out = fopen(path, "w");
+	if (!out) {
+		perror(path);
+		return false;
+	}
+
+	for (size_t i = 0; i < trace.size(); i++) {
+		const sample &s = trace[i];
+		fprintf(out, "%lu,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.3f,%.3f,%.3f\n",
+			(unsigned long) (i * 1000000 / RATE),
+			s.gyro[0], s.gyro[1], s.gyro[2], s.acc[0], s.acc[1], s.acc[2],
+			s.mag[0], s.mag[1], s.mag[2], s.heading, s.pitch, s.roll);
+	}
+
+	fclose(out);
+	return true;
+}
+
+//
+// the reference: mahony.cpp's filter, step for step, in double
+//
+struct reference {
+	quat q;
+	double bias[3];
+	bool ready;
+};
+
+static void normalize3(const int16_t v[3], double out[3], double *norm) {
+	*norm = sqrt((double) v[0] * v[0] + (double) v[1] * v[1] + (double) v[2] * v[2]);
+	for (int i = 0; i < 3; i++)
+		out[i] = *norm > 0 ? v[i] / *norm : 0;
+}
+
+static void cross(const double a[3], const double b[3], double out[3]) {
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static double dot(const double a[3], const double b[3]) {
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static quat fromMatrix(const double r[3][3]) {
+	quat q;
+
+	if (r[0][0] + r[1][1] + r[2][2] > 0) {
+		double s = 2 * sqrt(1 + r[0][0] + r[1][1] + r[2][2]);
+		q.w = s / 4;
+		q.x = (r[2][1] - r[1][2]) / s;
+		q.y = (r[0][2] - r[2][0]) / s;
+		q.z = (r[1][0] - r[0][1]) / s;
+	} else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+		double s = 2 * sqrt(1 + r[0][0] - r[1][1] - r[2][2]);
+		q.w = (r[2][1] - r[1][2]) / s;
+		q.x = s / 4;
+		q.y = (r[0][1] + r[1][0]) / s;
+		q.z = (r[0][2] + r[2][0]) / s;
+	} else if (r[1][1] > r[2][2]) {
+		double s = 2 * sqrt(1 + r[1][1] - r[0][0] - r[2][2]);
+		q.w = (r[0][2] - r[2][0]) / s;
+		q.x = (r[0][1] + r[1][0]) / s;
+		q.y = s / 4;
+		q.z = (r[1][2] + r[2][1]) / s;
+	} else {
+		double s = 2 * sqrt(1 + r[2][2] - r[0][0] - r[1][1]);
+		q.w = (r[1][0] - r[0][1]) / s;
+		q.x = (r[0][2] + r[2][0]) / s;
+		q.y = (r[1][2] + r[2][1]) / s;
+		q.z = s / 4;
+	}
+
+	return q;
+}
+
+// whether to use the mag is the fixed point filter's call: a reading right on
+// the threshold would otherwise send the two off different ways
+static void referenceUpdate(reference *f, const sample &s, bool good) {
+	double dt = 1.0 / RATE;
+	double a[3], m[3], a_norm, m_norm;
+
+	normalize3(s.acc, a, &a_norm);
+	normalize3(s.mag, m, &m_norm);
+
+	if (!f->ready) {
+		// north is the horizontal part of the field, west is up x north
+		double north[3], west[3];
+		double along = dot(m, a);
+		for (int i = 0; i < 3; i++)
+			north[i] = m[i] - along * a[i];
+		double n = sqrt(dot(north, north));
+		for (int i = 0; i < 3; i++)
+			north[i] /= n;
+		cross(a, north, west);
+
+		double r[3][3] = {
+			{ north[0], north[1], north[2] },
+			{ west[0], west[1], west[2] },
+			{ a[0], a[1], a[2] }
+		};
+		f->q = fromMatrix(r);
+		f->ready = true;
+	}
+
+	double r[3][3];
+	matrix(f->q, r);
+
+	double *v = r[2];
+	double e[3];
+	cross(a, v, e);
+
+	double h[3];
+	for (int i = 0; i < 3; i++)
+		h[i] = dot(r[i], m);
+
+	double bx = hypot(h[0], h[1]);
+
+	if (good && bx > 0) {
+		double yaw = -h[1] / bx;
+		for (int i = 0; i < 3; i++)
+			e[i] += yaw * v[i];
+	}
+
+	double d[3];
+	for (int i = 0; i < 3; i++) {
+		f->bias[i] = fmax(-D2R(10), fmin(D2R(10), f->bias[i] + MAHONY_KI * dt * e[i]));
+		d[i] = (D2R(s.gyro[i] * GYRO_LSB) + f->bias[i] + MAHONY_KP * e[i]) * dt / 2;
+	}
+
+	quat step = { 0, d[0], d[1], d[2] };
+	quat dq = qmul(f->q, step);
+	f->q.w += dq.w;
+	f->q.x += dq.x;
+	f->q.y += dq.y;
+	f->q.z += dq.z;
+
+	double n = sqrt(f->q.w * f->q.w + f->q.x * f->q.x + f->q.y * f->q.y + f->q.z * f->q.z);
+	f->q.w /= n;
+	f->q.x /= n;
+	f->q.y /= n;
+	f->q.z /= n;
+}
+
+// ahrs.cpp's heading(): accel and mag alone, no gyro
+static double compass(const sample &s) {
+	double a[3], m[3], n, east[3], north[3];
+	double forward[3] = { 1, 0, 0 };
+
+	normalize3(s.acc, a, &n);
+	normalize3(s.mag, m, &n);
+
+	cross(m, a, east);
+	double en = sqrt(dot(east, east));
+	for (int i = 0; i < 3; i++)
+		east[i] /= en;
+	cross(a, east, north);
+
+	return R2D(atan2(dot(east, forward), dot(north, forward)));
+}
+
+struct error {
+	double sum, worst;
+	uint32_t n;
+
+	void add(double e) {
+		sum += e * e;
+		worst = fmax(worst, fabs(e));
+		n++;
+	}
+
+	double rms() const {
+		return n ? sqrt(sum / n) : NAN;
+	}
+};
+
+int main(int argc, char **argv) {
+	double seconds = 1800;
+	const char *in = NULL, *out = NULL;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:f:w:r:")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'f': in = optarg; break;
+			case 'w': out = optarg; break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-t seconds] [-f trace] [-w trace] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	rng_state = seed ? seed : 1;
+
+	std::vector<sample> trace;
+	if (in) {
+		if (!load(in, trace))
+			return 1;
+	} else
+		generate(trace, seconds);
+
+	if (trace.empty())
+		return 1;
+
+	if (out && !save(out, trace))
+		return 1;
+
+	// the filters' first minute is settling the gyro bias
+	size_t settle = min(trace.size() / 2, (size_t) 60 * RATE);
+
+	Mahony fixed;
+	reference ref;
+	memset(&ref, 0, sizeof(ref));
+	mahonyInit(&fixed, RATE, GYRO_LSB);
+
+	// error[filter][angle], filter: fixed, double, compass; angle: heading,
+	// pitch, roll, heading while disturbed
+	error err[3][4], diff[3];
+	memset(err, 0, sizeof(err));
+	memset(diff, 0, sizeof(diff));
+	uint32_t rejected = 0;
+
+	for (size_t i = 0; i < trace.size(); i++) {
+		const sample &s = trace[i];
+
+		mahonyUpdate(&fixed, s.gyro, s.acc, s.mag);
+		referenceUpdate(&ref, s, fixed.mag_rejected == 0);
+		rejected += fixed.mag_rejected > 0;
+
+		if (i < settle)
+			continue;
+
+		Bam bh, bp, br;
+		mahonyAngles(&fixed, &bh, &bp, &br);
+		double fa[3] = { bamToDeg(bh), wrap180(bamToDeg(bp)), wrap180(bamToDeg(br)) };
+
+		double ra[3];
+		angles(ref.q, &ra[0], &ra[1], &ra[2]);
+
+		for (int j = 0; j < 3; j++)
+			diff[j].add(wrap180(fa[j] - ra[j]));
+
+		if (isnan(s.heading))
+			continue;
+
+		double truth[3] = { s.heading, s.pitch, s.roll };
+		double compass_heading = compass(s);
+
+		for (int j = 0; j < 3; j++) {
+			err[0][j].add(wrap180(fa[j] - truth[j]));
+			err[1][j].add(wrap180(ra[j] - truth[j]));
+		}
+		err[2][0].add(wrap180(compass_heading - truth[0]));
+
+		if (s.disturbed) {
+			err[0][3].add(wrap180(fa[0] - truth[0]));
+			err[1][3].add(wrap180(ra[0] - truth[0]));
+			err[2][3].add(wrap180(compass_heading - truth[0]));
+		}
+	}
+
+	// cost per update
+	volatile uint16_t sink;
+	double ns[3], t0;
+
+	mahonyInit(&fixed, RATE, GYRO_LSB);
+	t0 = now_ns();
+	for (size_t i = 0; i < trace.size(); i++)
+		mahonyUpdate(&fixed, trace[i].gyro, trace[i].acc, trace[i].mag);
+	ns[0] = (now_ns() - t0) / trace.size();
+	sink = fixed.q[0];
+
+	memset(&ref, 0, sizeof(ref));
+	t0 = now_ns();
+	for (size_t i = 0; i < trace.size(); i++)
+		referenceUpdate(&ref, trace[i], true);
+	ns[1] = (now_ns() - t0) / trace.size();
+	sink = ref.q.w > 0;
+
+	t0 = now_ns();
+	for (size_t i = 0; i < trace.size(); i++)
+		sink = compass(trace[i]);
+	ns[2] = (now_ns() - t0) / trace.size();
+
+	printf("%zu samples at %dHz, mag left out of %.1f%% of updates\n",
+		trace.size(), RATE, rejected * 100.0 / trace.size());
+	printf("            heading rms/max  pitch rms/max   roll rms/max   motor on rms/max      ns\n");
+
+	static const char *names[] = { "fixed", "double", "compass" };
+	for (int f = 0; f < 3; f++) {
+		printf("%-8s", names[f]);
+		for (int j = 0; j < 4; j++) {
+			if (err[f][j].n)
+				printf("   %6.2f %6.2f", err[f][j].rms(), err[f][j].worst);
+			else
+				printf("        -      -");
+		}
+		printf(" %8.1f\n", ns[f]);
+	}
+
+	printf("fixed - double: heading %.3f/%.3f, pitch %.3f/%.3f, roll %.3f/%.3f\n",
+		diff[0].rms(), diff[0].worst, diff[1].rms(), diff[1].worst, diff[2].rms(), diff[2].worst);
+
+	for (int j = 0; j < 3; j++)
+		if (diff[j].rms() > MAX_RMS_DIFF || diff[j].worst > MAX_DIFF) {
+			fprintf(stderr, "fixed point filter is off from the double precision one\n");
+			return 1;
+		}
+
+	return 0;
+}
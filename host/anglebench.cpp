@@ -0,0 +1,197 @@
+/*
+ * anglebench.cpp: cost of the pilot's angle helpers as floats (util.ino
+ * before bam.h) against binary angles.
+ *
+ * Three columns per operation: the old float code, the pilot's code as it
+ * runs on float headings (converted to binary angles and the result back to
+ * degrees, as pilot.ino does with fused_heading), and the binary angle
+ * arithmetic alone. Times are host nanoseconds per call; the host has an
+ * fpu, so the gap on the avr, where every float compare and subtract is a
+ * library call, is wider than shown. The error column is the largest
+ * difference between the old and the pilot's results, in degrees.
+ *
+ * usage: ardusailor_anglebench [-n calls] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "Arduino.h"
+#include "bam.h"
+#include "sketch.h"
+
+static uint32_t rng_state;
+
+static float rnd() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state & 0xffffff) / (float) 0x1000000;
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// util.ino before bam.h
+static float oldToCircleDeg(float value) {
+	if (value > 360.0)
+		return value - 360.0;
+	if (value < 0)
+		return value + 360.0;
+
+	return value;
+}
+
+static float oldAngleDiff(float a1, float a2, boolean sign) {
+	float larger, smaller, mult;
+	if (a1 > a2) {
+		larger = a1;
+		smaller = a2;
+		mult = -1;
+	} else {
+		larger = a2;
+		smaller = a1;
+		mult = 1;
+	}
+
+	float d = larger - smaller;
+	if (d > 180.0) {
+		d = 360.0 - d;
+		mult *= -1;
+	}
+
+	if (!sign)
+		mult = 1.0;
+
+	return mult * d;
+}
+
+// the pilot's way, from float headings: bamDist() for how far off, as
+// beating in adjustHeading(), bamDiffDeg() for which way, as steering
+static float pilotDist(float a, float b) {
+	return bamDist(bamDeg(a), bamDeg(b)) * (360.0 / 65536.0);
+}
+
+static float pilotDiff(float a, float b) {
+	return bamDiffDeg(bamDeg(a), bamDeg(b));
+}
+
+static double diffError(float a, float b) {
+	double d = fabs(a - b);
+	return d > 180 ? 360 - d : d;
+}
+
+int main(int argc, char **argv) {
+	int calls = 4000000;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+			case 'n': calls = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n calls] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (calls <= 0)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	// headings and wind in [0, 360), and the same as binary angles
+	std::vector<float> a(calls), b(calls);
+	std::vector<Bam> ba(calls), bb(calls);
+	for (int i = 0; i < calls; i++) {
+		a[i] = rnd() * 360;
+		b[i] = rnd() * 360;
+		ba[i] = bamDeg(a[i]);
+		bb[i] = bamDeg(b[i]);
+	}
+
+	// volatile sinks, so the calls aren't optimized away
+	volatile float fsink = 0;
+	volatile uint16_t bsink = 0;
+	double t0, ns[3], err;
+
+	printf("operation          float ns     pilot ns    bam ns   max err\n");
+
+	// the wind in world terms: heading + wind, wrapped
+	t0 = now_ns();
+	for (int i = 0; i < calls; i++)
+		fsink = oldToCircleDeg(a[i] + b[i]);
+	ns[0] = (now_ns() - t0) / calls;
+
+	t0 = now_ns();
+	for (int i = 0; i < calls; i++)
+		fsink = toCircleDeg(a[i] + b[i]);
+	ns[1] = (now_ns() - t0) / calls;
+
+	t0 = now_ns();
+	for (int i = 0; i < calls; i++)
+		bsink = (ba[i] + bb[i]).v;
+	ns[2] = (now_ns() - t0) / calls;
+
+	err = 0;
+	for (int i = 0; i < calls; i++)
+		err = fmax(err, diffError(oldToCircleDeg(a[i] + b[i]), toCircleDeg(a[i] + b[i])));
+
+	printf("%-16s %10.2f %12.2f %9.2f %9.5f\n", "wrap", ns[0], ns[1], ns[2], err);
+
+	// how far off the mark, the test adjustHeading() makes for beating
+	t0 = now_ns();
+	for (int i = 0; i < calls; i++)
+		fsink = oldAngleDiff(a[i], b[i], false);
+	ns[0] = (now_ns() - t0) / calls;
+
+	t0 = now_ns();
+	for (int i = 0; i < calls; i++)
+		fsink = pilotDist(a[i], b[i]);
+	ns[1] = (now_ns() - t0) / calls;
+
+	t0 = now_ns();
+	for (int i = 0; i < calls; i++)
+		bsink = bamDist(ba[i], bb[i]);
+	ns[2] = (now_ns() - t0) / calls;
+
+	err = 0;
+	for (int i = 0; i < calls; i++)
+		err = fmax(err, fabs(oldAngleDiff(a[i], b[i], false) - pilotDist(a[i], b[i])));
+
+	printf("%-16s %10.2f %12.2f %9.2f %9.5f\n", "distance", ns[0], ns[1], ns[2], err);
+
+	// signed difference, as the pilot steers by
+	t0 = now_ns();
+	for (int i = 0; i < calls; i++)
+		fsink = oldAngleDiff(a[i], b[i], true);
+	ns[0] = (now_ns() - t0) / calls;
+
+	t0 = now_ns();
+	for (int i = 0; i < calls; i++)
+		fsink = pilotDiff(a[i], b[i]);
+	ns[1] = (now_ns() - t0) / calls;
+
+	t0 = now_ns();
+	for (int i = 0; i < calls; i++)
+		bsink = bamDiff(ba[i], bb[i]);
+	ns[2] = (now_ns() - t0) / calls;
+
+	err = 0;
+	for (int i = 0; i < calls; i++)
+		err = fmax(err, diffError(oldAngleDiff(a[i], b[i], true), pilotDiff(a[i], b[i])));
+
+	printf("%-16s %10.2f %12.2f %9.2f %9.5f\n", "signed diff", ns[0], ns[1], ns[2], err);
+
+	return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * batch.cpp: monte carlo runs of the pilot against the boat simulation.
+ *
+ * usage: ardusailor_batch [options]
+ *   -n count        number of scenarios (default 1000)
+ *   -j jobs         scenarios run in parallel (default: one per core)
+ *   -t seconds      virtual time limit per scenario (default 3600)
+ *   -l legs         waypoints to reach before a scenario is done (default: one of each)
+ *   -o file         results file (default results.csv)
+ *   -w file         waypoint sets, one per line: start lat,lon then up to
+ *                   16 waypoint lat,lon pairs. scenarios cycle through them
+ *   -r seed         base random seed (default 1)
+ *   -p name=lo:hi   sample a parameter uniformly from [lo, hi]
+ *   -p name=value   fix a parameter
+ *
+ * Parameters (defaults in brackets):
+ *   wind_dir [0:360], wind_speed [4:14], gust [0:0.3], gust_time [20],
+ *   shift [0:15], shift_period [300], kp [0.1], ki [0.001], kd [2.8],
+ *   irons [40], tack_every [0], tack_cost [10], lookahead [15], learning [1],
+ *   trimming [1], power_saving [1], compass_noise [3], wind_noise [5],
+ *   gps_noise [2], current [0], current_dir [0:360], sea_roll [0], sea_yaw [0],
+ *   sea_period [6], battery [12.4]
+ *
+ * Results are written as csv, one column per metric/parameter, sorted by
+ * score (lower is better).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "scenario.h"
+
+// score weights: seconds per meter of rms cross-track error, per maneuver, per degree of rudder travel
+#define XTE_WEIGHT 5.0
+#define MANEUVER_WEIGHT 10.0
+#define RUDDER_WEIGHT 0.05
+
+// unfinished runs are charged for the distance left, at about a knot
+#define DNF_SECONDS_PER_METER 2.0
+
+enum param_id {
+	P_WIND_DIR, P_WIND_SPEED, P_GUST, P_GUST_TIME, P_SHIFT, P_SHIFT_PERIOD,
+	P_KP, P_KI, P_KD, P_IRONS, P_TACK_EVERY, P_TACK_COST, P_LOOKAHEAD, P_LEARNING, P_TRIMMING,
+	P_POWER_SAVING, P_COMPASS_NOISE, P_WIND_NOISE, P_GPS_NOISE, P_CURRENT, P_CURRENT_DIR,
+	P_SEA_ROLL, P_SEA_YAW, P_SEA_PERIOD, P_BATTERY,
+	P_COUNT
+};
+
+struct param {
+	const char *name;
+	double lo, hi;
+};
+
+static param params[P_COUNT] = {
+	{ "wind_dir", 0, 360 },
+	{ "wind_speed", 4, 14 },
+	{ "gust", 0, 0.3 },
+	{ "gust_time", 20, 20 },
+	{ "shift", 0, 15 },
+	{ "shift_period", 300, 300 },
+	{ "kp", 0.1, 0.1 },
+	{ "ki", 0.001, 0.001 },
+	{ "kd", 2.8, 2.8 },
+	{ "irons", 40, 40 },
+	{ "tack_every", 0, 0 },
+	{ "tack_cost", 10, 10 },
+	{ "lookahead", 15, 15 },
+	{ "learning", 1, 1 },
+	{ "trimming", 1, 1 },
+	{ "power_saving", 1, 1 },
+	{ "compass_noise", 3, 3 },
+	{ "wind_noise", 5, 5 },
+	{ "gps_noise", 2, 2 },
+	{ "current", 0, 0 },
+	{ "current_dir", 0, 360 },
+	{ "sea_roll", 0, 0 },
+	{ "sea_yaw", 0, 0 },
+	{ "sea_period", 6, 6 },
+	{ "battery", 12.4, 12.4 },
+};
+
+struct waypoint_set {
+	double start[2];
+	float wp[SCENARIO_MAX_WAYPOINTS * 2];
+	uint8_t count;
+};
+
+struct row {
+	const double *values;
+	const struct scenario_result *result;
+	uint16_t wp_set;
+	uint32_t seed;
+	float score;
+};
+
+static uint32_t rng_state;
+
+static double uniform() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state >> 8) / (double) (1 << 24);
+}
+
+static float score(const struct scenario_result *r) {
+	return r->elapsed + XTE_WEIGHT * r->xte_rms + MANEUVER_WEIGHT * r->maneuvers +
+		RUDDER_WEIGHT * r->rudder_travel + DNF_SECONDS_PER_METER * r->remaining;
+}
+
+static void buildScenario(const double *v, const waypoint_set *set, struct scenario *s) {
+	s->sim.start_lat = set->start[0];
+	s->sim.start_lon = set->start[1];
+	s->sim.wind.direction = v[P_WIND_DIR];
+	s->sim.wind.speed = v[P_WIND_SPEED];
+	s->sim.wind.gust_factor = v[P_GUST];
+	s->sim.wind.gust_time = v[P_GUST_TIME];
+	s->sim.wind.shift_amplitude = v[P_SHIFT];
+	s->sim.wind.shift_period = v[P_SHIFT_PERIOD];
+	s->sim.noise.compass = v[P_COMPASS_NOISE];
+	s->sim.noise.wind = v[P_WIND_NOISE];
+	s->sim.noise.gps_position = v[P_GPS_NOISE];
+	s->sim.current_speed = v[P_CURRENT];
+	s->sim.current_direction = v[P_CURRENT_DIR];
+	s->sim.sea.roll = v[P_SEA_ROLL];
+	s->sim.sea.yaw = v[P_SEA_YAW];
+	s->sim.sea.period = v[P_SEA_PERIOD];
+	s->sim.battery = v[P_BATTERY];
+
+	s->tunings[0] = v[P_KP];
+	s->tunings[1] = v[P_KI];
+	s->tunings[2] = v[P_KD];
+	s->irons = (int16_t) v[P_IRONS];
+	s->tack_every = (uint32_t) v[P_TACK_EVERY];
+	s->tack_cost = (uint16_t) v[P_TACK_COST];
+	s->lookahead = (uint16_t) v[P_LOOKAHEAD];
+	s->learning = v[P_LEARNING] != 0;
+	s->trimming = v[P_TRIMMING] != 0;
+	s->power_saving = v[P_POWER_SAVING] != 0;
+
+	s->waypoint_count = set->count;
+	memcpy(s->waypoints, set->wp, sizeof(set->wp));
+}
+
+static bool readWaypointSets(const char *path, std::vector<waypoint_set> &sets) {
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return false;
+
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		double v[2 + SCENARIO_MAX_WAYPOINTS * 2];
+		int n = 0;
+
+		for (char *tok = strtok(line, ", \t\r\n"); tok && n < (int) (sizeof(v) / sizeof(v[0])); tok = strtok(NULL, ", \t\r\n"))
+			v[n++] = atof(tok);
+
+		if (n < 4 || n % 2)
+			continue;
+
+		waypoint_set set;
+		memset(&set, 0, sizeof(set));
+		set.start[0] = v[0];
+		set.start[1] = v[1];
+		set.count = (n - 2) / 2;
+		for (int i = 2; i < n; i++)
+			set.wp[i - 2] = v[i];
+
+		sets.push_back(set);
+	}
+
+	fclose(f);
+	return !sets.empty();
+}
+
+static bool parseParam(const char *arg) {
+	const char *eq = strchr(arg, '=');
+	if (!eq)
+		return false;
+
+	for (int i = 0; i < P_COUNT; i++) {
+		if (strlen(params[i].name) != (size_t) (eq - arg) || strncmp(params[i].name, arg, eq - arg))
+			continue;
+
+		const char *colon = strchr(eq, ':');
+		params[i].lo = atof(eq + 1);
+		params[i].hi = colon ? atof(colon + 1) : params[i].lo;
+
+		return true;
+	}
+
+	return false;
+}
+
+static void progress(int finished, int count) {
+	if (finished % 100 == 0 || finished == count)
+		fprintf(stderr, "%d/%d\n", finished, count);
+}
+
+static void writeResults(FILE *f, const std::vector<row> &rows) {
+	fprintf(f, "score,elapsed,legs,xte_rms,heading_rms,maneuvers,rudder_travel,distance,remaining,heel_max,heel_over,mah,awake,gps_on");
+	for (int i = 0; i < P_COUNT; i++)
+		fprintf(f, ",%s", params[i].name);
+	fprintf(f, ",wp_set,seed\n");
+
+	for (size_t i = 0; i < rows.size(); i++) {
+		const struct scenario_result *r = rows[i].result;
+
+		float used = 0;
+		for (int k = 0; k < POWER_LOADS; k++)
+			used += r->used[k];
+
+		fprintf(f, "%.1f,%.1f,%u,%.2f,%.2f,%u,%.0f,%.0f,%.0f,%.1f,%.3f,%.1f,%.3f,%.3f",
+			rows[i].score, r->elapsed, r->legs, r->xte_rms, r->heading_rms, r->maneuvers,
+			r->rudder_travel, r->distance, r->remaining, r->heel_max, r->heel_over,
+			used, r->awake, r->gps_on);
+		for (int p = 0; p < P_COUNT; p++)
+			fprintf(f, ",%g", rows[i].values[p]);
+		fprintf(f, ",%u,%u\n", rows[i].wp_set, rows[i].seed);
+	}
+}
+
+int main(int argc, char **argv) {
+	int count = 1000;
+	int jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	double limit = 3600;
+	int legs = 0;
+	const char *out = "results.csv";
+	const char *wp_file = NULL;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:j:t:l:o:w:r:p:")) != -1) {
+		switch (opt) {
+			case 'n': count = atoi(optarg); break;
+			case 'j': jobs = atoi(optarg); break;
+			case 't': limit = atof(optarg); break;
+			case 'l': legs = atoi(optarg); break;
+			case 'o': out = optarg; break;
+			case 'w': wp_file = optarg; break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			case 'p':
+				if (!parseParam(optarg)) {
+					fprintf(stderr, "unknown parameter: %s\n", optarg);
+					return 1;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n count] [-j jobs] [-t seconds] [-l legs] [-o file] [-w waypoints] [-r seed] [-p name=lo:hi]...\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (count <= 0 || jobs <= 0)
+		return 1;
+
+	struct scenario base;
+	scenario_defaults(&base);
+	base.legs = legs;
+	base.limit = limit;
+
+	std::vector<waypoint_set> sets;
+	if (wp_file) {
+		if (!readWaypointSets(wp_file, sets)) {
+			fprintf(stderr, "no waypoint sets in %s\n", wp_file);
+			return 1;
+		}
+	} else {
+		// the firmware's own list, starting from the simulation's default position
+		waypoint_set set;
+		memset(&set, 0, sizeof(set));
+		set.start[0] = base.sim.start_lat;
+		set.start[1] = base.sim.start_lon;
+		set.count = base.waypoint_count;
+		memcpy(set.wp, base.waypoints, sizeof(set.wp));
+		sets.push_back(set);
+	}
+
+	// sample everything up front so results don't depend on scheduling
+	std::vector<double> values(count * P_COUNT);
+	std::vector<struct scenario> scenarios(count, base);
+	std::vector<struct scenario_result> results(count);
+
+	rng_state = seed ? seed : 1;
+	for (int i = 0; i < count; i++) {
+		double *v = &values[i * P_COUNT];
+		for (int p = 0; p < P_COUNT; p++)
+			v[p] = params[p].lo + (params[p].hi - params[p].lo) * uniform();
+
+		buildScenario(v, &sets[i % sets.size()], &scenarios[i]);
+		scenarios[i].sim.seed = seed * 100003 + i;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (!scenario_run_all(&scenarios[0], &results[0], count, jobs, progress))
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	std::vector<row> rows;
+	double simulated = 0;
+	for (int i = 0; i < count; i++) {
+		if (!results[i].done) {
+			fprintf(stderr, "scenario %d failed\n", i);
+			continue;
+		}
+
+		row r = { &values[i * P_COUNT], &results[i], (uint16_t) (i % sets.size()), scenarios[i].sim.seed, score(&results[i]) };
+		rows.push_back(r);
+		simulated += results[i].elapsed;
+	}
+
+	std::sort(rows.begin(), rows.end(), [](const row &a, const row &b) { return a.score < b.score; });
+
+	FILE *f = fopen(out, "w");
+	if (!f) {
+		perror(out);
+		return 1;
+	}
+
+	writeResults(f, rows);
+	fclose(f);
+
+	fprintf(stderr, "%zu scenarios, %.0f hours simulated in %.1fs on %d jobs\n",
+		rows.size(), simulated / 3600, wall, jobs);
+
+	return 0;
+}
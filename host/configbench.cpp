@@ -0,0 +1,349 @@
+/*
+ * configbench.cpp: config.h's settings store against the host's eeprom, with
+ * saves cut off part way and the eeprom worn.
+ *
+ *   blank     nothing saved: every record at its defaults
+ *   saved     each record saved with made up values, and read back
+ *   boot      the gains and mag offset saved, then setup(): the pilot
+ *             steers with the gains, and the heading has the offset
+ *   version   a record saved at another version, its crc good: passed over
+ *   corrupt   a byte of the newest save flipped: the one before it's read
+ *   cut       a save cut off after each of its writes in turn: either the
+ *             save before it or this one is read, never anything else
+ *   wear      -s saves of the gains, read back after each: the most
+ *             writes any one byte took, against a single slot's
+ *   legacy    the layout before config.h, read and saved in this one
+ *
+ * Every check has to pass, and the settings have to fit below the route.
+ *
+ * usage: ardusailor_configbench [-s saves] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <PID_v1.h>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "hal_host.h"
+#include "config.h"
+#include "telemetry.h"
+#include "sketch.h"
+#include "sim/sim.h"
+
+// firmware.ino: where the settings go, and the route after them
+#define CONFIG_PARAM_ADDRESS 0
+#define ROUTE_PARAM_ADDRESS 512
+
+// firmware (pilot.ino, ahrs)
+extern PID steeringPID;
+extern float mag_offset;
+
+static uint32_t rng_state;
+static int failed;
+
+static double rnd() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state & 0xffffff) / (double) 0x1000000;
+}
+
+// made up values for every record
+static void makeUp(Config *c) {
+	for (int i = 0; i < 3; i++) {
+		c->mag_range.min[i] = -200 - 400 * rnd();
+		c->mag_range.max[i] = 200 + 400 * rnd();
+		c->mag_fit.offset[i] = 100 * (rnd() - 0.5);
+		for (int j = 0; j < 3; j++)
+			c->mag_fit.matrix[i][j] = (i == j) + 0.1 * (rnd() - 0.5);
+		c->pid[i] = rnd();
+	}
+	c->mag_fit.field = 400 * rnd();
+	c->mag_offset = rnd() - 0.5;
+}
+
+// a record's value in c
+static const void *recordData(const Config *c, uint8_t record, size_t *size) {
+	switch (record) {
+		case CONFIG_MAG_RANGE: *size = sizeof(c->mag_range); return &c->mag_range;
+		case CONFIG_MAG_FIT: *size = sizeof(c->mag_fit); return &c->mag_fit;
+		case CONFIG_PID: *size = sizeof(c->pid); return c->pid;
+		default: *size = sizeof(c->mag_offset); return &c->mag_offset;
+	}
+}
+
+static bool sameRecord(const Config *a, const Config *b, uint8_t record) {
+	size_t size;
+	const void *x = recordData(a, record, &size);
+	const void *y = recordData(b, record, &size);
+
+	return memcmp(x, y, size) == 0;
+}
+
+static bool same(const Config *a, const Config *b) {
+	for (uint8_t r = 0; r < CONFIG_RECORDS; r++)
+		if (!sameRecord(a, b, r))
+			return false;
+
+	return true;
+}
+
+// what a boot would read
+static uint8_t reload(Config *c) {
+	configInit(c, CONFIG_PARAM_ADDRESS);
+	return configLoad(c);
+}
+
+static void report(const char *name, bool ok, const char *detail) {
+	printf("%-10s %-6s %s\n", name, ok ? "ok" : "FAILED", detail);
+	if (!ok)
+		failed++;
+}
+
+static void checkBlank() {
+	Config c, blank;
+
+	hal_reset();
+	configInit(&blank, CONFIG_PARAM_ADDRESS);
+	uint8_t loaded = reload(&c);
+
+	report("blank", !loaded && same(&c, &blank), "every record at its defaults");
+}
+
+static void checkSaved() {
+	Config c, back;
+
+	hal_reset();
+	configInit(&c, CONFIG_PARAM_ADDRESS);
+	makeUp(&c);
+	for (uint8_t r = 0; r < CONFIG_RECORDS; r++)
+		configSave(&c, r);
+
+	uint8_t loaded = reload(&back);
+
+	report("saved", loaded == bit(CONFIG_RECORDS) - 1 && same(&c, &back), "every record read back as saved");
+}
+
+static void checkBoot() {
+	struct sim_config cfg;
+	Config c;
+	char detail[96];
+
+	sim_default_config(&cfg);
+	sim_begin(&cfg);
+
+	configInit(&c, CONFIG_PARAM_ADDRESS);
+	c.pid[0] = 0.75;
+	c.pid[1] = 0.025;
+	c.pid[2] = 0.125;
+	c.mag_offset = 0.25;
+	configSave(&c, CONFIG_PID);
+	configSave(&c, CONFIG_MAG_OFFSET);
+
+	setup();
+
+	bool ok = steeringPID.GetKp() == c.pid[0] && steeringPID.GetKi() == c.pid[1] && steeringPID.GetKd() == c.pid[2] &&
+		mag_offset == c.mag_offset;
+	snprintf(detail, sizeof(detail), "gains %.3f %.3f %.3f, mag offset %.2f",
+		steeringPID.GetKp(), steeringPID.GetKi(), steeringPID.GetKd(), mag_offset);
+	report("boot", ok, detail);
+}
+
+static void checkVersion() {
+	Config c, back;
+
+	hal_reset();
+	configInit(&c, CONFIG_PARAM_ADDRESS);
+	c.mag_offset = 0.5;
+	configSave(&c, CONFIG_MAG_OFFSET);
+
+	// the same save, as another version would have made it
+	uint16_t at = configAddress(&c, CONFIG_MAG_OFFSET);
+	uint8_t seq = EEPROM.read(at), version = CONFIG_MAG_OFFSET_VERSION + 1;
+	uint16_t crc = telemetryCrc(telemetryCrc(telemetryCrc(0xffff, CONFIG_MAG_OFFSET), seq), version);
+
+	for (uint8_t i = 0; i < sizeof(float); i++)
+		crc = telemetryCrc(crc, EEPROM.read(at + CONFIG_HEADER + i));
+	EEPROM.write(at + 1, version);
+	EEPROM.write(at + 2, crc);
+	EEPROM.write(at + 3, crc >> 8);
+
+	uint8_t loaded = reload(&back);
+
+	report("version", !(loaded & bit(CONFIG_MAG_OFFSET)) && back.mag_offset == 0, "passed over, at its default");
+}
+
+static void checkCorrupt() {
+	Config c, before, back;
+	int bad = 0;
+
+	for (uint8_t r = 0; r < CONFIG_RECORDS; r++) {
+		hal_reset();
+		configInit(&c, CONFIG_PARAM_ADDRESS);
+		makeUp(&c);
+		configSave(&c, r);
+		before = c;
+		makeUp(&c);
+		configSave(&c, r);
+
+		size_t size;
+		recordData(&c, r, &size);
+		uint16_t at = configAddress(&c, r) + c.slot[r] * (CONFIG_HEADER + size) + CONFIG_HEADER + size / 2;
+		EEPROM.write(at, EEPROM.read(at) ^ 0x10);
+
+		reload(&back);
+		bad += !sameRecord(&back, &before, r);
+	}
+
+	report("corrupt", !bad, "the save before read instead, every record");
+}
+
+static void checkCut() {
+	Config c, first, second, back;
+	int cuts = 0, bad = 0;
+
+	for (uint8_t r = 0; r < CONFIG_RECORDS; r++) {
+		configInit(&first, CONFIG_PARAM_ADDRESS);
+		makeUp(&first);
+		second = first;
+		makeUp(&second);
+
+		size_t size;
+		const void *value = recordData(&second, r, &size);
+
+		// the first time round uncut, to count the save's writes
+		int32_t writes = -1;
+		for (int32_t n = -1; n <= writes; n++) {
+			hal_reset();
+			c = first;
+			configSave(&c, r);
+			configSave(&c, r);
+			memcpy((void *) recordData(&c, r, &size), value, size);
+
+			uint32_t from = 0;
+			for (int i = 0; i <= E2END; i++)
+				from += hal_eeprom_writes[i];
+
+			hal_eeprom_cut(n);
+			configSave(&c, r);
+			hal_eeprom_cut(-1);
+
+			if (n < 0) {
+				uint32_t made = 0;
+				for (int i = 0; i <= E2END; i++)
+					made += hal_eeprom_writes[i];
+				writes = made - from;
+				continue;
+			}
+
+			reload(&back);
+			bad += !sameRecord(&back, n == writes ? &second : &first, r);
+			cuts++;
+		}
+	}
+
+	char detail[64];
+	snprintf(detail, sizeof(detail), "%d cuts, the old save or the new one each time", cuts);
+	report("cut", !bad, detail);
+}
+
+static void checkWear(int saves) {
+	Config c, back;
+	int bad = 0;
+
+	hal_reset();
+	configInit(&c, CONFIG_PARAM_ADDRESS);
+
+	for (int i = 0; i < saves; i++) {
+		c.pid[0] = i;
+		c.pid[1] = i * 0.5;
+		c.pid[2] = i * 0.25;
+		configSave(&c, CONFIG_PID);
+
+		reload(&back);
+		bad += !sameRecord(&back, &c, CONFIG_PID);
+	}
+
+	uint32_t most = 0;
+	uint16_t from = configAddress(&c, CONFIG_PID);
+	for (uint16_t at = from; at < from + configSize(CONFIG_PID); at++)
+		most = max(most, hal_eeprom_writes[at]);
+
+	char detail[96];
+	snprintf(detail, sizeof(detail), "%d saves, at most %u writes a byte (%.0f%% of one slot's), the newest read back each time",
+		saves, most, 100.0 * most / saves);
+	report("wear", !bad && most <= (uint32_t) (saves + CONFIG_PID_SLOTS - 1) / CONFIG_PID_SLOTS, detail);
+}
+
+static void checkLegacy() {
+	Config c, old, back;
+
+	hal_reset();
+	configInit(&old, CONFIG_PARAM_ADDRESS);
+	makeUp(&old);
+
+	// as mpuInit() and pilotInit() read it, before config.h
+	EEPROM.put(CONFIG_PARAM_ADDRESS, old.mag_range);
+	EEPROM.write(CONFIG_PARAM_ADDRESS + sizeof(old.mag_range), 'e');
+	EEPROM.put(CONFIG_PARAM_ADDRESS + sizeof(old.mag_range) + 1, old.mag_fit);
+	EEPROM.write(CONFIG_PARAM_ADDRESS + 256, 'w');
+	for (int i = 0; i < 3; i++)
+		EEPROM.put(CONFIG_PARAM_ADDRESS + 257 + i * sizeof(double), (double) old.pid[i]);
+
+	uint8_t loaded = reload(&c);
+	uint8_t again = reload(&back);
+	uint8_t want = bit(CONFIG_MAG_RANGE) | bit(CONFIG_MAG_FIT) | bit(CONFIG_PID);
+
+	bool ok = loaded == want && again == want;
+	for (uint8_t r = 0; r < CONFIG_MAG_OFFSET; r++)
+		ok = ok && sameRecord(&c, &old, r) && sameRecord(&back, &old, r);
+
+	report("legacy", ok, "the calibration and gains read, then saved in this layout");
+}
+
+int main(int argc, char **argv) {
+	int saves = 1000;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+		switch (opt) {
+			case 's': saves = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-s saves] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (saves < 1)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	Config c;
+	configInit(&c, CONFIG_PARAM_ADDRESS);
+	printf("%u bytes of eeprom from %d, the route's at %d\n\n",
+		configSize(CONFIG_RECORDS), CONFIG_PARAM_ADDRESS, ROUTE_PARAM_ADDRESS);
+	if (configAddress(&c, CONFIG_RECORDS) > ROUTE_PARAM_ADDRESS) {
+		fprintf(stderr, "the settings run into the route\n");
+		failed++;
+	}
+
+	checkBlank();
+	checkSaved();
+	checkBoot();
+	checkVersion();
+	checkCorrupt();
+	checkCut();
+	checkWear(saves);
+	checkLegacy();
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * EEPROM.h: host stand-in for the Arduino EEPROM library, backed by a RAM
+ * image the size of the ATmega2560's EEPROM. Use hal_eeprom_load/save to
+ * persist it between runs.
+ *
+ * A byte written keeps the part busy for HAL_EEPROM_WRITE_US of virtual time,
+ * as eeprom_is_ready() shows; writes themselves don't wait for it.
+ *
+ * Each byte's writes are counted in hal_eeprom_writes, for wear, and
+ * hal_eeprom_cut(n) loses every write after the next n, as if the power
+ * went; -1 puts it back.
+ */
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define E2END 0xFFF
+
+// the mega's byte write time
+#define HAL_EEPROM_WRITE_US 3400
+
+extern uint8_t hal_eeprom[E2END + 1];
+extern uint32_t hal_eeprom_writes[E2END + 1];
+
+void hal_eeprom_write(int idx, uint8_t val);
+void hal_eeprom_cut(int32_t n);
+bool hal_eeprom_ready();
+
+// avr/eeprom.h
+#define eeprom_is_ready() hal_eeprom_ready()
+
+class EEPROMClass {
+public:
+	uint8_t read(int idx) { return hal_eeprom[idx]; }
+	void write(int idx, uint8_t val) { hal_eeprom_write(idx, val); }
+	void update(int idx, uint8_t val) { if (hal_eeprom[idx] != val) write(idx, val); }
+	uint16_t length() { return E2END + 1; }
+
+	uint8_t &operator[](int idx) { return hal_eeprom[idx]; }
+
+	template <typename T> T &get(int idx, T &t) {
+		memcpy(&t, &hal_eeprom[idx], sizeof(T));
+		return t;
+	}
+
+	// a byte at a time, like update()
+	template <typename T> const T &put(int idx, const T &t) {
+		for (size_t i = 0; i < sizeof(T); i++)
+			update(idx + i, ((const uint8_t *) &t)[i]);
+		return t;
+	}
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Fat16.h: host stand-in for the Fat16 SD card library. Log files are created
+ * in the working directory.
+ */
+
+#ifndef Fat16_h
+#define Fat16_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "HardwareSerial.h"
+
+#define O_READ 0x01
+#define O_WRITE 0x02
+#define O_APPEND 0x04
+#define O_SYNC 0x08
+#define O_CREAT 0x10
+#define O_EXCL 0x20
+#define O_TRUNC 0x40
+
+class SdCard {
+public:
+	SdCard() : errorCode(0) {}
+
+	uint8_t init(uint8_t slow = 0, uint8_t pin = 53) { (void) slow; (void) pin; return 1; }
+
+	uint8_t errorCode;
+};
+
+class Fat16 : public Print {
+public:
+	Fat16() : writeError(false), _file(NULL) {}
+
+	static uint8_t init(SdCard *dev) { (void) dev; return 1; }
+
+	uint8_t open(const char *fileName, uint8_t oflag);
+	uint8_t close();
+	uint8_t isOpen() { return _file != NULL; }
+	uint8_t sync();
+
+	virtual size_t write(uint8_t b);
+	int16_t write(const void *buf, uint16_t nbyte);
+
+	bool writeError;
+
+private:
+	FILE *_file;
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * HardwareSerial.h: host stand-in for Print/Stream/HardwareSerial.
+ *
+ * Received bytes are queued by the simulation (hal_serial_inject), transmitted
+ * bytes go to an optional FILE* sink so long runs don't pay for console output.
+ */
+
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+
+class __FlashStringHelper;
+
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	size_t write(const char *str);
+	size_t write(const uint8_t *buffer, size_t size);
+
+	size_t print(const __FlashStringHelper *ifsh);
+	size_t print(const char *str);
+	size_t print(char c);
+	size_t print(unsigned char n, int base = DEC);
+	size_t print(int n, int base = DEC);
+	size_t print(unsigned int n, int base = DEC);
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+
+	size_t println(void);
+	size_t println(const __FlashStringHelper *ifsh);
+	size_t println(const char *str);
+	size_t println(char c);
+	size_t println(unsigned char n, int base = DEC);
+	size_t println(int n, int base = DEC);
+	size_t println(unsigned int n, int base = DEC);
+	size_t println(long n, int base = DEC);
+	size_t println(unsigned long n, int base = DEC);
+	size_t println(double n, int digits = 2);
+
+private:
+	size_t printNumber(unsigned long n, uint8_t base);
+	size_t printFloat(double number, uint8_t digits);
+};
+
+class Stream : public Print {
+public:
+	Stream() : _timeout(1000) {}
+
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+
+	void setTimeout(unsigned long timeout) { _timeout = timeout; }
+	long parseInt();
+	float parseFloat();
+
+protected:
+	int timedRead();
+	int timedPeek();
+	int peekNextDigit(bool detectDecimal);
+
+	unsigned long _timeout;
+};
+
+class HardwareSerial : public Stream {
+public:
+	HardwareSerial() : _sink(NULL) {}
+
+	void begin(unsigned long baud) { (void) baud; }
+	void end() {}
+
+	virtual int available();
+	virtual int read();
+	virtual int peek();
+	virtual size_t write(uint8_t c);
+	using Print::write;
+
+	operator bool() { return true; }
+
+	// host side. injectAt() bytes arrive once the virtual clock reaches at_us;
+	// injections must come in time order
+	void inject(const char *data, size_t len);
+	void injectAt(const char *data, size_t len, uint64_t at_us);
+	void setSink(FILE *sink) { _sink = sink; }
+	void clear() { _rx.clear(); }
+
+private:
+	struct rx_byte {
+		uint64_t at;
+		uint8_t c;
+	};
+
+	bool due();
+
+	std::deque<rx_byte> _rx;
+	FILE *_sink;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+extern HardwareSerial Serial3;
+
+#endif
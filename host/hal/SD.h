@@ -0,0 +1 @@
+// everything the firmware uses is in Fat16.h
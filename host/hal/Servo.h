@@ -0,0 +1,28 @@
+/*
+ * Servo.h: host stand-in for the Arduino Servo library. Written angles are
+ * recorded per pin and can be read back with hal_servo_angle().
+ */
+
+#ifndef Servo_h
+#define Servo_h
+
+#include <stdint.h>
+
+class Servo {
+public:
+	Servo() : _pin(0xff), _angle(90) {}
+
+	uint8_t attach(int pin);
+	uint8_t attach(int pin, int min, int max) { (void) min; (void) max; return attach(pin); }
+	void detach();
+	void write(int value);
+	void writeMicroseconds(int value) { write((value - 544) * 180L / (2400 - 544)); }
+	int read() { return _angle; }
+	bool attached() { return _pin != 0xff; }
+
+private:
+	uint8_t _pin;
+	int _angle;
+};
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Wire.h: host stand-in for the Arduino TwoWire (I2C) library. There are no
+ * devices on the host bus unless the simulation registers one with
+ * hal_wire_attach(); transmissions to empty addresses are NACKed.
+ */
+
+#ifndef TwoWire_h
+#define TwoWire_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BUFFER_LENGTH 32
+
+class TwoWire {
+public:
+	void begin() {}
+	void setClock(uint32_t clock) { (void) clock; }
+
+	void beginTransmission(uint8_t address);
+	void beginTransmission(int address) { beginTransmission((uint8_t) address); }
+	uint8_t endTransmission(bool sendStop = true);
+
+	uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+	uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t) address, (uint8_t) quantity); }
+	uint8_t requestFrom(int address, int quantity, int sendStop) { return requestFrom((uint8_t) address, (uint8_t) quantity, sendStop != 0); }
+
+	size_t write(uint8_t data);
+	size_t write(const uint8_t *data, size_t quantity);
+	int available();
+	int read();
+	int peek();
+
+private:
+	uint8_t _address;
+	uint8_t _tx[BUFFER_LENGTH];
+	uint8_t _txLength;
+	uint8_t _rx[BUFFER_LENGTH];
+	uint8_t _rxLength;
+	uint8_t _rxIndex;
+};
+
+extern TwoWire Wire;
+
+#endif
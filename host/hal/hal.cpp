@@ -0,0 +1,726 @@
+#include "Arduino.h"
+#include "Servo.h"
+#include "EEPROM.h"
+#include "Wire.h"
+#include "Fat16.h"
+#include "hal_host.h"
+
+#define HAL_PINS 70
+#define HAL_INTERRUPTS 6
+#define HAL_WIRE_DEVICES 8
+
+static uint64_t now_us = 0;
+static uint32_t poll_cost = HAL_DEFAULT_POLL_COST;
+
+static uint8_t pin_out[HAL_PINS];
+static int pin_analog[HAL_PINS];
+static int servo_angle[HAL_PINS];
+static hal_servo_fn servo_watch = NULL;
+
+static void (*isrs[HAL_INTERRUPTS])(void);
+
+static hal_timer_fn timer_fn = NULL;
+static uint32_t timer_period = 0;
+static uint64_t timer_next = 0;
+static bool in_timer = false;
+
+struct wire_device {
+	uint8_t address;
+	hal_wire_write_fn on_write;
+	hal_wire_read_fn on_read;
+};
+
+static wire_device wire_devices[HAL_WIRE_DEVICES];
+static uint8_t wire_device_count = 0;
+
+static unsigned long rand_state = 1;
+
+static uint32_t sd_syncs = 0;
+static hal_sd_fn sd_watch = NULL;
+
+uint8_t hal_eeprom[E2END + 1];
+uint32_t hal_eeprom_writes[E2END + 1];
+static uint64_t eeprom_busy_until = 0;
+static int32_t eeprom_cut = -1;
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+HardwareSerial Serial3;
+EEPROMClass EEPROM;
+TwoWire Wire;
+
+// arduino's core calls these after each loop() if the sketch defines them
+void serialEvent() __attribute__((weak));
+void serialEvent2() __attribute__((weak));
+
+//
+// host controls
+//
+void hal_reset() {
+	now_us = 0;
+	poll_cost = HAL_DEFAULT_POLL_COST;
+	rand_state = 1;
+
+	memset(pin_out, 0, sizeof(pin_out));
+	memset(pin_analog, 0, sizeof(pin_analog));
+	for (int i = 0; i < HAL_PINS; i++)
+		servo_angle[i] = -1;
+	servo_watch = NULL;
+	memset(isrs, 0, sizeof(isrs));
+	timer_fn = NULL;
+	in_timer = false;
+	memset(hal_eeprom, 0xff, sizeof(hal_eeprom));
+	memset(hal_eeprom_writes, 0, sizeof(hal_eeprom_writes));
+	eeprom_busy_until = 0;
+	eeprom_cut = -1;
+	wire_device_count = 0;
+	sd_syncs = 0;
+	sd_watch = NULL;
+
+	Serial.clear();
+	Serial1.clear();
+	Serial2.clear();
+	Serial3.clear();
+}
+
+// moves the clock on, running the timer at each time it comes due on the way
+static void advance(uint64_t us) {
+	uint64_t until = now_us + us;
+
+	while (timer_fn && !in_timer && timer_next <= until) {
+		if (now_us < timer_next)
+			now_us = timer_next;
+		timer_next += timer_period;
+
+		in_timer = true;
+		timer_fn();
+		in_timer = false;
+	}
+
+	if (now_us < until)
+		now_us = until;
+}
+
+uint64_t hal_now_us() {
+	return now_us;
+}
+
+void hal_advance_us(uint64_t us) {
+	advance(us);
+}
+
+void hal_set_poll_cost(uint32_t us) {
+	poll_cost = us;
+}
+
+int hal_pin(uint8_t pin) {
+	return pin < HAL_PINS ? pin_out[pin] : 0;
+}
+
+void hal_set_digital(uint8_t pin, int value) {
+	if (pin < HAL_PINS)
+		pin_out[pin] = value ? HIGH : LOW;
+}
+
+void hal_set_analog(uint8_t pin, int value) {
+	if (pin < HAL_PINS)
+		pin_analog[pin] = value;
+}
+
+int hal_servo_angle(uint8_t pin) {
+	return pin < HAL_PINS ? servo_angle[pin] : -1;
+}
+
+void hal_servo_watch(hal_servo_fn on_write) {
+	servo_watch = on_write;
+}
+
+void hal_timer(uint32_t period_us, hal_timer_fn on_tick) {
+	timer_fn = period_us ? on_tick : NULL;
+	timer_period = period_us;
+	timer_next = now_us + period_us;
+}
+
+void hal_raise_interrupt(uint8_t interrupt) {
+	if (interrupt < HAL_INTERRUPTS && isrs[interrupt])
+		isrs[interrupt]();
+}
+
+void hal_wire_attach(uint8_t address, hal_wire_write_fn on_write, hal_wire_read_fn on_read) {
+	if (wire_device_count == HAL_WIRE_DEVICES)
+		return;
+
+	wire_device d = { address, on_write, on_read };
+	wire_devices[wire_device_count++] = d;
+}
+
+bool hal_eeprom_load(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	size_t n = fread(hal_eeprom, 1, sizeof(hal_eeprom), f);
+	fclose(f);
+
+	return n == sizeof(hal_eeprom);
+}
+
+bool hal_eeprom_save(const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		return false;
+
+	size_t n = fwrite(hal_eeprom, 1, sizeof(hal_eeprom), f);
+	fclose(f);
+
+	return n == sizeof(hal_eeprom);
+}
+
+void hal_eeprom_write(int idx, uint8_t val) {
+	eeprom_busy_until = now_us + HAL_EEPROM_WRITE_US;
+
+	if (!eeprom_cut)
+		return;
+	if (eeprom_cut > 0)
+		eeprom_cut--;
+
+	hal_eeprom[idx] = val;
+	hal_eeprom_writes[idx]++;
+}
+
+void hal_eeprom_cut(int32_t n) {
+	eeprom_cut = n;
+}
+
+bool hal_eeprom_ready() {
+	return now_us >= eeprom_busy_until;
+}
+
+void hal_loop_once() {
+	loop();
+
+	if (serialEvent && Serial.available())
+		serialEvent();
+	if (serialEvent2 && Serial2.available())
+		serialEvent2();
+}
+
+//
+// arduino core
+//
+unsigned long millis() {
+	advance(poll_cost);
+	return (unsigned long) (now_us / 1000);
+}
+
+unsigned long micros() {
+	advance(poll_cost);
+	return (unsigned long) now_us;
+}
+
+void delay(unsigned long ms) {
+	advance((uint64_t) ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+	advance(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+	(void) pin;
+	(void) mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+	hal_set_digital(pin, val);
+}
+
+int digitalRead(uint8_t pin) {
+	return hal_pin(pin);
+}
+
+int analogRead(uint8_t pin) {
+	// the mega maps A0 to 54 but also accepts channel numbers
+	if (pin >= 54)
+		pin -= 54;
+
+	return pin < HAL_PINS ? pin_analog[pin] : 0;
+}
+
+void analogWrite(uint8_t pin, int val) {
+	hal_set_digital(pin, val > 127);
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode) {
+	(void) mode;
+
+	if (interrupt < HAL_INTERRUPTS)
+		isrs[interrupt] = isr;
+}
+
+void detachInterrupt(uint8_t interrupt) {
+	if (interrupt < HAL_INTERRUPTS)
+		isrs[interrupt] = NULL;
+}
+
+// small deterministic lcg so runs are reproducible for a given seed
+long random(long howbig) {
+	if (howbig == 0)
+		return 0;
+
+	rand_state = rand_state * 1103515245UL + 12345UL;
+	return (long) ((rand_state >> 16) & 0x7fffffff) % howbig;
+}
+
+long random(long howsmall, long howbig) {
+	if (howsmall >= howbig)
+		return howsmall;
+
+	return random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed) {
+	if (seed != 0)
+		rand_state = seed;
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+	return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+//
+// Print
+//
+size_t Print::write(const char *str) {
+	if (str == NULL)
+		return 0;
+
+	return write((const uint8_t *) str, strlen(str));
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+	size_t n = 0;
+	while (size--)
+		n += write(*buffer++);
+
+	return n;
+}
+
+size_t Print::print(const __FlashStringHelper *ifsh) {
+	return write(reinterpret_cast<const char *>(ifsh));
+}
+
+size_t Print::print(const char *str) {
+	return write(str);
+}
+
+size_t Print::print(char c) {
+	return write((uint8_t) c);
+}
+
+size_t Print::print(unsigned char n, int base) {
+	return print((unsigned long) n, base);
+}
+
+size_t Print::print(int n, int base) {
+	return print((long) n, base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+	return print((unsigned long) n, base);
+}
+
+size_t Print::print(long n, int base) {
+	if (base == 0)
+		return write((uint8_t) n);
+
+	if (base == 10 && n < 0) {
+		size_t t = print('-');
+		return printNumber(-n, 10) + t;
+	}
+
+	return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+	if (base == 0)
+		return write((uint8_t) n);
+
+	return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits) {
+	return printFloat(n, digits);
+}
+
+size_t Print::println(void) {
+	return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper *ifsh) { size_t n = print(ifsh); return n + println(); }
+size_t Print::println(const char *str) { size_t n = print(str); return n + println(); }
+size_t Print::println(char c) { size_t n = print(c); return n + println(); }
+size_t Print::println(unsigned char b, int base) { size_t n = print(b, base); return n + println(); }
+size_t Print::println(int num, int base) { size_t n = print(num, base); return n + println(); }
+size_t Print::println(unsigned int num, int base) { size_t n = print(num, base); return n + println(); }
+size_t Print::println(long num, int base) { size_t n = print(num, base); return n + println(); }
+size_t Print::println(unsigned long num, int base) { size_t n = print(num, base); return n + println(); }
+size_t Print::println(double num, int digits) { size_t n = print(num, digits); return n + println(); }
+
+size_t Print::printNumber(unsigned long n, uint8_t base) {
+	char buf[8 * sizeof(long) + 1];
+	char *str = &buf[sizeof(buf) - 1];
+
+	*str = '\0';
+
+	if (base < 2)
+		base = 10;
+
+	do {
+		char c = n % base;
+		n /= base;
+
+		*--str = c < 10 ? c + '0' : c + 'A' - 10;
+	} while (n);
+
+	return write(str);
+}
+
+// same output as the avr core, including "nan"/"inf"/"ovf"
+size_t Print::printFloat(double number, uint8_t digits) {
+	size_t n = 0;
+
+	if (isnan(number)) return print("nan");
+	if (isinf(number)) return print("inf");
+	if (number > 4294967040.0) return print("ovf");
+	if (number < -4294967040.0) return print("ovf");
+
+	if (number < 0.0) {
+		n += print('-');
+		number = -number;
+	}
+
+	double rounding = 0.5;
+	for (uint8_t i = 0; i < digits; ++i)
+		rounding /= 10.0;
+
+	number += rounding;
+
+	unsigned long int_part = (unsigned long) number;
+	double remainder = number - (double) int_part;
+	n += print(int_part);
+
+	if (digits > 0)
+		n += print('.');
+
+	while (digits-- > 0) {
+		remainder *= 10.0;
+		unsigned int to_print = (unsigned int) remainder;
+		n += print(to_print);
+		remainder -= to_print;
+	}
+
+	return n;
+}
+
+//
+// Stream. timeouts run on the virtual clock, so a partial read costs the
+// same (virtual) time it would on the board.
+//
+int Stream::timedRead() {
+	unsigned long start = millis();
+
+	do {
+		int c = read();
+		if (c >= 0)
+			return c;
+		delay(1);
+	} while (millis() - start < _timeout);
+
+	return -1;
+}
+
+int Stream::timedPeek() {
+	unsigned long start = millis();
+
+	do {
+		int c = peek();
+		if (c >= 0)
+			return c;
+		delay(1);
+	} while (millis() - start < _timeout);
+
+	return -1;
+}
+
+int Stream::peekNextDigit(bool detectDecimal) {
+	while (1) {
+		int c = timedPeek();
+
+		if (c < 0 || c == '-' || (c >= '0' && c <= '9') || (detectDecimal && c == '.'))
+			return c;
+
+		read();
+	}
+}
+
+long Stream::parseInt() {
+	bool isNegative = false;
+	long value = 0;
+
+	int c = peekNextDigit(false);
+	if (c < 0)
+		return 0;
+
+	do {
+		if (c == '-')
+			isNegative = true;
+		else if (c >= '0' && c <= '9')
+			value = value * 10 + c - '0';
+
+		read();
+		c = timedPeek();
+	} while ((c >= '0' && c <= '9'));
+
+	return isNegative ? -value : value;
+}
+
+float Stream::parseFloat() {
+	bool isNegative = false;
+	bool isFraction = false;
+	long value = 0;
+	float fraction = 1.0;
+
+	int c = peekNextDigit(true);
+	if (c < 0)
+		return 0;
+
+	do {
+		if (c == '-')
+			isNegative = true;
+		else if (c == '.')
+			isFraction = true;
+		else if (c >= '0' && c <= '9') {
+			value = value * 10 + c - '0';
+			if (isFraction)
+				fraction *= 0.1;
+		}
+
+		read();
+		c = timedPeek();
+	} while ((c >= '0' && c <= '9') || (c == '.' && !isFraction));
+
+	if (isNegative)
+		value = -value;
+
+	return isFraction ? value * fraction : value;
+}
+
+//
+// HardwareSerial
+//
+bool HardwareSerial::due() {
+	return !_rx.empty() && _rx.front().at <= now_us;
+}
+
+int HardwareSerial::available() {
+	int n = 0;
+	for (std::deque<rx_byte>::iterator i = _rx.begin(); i != _rx.end() && i->at <= now_us; i++)
+		n++;
+
+	return n;
+}
+
+int HardwareSerial::read() {
+	if (!due())
+		return -1;
+
+	uint8_t c = _rx.front().c;
+	_rx.pop_front();
+
+	return c;
+}
+
+int HardwareSerial::peek() {
+	return due() ? _rx.front().c : -1;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	if (_sink)
+		fputc(c, _sink);
+
+	return 1;
+}
+
+void HardwareSerial::inject(const char *data, size_t len) {
+	injectAt(data, len, 0);
+}
+
+void HardwareSerial::injectAt(const char *data, size_t len, uint64_t at_us) {
+	for (size_t i = 0; i < len; i++) {
+		rx_byte b = { at_us, (uint8_t) data[i] };
+		_rx.push_back(b);
+	}
+}
+
+//
+// Servo
+//
+uint8_t Servo::attach(int pin) {
+	if (pin < 0 || pin >= HAL_PINS)
+		return 0;
+
+	_pin = pin;
+	servo_angle[_pin] = _angle;
+
+	return 1;
+}
+
+void Servo::detach() {
+	if (attached())
+		servo_angle[_pin] = -1;
+
+	_pin = 0xff;
+}
+
+void Servo::write(int value) {
+	_angle = constrain(value, 0, 180);
+
+	if (attached()) {
+		servo_angle[_pin] = _angle;
+
+		if (servo_watch)
+			servo_watch(_pin, _angle);
+	}
+}
+
+//
+// Fat16
+//
+uint8_t Fat16::open(const char *fileName, uint8_t oflag) {
+	if (_file)
+		return 0;
+
+	const char *mode = "rb";
+	if (oflag & O_WRITE)
+		mode = (oflag & O_EXCL) ? "wbx" : (oflag & O_TRUNC) ? "wb" : "ab";
+
+	_file = fopen(fileName, mode);
+	return _file != NULL;
+}
+
+uint8_t Fat16::close() {
+	if (!_file)
+		return 0;
+
+	fclose(_file);
+	_file = NULL;
+
+	return 1;
+}
+
+uint8_t Fat16::sync() {
+	if (!_file)
+		return 0;
+
+	sd_syncs++;
+	return fflush(_file) == 0;
+}
+
+size_t Fat16::write(uint8_t b) {
+	return write(&b, 1);
+}
+
+int16_t Fat16::write(const void *buf, uint16_t nbyte) {
+	if (_file && sd_watch)
+		sd_watch(ftell(_file), nbyte);
+
+	if (!_file || fwrite(buf, 1, nbyte, _file) != nbyte) {
+		writeError = true;
+		return -1;
+	}
+
+	return nbyte;
+}
+
+uint32_t hal_sd_syncs() {
+	return sd_syncs;
+}
+
+void hal_sd_watch(hal_sd_fn on_write) {
+	sd_watch = on_write;
+}
+
+//
+// TwoWire
+//
+static wire_device *findWireDevice(uint8_t address) {
+	for (uint8_t i = 0; i < wire_device_count; i++)
+		if (wire_devices[i].address == address)
+			return &wire_devices[i];
+
+	return NULL;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+	_address = address;
+	_txLength = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+	(void) sendStop;
+
+	wire_device *d = findWireDevice(_address);
+	if (!d)
+		return 2; // address NACK
+
+	if (d->on_write)
+		d->on_write(_tx, _txLength);
+
+	return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool sendStop) {
+	(void) sendStop;
+
+	_rxIndex = 0;
+	_rxLength = 0;
+
+	wire_device *d = findWireDevice(address);
+	if (!d || !d->on_read)
+		return 0;
+
+	_rxLength = d->on_read(_rx, min(quantity, (uint8_t) BUFFER_LENGTH));
+
+	return _rxLength;
+}
+
+size_t TwoWire::write(uint8_t data) {
+	if (_txLength >= BUFFER_LENGTH)
+		return 0;
+
+	_tx[_txLength++] = data;
+
+	return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity) {
+	size_t n = 0;
+	while (quantity--)
+		n += write(*data++);
+
+	return n;
+}
+
+int TwoWire::available() {
+	return _rxLength - _rxIndex;
+}
+
+int TwoWire::read() {
+	return _rxIndex < _rxLength ? _rx[_rxIndex++] : -1;
+}
+
+int TwoWire::peek() {
+	return _rxIndex < _rxLength ? _rx[_rxIndex] : -1;
+}
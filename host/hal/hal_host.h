@@ -0,0 +1,63 @@
+/*
+ * hal_host.h: simulation-side controls for the host HAL.
+ *
+ * The firmware only ever sees the Arduino API; a simulation or tool uses these
+ * to drive the virtual clock, feed inputs and observe outputs.
+ */
+
+#ifndef hal_host_h
+#define hal_host_h
+
+#include <stdint.h>
+
+// every millis()/micros() call costs this much virtual time, so busy-wait
+// loops in the firmware terminate. default 1us.
+#define HAL_DEFAULT_POLL_COST 1
+
+// resets the clock, pins, servos, i2c bus and serial queues. eeprom is reset to erased (0xff)
+void hal_reset();
+
+uint64_t hal_now_us();
+void hal_advance_us(uint64_t us);
+void hal_set_poll_cost(uint32_t us);
+
+// last value written with digitalWrite (or set with hal_set_digital)
+int hal_pin(uint8_t pin);
+void hal_set_digital(uint8_t pin, int value);
+void hal_set_analog(uint8_t pin, int value);
+
+// last angle written to the servo attached to pin, -1 if none attached
+int hal_servo_angle(uint8_t pin);
+
+// called on every servo write, at the virtual time it happens
+typedef void (*hal_servo_fn)(uint8_t pin, int angle);
+void hal_servo_watch(hal_servo_fn on_write);
+
+// raise an external interrupt registered with attachInterrupt()
+void hal_raise_interrupt(uint8_t interrupt);
+
+// a device running off its own clock: on_tick is called every period_us of
+// virtual time, at the time it's due, even from the middle of a delay(). one
+// timer at a time; a period of 0 stops it
+typedef void (*hal_timer_fn)();
+void hal_timer(uint32_t period_us, hal_timer_fn on_tick);
+
+// i2c devices. on_write gets each completed transmission, on_read fills a requestFrom()
+typedef void (*hal_wire_write_fn)(const uint8_t *data, uint8_t len);
+typedef uint8_t (*hal_wire_read_fn)(uint8_t *data, uint8_t len);
+void hal_wire_attach(uint8_t address, hal_wire_write_fn on_write, hal_wire_read_fn on_read);
+
+// times the firmware has synced an sd file (each one a sector write or more on the card)
+uint32_t hal_sd_syncs();
+
+// called on every write to an sd file, with where in the file it starts
+typedef void (*hal_sd_fn)(uint32_t at, uint16_t bytes);
+void hal_sd_watch(hal_sd_fn on_write);
+
+bool hal_eeprom_load(const char *path);
+bool hal_eeprom_save(const char *path);
+
+// one pass of the arduino main loop: loop() followed by any pending serialEvent
+void hal_loop_once();
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * headingbench.cpp: compass.h's heading filter in closed loop, against the
+ * simulation's true heading.
+ *
+ * The firmware sails the test waypoints, steering by the filter, with
+ * deviation made up per run: up to 8 degrees constant, and up to 10 each way
+ * with heading, on top of the simulated 3 degrees of compass noise, and the
+ * boat making leeway as it heels. The boat gets a polar with no irons, so
+ * it keeps moving whatever the pilot does with the sails, faster on some
+ * points of sail than others: this is about the heading, and the gps course
+ * only counts at speed. After every pass through loop() the filter's
+ * heading, carried forward to then, is checked against the true heading,
+ * and so is the 10 sample average the pilot used to steer by: as it is,
+ * less the deviation the filter's learned, which leaves it the filter's
+ * deviation error but not its noise and lag, and less the true deviation.
+ *
+ * Errors are rms degrees over the second half of each run, once the
+ * deviation's been learned. "deviation" is how far the learned deviation is
+ * off the true one, rms over all headings, and "leeway" the learned leeway
+ * per degree of heel against the simulation's (8 degrees at 45 of heel).
+ *
+ * With no current, over all the runs, the filter has to come within 4
+ * degrees rms and beat the average less the same deviation, and the
+ * deviation has to be learned to within 2 degrees rms, and to within 4 on
+ * every run. The filter learns the current (-c) too, but it's harder to
+ * tell from deviation the stronger it is, so with it the numbers are only
+ * reported, means last.
+ *
+ * usage: ardusailor_headingbench [-n runs] [-t seconds] [-c knots] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "compass.h"
+#include "sketch.h"
+#include "sim/sim.h"
+
+#define MAX_FUSED_ERROR 4.0
+#define MAX_DEVIATION_ERROR 2.0
+#define MAX_RUN_DEVIATION_ERROR 4.0
+
+#define D2R(v) ((v) * M_PI / 180)
+
+// firmware.ino
+extern Compass compass;
+extern float ahrs_heading;
+
+static uint32_t rng_state;
+
+static double rnd() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state & 0xffffff) / (double) 0x1000000;
+}
+
+static double wrap180(double v) {
+	return v - 360 * floor((v + 180) / 360);
+}
+
+static double deviation(const float d[3], double heading) {
+	return d[0] + d[1] * sin(D2R(heading)) + d[2] * cos(D2R(heading));
+}
+
+int main(int argc, char **argv) {
+	int runs = 8;
+	double seconds = 3600, current = 0;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:t:c:r:")) != -1) {
+		switch (opt) {
+			case 'n': runs = atoi(optarg); break;
+			case 't': seconds = atof(optarg); break;
+			case 'c': current = atof(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-t seconds] [-c knots] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (runs <= 0 || seconds <= 0)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	printf("rms degrees over the second half of each run\n");
+	printf("run  true deviation       filter  average  less learned  less dev  deviation  leeway  true   fixes\n");
+
+	int failed = 0;
+	double fused_sum = 0, learned_sum = 0, less_sum = 0, dev_sum = 0;
+	for (int run = 0; run < runs; run++) {
+		struct sim_config cfg;
+		sim_default_config(&cfg);
+		cfg.seed = seed * 1000 + run;
+		cfg.wind.direction = 360 * rnd();
+		cfg.current_speed = current;
+		cfg.current_direction = 360 * rnd();
+		cfg.noise.deviation[0] = 8 * (2 * rnd() - 1);
+		cfg.noise.deviation[1] = 10 * (2 * rnd() - 1);
+		cfg.noise.deviation[2] = 10 * (2 * rnd() - 1);
+		for (int i = 0; i < 13; i++)
+			cfg.boat.polar[i] = 0.15 + 0.2 * sin(D2R(i * 15));
+		cfg.boat.irons_angle = 0;
+		sim_begin(&cfg);
+
+		setup();
+
+		const struct sim_state *st = sim_get_state();
+		uint64_t start = hal_now_us();
+		uint64_t half = start + (uint64_t) (seconds * 5e5);
+		uint64_t until = start + (uint64_t) (seconds * 1e6);
+		double fused = 0, average = 0, learned = 0, less = 0;
+		uint32_t n = 0;
+
+		while (hal_now_us() < until) {
+			sim_advance();
+			hal_loop_once();
+			sim_advance();
+
+			if (hal_now_us() < half)
+				continue;
+
+			double truth = st->heading;
+			double f = wrap180(bamToDeg(compassHeading(&compass, micros())) - truth);
+			double a = wrap180(ahrs_heading - truth);
+			double d = wrap180(ahrs_heading - compassDeviation(&compass, ahrs_heading) - truth);
+			double l = wrap180(ahrs_heading - deviation(cfg.noise.deviation, truth) - truth);
+
+			fused += f * f;
+			average += a * a;
+			learned += d * d;
+			less += l * l;
+			n++;
+		}
+
+		fused = sqrt(fused / n);
+		average = sqrt(average / n);
+		learned = sqrt(learned / n);
+		less = sqrt(less / n);
+
+		double dev = 0;
+		for (int h = 0; h < 360; h++) {
+			double e = compassDeviation(&compass, h) - deviation(cfg.noise.deviation, h);
+			dev += e * e;
+		}
+		dev = sqrt(dev / 360);
+
+		printf("%3d  %+5.1f %+5.1f %+5.1f  %7.2f  %7.2f  %12.2f  %8.2f  %9.2f  %6.3f %5.3f  %6u\n",
+			run, cfg.noise.deviation[0], cfg.noise.deviation[1], cfg.noise.deviation[2],
+			fused, average, learned, less, dev, compass.dev[3], cfg.boat.leeway / 45, compass.fixes);
+
+		fused_sum += fused;
+		learned_sum += learned;
+		less_sum += less;
+		dev_sum += dev;
+
+		if (current == 0 && dev > MAX_RUN_DEVIATION_ERROR) {
+			fprintf(stderr, "run %d: deviation off the true one\n", run);
+			failed++;
+		}
+	}
+
+	printf("mean                     %7.2f  %7s  %12.2f  %8.2f  %9.2f\n",
+		fused_sum / runs, "", learned_sum / runs, less_sum / runs, dev_sum / runs);
+
+	if (current == 0 && (fused_sum / runs > MAX_FUSED_ERROR || fused_sum > learned_sum ||
+			dev_sum / runs > MAX_DEVIATION_ERROR)) {
+		fprintf(stderr, "filter off the true heading\n");
+		failed++;
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * imuload.cpp: the AHRS sample queue under load, against a simulated MPU.
+ *
+ * The simulated DMP puts a packet in its FIFO every 20ms and raises the
+ * data-ready interrupt, at the virtual time it happens (sim/sensors.cpp).
+ * The firmware runs as usual, with a random extra delay after each pass
+ * through loop() standing in for work that holds it up: up to each of the
+ * loads below. Every sample readSteadyHeading() takes is checked against the
+ * packet it came from, for order and timestamp.
+ *
+ * Up to the FIFO's worth of time between reads (24 packets, 480ms) nothing
+ * may be lost. Beyond it the FIFO overflows, and every packet lost has to be
+ * accounted for.
+ *
+ * usage: ardusailor_imuload [-t seconds] [-r seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "imu.h"
+#include "sketch.h"
+#include "sim/sim.h"
+
+// the simulated mpu's fifo, in packets
+#define MPU_FIFO 24
+
+// ms of extra delay per loop, at most. the last is too much for the fifo
+static const int loads[] = { 0, 100, 200, 300, 1000 };
+#define SAFE_LOADS 4
+
+int main(int argc, char **argv) {
+	double seconds = 600;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:r:")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-t seconds] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (seconds <= 0)
+		return 1;
+
+	printf("load ms   loop ms   packets     taken    lost  mistimed  max age ms  i2c %%\n");
+
+	int failed = 0;
+	for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+		struct sim_config cfg;
+		sim_default_config(&cfg);
+		cfg.seed = seed;
+		sim_begin(&cfg);
+
+		// setup() leaves the mpu to itself for seconds at a time, blinking
+		// the led and so on, so its fifo overflows. count from once the
+		// first few loops have cleared that up
+		setup();
+		for (int i = 0; i < 10; i++)
+			hal_loop_once();
+
+		struct sim_imu before = *sim_get_imu();
+		uint32_t taken_before = imu_stats.taken, overflows_before = imu_stats.overflows;
+
+		uint64_t start = hal_now_us();
+		uint64_t until = start + (uint64_t) (seconds * 1e6);
+		uint32_t loops = 0;
+
+		while (hal_now_us() < until) {
+			sim_advance();
+			hal_loop_once();
+			loops++;
+
+			if (loads[l])
+				delay(random(loads[l] + 1));
+		}
+
+		const struct sim_imu *after = sim_get_imu();
+		uint32_t packets = after->packets - before.packets;
+		uint32_t taken = after->taken - before.taken;
+		uint32_t lost = after->lost - before.lost;
+		uint32_t mistimed = after->mistimed - before.mistimed;
+
+		// at most a fifo and a queue's worth from before the first loop and
+		// after the last
+		int32_t unaccounted = (int32_t) (packets - taken - lost);
+
+		printf("%7d %9.1f %9u %9u %7u %9u %11.1f %6.1f\n",
+			loads[l], (hal_now_us() - start) / 1000.0 / loops,
+			packets, taken, lost, mistimed, after->max_age / 1000.0,
+			(after->read_time - before.read_time) * 100.0 / (hal_now_us() - start));
+
+		// out of order or with the wrong time, or lost with nothing to say so
+		if (mistimed || abs(unaccounted) > MPU_FIFO + IMU_QUEUE_SIZE ||
+			taken != imu_stats.taken - taken_before ||
+			(lost && imu_stats.overflows == overflows_before)) {
+			fprintf(stderr, "load %dms: samples lost or mixed up\n", loads[l]);
+			failed++;
+		}
+
+		if (l < SAFE_LOADS && lost) {
+			fprintf(stderr, "load %dms: %u packets lost to fifo overflow\n", loads[l], lost);
+			failed++;
+		}
+	}
+
+	return failed ? 1 : 0;
+}
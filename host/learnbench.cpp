@@ -0,0 +1,203 @@
+/*
+ * learnbench.cpp: sailing with the polar learned as it goes (learn.h)
+ * against the default polar and trim, in closed loop against the boat
+ * simulation.
+ *
+ * The course and conditions are tackbench's: two marks 300m apart, one
+ * upwind of the other, 6 to 12 knots of wind, gusting and shifting, a
+ * little current. Every run is sailed with and without learning, the same
+ * seed each time, starting from nothing learned, and for half the legs as
+ * well as all of them: the runs are the same up to half way, so the second
+ * half's time is the difference. The sheet's set by the wind angle, not
+ * trimmed (trim.h, trimbench), which leaves the polar alone.
+ *
+ * Reported per leg, over the runs all four sailings finished: the median
+ * seconds over the first half and the second. Learning has to be faster
+ * over the second half.
+ *
+ * usage: ardusailor_learnbench [-n runs] [-l legs] [-j jobs] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "scenario.h"
+
+#define EARTH_R 6371000.0
+#define D2R(v) ((v) * M_PI / 180.0)
+
+// m from the bottom mark to the top one
+#define COURSE_LENGTH 300
+
+#define TUNED_KP 0.85
+#define TUNED_KI 0.012
+#define TUNED_KD 0.011
+
+static uint32_t rng_state;
+
+static double uniform() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state >> 8) / (double) (1 << 24);
+}
+
+static void buildScenario(struct scenario *s, uint32_t seed, int legs) {
+	scenario_defaults(s);
+
+	struct sim_config *cfg = &s->sim;
+	cfg->seed = seed;
+	cfg->wind.direction = 360 * uniform();
+	cfg->wind.speed = 6 + 6 * uniform();
+	cfg->wind.gust_factor = 0.3 * uniform();
+	cfg->wind.shift_amplitude = 15 * uniform();
+	cfg->current_speed = 0.25 * uniform();
+	cfg->current_direction = 360 * uniform();
+
+	// the top mark up the wind from the start, the bottom one at it
+	double up = D2R(cfg->wind.direction + 40 * uniform() - 20);
+
+	s->waypoints[0] = cfg->start_lat + COURSE_LENGTH * cos(up) / EARTH_R * 180 / M_PI;
+	s->waypoints[1] = cfg->start_lon + COURSE_LENGTH * sin(up) / (EARTH_R * cos(D2R(cfg->start_lat))) * 180 / M_PI;
+	s->waypoints[2] = cfg->start_lat;
+	s->waypoints[3] = cfg->start_lon;
+	s->waypoint_count = 2;
+
+	// what ardusailor_tune finds for the simulated boat
+	s->tunings[0] = TUNED_KP;
+	s->tunings[1] = TUNED_KI;
+	s->tunings[2] = TUNED_KD;
+	s->legs = legs;
+	s->limit = legs * 600;
+	s->tack_every = 0;
+}
+
+// per leg, for each run all four sailings finished
+struct totals {
+	int finished;
+	int paired;
+	float *first;
+	float *second;
+};
+
+static int cmpFloat(const void *a, const void *b) {
+	float x = *(const float *) a, y = *(const float *) b;
+
+	return (x > y) - (x < y);
+}
+
+static float median(float *v, int n) {
+	if (!n)
+		return 0;
+
+	qsort(v, n, sizeof(float), cmpFloat);
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static void add(struct totals *t, const struct scenario_result *half, const struct scenario_result *all) {
+	t->first[t->paired] = half->elapsed / half->legs;
+	t->second[t->paired] = (all->elapsed - half->elapsed) / (all->legs - half->legs);
+	t->paired++;
+}
+
+static void report(const char *name, struct totals *t, int runs) {
+	printf("%-10s %4d/%-4d %8.1f %8.1f\n", name, t->finished, runs,
+		median(t->first, t->paired), median(t->second, t->paired));
+}
+
+int main(int argc, char **argv) {
+	int runs = 32;
+	int legs = 16;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:l:j:r:")) != -1) {
+		switch (opt) {
+			case 'n': runs = atoi(optarg); break;
+			case 'l': legs = atoi(optarg); break;
+			case 'j': jobs = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-l legs] [-j jobs] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (runs < 1 || legs < 2 || jobs < 1)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	// without learning, half way and all the way, then the same with
+	struct scenario *s = (struct scenario *) calloc(runs * 4, sizeof(struct scenario));
+	struct scenario_result *r = (struct scenario_result *) calloc(runs * 4, sizeof(struct scenario_result));
+
+	for (int i = 0; i < runs; i++) {
+		buildScenario(&s[i * 4], seed * 1000 + i, legs);
+		s[i * 4].learning = false;
+		s[i * 4].trimming = false;
+
+		s[i * 4 + 1] = s[i * 4];
+		s[i * 4 + 1].legs = legs / 2;
+
+		s[i * 4 + 2] = s[i * 4];
+		s[i * 4 + 2].learning = true;
+
+		s[i * 4 + 3] = s[i * 4 + 1];
+		s[i * 4 + 3].learning = true;
+	}
+
+	if (!scenario_run_all(s, r, runs * 4, jobs, NULL))
+		return 1;
+
+	struct totals fixed, learned;
+	memset(&fixed, 0, sizeof(fixed));
+	memset(&learned, 0, sizeof(learned));
+	fixed.first = (float *) calloc(runs, sizeof(float));
+	fixed.second = (float *) calloc(runs, sizeof(float));
+	learned.first = (float *) calloc(runs, sizeof(float));
+	learned.second = (float *) calloc(runs, sizeof(float));
+
+	// runs the second half went faster learning
+	int faster = 0;
+
+	for (int i = 0; i < runs; i++) {
+		const struct scenario_result *a = &r[i * 4], *b = &r[i * 4 + 2];
+		const struct scenario_result *ah = &r[i * 4 + 1], *bh = &r[i * 4 + 3];
+
+		fixed.finished += a->finished;
+		learned.finished += b->finished;
+
+		if (a->finished && b->finished && ah->finished && bh->finished) {
+			add(&fixed, ah, a);
+			add(&learned, bh, b);
+			faster += b->elapsed - bh->elapsed < a->elapsed - ah->elapsed;
+		}
+	}
+
+	printf("polar      finished    first   second   (s/leg)\n");
+	report("default", &fixed, runs);
+	report("learned", &learned, runs);
+	printf("learning was faster over the second half in %d of %d runs\n", faster, learned.paired);
+
+	int failed = 0;
+
+	if (!learned.paired || median(learned.second, learned.paired) >= median(fixed.second, fixed.paired)) {
+		fprintf(stderr, "learning wasn't faster over the second half\n");
+		failed++;
+	}
+
+	free(fixed.first);
+	free(fixed.second);
+	free(learned.first);
+	free(learned.second);
+	free(s);
+	free(r);
+
+	return failed ? 1 : 0;
+}
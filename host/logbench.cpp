@@ -0,0 +1,171 @@
+/*
+ * logbench.cpp: the sd card log (logger.h) over a simulated run, on the
+ * host's Fat16 stand-in. Built once for each way the log can be written:
+ *
+ *   ardusailor_logbench_line     every line written and synced as it's
+ *                                logged, as before the block (LOG_UNBUFFERED)
+ *   ardusailor_logbench_block    text, a 512 byte block at a time
+ *   ardusailor_logbench_binary   binary records, a block at a time (LOG_BINARY)
+ *
+ * Each sails the default run for -t seconds, counting the bytes written to
+ * the file, the writes and the syncs (each a sector write or more on the
+ * card), then times -n calls of logln() on the host's clock. Built with the
+ * block, every write has to end on a block of the file, bar those a timed
+ * flush syncs straight after, and there can be no more syncs than the
+ * flush interval allows. Line by line, every line has to have been synced.
+ *
+ * The log's written to a directory of its own under /tmp, removed after.
+ *
+ *   for v in line block binary; do ./build/ardusailor_logbench_$v; done
+ *
+ * usage: ardusailor_logbench_<way> [-t seconds] [-n calls] [-r seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "logger.h"
+#include "sim/sim.h"
+
+#if defined(LOG_UNBUFFERED)
+#define WAY "line"
+#elif defined(LOG_BINARY)
+#define WAY "binary"
+#else
+#define WAY "block"
+#endif
+
+#ifdef LOG_BINARY
+#define LOG_NAME "LOGGER00.BIN"
+#else
+#define LOG_NAME "LOGGER00.TXT"
+#endif
+
+static uint64_t bytes;
+static uint32_t writes;
+
+// a write that didn't end on a block, and the syncs there'd been before it
+static bool partial;
+static uint32_t partial_syncs;
+static uint32_t unsynced;
+
+static void countWrite(uint32_t at, uint16_t n) {
+	if (partial && hal_sd_syncs() == partial_syncs)
+		unsynced++;
+
+	partial = (at + n) % LOG_BUFFER_SIZE != 0;
+	partial_syncs = hal_sd_syncs();
+
+	bytes += n;
+	writes++;
+}
+
+static uint32_t countLines() {
+	FILE *f = fopen(LOG_NAME, "rb");
+	uint32_t lines = 0;
+	int c;
+
+	if (!f)
+		return 0;
+
+	while ((c = fgetc(f)) != EOF)
+		lines += c == '\n';
+	fclose(f);
+
+	return lines;
+}
+
+static double wallNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+	double seconds = 600;
+	int calls = 100000;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:n:r:")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'n': calls = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-t seconds] [-n calls] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (seconds <= 0 || calls < 1)
+		return 1;
+
+	char dir[] = "/tmp/ardusailor_logbenchXXXXXX";
+	if (!mkdtemp(dir) || chdir(dir)) {
+		perror(dir);
+		return 1;
+	}
+
+	struct sim_config cfg;
+	sim_default_config(&cfg);
+	cfg.seed = seed;
+	sim_begin(&cfg);
+	hal_sd_watch(countWrite);
+
+	sim_run(seconds, NULL, NULL);
+
+	// the tail, as a timed flush would
+	logTick();
+	hal_advance_us((LOG_FLUSH_INTERVAL + 1) * 1000ULL);
+	logTick();
+
+	uint64_t run_bytes = bytes;
+	uint32_t run_writes = writes, run_unsynced = unsynced, run_syncs = hal_sd_syncs();
+
+	char detail[160];
+#ifdef LOG_BINARY
+	uint32_t lines = 0;
+	snprintf(detail, sizeof(detail), "%.0fs: %llu bytes", seconds, (unsigned long long) run_bytes);
+#else
+	uint32_t lines = countLines();
+	snprintf(detail, sizeof(detail), "%.0fs: %llu bytes, %u lines", seconds, (unsigned long long) run_bytes, lines);
+#endif
+
+	// lines as the data task logs them, to the card alone
+	serial_logging = false;
+	double total = 0, worst = 0;
+
+	for (int i = 0; i < calls; i++) {
+		double start = wallNs();
+		logln(F("Position: %s, %s (%dms old, %d sats, HDOP %d.%d), Speed: %d.%d, Direction: %d.%d, Wind: %d, Battery %d.%d"),
+			"47.6062000", "-122.3321000", i % 1000, 8, 1, 2, 4, 5, 271, 3, i % 360, 12, 6);
+		double took = wallNs() - start;
+
+		total += took;
+		worst = max(worst, took);
+	}
+
+	unlink(LOG_NAME);
+	if (chdir("/") == 0)
+		rmdir(dir);
+
+	uint32_t most_syncs = seconds * 1000 / LOG_FLUSH_INTERVAL + 2;
+	bool ok;
+#ifdef LOG_UNBUFFERED
+	ok = run_syncs >= lines;
+#else
+	ok = !run_unsynced && run_syncs <= most_syncs;
+#endif
+
+	printf("%-10s %-6s %s, %u writes (%u off a block unsynced), %u syncs; logln %.0fns mean, %.0fns worst\n",
+		WAY, ok ? "ok" : "FAILED", detail, run_writes, run_unsynced, run_syncs, total / calls, worst);
+
+	return ok ? 0 : 1;
+}
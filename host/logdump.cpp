@@ -0,0 +1,225 @@
+/*
+ * logdump.cpp: turns a binary log (LOGGERnn.BIN, written with LOG_BINARY)
+ * back into the text the firmware logs over serial, one "HHMMSS:millis line"
+ * per record.
+ *
+ * usage: ardusailor_logdump file [file...]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "logger.h"
+
+struct reader {
+	const uint8_t *p, *end;
+
+	bool has(size_t n) { return (size_t) (end - p) >= n; }
+	uint8_t u8() { return *p++; }
+	uint16_t u16() { uint16_t v = p[0] | (p[1] << 8); p += 2; return v; }
+	uint32_t u32() { uint32_t v = u16(); return v | ((uint32_t) u16() << 16); }
+};
+
+// formats one conversion (spec is e.g. "%5d") with the next raw argument
+static bool formatArg(std::string &out, std::string spec, reader &args) {
+	char buf[256];
+	char conv = spec[spec.size() - 1];
+	bool is_long = spec.find('l') != std::string::npos;
+
+	size_t star;
+	while ((star = spec.find('*')) != std::string::npos) {
+		if (!args.has(2))
+			return false;
+		spec.replace(star, 1, std::to_string((int16_t) args.u16()));
+	}
+
+	switch (conv) {
+		case 's': {
+			if (!args.has(1))
+				return false;
+			uint8_t len = args.u8();
+			if (!args.has(len))
+				return false;
+			std::string s((const char *) args.p, len);
+			args.p += len;
+			snprintf(buf, sizeof(buf), spec.c_str(), s.c_str());
+			break;
+		}
+
+		case 'e': case 'E': case 'f': case 'g': case 'G': {
+			if (!args.has(4))
+				return false;
+			uint32_t bits = args.u32();
+			float f;
+			memcpy(&f, &bits, 4);
+			snprintf(buf, sizeof(buf), spec.c_str(), f);
+			break;
+		}
+
+		case 'd': case 'i':
+			if (!args.has(is_long ? 4 : 2))
+				return false;
+			if (is_long)
+				snprintf(buf, sizeof(buf), spec.c_str(), (long) (int32_t) args.u32());
+			else
+				snprintf(buf, sizeof(buf), spec.c_str(), (int) (int16_t) args.u16());
+			break;
+
+		default:
+			if (!args.has(is_long ? 4 : 2))
+				return false;
+			if (is_long)
+				snprintf(buf, sizeof(buf), spec.c_str(), (unsigned long) args.u32());
+			else
+				snprintf(buf, sizeof(buf), spec.c_str(), (unsigned) args.u16());
+			break;
+	}
+
+	out += buf;
+	return true;
+}
+
+// the avr's vsnprintf, fed from the record's argument bytes. missing arguments print as '?'
+static std::string format(const std::string &fmt, reader args) {
+	std::string out;
+
+	for (size_t i = 0; i < fmt.size(); i++) {
+		if (fmt[i] != '%') {
+			out += fmt[i];
+			continue;
+		}
+
+		size_t start = i++;
+		while (i < fmt.size() && strchr("-+ #0123456789.*hl", fmt[i]))
+			i++;
+
+		if (i >= fmt.size())
+			break;
+
+		if (fmt[i] == '%') {
+			out += '%';
+			continue;
+		}
+
+		if (!formatArg(out, fmt.substr(start, i - start + 1), args))
+			out += '?';
+	}
+
+	return out;
+}
+
+static bool dump(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return false;
+	}
+
+	std::vector<uint8_t> data;
+	uint8_t chunk[4096];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		data.insert(data.end(), chunk, chunk + n);
+	fclose(f);
+
+	if (data.size() < 4 || memcmp(&data[0], LOG_MAGIC, 4)) {
+		fprintf(stderr, "%s: not a binary log\n", path);
+		return false;
+	}
+
+	std::map<uint16_t, std::string> formats;
+	char time[7] = "";
+
+	reader r = { &data[4], &data[0] + data.size() };
+	while (r.has(1)) {
+		const uint8_t *rec = r.p;
+		uint8_t type = r.u8();
+
+		switch (type) {
+			case LOG_REC_FORMAT: {
+				if (!r.has(3))
+					goto truncated;
+				uint16_t id = r.u16();
+				uint8_t len = r.u8();
+				if (!r.has(len))
+					goto truncated;
+				formats[id] = std::string((const char *) r.p, len);
+				r.p += len;
+				break;
+			}
+
+			case LOG_REC_TIME:
+				if (!r.has(6))
+					goto truncated;
+				memcpy(time, r.p, 6);
+				r.p += 6;
+				break;
+
+			case LOG_REC_LINE: {
+				if (!r.has(7))
+					goto truncated;
+				uint16_t id = r.u16();
+				uint32_t millis = r.u32();
+				uint8_t len = r.u8();
+				if (!r.has(len))
+					goto truncated;
+
+				reader args = { r.p, r.p + len };
+				r.p += len;
+
+				std::map<uint16_t, std::string>::iterator fmt = formats.find(id);
+				printf("%s:%u %s\n", time, millis,
+					fmt == formats.end() ? "[unknown format]" : format(fmt->second, args).c_str());
+				break;
+			}
+
+			case LOG_REC_TEXT: {
+				if (!r.has(6))
+					goto truncated;
+				uint32_t millis = r.u32();
+				bool println = r.u8();
+				uint8_t len = r.u8();
+				if (!r.has(len))
+					goto truncated;
+
+				printf("%s:%u ", time, millis);
+				fwrite(r.p, 1, len, stdout);
+				r.p += len;
+
+				if (println)
+					printf("\n");
+				break;
+			}
+
+			default:
+				fprintf(stderr, "%s: bad record type %u at offset %zu\n", path, type, (size_t) (rec - &data[0]));
+				return false;
+		}
+	}
+
+	return true;
+
+truncated:
+	// the tail of a log cut off by a power loss
+	fprintf(stderr, "%s: truncated record at the end\n", path);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file [file...]\n", argv[0]);
+		return 1;
+	}
+
+	int failed = 0;
+	for (int i = 1; i < argc; i++)
+		if (!dump(argv[i]))
+			failed++;
+
+	return failed ? 1 : 0;
+}
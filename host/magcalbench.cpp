@@ -0,0 +1,329 @@
+/*
+ * magcalbench.cpp: magcal.h's streaming ellipsoid fit on synthetic mag
+ * readings with known hard and soft iron, against the min/max midpoint
+ * calibrateMag() used before.
+ *
+ * Each trial makes up a soft iron matrix (up to 15% stretch and some
+ * skew), a hard iron offset, and 300 noisy readings the way a calibration
+ * takes them: "tumble" is turning the unit every which way by hand (menu
+ * 'c'), "circles" the boat going round with the rudder over, heeled and
+ * rolling (menu 'o'). Both are then scored on fresh readings, without
+ * noise: how far the offset is off in mag lsb, how far corrected readings
+ * are off a sphere (% of the field), and tilt-compensated heading error in
+ * degrees at boat-like attitudes. "fit" is magCalSolve() after 25 to 300 readings, "held" how
+ * many of those it had to hold to the last calibration, and "min/max" the
+ * old way after 300. Tumble starts from no soft iron and an offset off by
+ * up to the field; circles from tumble's fit, as if the boat had been
+ * calibrated by hand before, with the offset since moved by up to 30 lsb.
+ *
+ * Over all trials, tumble has to converge to the full ellipsoid on its own:
+ * the offset within 2 lsb and heading within 1 degree. Circles only see the
+ * field round a cone, so they're held to tumble's soft iron and field, and
+ * may not come out worse than min/max.
+ *
+ * usage: ardusailor_magcalbench [-n trials] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "magcal.h"
+
+#define READINGS 300
+#define FIELD 170
+#define DIP 65
+#define NOISE 1.5
+#define DRIFT 30
+#define CHECKS 2000
+
+#define D2R(v) ((v) * M_PI / 180)
+#define R2D(v) ((v) * 180 / M_PI)
+
+// readings the fit is tried after
+static const int steps[] = { 25, 50, 100, 200, 300 };
+#define STEPS (sizeof(steps) / sizeof(steps[0]))
+
+#define MAX_OFFSET_ERROR 2.0
+#define MAX_HEADING_ERROR 1.0
+
+static uint32_t rng_state;
+
+static double rnd() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state & 0xffffff) / (double) 0x1000000;
+}
+
+static double gaussian() {
+	return sqrt(-2 * log(rnd() + 1e-12)) * cos(2 * M_PI * rnd());
+}
+
+// the unit's axes in earth ones (north, west, up): heading clockwise, pitch
+// bow up, roll to starboard
+static void attitude(double heading, double pitch, double roll, double r[3][3]) {
+	double ch = cos(D2R(heading)), sh = sin(D2R(heading));
+	double cp = cos(D2R(pitch)), sp = sin(D2R(pitch));
+	double cr = cos(D2R(roll)), sr = sin(D2R(roll));
+
+	// columns are the unit's x (forward), y (port) and z (up)
+	double x[3] = { ch * cp, -sh * cp, sp };
+	double y0[3] = { sh, ch, 0 };
+	double z0[3] = { -ch * sp, sh * sp, cp };
+
+	for (int i = 0; i < 3; i++) {
+		r[i][0] = x[i];
+		r[i][1] = cr * y0[i] + sr * z0[i];
+		r[i][2] = cr * z0[i] - sr * y0[i];
+	}
+}
+
+struct distortion {
+	double soft[3][3];
+	double offset[3];
+};
+
+static void reading(const distortion &d, double r[3][3], double noise, int16_t raw[3]) {
+	double field[3] = { FIELD * cos(D2R(DIP)), 0, -FIELD * sin(D2R(DIP)) };
+	double b[3];
+
+	for (int i = 0; i < 3; i++)
+		b[i] = r[0][i] * field[0] + r[1][i] * field[1] + r[2][i] * field[2];
+
+	for (int i = 0; i < 3; i++) {
+		double v = d.offset[i] + noise * gaussian();
+		for (int j = 0; j < 3; j++)
+			v += d.soft[i][j] * b[j];
+		raw[i] = lround(v);
+	}
+}
+
+static void tumble(double r[3][3]) {
+	attitude(360 * rnd(), R2D(asin(2 * rnd() - 1)), 360 * rnd() - 180, r);
+}
+
+static void circle(int i, double r[3][3]) {
+	double t = i * 0.1;
+	attitude(t * 20 + 10 * sin(t), 4 * sin(2.5 * t), 18 + 8 * sin(1.6 * t), r);
+}
+
+static void boat(double r[3][3]) {
+	attitude(360 * rnd(), 10 * (2 * rnd() - 1), 30 * (2 * rnd() - 1), r);
+}
+
+struct score {
+	double offset, sphere, heading;
+};
+
+// offset error, corrected field off a sphere (rms %), heading error (rms)
+static score check(const distortion &d, const MagCal &cal) {
+	score s = { 0, 0, 0 };
+	double sum = 0, sum2 = 0;
+
+	for (int i = 0; i < 3; i++)
+		s.offset = fmax(s.offset, fabs(cal.offset[i] - d.offset[i]));
+
+	for (int n = 0; n < CHECKS; n++) {
+		double r[3][3];
+		int16_t raw[3];
+		float m[3];
+
+		n % 2 ? boat(r) : tumble(r);
+		reading(d, r, 0, raw);
+		magCalApply(&cal, raw, m);
+
+		double len = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+		sum += len;
+		sum2 += len * len;
+
+		if (n % 2 == 0)
+			continue;
+
+		// tilt compensated with the true attitude: the field back in earth
+		// axes, where its horizontal part should point north
+		double north = 0, west = 0;
+		for (int j = 0; j < 3; j++) {
+			north += r[0][j] * m[j];
+			west += r[1][j] * m[j];
+		}
+
+		double e = R2D(atan2(west, north));
+		s.heading += e * e;
+	}
+
+	double mean = sum / CHECKS;
+	s.sphere = 100 * sqrt(fmax(0, sum2 / CHECKS - mean * mean)) / mean;
+	s.heading = sqrt(s.heading / (CHECKS / 2));
+
+	return s;
+}
+
+// the old way: the midpoint of each axis' range, nothing for soft iron
+static MagCal minMax(const int16_t lo[3], const int16_t hi[3]) {
+	MagCal cal;
+	memset(&cal, 0, sizeof(cal));
+
+	for (int i = 0; i < 3; i++) {
+		cal.offset[i] = (lo[i] + hi[i]) / 2.0;
+		cal.matrix[i][i] = 1;
+	}
+
+	return cal;
+}
+
+struct totals {
+	score worst[STEPS + 1];
+	uint32_t solved[STEPS + 1];
+	uint32_t held[STEPS + 1];
+	uint32_t worse;
+};
+
+int main(int argc, char **argv) {
+	int trials = 100;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+			case 'n': trials = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n trials] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (trials <= 0)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	static const char *names[] = { "tumble", "circles" };
+	totals tot[2];
+	memset(tot, 0, sizeof(tot));
+
+	for (int t = 0; t < trials; t++) {
+		distortion d;
+		for (int i = 0; i < 3; i++) {
+			d.offset[i] = 300 * (2 * rnd() - 1);
+			for (int j = 0; j <= i; j++)
+				d.soft[i][j] = d.soft[j][i] = i == j ? 1 + 0.15 * (2 * rnd() - 1) : 0.08 * (2 * rnd() - 1);
+		}
+
+		// the last calibration, as calibrateMag() has it. the first is only
+		// an offset, off by as much as the field, then circles follow on
+		// from tumble
+		MagCal last;
+		memset(&last, 0, sizeof(last));
+		for (int i = 0; i < 3; i++) {
+			last.offset[i] = lround(d.offset[i] + FIELD * (2 * rnd() - 1));
+			last.matrix[i][i] = 1;
+		}
+
+		for (int kind = 0; kind < 2; kind++) {
+			// something's been moved aboard since
+			if (kind)
+				for (int i = 0; i < 3; i++)
+					d.offset[i] += DRIFT * (2 * rnd() - 1);
+
+			MagCalSums sums;
+			magCalBegin(&sums, &last);
+			MagCal next = last;
+
+			int16_t lo[3] = { 32767, 32767, 32767 }, hi[3] = { -32768, -32768, -32768 };
+			size_t step = 0;
+			score fit = { 0, 0, 0 };
+			bool solved = false;
+
+			for (int n = 1; n <= READINGS; n++) {
+				double r[3][3];
+				int16_t raw[3];
+
+				kind ? circle(n, r) : tumble(r);
+				reading(d, r, NOISE, raw);
+				magCalAdd(&sums, raw);
+
+				for (int i = 0; i < 3; i++) {
+					lo[i] = raw[i] < lo[i] ? raw[i] : lo[i];
+					hi[i] = raw[i] > hi[i] ? raw[i] : hi[i];
+				}
+
+				if (step < STEPS && n == steps[step]) {
+					MagCal cal;
+					uint8_t got = magCalSolve(&sums, &last, &cal);
+					solved = got != MAGCAL_FAILED;
+					if (solved) {
+						if (n == READINGS)
+							next = cal;
+
+						fit = check(d, cal);
+						score &w = tot[kind].worst[step];
+						w.offset = fmax(w.offset, fit.offset);
+						w.sphere = fmax(w.sphere, fit.sphere);
+						w.heading = fmax(w.heading, fit.heading);
+						tot[kind].solved[step]++;
+						tot[kind].held[step] += got == MAGCAL_PARTIAL;
+					}
+					step++;
+				}
+			}
+
+			score old = check(d, minMax(lo, hi));
+			score &w = tot[kind].worst[STEPS];
+			w.offset = fmax(w.offset, old.offset);
+			w.sphere = fmax(w.sphere, old.sphere);
+			w.heading = fmax(w.heading, old.heading);
+			tot[kind].solved[STEPS]++;
+
+			if (solved && fit.heading > old.heading)
+				tot[kind].worse++;
+
+			last = next;
+		}
+	}
+
+	printf("%d trials, worst of each; offset lsb, off a sphere %%, heading rms degrees\n", trials);
+	printf("           readings  solved    held   offset   sphere  heading\n");
+
+	for (int kind = 0; kind < 2; kind++)
+		for (size_t s = 0; s <= STEPS; s++) {
+			const score &w = tot[kind].worst[s];
+			char label[16];
+			snprintf(label, sizeof(label), s < STEPS ? "fit %d" : "min/max %d", s < STEPS ? steps[s] : READINGS);
+
+			printf("%-8s %12s %7u %7u", s ? "" : names[kind], label, tot[kind].solved[s], tot[kind].held[s]);
+			if (tot[kind].solved[s])
+				printf(" %8.2f %8.2f %8.2f\n", w.offset, w.sphere, w.heading);
+			else
+				printf("        -        -        -\n");
+		}
+
+	int failed = 0;
+	const score &tumbled = tot[0].worst[STEPS - 1];
+	if (tot[0].solved[STEPS - 1] != (uint32_t) trials ||
+		tumbled.offset > MAX_OFFSET_ERROR || tumbled.heading > MAX_HEADING_ERROR) {
+		fprintf(stderr, "tumble: the fit didn't converge\n");
+		failed++;
+	}
+
+	if (tot[0].held[STEPS - 1]) {
+		fprintf(stderr, "tumble: %u fits held to the last calibration\n", tot[0].held[STEPS - 1]);
+		failed++;
+	}
+
+	if (tot[1].solved[STEPS - 1] != (uint32_t) trials) {
+		fprintf(stderr, "circles: no fit\n");
+		failed++;
+	}
+
+	if (tot[0].worse || tot[1].worse) {
+		fprintf(stderr, "fits worse than min/max: %u tumble, %u circles\n", tot[0].worse, tot[1].worse);
+		failed++;
+	}
+
+	return failed ? 1 : 0;
+}
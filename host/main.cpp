@@ -0,0 +1,105 @@
+/*
+ * main.cpp: runs the firmware on the host against the simulated boat.
+ *
+ * usage: ardusailor_host [options]
+ *   -t seconds    virtual time to run (default 3600)
+ *   -d degrees    true wind direction (default 270)
+ *   -s knots      true wind speed (default 8)
+ *   -g fraction   gust factor (default 0.2)
+ *   -r seed       random seed
+ *   -e file       eeprom image, loaded before setup() and saved at the end
+ *   -c            print the boat's track as csv, once per simulated second
+ *   -v            pass the firmware's serial output through to stdout
+ *   -p            print the stage profile at the end (built WITH_PROFILE)
+ *
+ * Serial input is read from stdin up front, if it isn't a terminal.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "profile.h"
+#include "servo_ctl.h"
+#include "sim/sim.h"
+
+static bool printTrack(const struct sim_state *s, void *ctx) {
+	printf("%.0f,%.7f,%.7f,%.1f,%.2f,%.2f,%.1f,%.1f,%.1f,%.1f,%d,%d\n",
+		s->time / 1e6, s->lat, s->lon, s->heading, s->speed, s->sog, s->heel,
+		s->wind_direction, s->wind_speed, s->awa, current_rudder, current_winch);
+
+	return true;
+}
+
+int main(int argc, char **argv) {
+	struct sim_config cfg;
+	sim_default_config(&cfg);
+
+	double seconds = 3600;
+	const char *eeprom = NULL;
+	bool track = false;
+	bool verbose = false;
+	bool profile = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:d:s:g:r:e:cvp")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'd': cfg.wind.direction = atof(optarg); break;
+			case 's': cfg.wind.speed = atof(optarg); break;
+			case 'g': cfg.wind.gust_factor = atof(optarg); break;
+			case 'r': cfg.seed = strtoul(optarg, NULL, 10); break;
+			case 'e': eeprom = optarg; break;
+			case 'c': track = true; break;
+			case 'v': verbose = true; break;
+			case 'p': profile = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-t seconds] [-d wind dir] [-s wind speed] [-g gust] [-r seed] [-e eeprom] [-c] [-v] [-p]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	sim_begin(&cfg);
+
+	if (eeprom)
+		hal_eeprom_load(eeprom);
+
+	if (!isatty(STDIN_FILENO)) {
+		char buf[256];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0)
+			Serial.inject(buf, n);
+	}
+
+	if (verbose)
+		Serial.setSink(stdout);
+
+	if (track)
+		printf("t,lat,lon,heading,speed,sog,heel,twd,tws,awa,rudder,winch\n");
+
+	clock_t start = clock();
+
+	sim_run(seconds, track ? printTrack : NULL, NULL);
+
+	double wall = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	if (eeprom)
+		hal_eeprom_save(eeprom);
+
+	const struct sim_state *s = sim_get_state();
+	fprintf(stderr, "%.0fs virtual in %.3fs cpu (%.0fx real time), %.0fm sailed\n",
+		hal_now_us() / 1e6, wall, wall > 0 ? hal_now_us() / 1e6 / wall : 0, s->distance);
+
+	if (profile) {
+		Serial.setSink(stderr);
+		profDump(Serial);
+	}
+
+	if (hal_sd_syncs())
+		fprintf(stderr, "%u sd syncs\n", hal_sd_syncs());
+
+	return 0;
+}
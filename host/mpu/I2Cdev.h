@@ -0,0 +1 @@
+// everything the firmware uses is in MPU6050_9Axis_MotionApps41.h
@@ -0,0 +1,106 @@
+/*
+ * MPU6050_9Axis_MotionApps41.h: host stand-in for the i2cdevlib MPU6050
+ * library, as far as ahrs.cpp uses it, so ahrs.cpp builds on the host.
+ *
+ * Nothing's on the i2c bus: the mpu is its fifo, which the host fills a
+ * packet at a time with push(), raising the data-ready interrupt as it
+ * does. Past MPU6050_FIFO_SIZE bytes the packet's lost and the fifo flags
+ * an overflow, until it's reset. The setup calls are recorded, for the host
+ * to check what ahrs.cpp set up.
+ *
+ * A dmp packet's laid out as MotionApps 4.1 has it, 48 bytes, big endian:
+ * the quaternion as 32 bit values from 0, the accel as the high halves of
+ * 32 bit values from 28, and the mag from 40.
+ */
+
+#ifndef MPU6050_9Axis_MotionApps41_h
+#define MPU6050_9Axis_MotionApps41_h
+
+#include <stdint.h>
+
+#define MPU6050_FIFO_SIZE 1024
+#define MPU6050_DMP_PACKET 48
+
+#define MPU6050_DLPF_BW_42 0x03
+#define MPU6050_GYRO_FS_250 0x00
+#define MPU6050_ACCEL_FS_2 0x00
+
+// the interrupt the mpu's wired to
+#define MPU6050_HOST_INTERRUPT 0
+
+class Quaternion {
+public:
+	Quaternion() : w(1), x(0), y(0), z(0) {}
+
+	float w, x, y, z;
+};
+
+class VectorFloat {
+public:
+	VectorFloat() : x(0), y(0), z(0) {}
+
+	float x, y, z;
+};
+
+class MPU6050 {
+public:
+	MPU6050();
+
+	void initialize();
+	bool testConnection() { return true; }
+
+	uint8_t dmpInitialize();
+	void setDMPEnabled(bool enabled) { dmp = enabled; }
+	uint16_t dmpGetFIFOPacketSize() { return MPU6050_DMP_PACKET; }
+	uint8_t dmpGetQuaternion(int16_t *data, const uint8_t *packet);
+	uint8_t dmpGetAccel(int16_t *data, const uint8_t *packet);
+	uint8_t dmpGetMag(int16_t *data, const uint8_t *packet);
+	uint8_t dmpGetGravity(VectorFloat *v, Quaternion *q);
+	uint8_t dmpGetYawPitchRoll(float *data, Quaternion *q, VectorFloat *gravity);
+
+	void setDLPFMode(uint8_t mode) { dlpf = mode; }
+	void setRate(uint8_t r) { rate = r; }
+	void setFullScaleGyroRange(uint8_t range) { gyro_range = range; }
+	void setFullScaleAccelRange(uint8_t range) { accel_range = range; }
+
+	void setI2CBypassEnabled(bool enabled) { bypass = enabled; }
+	void setI2CMasterModeEnabled(bool enabled) { master = enabled; }
+	void setSlaveAddress(uint8_t num, uint8_t address) { slave[num].address = address; }
+	void setSlaveRegister(uint8_t num, uint8_t reg) { slave[num].reg = reg; }
+	void setSlaveDataLength(uint8_t num, uint8_t length) { slave[num].length = length; }
+	void setSlaveOutputByte(uint8_t num, uint8_t data) { slave[num].out = data; }
+	void setSlaveEnabled(uint8_t num, bool enabled) { slave[num].enabled = enabled; }
+
+	void setAccelFIFOEnabled(bool enabled) { fifo_accel = enabled; }
+	void setXGyroFIFOEnabled(bool enabled) { fifo_gyro[0] = enabled; }
+	void setYGyroFIFOEnabled(bool enabled) { fifo_gyro[1] = enabled; }
+	void setZGyroFIFOEnabled(bool enabled) { fifo_gyro[2] = enabled; }
+	void setSlave0FIFOEnabled(bool enabled) { fifo_slave0 = enabled; }
+	void setFIFOEnabled(bool enabled) { fifo_enabled = enabled; }
+	void setIntDataReadyEnabled(bool enabled) { data_ready = enabled; }
+
+	// reading INT_STATUS clears it
+	uint8_t getIntStatus();
+	uint16_t getFIFOCount() { return fifo_count; }
+	void getFIFOBytes(uint8_t *data, uint8_t length);
+	void resetFIFO();
+
+	// host side
+	void push(const uint8_t *packet, uint8_t length);
+
+	uint8_t fifo[MPU6050_FIFO_SIZE];
+	uint16_t fifo_count;
+	uint8_t int_status;
+	uint16_t resets;
+
+	bool dmp, bypass, master, data_ready;
+	bool fifo_enabled, fifo_accel, fifo_gyro[3], fifo_slave0;
+	uint8_t dlpf, rate, gyro_range, accel_range;
+
+	struct {
+		uint8_t address, reg, length, out;
+		bool enabled;
+	} slave[2];
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include <math.h>
+#include <string.h>
+
+#include "hal_host.h"
+#include "MPU6050_9Axis_MotionApps41.h"
+
+#define INT_FIFO_OFLOW 0x10
+#define INT_DATA_RDY 0x01
+
+MPU6050::MPU6050() {
+	initialize();
+}
+
+void MPU6050::initialize() {
+	memset((void *) this, 0, sizeof(*this));
+}
+
+uint8_t MPU6050::dmpInitialize() {
+	fifo_enabled = true;
+	data_ready = true;
+	resetFIFO();
+
+	return 0;
+}
+
+static int16_t bigEndian(const uint8_t *b) {
+	return (int16_t) ((b[0] << 8) | b[1]);
+}
+
+uint8_t MPU6050::dmpGetQuaternion(int16_t *data, const uint8_t *packet) {
+	for (uint8_t i = 0; i < 4; i++)
+		data[i] = bigEndian(packet + 4 * i);
+
+	return 0;
+}
+
+uint8_t MPU6050::dmpGetAccel(int16_t *data, const uint8_t *packet) {
+	for (uint8_t i = 0; i < 3; i++)
+		data[i] = bigEndian(packet + 28 + 4 * i);
+
+	return 0;
+}
+
+uint8_t MPU6050::dmpGetMag(int16_t *data, const uint8_t *packet) {
+	for (uint8_t i = 0; i < 3; i++)
+		data[i] = bigEndian(packet + 40 + 2 * i);
+
+	return 0;
+}
+
+uint8_t MPU6050::dmpGetGravity(VectorFloat *v, Quaternion *q) {
+	v->x = 2 * (q->x * q->z - q->w * q->y);
+	v->y = 2 * (q->w * q->x + q->y * q->z);
+	v->z = q->w * q->w - q->x * q->x - q->y * q->y + q->z * q->z;
+
+	return 0;
+}
+
+uint8_t MPU6050::dmpGetYawPitchRoll(float *data, Quaternion *q, VectorFloat *gravity) {
+	data[0] = atan2(2 * q->x * q->y - 2 * q->w * q->z, 2 * q->w * q->w + 2 * q->x * q->x - 1);
+	data[1] = atan(gravity->x / sqrt(gravity->y * gravity->y + gravity->z * gravity->z));
+	data[2] = atan(gravity->y / sqrt(gravity->x * gravity->x + gravity->z * gravity->z));
+
+	return 0;
+}
+
+uint8_t MPU6050::getIntStatus() {
+	uint8_t status = int_status;
+	int_status = 0;
+
+	return status;
+}
+
+void MPU6050::getFIFOBytes(uint8_t *data, uint8_t length) {
+	if (length > fifo_count)
+		length = fifo_count;
+
+	memcpy(data, fifo, length);
+	memmove(fifo, fifo + length, fifo_count - length);
+	fifo_count -= length;
+}
+
+void MPU6050::resetFIFO() {
+	fifo_count = 0;
+	int_status &= ~INT_FIFO_OFLOW;
+	resets++;
+}
+
+void MPU6050::push(const uint8_t *packet, uint8_t length) {
+	if (!fifo_enabled)
+		return;
+
+	if (fifo_count + length > MPU6050_FIFO_SIZE)
+		int_status |= INT_FIFO_OFLOW;
+	else {
+		memcpy(fifo + fifo_count, packet, length);
+		fifo_count += length;
+	}
+
+	int_status |= INT_DATA_RDY;
+	if (data_ready)
+		hal_raise_interrupt(MPU6050_HOST_INTERRUPT);
+}
@@ -0,0 +1,328 @@
+/*
+ * mpubench.cpp: ahrs.cpp as it's built with the mpu fitted (WITH_MPU), on
+ * a stand-in for the MPU6050 library (mpu/) whose fifo is filled here. Built
+ * once reading the dmp's quaternion, and once with AHRS_FUSION, reading raw
+ * big endian accel and gyro and the ak8975's little endian mag:
+ *
+ *   ardusailor_mpubench_dmp
+ *   ardusailor_mpubench_fusion
+ *
+ * The mpu makes a packet every PERIOD, level, turning at whatever rate's
+ * set, in a field with a hard iron offset, and raises the data-ready
+ * interrupt for each.
+ *
+ *   init       mpuInit() with an ellipsoid fit saved in the settings: it's
+ *              read, the mpu's set up (the ak8975 on the aux bus, fusing)
+ *              and a first sample's in
+ *   heading    turned all the way round at 30 degrees a second, read every
+ *              READ: the heading from each newest sample, to within MAX_ERROR
+ *   drain      more packets than the queue holds while nothing reads them:
+ *              one readSteadyHeading() takes them all, and the newest
+ *              sample's interrupt time is heading_time
+ *   overflow   the fifo let fill past its end: reset, counted, and the
+ *              samples after it read
+ *   calibrate  calibrateMag() tumbling the mpu in a field off by another
+ *              offset: the range and fit it finds are saved to the settings,
+ *              and read back by configLoad()
+ *
+ * usage: ardusailor_mpubench_<way>
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "MPU6050_9Axis_MotionApps41.h"
+#include "ahrs.h"
+#include "config.h"
+#include "imu.h"
+#include "magcal.h"
+
+#ifdef AHRS_FUSION
+#define WAY "fusion"
+#define PACKET 18
+#else
+#define WAY "dmp"
+#define PACKET MPU6050_DMP_PACKET
+#endif
+
+#define PERIOD 10000
+
+// how often the heading's read, as the ahrs task does
+#define READ 50000
+
+// the field at the boat, in mag lsb: across the horizon, and down
+#define FIELD_H 200
+#define FIELD_V 300
+
+// in the ak8975's axes
+static const int16_t iron[3] = { 40, -25, 60 };
+static const int16_t new_iron[3] = { -70, 35, 20 };
+
+#define GYRO_LSB 131.0
+#define ACC_1G 16384
+
+// degrees, and off the fit's offset, mag lsb
+#define MAX_ERROR 2.0
+#define MAX_OFFSET_ERROR 5
+
+#define D2R(v) ((v) * M_PI / 180)
+#define R2D(v) ((v) * 180 / M_PI)
+
+// ahrs.cpp
+extern MPU6050 mpu;
+extern MagCal mag_cal;
+extern bool mag_cal_valid;
+extern uint16_t packetSize;
+
+// the sketch's, as logger.cpp, ahrs.cpp and the hal want them
+boolean serial_logging = false;
+
+// hal_loop_once()'s, never run here
+void loop() {}
+
+float toCircle(float value) {
+	while (value < 0)
+		value += TWO_PI;
+	while (value >= TWO_PI)
+		value -= TWO_PI;
+
+	return value;
+}
+
+// the mpu: its x axis's heading, and how fast that's turning
+static double mpu_heading;
+static double turn;
+static const int16_t *mpu_iron = iron;
+
+// tumbling, for calibrateMag(): the field's direction steps round a sphere
+static bool tumbling;
+static uint32_t last_packet;
+
+static void put16(uint8_t *p, int16_t v, bool big) {
+	p[big ? 0 : 1] = (uint16_t) v >> 8;
+	p[big ? 1 : 0] = v;
+}
+
+static void tick() {
+	double mpu_mag[3];
+
+	mpu_heading = fmod(mpu_heading + turn * PERIOD / 1e6 + 360, 360);
+
+	if (tumbling) {
+		// a fibonacci sphere, a point a calibration step
+		double k = hal_now_us() / 100000 % 300;
+		double z = 1 - 2 * (k + 0.5) / 300;
+		double around = k * M_PI * (3 - sqrt(5));
+		double field = sqrt(FIELD_H * FIELD_H + FIELD_V * FIELD_V);
+
+		mpu_mag[0] = field * sqrt(1 - z * z) * cos(around);
+		mpu_mag[1] = field * sqrt(1 - z * z) * sin(around);
+		mpu_mag[2] = field * z;
+	} else {
+		mpu_mag[0] = FIELD_H * cos(D2R(mpu_heading));
+		mpu_mag[1] = FIELD_H * sin(D2R(mpu_heading));
+		mpu_mag[2] = -FIELD_V;
+	}
+
+	// the ak8975 has x and y the other way round, and z down
+	int16_t mag[3] = {
+		(int16_t) lround(mpu_mag[1] + mpu_iron[0]),
+		(int16_t) lround(mpu_mag[0] + mpu_iron[1]),
+		(int16_t) lround(-mpu_mag[2] + mpu_iron[2])
+	};
+
+	uint8_t p[PACKET];
+	memset(p, 0, sizeof(p));
+
+#ifdef AHRS_FUSION
+	// turning clockwise from above is about z, down
+	int16_t acc[3] = { 0, 0, ACC_1G };
+	int16_t gyro[3] = { 0, 0, (int16_t) lround(-turn * GYRO_LSB) };
+
+	for (uint8_t i = 0; i < 3; i++) {
+		put16(p + 2 * i, acc[i], true);
+		put16(p + 6 + 2 * i, gyro[i], true);
+		put16(p + 12 + 2 * i, mag[i], false);
+	}
+#else
+	// level: the quaternion's 1, 0, 0, 0
+	put16(p, 16384, true);
+	put16(p + 36, ACC_1G / 2, true);
+	for (uint8_t i = 0; i < 3; i++)
+		put16(p + 40 + 2 * i, mag[i], true);
+#endif
+
+	last_packet = hal_now_us();
+	mpu.push(p, sizeof(p));
+}
+
+static int failed;
+
+static void report(const char *name, bool ok, const char *detail) {
+	printf("%-10s %-6s %s\n", name, ok ? "ok" : "FAILED", detail);
+	if (!ok)
+		failed++;
+}
+
+static double headingError(float heading) {
+	// the board's mounted facing aft
+	double want = fmod(mpu_heading + 180, 360);
+
+	return fabs(remainder(R2D(heading) - want, 360));
+}
+
+static void checkInit(Config *settings) {
+	char detail[160];
+
+	Config c;
+	configInit(&c, 0);
+	for (uint8_t i = 0; i < 3; i++) {
+		c.mag_fit.offset[i] = iron[i];
+		c.mag_fit.matrix[i][i] = 1;
+	}
+	c.mag_fit.field = sqrt(FIELD_H * FIELD_H + FIELD_V * FIELD_V);
+	configSave(&c, CONFIG_MAG_FIT);
+
+	configInit(settings, 0);
+	configLoad(settings);
+
+	int status = mpuInit(settings);
+
+	bool ok = status == 0 && mag_cal_valid && !memcmp(&mag_cal, &c.mag_fit, sizeof(mag_cal)) &&
+		packetSize == PACKET && imuQueued();
+#ifdef AHRS_FUSION
+	ok = ok && mpu.master && !mpu.bypass && mpu.fifo_accel && mpu.fifo_gyro[0] && mpu.fifo_gyro[1] &&
+		mpu.fifo_gyro[2] && mpu.fifo_slave0 &&
+		mpu.slave[0].address == (0x80 | 0x0C) && mpu.slave[0].reg == 0x03 && mpu.slave[0].length == 6 &&
+		mpu.slave[0].enabled &&
+		mpu.slave[1].address == 0x0C && mpu.slave[1].reg == 0x0A && mpu.slave[1].out == 0x01 &&
+		mpu.slave[1].enabled;
+#else
+	ok = ok && mpu.dmp;
+#endif
+
+	snprintf(detail, sizeof(detail), "status %d, fit %s, %u byte packets, %u sample in%s",
+		status, mag_cal_valid ? "read" : "not read", packetSize, imuQueued(),
+#ifdef AHRS_FUSION
+		", ak8975 on the aux bus"
+#else
+		", dmp on"
+#endif
+		);
+	report("init", ok, detail);
+}
+
+static void checkHeading() {
+	char detail[96];
+	double worst = 0;
+
+	// settled, then turned 30 degrees a second, read every READ as the
+	// pilot would
+	for (int i = 0; i < 2000000 / READ; i++) {
+		hal_advance_us(READ);
+		readSteadyHeading();
+	}
+
+	turn = 30;
+	for (int i = 0; i < 12000000 / READ; i++) {
+		hal_advance_us(READ);
+
+		float heading = readSteadyHeading();
+		worst = max(worst, headingError(heading));
+	}
+	turn = 0;
+
+	snprintf(detail, sizeof(detail), "all the way round: off by %.2f degrees at worst", worst);
+	report("heading", worst <= MAX_ERROR, detail);
+}
+
+static void checkDrain() {
+	char detail[128];
+
+	readSteadyHeading();
+	uint32_t taken = imu_stats.taken;
+
+	// nothing read for twice what the queue holds
+	hal_advance_us(2 * IMU_QUEUE_SIZE * PERIOD);
+
+	float heading = readSteadyHeading();
+	uint32_t took = imu_stats.taken - taken;
+	int32_t off = heading_time - (uint32_t) last_packet;
+
+	snprintf(detail, sizeof(detail), "%u packets in one read (queue %d), fifo left %u, newest stamped %dus off, heading off %.2f",
+		took, IMU_QUEUE_SIZE, mpu.getFIFOCount(), off, headingError(heading));
+	report("drain", took == 2 * IMU_QUEUE_SIZE && !mpu.getFIFOCount() && abs(off) < 50 &&
+		headingError(heading) <= MAX_ERROR, detail);
+}
+
+static void checkOverflow() {
+	char detail[128];
+
+	readSteadyHeading();
+	uint16_t overflows = imu_stats.overflows, resets = mpu.resets;
+
+	// past the end of the fifo
+	hal_advance_us((MPU6050_FIFO_SIZE / PACKET + 4) * PERIOD);
+	readSteadyHeading();
+
+	bool reset = imu_stats.overflows == overflows + 1 && mpu.resets == resets + 1 && !mpu.getFIFOCount();
+
+	hal_advance_us(5 * PERIOD);
+	float heading = readSteadyHeading();
+	int32_t off = heading_time - (uint32_t) last_packet;
+
+	snprintf(detail, sizeof(detail), "%s; after it, newest stamped %dus off, heading off %.2f",
+		reset ? "fifo reset and counted" : "fifo not reset", off, headingError(heading));
+	report("overflow", reset && abs(off) < 50 && headingError(heading) <= MAX_ERROR, detail);
+}
+
+static void checkCalibrate(Config *settings) {
+	char detail[160];
+
+	mpu_iron = new_iron;
+	tumbling = true;
+	calibrateMag(false);
+	tumbling = false;
+
+	Config back;
+	configInit(&back, 0);
+	uint8_t loaded = configLoad(&back);
+
+	double off = 0;
+	bool ranged = true;
+	for (uint8_t i = 0; i < 3; i++) {
+		off = max(off, fabs(back.mag_fit.offset[i] - new_iron[i]));
+		ranged = ranged && back.mag_range.min[i] < new_iron[i] && back.mag_range.max[i] > new_iron[i];
+	}
+
+	bool saved = (loaded & bit(CONFIG_MAG_RANGE)) && (loaded & bit(CONFIG_MAG_FIT)) &&
+		!memcmp(&back.mag_fit, &mag_cal, sizeof(mag_cal)) &&
+		!memcmp(&back.mag_range, &settings->mag_range, sizeof(back.mag_range));
+
+	snprintf(detail, sizeof(detail), "range and fit %s, fit offset %.1f %.1f %.1f (%d %d %d wanted)",
+		saved ? "saved and read back" : "not saved",
+		back.mag_fit.offset[0], back.mag_fit.offset[1], back.mag_fit.offset[2],
+		new_iron[0], new_iron[1], new_iron[2]);
+	report("calibrate", saved && ranged && off <= MAX_OFFSET_ERROR, detail);
+}
+
+int main() {
+	Config settings;
+
+	hal_reset();
+	hal_timer(PERIOD, tick);
+
+	printf("ahrs.cpp with the %s\n\n", WAY);
+
+	checkInit(&settings);
+	checkHeading();
+	checkDrain();
+	checkOverflow();
+	checkCalibrate(&settings);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * navbench.cpp: accuracy and cost of nav.h's bearing and range to a
+ * waypoint, against the float haversine the pilot used before.
+ *
+ * Positions are scattered around a waypoint at a few distances and checked
+ * against a double precision haversine and great-circle bearing. The float
+ * columns are the old computeBearing()/computeDistance() on the same float
+ * degrees the gps globals hold; the nav columns are nav.h on micro-degrees.
+ * Errors are the largest seen, bearing in degrees and range in meters; times
+ * are host nanoseconds for one bearing and range.
+ *
+ * usage: ardusailor_navbench [-n points] [-l latitude] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "nav.h"
+
+#define EARTH_R 6371000.0
+
+static const double ranges[] = { 2, 5, 20, 100, 500, 2000, 10000 };
+
+static uint32_t rng_state;
+
+static double rnd() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state & 0xffffff) / (double) 0x1000000;
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// pilot.ino before nav.h: lat/lon in radians
+static float computeBearing(float i_lat, float i_lon, float f_lat, float f_lon) {
+	float y = sin(f_lon-i_lon) * cos(f_lat);
+	float x = cos(i_lat)*sin(f_lat) - sin(i_lat)*cos(f_lat)*cos(f_lon-i_lon);
+	return atan2(y, x);
+}
+
+static float computeDistance(float i_lat, float i_lon, float f_lat, float f_lon) {
+	float a = sin((f_lat - i_lat)/2) * sin((f_lat - i_lat)/2) +
+						cos(i_lat) * cos(f_lat) *
+						sin((f_lon - i_lon)/2) * sin((f_lon - i_lon)/2);
+	float c = 2 * atan2(sqrt(a), sqrt(1-a));
+
+	return EARTH_R * c;
+}
+
+#define RADF(v) ((v) * (float) M_PI / 180)
+#define RADD(v) ((v) * M_PI / 180)
+
+static void exact(double i_lat, double i_lon, double f_lat, double f_lon, double *bearing, double *range) {
+	i_lat = RADD(i_lat); i_lon = RADD(i_lon);
+	f_lat = RADD(f_lat); f_lon = RADD(f_lon);
+
+	double y = sin(f_lon - i_lon) * cos(f_lat);
+	double x = cos(i_lat) * sin(f_lat) - sin(i_lat) * cos(f_lat) * cos(f_lon - i_lon);
+	*bearing = atan2(y, x) * 180 / M_PI;
+
+	double a = sin((f_lat - i_lat) / 2) * sin((f_lat - i_lat) / 2) +
+		cos(i_lat) * cos(f_lat) * sin((f_lon - i_lon) / 2) * sin((f_lon - i_lon) / 2);
+	*range = EARTH_R * 2 * atan2(sqrt(a), sqrt(1 - a));
+}
+
+static double bearingError(double a, double b) {
+	double d = fmod(fabs(a - b), 360);
+	return d > 180 ? 360 - d : d;
+}
+
+struct point {
+	double lat, lon;
+	float flat, flon;
+	int32_t ulat, ulon;
+};
+
+int main(int argc, char **argv) {
+	int count = 200000;
+	double wp_lat = 41.920708;
+	double wp_lon = -87.630361;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:l:r:")) != -1) {
+		switch (opt) {
+			case 'n': count = atoi(optarg); break;
+			case 'l': wp_lat = atof(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n points] [-l latitude] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (count <= 0)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	// the waypoint, as each side holds it
+	float fwp_lat = wp_lat, fwp_lon = wp_lon;
+	NavFrame frame;
+	navInit(&frame, NAV_UDEG(wp_lat), NAV_UDEG(wp_lon));
+
+	printf("waypoint at %.6f, %.6f\n", wp_lat, wp_lon);
+	printf(" range m   float brg err  nav brg err   float rng err  nav rng err   float ns    nav ns\n");
+
+	std::vector<point> pts(count);
+
+	for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+		// points at about this range, every which way, on a micro-degree grid
+		// like the gps delivers
+		for (int i = 0; i < count; i++) {
+			double d = ranges[r] * (0.5 + rnd());
+			double a = rnd() * 2 * M_PI;
+			double lat = wp_lat + d * cos(a) / EARTH_R * 180 / M_PI;
+			double lon = wp_lon + d * sin(a) / (EARTH_R * cos(RADD(wp_lat))) * 180 / M_PI;
+
+			pts[i].ulat = NAV_UDEG(lat);
+			pts[i].ulon = NAV_UDEG(lon);
+			pts[i].lat = pts[i].ulat / 1e6;
+			pts[i].lon = pts[i].ulon / 1e6;
+			pts[i].flat = pts[i].lat;
+			pts[i].flon = pts[i].lon;
+		}
+
+		double err[4] = { 0, 0, 0, 0 };
+		for (int i = 0; i < count; i++) {
+			double eb, er;
+			exact(pts[i].lat, pts[i].lon, wp_lat, wp_lon, &eb, &er);
+
+			float fb = computeBearing(RADF(pts[i].flat), RADF(pts[i].flon), RADF(fwp_lat), RADF(fwp_lon)) * 180 / M_PI;
+			float fr = computeDistance(RADF(pts[i].flat), RADF(pts[i].flon), RADF(fwp_lat), RADF(fwp_lon));
+
+			Bam nb = bamRaw(0);
+			uint32_t nr;
+			navLeg(&frame, pts[i].ulat, pts[i].ulon, &nb, &nr);
+
+			// the bearing is noise within a few cm of the mark either way
+			if (er > 0.5) {
+				err[0] = fmax(err[0], bearingError(fb, eb));
+				err[1] = fmax(err[1], bearingError(bamToDeg(nb), eb));
+			}
+			err[2] = fmax(err[2], fabs(fr - er));
+			err[3] = fmax(err[3], fabs(nr / 100.0 - er));
+		}
+
+		// volatile sinks, so the calls aren't optimized away
+		volatile float fsink = 0;
+		volatile uint32_t nsink = 0;
+		double t0, ns[2];
+
+		t0 = now_ns();
+		for (int i = 0; i < count; i++) {
+			fsink = computeBearing(RADF(pts[i].flat), RADF(pts[i].flon), RADF(fwp_lat), RADF(fwp_lon));
+			fsink = computeDistance(RADF(pts[i].flat), RADF(pts[i].flon), RADF(fwp_lat), RADF(fwp_lon));
+		}
+		ns[0] = (now_ns() - t0) / count;
+
+		t0 = now_ns();
+		for (int i = 0; i < count; i++) {
+			Bam b;
+			uint32_t range;
+			navLeg(&frame, pts[i].ulat, pts[i].ulon, &b, &range);
+			nsink = b.v + range;
+		}
+		ns[1] = (now_ns() - t0) / count;
+
+		printf("%8.0f %15.4f %12.4f %15.3f %12.3f %10.1f %9.1f\n",
+			ranges[r], err[0], err[1], err[2], err[3], ns[0], ns[1]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * nmeabench.cpp: throughput and fuzzing of the gps.ino NMEA parser.
+ *
+ * The parser is fed a recorded NMEA stream (-f) or a generated one: fixes
+ * on a random walk, each as RMC, GGA, VTG and GSA from a mix of talkers,
+ * with GSV and proprietary sentences in between that it should skip.
+ * Throughput is host nanoseconds per byte through gps_decode().
+ *
+ * With -z, every generated sentence is damaged with the given probability:
+ * a byte changed, dropped or added, or the line cut short. Any fix the
+ * parser reports is checked against the one that was sent; a damaged
+ * sentence must never get into the gps_* globals.
+ *
+ * usage: ardusailor_nmeabench [-n fixes] [-f file] [-z probability] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "bam.h"
+#include "sketch.h"
+
+extern int32_t gps_lat;
+extern int32_t gps_lon;
+extern Bam gps_course;
+extern uint16_t gps_speed;
+extern uint16_t gps_hdop;
+extern uint8_t gps_satellites;
+
+struct fix {
+	int32_t lat, lon;     // degrees * 1e6
+	uint16_t speed;       // knots * 100
+	uint16_t course;      // degrees * 100
+	uint16_t hdop;        // * 100
+	uint8_t satellites;
+	size_t end;           // offset of the end of the fix's last sentence
+};
+
+static uint32_t rng_state;
+
+static uint32_t rnd32() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return rng_state;
+}
+
+static double rnd() {
+	return (rnd32() & 0xffffff) / (double) 0x1000000;
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static std::string sentence(const char *body) {
+	uint8_t checksum = 0;
+	for (const char *p = body; *p; p++)
+		checksum ^= *p;
+
+	char s[128];
+	snprintf(s, sizeof(s), "$%s*%02X\r\n", body, checksum);
+	return s;
+}
+
+// one of the ways a sentence gets mangled on a noisy serial line
+static std::string damage(std::string s) {
+	size_t at = rnd32() % (s.size() - 2);
+
+	switch (rnd32() % 4) {
+		case 0: {
+			char c = s[at];
+			while (c == s[at])
+				c = 0x20 + rnd32() % 0x5f;
+			s[at] = c;
+			break;
+		}
+		case 1: s.erase(at, 1); break;
+		case 2: s.insert(at, 1, (char) (0x20 + rnd32() % 0x5f)); break;
+		case 3: s = s.substr(0, at) + "\r\n"; break;
+	}
+
+	return s;
+}
+
+// "DDMM.MMMMM" for a coordinate in micro-degrees, as receivers send it
+static void coordinate(char *out, size_t size, int32_t v, int degree_digits) {
+	int32_t a = labs(v);
+	int32_t d = a / 1000000;
+	double minutes = (a % 1000000) * 60 / 1e6;
+
+	snprintf(out, size, "%0*d%08.5f", degree_digits, d, minutes);
+}
+
+static void generate(std::vector<fix> &fixes, std::string &stream, std::vector<bool> *damaged, double p) {
+	static const char *talkers[] = { "GP", "GN", "GL", "GA" };
+
+	double lat = 41.920708, lon = -87.630361;
+	uint32_t tod = 12 * 3600 * 1000;
+	char body[112], la[16], lo[16], time[16];
+
+	for (size_t i = 0; i < fixes.size(); i++) {
+		fix &f = fixes[i];
+
+		lat += (rnd() - 0.5) * 2e-5;
+		lon += (rnd() - 0.5) * 2e-5;
+
+		// on the receiver's 1e-5 minute grid, then micro-degrees as the
+		// parser should make of it
+		double lat_min = round(fabs(lat) * 60 * 1e5) / 1e5, lon_min = round(fabs(lon) * 60 * 1e5) / 1e5;
+		f.lat = lround(lat_min / 60 * 1e6) * (lat < 0 ? -1 : 1);
+		f.lon = lround(lon_min / 60 * 1e6) * (lon < 0 ? -1 : 1);
+		f.speed = rnd32() % 1200;
+		f.course = rnd32() % 36000;
+		f.hdop = 50 + rnd32() % 400;
+		f.satellites = 4 + rnd32() % 20;
+
+		tod += 200;
+		snprintf(time, sizeof(time), "%02u%02u%02u.%03u",
+			(unsigned) (tod / 3600000 % 24), (unsigned) (tod / 60000 % 60), (unsigned) (tod / 1000 % 60), (unsigned) (tod % 1000));
+		coordinate(la, sizeof(la), f.lat, 2);
+		coordinate(lo, sizeof(lo), f.lon, 3);
+
+		const char *t = talkers[rnd32() % 4];
+		std::vector<std::string> out;
+
+		snprintf(body, sizeof(body), "%sGSV,3,1,12,01,40,083,46,02,17,308,41,12,07,344,39,14,22,228,45", t);
+		out.push_back(sentence(body));
+		snprintf(body, sizeof(body), "%sVTG,%d.%02d,T,,M,%d.%02d,N,%.2f,K,A", t,
+			f.course / 100, f.course % 100, f.speed / 100, f.speed % 100, f.speed / 100.0 * 1.852);
+		out.push_back(sentence(body));
+		snprintf(body, sizeof(body), "%sGSA,A,3,04,05,,09,12,,,24,,,,,2.5,%d.%02d,2.1", t, f.hdop / 100, f.hdop % 100);
+		out.push_back(sentence(body));
+		snprintf(body, sizeof(body), "%sRMC,%s,A,%s,%c,%s,%c,%d.%02d,%d.%02d,160126,,,A", t, time,
+			la, f.lat < 0 ? 'S' : 'N', lo, f.lon < 0 ? 'W' : 'E',
+			f.speed / 100, f.speed % 100, f.course / 100, f.course % 100);
+		out.push_back(sentence(body));
+		out.push_back("$PUBX,00,120003.00,4155.24248,N*00\r\n");
+		snprintf(body, sizeof(body), "%sGGA,%s,%s,%c,%s,%c,1,%02d,%d.%02d,180.0,M,-34.0,M,,", t, time,
+			la, f.lat < 0 ? 'S' : 'N', lo, f.lon < 0 ? 'W' : 'E',
+			f.satellites, f.hdop / 100, f.hdop % 100);
+		out.push_back(sentence(body));
+
+		for (size_t j = 0; j < out.size(); j++) {
+			bool hit = p > 0 && rnd() < p;
+			std::string s = hit ? damage(out[j]) : out[j];
+
+			if (damaged)
+				damaged->push_back(hit);
+			stream += s;
+		}
+
+		f.end = stream.size();
+	}
+}
+
+static bool matches(const fix &f) {
+	uint16_t course = ((uint32_t) gps_course.v * 36000 + 32768) >> 16;
+	int16_t course_err = (int16_t) course - f.course;
+
+	return labs(gps_lat - f.lat) <= 1 && labs(gps_lon - f.lon) <= 1 &&
+		gps_speed == f.speed && abs(course_err) <= 1 &&
+		gps_hdop == f.hdop && gps_satellites == f.satellites;
+}
+
+int main(int argc, char **argv) {
+	int count = 100000;
+	const char *file = NULL;
+	double p = 0;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:f:z:r:")) != -1) {
+		switch (opt) {
+			case 'n': count = atoi(optarg); break;
+			case 'f': file = optarg; break;
+			case 'z': p = atof(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n fixes] [-f file] [-z probability] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (count <= 0)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+	gpsInit();
+
+	std::string stream;
+	std::vector<fix> fixes;
+
+	if (file) {
+		FILE *in = fopen(file, "rb");
+		if (!in) {
+			perror(file);
+			return 1;
+		}
+
+		char buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+			stream.append(buf, n);
+		fclose(in);
+	} else {
+		fixes.resize(count);
+		generate(fixes, stream, NULL, p);
+	}
+
+	// throughput
+	uint32_t reported = 0;
+	double t0 = now_ns();
+	for (size_t i = 0; i < stream.size(); i++)
+		reported += gps_decode(stream[i]);
+	double ns = (now_ns() - t0) / stream.size();
+
+	printf("%zu bytes, %u fixes, %.1f ns/byte (%.1f MB/s)\n",
+		stream.size(), reported, ns, 1e3 / ns);
+
+	if (file || p <= 0)
+		return 0;
+
+	// fuzzing: every reported fix has to be the one that was sent
+	uint32_t good = 0, bad = 0;
+	size_t next = 0;
+
+	gpsInit();
+	for (size_t i = 0; i < stream.size(); i++) {
+		if (!gps_decode(stream[i]))
+			continue;
+
+		while (next < fixes.size() && fixes[next].end <= i)
+			next++;
+
+		if (next < fixes.size() && matches(fixes[next]))
+			good++;
+		else {
+			bad++;
+			if (bad <= 10)
+				fprintf(stderr, "bad fix near byte %zu: %d, %d, speed %u, course %u\n",
+					i, gps_lat, gps_lon, gps_speed, gps_course.v);
+		}
+	}
+
+	printf("%d fixes sent, %.0f%% of sentences damaged: %u fixes taken, %u wrong\n",
+		count, p * 100, good + bad, bad);
+
+	// and pure line noise, which shouldn't produce anything
+	uint32_t noise = 0;
+	for (int i = 0; i < count * 64; i++) {
+		uint32_t r = rnd32();
+		char c = r & 0x100 ? "$GNRMC,*\r\n0123456789.AV"[r % 24] : (char) r;
+		noise += gps_decode(c);
+	}
+
+	printf("%d bytes of noise: %u fixes taken\n", count * 64, noise);
+
+	return bad || noise ? 1 : 0;
+}
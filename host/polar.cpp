@@ -0,0 +1,253 @@
+/*
+ * polar.cpp: learns the boat's polar from logged runs, as the firmware
+ * does under way (learn.h), into the same table.
+ *
+ * The data lines (printDataLine(): 18 fields, or 15 in older logs) give
+ * the heading, apparent wind, gps speed and winch position. The true wind
+ * and its strength are worked out from them by the firmware's tactics, a
+ * fresh start for each log, then every line goes into one table for all
+ * of them. Logs have no clock on the data lines; they're taken to be
+ * DATA_FREQ apart.
+ *
+ * Directories are read all the way down. The table's printed as csv, as
+ * menu option e prints the board's, and can be written as an eeprom image
+ * for the board to start from.
+ *
+ * usage: ardusailor_polar [options] path [path...]
+ *   -p ms         between data lines (default 1500)
+ *   -o file       the table for the board, as an avrdude eeprom image
+ *   -e file       the table for the host build, written into this eeprom image
+ *
+ * Flash it with avrdude -p m2560 ... -U eeprom:w:polar.eep:i; pilotInit()
+ * picks it up on the next boot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <string>
+
+#include "Arduino.h"
+#include <EEPROM.h>
+#include "hal_host.h"
+#include "learn.h"
+
+// where pilotInit() looks for the table (firmware.ino), and the polar it
+// starts from (pilot.ino)
+#define LEARN_PARAM_ADDRESS 1024
+#define HULL_SPEED 3.0
+
+extern uint8_t default_polar[POLAR_BINS];
+
+// knots * 100 to cm/s, as speedCm()
+#define KNOTS_CM 0.5144
+
+static Polar polar;
+static Learn learn;
+static uint32_t period = 1500;
+
+static unsigned long files, lines, samples;
+
+static float wrap180(float v) {
+	return v - 360 * floor((v + 180) / 360);
+}
+
+static void learnLog(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return;
+	}
+
+	Tactics tactics;
+	tacticsInit(&tactics, &polar);
+
+	// the steady time's per log too
+	learn.winch = 0;
+
+	uint32_t now = 0;
+	unsigned long read = lines;
+	char line[512];
+
+	while (fgets(line, sizeof(line), f)) {
+		double v[18];
+		int n = 0;
+
+		// gps_aprs_lat is e.g. 4155.28N
+		char *comma = strchr(line, ',');
+		if (!comma || (comma[-1] != 'N' && comma[-1] != 'S'))
+			continue;
+
+		char *p = line;
+		for (char *tok = strsep(&p, ","); tok && n < 19; tok = strsep(&p, ","), n++)
+			if (n < 18)
+				v[n] = atof(tok);
+
+		float heading, wind;
+		uint8_t winch;
+
+		if (n == 18) {
+			heading = v[7];
+			wind = v[11];
+			winch = v[15];
+		} else if (n == 15) {
+			heading = v[7];
+			wind = v[8];
+			winch = v[12];
+		} else
+			continue;
+
+		uint16_t speed = v[5] * 100 * KNOTS_CM;
+		now += period;
+		lines++;
+
+		tacticsWind(&tactics, &polar, bamDeg(heading), bamDeg(wind), speed, now);
+		if (!tactics.started)
+			continue;
+
+		learnAdd(&learn, wrap180(tactics.wind - heading), tactics.strength, winch, speed, now);
+	}
+
+	fclose(f);
+	if (lines > read)
+		files++;
+}
+
+static void learnPath(const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		perror(path);
+		return;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		learnLog(path);
+		return;
+	}
+
+	DIR *d = opendir(path);
+	if (!d) {
+		perror(path);
+		return;
+	}
+
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL)
+		if (e->d_name[0] != '.')
+			learnPath((std::string(path) + "/" + e->d_name).c_str());
+
+	closedir(d);
+}
+
+static void hexRecord(FILE *f, uint16_t addr, uint8_t type, const uint8_t *data, uint8_t len) {
+	uint8_t sum = len + (addr >> 8) + (addr & 0xff) + type;
+
+	fprintf(f, ":%02X%04X%02X", len, addr, type);
+	for (int i = 0; i < len; i++) {
+		fprintf(f, "%02X", data[i]);
+		sum += data[i];
+	}
+	fprintf(f, "%02X\n", (uint8_t) -sum);
+}
+
+static bool writeEep(const char *path) {
+	hal_reset();
+	learnStore(&learn);
+
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return false;
+
+	for (uint16_t at = 0; at < LEARN_EEPROM; at += 16) {
+		uint8_t data[16];
+		uint8_t len = min(16, LEARN_EEPROM - at);
+
+		for (uint8_t i = 0; i < len; i++)
+			data[i] = EEPROM.read(LEARN_PARAM_ADDRESS + at + i);
+
+		hexRecord(f, LEARN_PARAM_ADDRESS + at, 0, data, len);
+	}
+	hexRecord(f, 0, 1, NULL, 0);
+
+	return fclose(f) == 0;
+}
+
+static bool writeHostEeprom(const char *path) {
+	// keep whatever else the image holds (gains, route)
+	hal_reset();
+	hal_eeprom_load(path);
+	learnStore(&learn);
+
+	return hal_eeprom_save(path);
+}
+
+static void printTable() {
+	printf("angle,strength,sheet,samples,speed,dev\n");
+
+	for (uint8_t i = 0; i < POLAR_BINS; i++)
+		for (uint8_t b = 0; b < LEARN_STRENGTHS; b++)
+			for (uint8_t s = 0; s < LEARN_SHEETS; s++) {
+				const LearnCell *c = learnCell(&learn, i, b, s);
+
+				if (c->samples)
+					printf("%d,%d,%d,%d,%.1f,%d\n", i * POLAR_STEP, learn.strength[b], s, c->samples, c->speed / 10.0, c->dev);
+			}
+}
+
+int main(int argc, char **argv) {
+	const char *out = NULL;
+	const char *eeprom = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:o:e:")) != -1) {
+		switch (opt) {
+			case 'p': period = strtoul(optarg, NULL, 10); break;
+			case 'o': out = optarg; break;
+			case 'e': eeprom = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-p ms] [-o polar.eep] [-e eeprom] path [path...]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc || !period) {
+		fprintf(stderr, "usage: %s [-p ms] [-o polar.eep] [-e eeprom] path [path...]\n", argv[0]);
+		return 1;
+	}
+
+	polarInit(&polar, default_polar, HULL_SPEED * 51.44);
+	learnInit(&learn, LEARN_PARAM_ADDRESS);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = optind; i < argc; i++)
+		learnPath(argv[i]);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	for (uint16_t i = 0; i < LEARN_CELLS; i++)
+		samples += learn.cells[i].samples;
+
+	printTable();
+	fprintf(stderr, "%lu logs, %lu data lines, %lu samples held, in %.3fs (%.0f lines/s)\n",
+		files, lines, samples, wall, wall > 0 ? lines / wall : 0);
+
+	if (out && !writeEep(out)) {
+		perror(out);
+		return 1;
+	}
+
+	if (eeprom && !writeHostEeprom(eeprom)) {
+		perror(eeprom);
+		return 1;
+	}
+
+	return 0;
+}
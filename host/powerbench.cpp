@@ -0,0 +1,279 @@
+/*
+ * powerbench.cpp: where the battery goes over a mission, and how long it'd
+ * last, with the power plan (power.h) against everything run flat out, in
+ * closed loop against the boat simulation.
+ *
+ * The mission's a triangle of marks 1km apart, sailed round back and forth:
+ * 4 to 14 knots of wind, gusting and shifting, up to a quarter knot of
+ * current, and up to a few degrees of sea. Every run is sailed three times,
+ * the same seed each time: flat out, as before; to the power plan; and to
+ * the plan with the battery low.
+ *
+ * Reported over the runs all three finished: the median mean draw of each
+ * load (mA, the firmware's own accounting), and of them all; the median
+ * time the gps was on and the mcu awake; the median speed made good along
+ * the legs (knots); and how long the battery would last at that draw, and
+ * how many missions that is. The plan has to draw less than flat out, and
+ * make good within SLOWER of its speed.
+ *
+ * usage: ardusailor_powerbench [-n runs] [-l legs] [-d m] [-c mAh] [-j jobs] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "scenario.h"
+
+#define EARTH_R 6371000.0
+#define D2R(v) ((v) * M_PI / 180.0)
+
+#define TUNED_KP 0.85
+#define TUNED_KI 0.012
+#define TUNED_KD 0.011
+
+#define KNOT 0.5144
+
+// volts for a low battery, under POWER_LOW_VOLTAGE
+#define LOW_BATTERY 10.9
+
+// how much slower than flat out the plan can make good
+#define SLOWER 0.05
+
+static const char *load_names[POWER_LOADS] = {
+	"awake", "asleep", "imu", "gps", "wind", "battery", "rail", "rudder", "winch", "motor"
+};
+
+static uint32_t rng_state;
+
+static double uniform() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state >> 8) / (double) (1 << 24);
+}
+
+static void buildScenario(struct scenario *s, uint32_t seed, int legs, double length) {
+	scenario_defaults(s);
+
+	struct sim_config *cfg = &s->sim;
+	cfg->seed = seed;
+	cfg->wind.direction = 360 * uniform();
+	cfg->wind.speed = 4 + 10 * uniform();
+	cfg->wind.gust_factor = 0.3 * uniform();
+	cfg->wind.shift_amplitude = 15 * uniform();
+	cfg->current_speed = 0.25 * uniform();
+	cfg->current_direction = 360 * uniform();
+	cfg->sea.roll = 8 * uniform();
+	cfg->sea.yaw = 8 * uniform();
+	cfg->sea.period = 4 + 4 * uniform();
+
+	// the other two corners of the triangle, turned any way to the wind.
+	// the start's the third
+	double turn = 360 * uniform();
+
+	for (int i = 0; i < 2; i++) {
+		double b = D2R(turn + 60 * i);
+
+		s->waypoints[i * 2] = cfg->start_lat + length * cos(b) / EARTH_R * 180 / M_PI;
+		s->waypoints[i * 2 + 1] = cfg->start_lon + length * sin(b) / (EARTH_R * cos(D2R(cfg->start_lat))) * 180 / M_PI;
+	}
+	s->waypoints[4] = cfg->start_lat;
+	s->waypoints[5] = cfg->start_lon;
+	s->waypoint_count = 3;
+
+	s->tunings[0] = TUNED_KP;
+	s->tunings[1] = TUNED_KI;
+	s->tunings[2] = TUNED_KD;
+	s->legs = legs;
+	s->limit = legs * length * 2.5;
+	s->tack_every = 0;
+}
+
+// for each run all three sailings finished
+struct totals {
+	int finished;
+	int paired;
+	float *draw[POWER_LOADS + 1];     // mA, each load then all of them
+	float *gps;
+	float *awake;
+	float *smg;
+	float *mission;                   // mAh
+	float *hours;                     // of the mission
+};
+
+static int cmpFloat(const void *a, const void *b) {
+	float x = *(const float *) a, y = *(const float *) b;
+
+	return (x > y) - (x < y);
+}
+
+static float median(float *v, int n) {
+	if (!n)
+		return 0;
+
+	qsort(v, n, sizeof(float), cmpFloat);
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static void add(struct totals *t, const struct scenario_result *r, double length) {
+	float hours = r->elapsed / 3600;
+	float used = 0;
+
+	for (int k = 0; k < POWER_LOADS; k++) {
+		t->draw[k][t->paired] = r->used[k] / hours;
+		used += r->used[k];
+	}
+	t->draw[POWER_LOADS][t->paired] = used / hours;
+	t->gps[t->paired] = r->gps_on;
+	t->awake[t->paired] = r->awake;
+	t->smg[t->paired] = length * r->legs / r->elapsed / KNOT;
+	t->mission[t->paired] = used;
+	t->hours[t->paired] = hours;
+	t->paired++;
+}
+
+int main(int argc, char **argv) {
+	int runs = 24;
+	int legs = 6;
+	double length = 1000;
+	double capacity = 10000;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:l:d:c:j:r:")) != -1) {
+		switch (opt) {
+			case 'n': runs = atoi(optarg); break;
+			case 'l': legs = atoi(optarg); break;
+			case 'd': length = atof(optarg); break;
+			case 'c': capacity = atof(optarg); break;
+			case 'j': jobs = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-l legs] [-d m] [-c mAh] [-j jobs] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (runs < 1 || legs < 1 || length < 50 || capacity <= 0 || jobs < 1)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	// flat out, to the plan, then to the plan on a low battery
+	struct scenario *s = (struct scenario *) calloc(runs * 3, sizeof(struct scenario));
+	struct scenario_result *r = (struct scenario_result *) calloc(runs * 3, sizeof(struct scenario_result));
+
+	for (int i = 0; i < runs; i++) {
+		buildScenario(&s[i], seed * 1000 + i, legs, length);
+		s[i].power_saving = false;
+
+		s[runs + i] = s[i];
+		s[runs + i].power_saving = true;
+
+		s[runs * 2 + i] = s[runs + i];
+		s[runs * 2 + i].sim.battery = LOW_BATTERY;
+	}
+
+	if (!scenario_run_all(s, r, runs * 3, jobs, NULL))
+		return 1;
+
+	struct totals t[3];
+	memset(t, 0, sizeof(t));
+	for (int k = 0; k < 3; k++) {
+		for (int i = 0; i <= POWER_LOADS; i++)
+			t[k].draw[i] = (float *) calloc(runs, sizeof(float));
+		t[k].gps = (float *) calloc(runs, sizeof(float));
+		t[k].awake = (float *) calloc(runs, sizeof(float));
+		t[k].smg = (float *) calloc(runs, sizeof(float));
+		t[k].mission = (float *) calloc(runs, sizeof(float));
+		t[k].hours = (float *) calloc(runs, sizeof(float));
+	}
+
+	for (int i = 0; i < runs; i++) {
+		const struct scenario_result *a = &r[i], *b = &r[runs + i], *c = &r[runs * 2 + i];
+
+		t[0].finished += a->finished;
+		t[1].finished += b->finished;
+		t[2].finished += c->finished;
+
+		if (a->finished && b->finished && c->finished) {
+			add(&t[0], a, length);
+			add(&t[1], b, length);
+			add(&t[2], c, length);
+		}
+	}
+
+	const char *names[3] = { "flat out", "plan", "plan, low" };
+
+	printf("mean draw, mA    %10s %10s %10s\n", names[0], names[1], names[2]);
+	for (int i = 0; i <= POWER_LOADS; i++) {
+		printf("%-16s", i < POWER_LOADS ? load_names[i] : "all");
+		for (int k = 0; k < 3; k++)
+			printf(" %10.1f", median(t[k].draw[i], t[k].paired));
+		printf("\n");
+	}
+
+	printf("\n%-16s", "finished");
+	for (int k = 0; k < 3; k++)
+		printf(" %7d/%-2d", t[k].finished, runs);
+	printf("\n%-16s", "gps on");
+	for (int k = 0; k < 3; k++)
+		printf(" %9.0f%%", 100 * median(t[k].gps, t[k].paired));
+	printf("\n%-16s", "mcu awake");
+	for (int k = 0; k < 3; k++)
+		printf(" %9.0f%%", 100 * median(t[k].awake, t[k].paired));
+	printf("\n%-16s", "smg, kt");
+	for (int k = 0; k < 3; k++)
+		printf(" %10.2f", median(t[k].smg, t[k].paired));
+	printf("\n%-16s", "mission, h");
+	for (int k = 0; k < 3; k++)
+		printf(" %10.2f", median(t[k].hours, t[k].paired));
+	printf("\n%-16s", "mission, mAh");
+	for (int k = 0; k < 3; k++)
+		printf(" %10.0f", median(t[k].mission, t[k].paired));
+	printf("\n%-16s", "battery, h");
+	for (int k = 0; k < 3; k++)
+		printf(" %10.1f", capacity / median(t[k].draw[POWER_LOADS], t[k].paired));
+	printf("\n%-16s", "missions");
+	for (int k = 0; k < 3; k++)
+		printf(" %10.1f", capacity / median(t[k].mission, t[k].paired));
+	printf("\n(%d legs of %.0fm, on %.0fmAh)\n", legs, length, capacity);
+
+	int failed = 0;
+	float flat = median(t[0].draw[POWER_LOADS], t[0].paired);
+	float plan = median(t[1].draw[POWER_LOADS], t[1].paired);
+
+	if (!t[1].paired || plan >= flat) {
+		fprintf(stderr, "the plan drew as much as flat out\n");
+		failed++;
+	}
+
+	if (median(t[1].smg, t[1].paired) < (1 - SLOWER) * median(t[0].smg, t[0].paired)) {
+		fprintf(stderr, "the plan was more than %.0f%% slower than flat out\n", SLOWER * 100);
+		failed++;
+	}
+
+	if (median(t[2].draw[POWER_LOADS], t[2].paired) >= plan) {
+		fprintf(stderr, "the plan drew as much with the battery low\n");
+		failed++;
+	}
+
+	for (int k = 0; k < 3; k++) {
+		for (int i = 0; i <= POWER_LOADS; i++)
+			free(t[k].draw[i]);
+		free(t[k].gps);
+		free(t[k].awake);
+		free(t[k].smg);
+		free(t[k].mission);
+		free(t[k].hours);
+	}
+	free(s);
+	free(r);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * rclatency.cpp: command-to-actuation latency of remote control, with the
+ * commands arriving in fragments.
+ *
+ * The firmware is put in remote control mode and sent a stream of rudder
+ * commands. Each frame is split into random pieces that arrive with random
+ * gaps, the way a radio link delivers them. Latency is measured from the
+ * frame's last byte arriving to the rudder servo's first move towards the
+ * commanded position. The longest passes through loop() are reported too:
+ * a parser that waits for the rest of a frame holds up everything else.
+ *
+ * usage: ardusailor_rclatency [options]
+ *   -n count      commands to send (default 200)
+ *   -p ms         time between commands (default 700)
+ *   -f count      most pieces a frame is split into (default 4)
+ *   -g ms         longest gap between pieces (default 60)
+ *   -b            binary frames instead of [RRR;WW] text
+ *   -s            a stray sync byte ahead of every binary frame, as line
+ *                 noise might put there
+ *   -r seed       random seed (default 1)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "servo_ctl.h"
+#include "telemetry.h"
+#include "rc_cmd.h"
+#include "sim/sim.h"
+
+// servo_ctl.cpp
+#define RUDDER_PIN 10
+
+// commands start once setup() is long done
+#define FIRST_COMMAND_US 10000000ULL
+
+struct command {
+	int rudder;
+	uint64_t complete;   // us, when its last byte arrives
+	int64_t latency;     // us, -1 until the rudder moves
+};
+
+static std::vector<command> commands;
+static size_t pending = 0;
+static int last_angle = -1;
+
+static uint32_t rng_state;
+
+static uint32_t rnd(uint32_t n) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return rng_state % n;
+}
+
+static void onServo(uint8_t pin, int angle) {
+	if (pin != RUDDER_PIN)
+		return;
+
+	uint64_t now = hal_now_us();
+
+	// the newest command that has fully arrived is the one being acted on
+	while (pending + 1 < commands.size() && commands[pending + 1].complete <= now)
+		pending++;
+
+	command *c = &commands[pending];
+	int target = constrain(90 + c->rudder, RUDDER_MIN, RUDDER_MAX);
+
+	if (c->complete <= now && c->latency < 0 && last_angle >= 0 &&
+		(target - last_angle) * (angle - last_angle) > 0)
+		c->latency = now - c->complete;
+
+	last_angle = angle;
+}
+
+static int encode(int rudder, int winch, bool binary, char *out) {
+	if (!binary)
+		return sprintf(out, "[%d;%d]", rudder, winch);
+
+	uint8_t r = (int8_t) rudder, w = winch;
+	uint16_t crc = telemetryCrc(telemetryCrc(0xffff, r), w);
+
+	out[0] = RC_SYNC;
+	out[1] = r;
+	out[2] = w;
+	out[3] = crc;
+	out[4] = crc >> 8;
+
+	return 5;
+}
+
+static double percentile(std::vector<double> &v, double p) {
+	return v[min(v.size() - 1, (size_t) (p * v.size()))];
+}
+
+int main(int argc, char **argv) {
+	int count = 200;
+	uint32_t period = 700;
+	int max_pieces = 4;
+	uint32_t max_gap = 60;
+	bool binary = false;
+	bool stray = false;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:p:f:g:bsr:")) != -1) {
+		switch (opt) {
+			case 'n': count = atoi(optarg); break;
+			case 'p': period = atoi(optarg); break;
+			case 'f': max_pieces = atoi(optarg); break;
+			case 'g': max_gap = atoi(optarg); break;
+			case 'b': binary = true; break;
+			case 's': stray = true; break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n count] [-p ms] [-f pieces] [-g ms] [-b] [-s] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (count <= 0 || max_pieces <= 0)
+		return 1;
+
+	struct sim_config cfg;
+	sim_default_config(&cfg);
+	sim_begin(&cfg);
+	hal_servo_watch(onServo);
+
+	rng_state = seed ? seed : 1;
+
+	// menu, remote control
+	Serial.inject("mr", 2);
+
+	int rudder = 0;
+	for (int i = 0; i < count; i++) {
+		// far enough from the last one that the servo has to move
+		int next;
+		do
+			next = (int) rnd(61) - 30;
+		while (abs(next - rudder) < 5);
+		rudder = next;
+
+		char frame[16];
+		int len = 0;
+
+		if (binary && stray)
+			frame[len++] = RC_SYNC;
+		len += encode(rudder, rnd(91), binary, frame + len);
+
+		uint64_t at = FIRST_COMMAND_US + (uint64_t) i * period * 1000;
+		int pieces = 1 + rnd(min(max_pieces, len));
+
+		for (int p = 0, sent = 0; p < pieces; p++) {
+			int n = p == pieces - 1 ? len - sent : 1 + rnd(len - sent - (pieces - p - 1));
+
+			Serial.injectAt(frame + sent, n, at);
+			sent += n;
+
+			if (p < pieces - 1)
+				at += rnd(max_gap * 1000 + 1);
+		}
+
+		command c = { rudder, at, -1 };
+		commands.push_back(c);
+	}
+
+	uint64_t until = commands.back().complete + 2000000;
+
+	setup();
+
+	std::vector<double> loops;
+	while (hal_now_us() < until) {
+		sim_advance();
+
+		uint64_t start = hal_now_us();
+		hal_loop_once();
+
+		if (start >= FIRST_COMMAND_US)
+			loops.push_back((hal_now_us() - start) / 1000.0);
+	}
+
+	std::vector<double> latencies;
+	for (size_t i = 0; i < commands.size(); i++)
+		if (commands[i].latency >= 0)
+			latencies.push_back(commands[i].latency / 1000.0);
+
+	if (latencies.empty()) {
+		fprintf(stderr, "no commands acted on\n");
+		return 1;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	double sum = 0;
+	for (size_t i = 0; i < latencies.size(); i++)
+		sum += latencies[i];
+
+	printf("%s frames%s in up to %d pieces, gaps up to %ums: %zu/%d acted on\n",
+		binary ? "binary" : "text", binary && stray ? " after stray syncs" : "", max_pieces, max_gap,
+		latencies.size(), count);
+	printf("latency ms: min %.1f  median %.1f  mean %.1f  p95 %.1f  max %.1f\n",
+		latencies[0], percentile(latencies, 0.5), sum / latencies.size(),
+		percentile(latencies, 0.95), latencies.back());
+
+	std::sort(loops.begin(), loops.end());
+	printf("loop() ms: median %.1f  p95 %.1f  max %.1f\n",
+		percentile(loops, 0.5), percentile(loops, 0.95), loops.back());
+
+	return 0;
+}
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "route/uploader.h"
+#include "telemetry.h"
+
+// begin, resend everything missing and commit, at most this many times
+#define RU_ROUNDS 4
+
+static void pack(const RouteWaypoint *wp, uint8_t *out) {
+	for (int i = 0; i < 4; i++) {
+		out[i] = wp->lat >> (8 * i);
+		out[4 + i] = wp->lon >> (8 * i);
+	}
+	out[8] = wp->radius;
+}
+
+size_t ru_frame(uint8_t type, const uint8_t *payload, uint8_t len, uint8_t *out) {
+	out[0] = ROUTE_SYNC;
+	out[1] = type;
+	out[2] = len;
+	if (len)
+		memcpy(out + 3, payload, len);
+
+	uint16_t crc = 0xffff;
+	for (int i = 1; i < 3 + len; i++)
+		crc = telemetryCrc(crc, out[i]);
+
+	out[3 + len] = crc;
+	out[4 + len] = crc >> 8;
+
+	return 5 + len;
+}
+
+uint16_t ru_route_crc(const RouteWaypoint *wps, uint8_t count, uint8_t mode) {
+	uint16_t crc = telemetryCrc(telemetryCrc(0xffff, count), mode);
+
+	for (int i = 0; i < count; i++) {
+		uint8_t b[ROUTE_RECORD];
+		pack(&wps[i], b);
+
+		for (int j = 0; j < ROUTE_RECORD; j++)
+			crc = telemetryCrc(crc, b[j]);
+	}
+
+	return crc;
+}
+
+// whether reply (past "route ") is one of want's, | between them. a
+// number in one has to match all of it
+static bool matches(const char *reply, const char *want) {
+	while (*want) {
+		const char *bar = strchr(want, '|');
+		size_t n = bar ? (size_t) (bar - want) : strlen(want);
+
+		if (!strncmp(reply, want, n) && (reply[n] == 0 || reply[n] == ' '))
+			return true;
+
+		want += n + (bar ? 1 : 0);
+	}
+
+	return false;
+}
+
+// sends a frame until one of the replies wanted comes back, into reply.
+// false if none did
+static bool exchange(const struct ru_link *link, struct ru_stats *stats, const uint8_t *frame, size_t len,
+		const char *want, char *reply, size_t size) {
+	for (int t = 0; t < RU_TRIES; t++) {
+		link->send(link->ctx, frame, len);
+		stats->frames++;
+		stats->bytes += len;
+		if (t)
+			stats->resent++;
+		if (frame[1] == 'W')
+			stats->waypoints++;
+
+		// anything else is a log line, or a late reply to something before
+		while (link->read_line(link->ctx, reply, size, RU_REPLY_TIMEOUT)) {
+			if (strncmp(reply, "route ", 6))
+				continue;
+			if (!strcmp(reply + 6, "busy"))
+				break;
+			if (matches(reply + 6, want))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+bool ru_upload(const struct ru_link *link, const RouteWaypoint *wps, uint8_t count, uint8_t mode,
+		struct ru_stats *stats, ru_stop_fn stop, void *stop_ctx) {
+	if (!count || count > ROUTE_MAX_WAYPOINTS)
+		return false;
+
+	uint8_t frame[ROUTE_FRAME_MAX + 1];
+	char reply[128];
+
+	uint16_t crc = ru_route_crc(wps, count, mode);
+	uint8_t begin[4] = { count, mode, (uint8_t) crc, (uint8_t) (crc >> 8) };
+
+	for (int round = 0; round < RU_ROUNDS; round++) {
+		size_t len = ru_frame('B', begin, sizeof(begin), frame);
+		if (!exchange(link, stats, frame, len, "missing", reply, sizeof(reply)))
+			return false;
+
+		unsigned long missing = strtoul(reply + 14, NULL, 16);
+
+		// refused if the boat's been reset since: begun again
+		bool refused = false;
+
+		for (int i = 0; i < count && !refused; i++) {
+			if (!(missing & (1UL << i)))
+				continue;
+
+			uint8_t payload[1 + ROUTE_RECORD];
+			payload[0] = i;
+			pack(&wps[i], payload + 1);
+
+			char want[32];
+			snprintf(want, sizeof(want), "written %d|refused", i);
+
+			len = ru_frame('W', payload, sizeof(payload), frame);
+			if (!exchange(link, stats, frame, len, want, reply, sizeof(reply)))
+				return false;
+
+			refused = !strcmp(reply + 6, "refused");
+
+			if (stop && stop(stop_ctx, stats))
+				return false;
+		}
+
+		if (refused)
+			continue;
+
+		// refused if what the boat has doesn't add up to the crc: it's then
+		// all missing again
+		len = ru_frame('C', NULL, 0, frame);
+		if (!exchange(link, stats, frame, len, "live|missing|refused", reply, sizeof(reply)))
+			return false;
+
+		if (!strncmp(reply + 6, "live", 4))
+			return true;
+	}
+
+	return false;
+}
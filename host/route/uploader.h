@@ -0,0 +1,56 @@
+/*
+ * uploader.h: sending side of the firmware's route upload (route.h).
+ *
+ * One frame at a time, each waiting for the boat's reply line ("route ...")
+ * and sent again if none comes or the boat's busy. A begin frame comes back
+ * with the waypoints the boat hasn't got yet, so an upload that was cut off,
+ * by the link or a reset, only sends what's left of it. Other lines from the
+ * boat (log lines, data lines) are skipped.
+ */
+
+#ifndef ru_uploader_h
+#define ru_uploader_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "route.h"
+
+// tries at each frame before giving up
+#define RU_TRIES 10
+
+// how long to wait for a reply, ms. a waypoint's 10 eeprom writes take
+// about 40ms
+#define RU_REPLY_TIMEOUT 500
+
+struct ru_link {
+	void *ctx;
+
+	// to the boat
+	void (*send)(void *ctx, const uint8_t *data, size_t len);
+
+	// the next line from the boat, without its line ending. false if none
+	// came within timeout_ms
+	bool (*read_line)(void *ctx, char *line, size_t size, uint32_t timeout_ms);
+};
+
+struct ru_stats {
+	uint32_t frames;      // sent, counting resends
+	uint32_t resent;
+	uint32_t waypoints;   // waypoint frames sent, counting resends
+	uint32_t bytes;
+};
+
+// a frame of type with payload, into out (ROUTE_FRAME_MAX + 1 bytes). its length
+size_t ru_frame(uint8_t type, const uint8_t *payload, uint8_t len, uint8_t *out);
+
+uint16_t ru_route_crc(const RouteWaypoint *wps, uint8_t count, uint8_t mode);
+
+// sends frames for a route until it's live on the boat, or stop (if set)
+// says to, after each waypoint's written. true once it's live
+typedef bool (*ru_stop_fn)(void *ctx, const struct ru_stats *stats);
+
+bool ru_upload(const struct ru_link *link, const RouteWaypoint *wps, uint8_t count, uint8_t mode,
+	struct ru_stats *stats, ru_stop_fn stop = NULL, void *stop_ctx = NULL);
+
+#endif
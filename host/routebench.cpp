@@ -0,0 +1,323 @@
+/*
+ * routebench.cpp: route uploads (route.h, route/uploader.h) to the firmware
+ * under way, in closed loop against the boat simulation, on virtual time.
+ *
+ * The uploader talks to the firmware over a simulated 9600 baud link, bytes
+ * taking their time each way, while the firmware sails. Three uploads:
+ *
+ *   clean    a 12 waypoint loop, on a clean link
+ *   noisy    an 8 waypoint back and forth, with bytes corrupted at random
+ *   resumed  a 16 waypoint one way route, cut off after 6 waypoints by a
+ *            reset of the board, then sent again
+ *
+ * Each has to end up live, waypoint for waypoint, with the pilot steering
+ * for its first waypoint. The clean one has to take under MAX_UPLOAD_S; the
+ * resumed one must keep the route before it live through the reset, and
+ * only send the waypoints the board didn't have. All along, the eeprom
+ * writes mustn't make the heading or the pilot miss a run.
+ *
+ * usage: ardusailor_routebench [-e error rate] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "route.h"
+#include "route/uploader.h"
+#include "sched.h"
+#include "sketch.h"
+#include "sim/sim.h"
+#include "tasks.h"
+
+// 10 bits a byte at 9600 baud
+#define BYTE_US 1042
+
+#define MAX_UPLOAD_S 5
+
+// where the resumed upload's cut off
+#define CUT_AFTER 6
+
+#define EARTH_R 6371000.0
+#define D2R(v) ((v) * M_PI / 180.0)
+
+// firmware.ino
+extern Sched sched;
+extern Route route;
+extern int32_t gps_lat, gps_lon;
+extern double wp_heading;
+
+struct bench_link {
+	double error_rate;
+	uint64_t tx_free;     // when the last byte sent is all there
+	uint32_t corrupted;
+
+	FILE *out;            // the firmware's serial output
+	char *buf;
+	size_t size;
+	size_t seen;
+};
+
+static uint32_t rng_state;
+static uint32_t misses;
+
+static double rnd() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state & 0xffffff) / (double) 0x1000000;
+}
+
+static void linkSend(void *ctx, const uint8_t *data, size_t len) {
+	bench_link *l = (bench_link *) ctx;
+	uint64_t at = max(hal_now_us(), l->tx_free);
+
+	for (size_t i = 0; i < len; i++) {
+		char b = data[i];
+
+		if (rnd() < l->error_rate) {
+			b ^= 1 << (int) (rnd() * 8);
+			l->corrupted++;
+		}
+
+		at += BYTE_US;
+		Serial.injectAt(&b, 1, at);
+	}
+
+	l->tx_free = at;
+}
+
+static void step() {
+	sim_advance();
+	hal_loop_once();
+}
+
+static void runFor(uint64_t us) {
+	uint64_t until = hal_now_us() + us;
+
+	while (hal_now_us() < until)
+		step();
+}
+
+static bool linkLine(void *ctx, char *line, size_t size, uint32_t timeout_ms) {
+	bench_link *l = (bench_link *) ctx;
+	uint64_t until = hal_now_us() + (uint64_t) timeout_ms * 1000;
+
+	for (;;) {
+		fflush(l->out);
+
+		char *start = l->buf + l->seen;
+		char *end = (char *) memchr(start, '\n', l->size - l->seen);
+
+		if (end) {
+			size_t len = end - start;
+			l->seen += len + 1;
+
+			// here once it's come over the link
+			runFor((len + 1) * BYTE_US);
+
+			if (len && start[len - 1] == '\r')
+				len--;
+			if (len >= size)
+				len = size - 1;
+
+			memcpy(line, start, len);
+			line[len] = 0;
+			return true;
+		}
+
+		if (hal_now_us() >= until)
+			return false;
+
+		step();
+	}
+}
+
+// what the firmware's printed so far has come over the link already
+static void skipOutput(bench_link *l) {
+	fflush(l->out);
+	l->seen = l->size;
+}
+
+// a lap around the start, radius m
+static void makeRoute(const struct sim_config *cfg, RouteWaypoint *wps, int count, double radius) {
+	for (int i = 0; i < count; i++) {
+		double a = 2 * M_PI * i / count;
+
+		wps[i].lat = NAV_UDEG(cfg->start_lat + radius * cos(a) / EARTH_R * 180 / M_PI);
+		wps[i].lon = NAV_UDEG(cfg->start_lon + radius * sin(a) / (EARTH_R * cos(D2R(cfg->start_lat))) * 180 / M_PI);
+		wps[i].radius = 3 + i % 5;
+	}
+}
+
+// the firmware's route is wps, to be sailed from its first waypoint
+static bool isLive(const RouteWaypoint *wps, int count, uint8_t mode) {
+	if (route.count != count || route.mode != mode || route.target != 0)
+		return false;
+
+	for (int i = 0; i < count; i++)
+		if (route.legs[i].to.lat != wps[i].lat || route.legs[i].to.lon != wps[i].lon ||
+				route.legs[i].radius != wps[i].radius)
+			return false;
+
+	return true;
+}
+
+// degrees between where the pilot's heading for and the first waypoint
+static double headingError(const RouteWaypoint *wps) {
+	double lat1 = D2R(gps_lat / 1e6), lat2 = D2R(wps[0].lat / 1e6);
+	double dlon = D2R((wps[0].lon - gps_lon) / 1e6);
+
+	double bearing = atan2(sin(dlon) * cos(lat2), cos(lat1) * sin(lat2) - sin(lat1) * cos(lat2) * cos(dlon)) * 180 / M_PI;
+	double e = fmod(fabs(bearing - wp_heading) + 360, 360);
+
+	return e > 180 ? 360 - e : e;
+}
+
+static void countMisses() {
+	misses += sched.tasks[TASK_AHRS].misses + sched.tasks[TASK_PILOT].misses;
+}
+
+static bool stopAfter(void *ctx, const struct ru_stats *stats) {
+	return stats->waypoints >= *(uint32_t *) ctx;
+}
+
+static bool report(const char *name, bool live, const struct ru_stats *stats, uint64_t took, const bench_link *l) {
+	printf("%-8s %-4s %6u %6u %9u %6u %9u %7.2f\n", name, live ? "yes" : "no",
+		stats->frames, stats->resent, stats->waypoints, stats->bytes, l->corrupted, took / 1e6);
+
+	return live;
+}
+
+int main(int argc, char **argv) {
+	double error_rate = 0.02;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "e:r:")) != -1) {
+		switch (opt) {
+			case 'e': error_rate = atof(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-e error rate] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	struct sim_config cfg;
+	sim_default_config(&cfg);
+	cfg.seed = seed;
+	sim_begin(&cfg);
+	rng_state = seed ? seed : 1;
+
+	bench_link l;
+	memset(&l, 0, sizeof(l));
+	l.out = open_memstream(&l.buf, &l.size);
+	Serial.setSink(l.out);
+
+	struct ru_link link = { &l, linkSend, linkLine };
+
+	setup();
+	runFor(20000000);
+
+	int failed = 0;
+	struct ru_stats stats;
+	uint64_t start;
+	bool live;
+
+	printf("upload   live frames resent waypoints  bytes corrupted seconds\n");
+
+	// clean
+	RouteWaypoint clean[12];
+	makeRoute(&cfg, clean, 12, 150);
+
+	skipOutput(&l);
+	memset(&stats, 0, sizeof(stats));
+	start = hal_now_us();
+	live = ru_upload(&link, clean, 12, ROUTE_LOOP, &stats);
+	live = report("clean", live, &stats, hal_now_us() - start, &l) && isLive(clean, 12, ROUTE_LOOP);
+
+	if (!live || hal_now_us() - start > MAX_UPLOAD_S * 1000000ULL) {
+		fprintf(stderr, "clean upload not live within %ds\n", MAX_UPLOAD_S);
+		failed++;
+	}
+
+	// steering for it by the next pass of the pilot
+	runFor(100000);
+	if (headingError(clean) > 1) {
+		fprintf(stderr, "heading for %.1f, not the new route's first waypoint\n", wp_heading);
+		failed++;
+	}
+
+	// noisy
+	RouteWaypoint noisy[8];
+	makeRoute(&cfg, noisy, 8, 300);
+
+	l.error_rate = error_rate;
+	skipOutput(&l);
+	memset(&stats, 0, sizeof(stats));
+	start = hal_now_us();
+	live = ru_upload(&link, noisy, 8, ROUTE_PINGPONG, &stats);
+	if (!report("noisy", live, &stats, hal_now_us() - start, &l) || !isLive(noisy, 8, ROUTE_PINGPONG)) {
+		fprintf(stderr, "noisy upload not live\n");
+		failed++;
+	}
+	l.error_rate = 0;
+	l.corrupted = 0;
+
+	// resumed, over a reset
+	RouteWaypoint resumed[ROUTE_MAX_WAYPOINTS];
+	makeRoute(&cfg, resumed, ROUTE_MAX_WAYPOINTS, 500);
+
+	uint32_t cut = CUT_AFTER;
+	skipOutput(&l);
+	memset(&stats, 0, sizeof(stats));
+	start = hal_now_us();
+	ru_upload(&link, resumed, ROUTE_MAX_WAYPOINTS, ROUTE_ONCE, &stats, stopAfter, &cut);
+	report("cut off", false, &stats, hal_now_us() - start, &l);
+
+	countMisses();
+	Serial.clear();
+	setup();
+
+	if (!isLive(noisy, 8, ROUTE_PINGPONG)) {
+		fprintf(stderr, "the route before didn't stay live through the reset\n");
+		failed++;
+	}
+
+	runFor(5000000);
+
+	skipOutput(&l);
+	memset(&stats, 0, sizeof(stats));
+	start = hal_now_us();
+	live = ru_upload(&link, resumed, ROUTE_MAX_WAYPOINTS, ROUTE_ONCE, &stats);
+	if (!report("resumed", live, &stats, hal_now_us() - start, &l) || !isLive(resumed, ROUTE_MAX_WAYPOINTS, ROUTE_ONCE)) {
+		fprintf(stderr, "resumed upload not live\n");
+		failed++;
+	}
+
+	if (stats.waypoints != ROUTE_MAX_WAYPOINTS - CUT_AFTER) {
+		fprintf(stderr, "resumed upload sent %u waypoints, not the %d missing\n", stats.waypoints, ROUTE_MAX_WAYPOINTS - CUT_AFTER);
+		failed++;
+	}
+
+	runFor(5000000);
+	countMisses();
+
+	printf("heading and pilot runs missed: %u\n", misses);
+	if (misses) {
+		fprintf(stderr, "uploads held up the heading or the pilot\n");
+		failed++;
+	}
+
+	Serial.setSink(NULL);
+	fclose(l.out);
+	free(l.buf);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * routeup.cpp: sends a new route to the boat over its serial (or radio)
+ * link, where it's sailed from its first waypoint as soon as it's all there.
+ * No reflash. Run it again after a dropped link or a reset and it carries on
+ * with what the boat hasn't got yet.
+ *
+ * The route file has a waypoint a line: lat,lon in degrees and, if it's not
+ * the firmware's default, how close counts as there in m. # starts a comment.
+ * The boat takes uploads whenever it's not under manual override.
+ *
+ * usage: ardusailor_routeup [-d device] [-b baud] [-m loop|pingpong|once] [file]
+ *   -d device     serial port (default /dev/ttyUSB0)
+ *   -b baud       (default 9600)
+ *   -m mode       what to do after the last waypoint (default loop)
+ *   file          the route (default: stdin)
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include "route/uploader.h"
+
+struct port {
+	int fd;
+	char buf[256];
+	size_t used;
+};
+
+static speed_t baudRate(long baud) {
+	switch (baud) {
+		case 4800: return B4800;
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+	}
+
+	return 0;
+}
+
+static bool openPort(struct port *p, const char *device, speed_t speed) {
+	p->used = 0;
+	p->fd = open(device, O_RDWR | O_NOCTTY);
+	if (p->fd < 0)
+		return false;
+
+	struct termios t;
+	if (tcgetattr(p->fd, &t) < 0)
+		return false;
+
+	cfmakeraw(&t);
+	cfsetispeed(&t, speed);
+	cfsetospeed(&t, speed);
+	t.c_cflag |= CLOCAL | CREAD;
+
+	return tcsetattr(p->fd, TCSANOW, &t) == 0;
+}
+
+static void portSend(void *ctx, const uint8_t *data, size_t len) {
+	struct port *p = (struct port *) ctx;
+
+	while (len) {
+		ssize_t n = write(p->fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+
+		data += n;
+		len -= n;
+	}
+
+	tcdrain(p->fd);
+}
+
+static uint64_t nowMs() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static bool portLine(void *ctx, char *line, size_t size, uint32_t timeout_ms) {
+	struct port *p = (struct port *) ctx;
+	uint64_t until = nowMs() + timeout_ms;
+
+	for (;;) {
+		char *end = (char *) memchr(p->buf, '\n', p->used);
+
+		// a line too long for buf is cut where it fills up
+		if (end || p->used == sizeof(p->buf)) {
+			size_t len = end ? (size_t) (end - p->buf) : p->used;
+			size_t take = end ? len + 1 : len;
+
+			if (len && p->buf[len - 1] == '\r')
+				len--;
+			if (len >= size)
+				len = size - 1;
+
+			memcpy(line, p->buf, len);
+			line[len] = 0;
+
+			memmove(p->buf, p->buf + take, p->used - take);
+			p->used -= take;
+			return true;
+		}
+
+		uint64_t now = nowMs();
+		if (now >= until)
+			return false;
+
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(p->fd, &fds);
+
+		struct timeval tv = { (time_t) ((until - now) / 1000), (suseconds_t) ((until - now) % 1000 * 1000) };
+		if (select(p->fd + 1, &fds, NULL, NULL, &tv) <= 0)
+			continue;
+
+		ssize_t n = read(p->fd, p->buf + p->used, sizeof(p->buf) - p->used);
+		if (n > 0)
+			p->used += n;
+	}
+}
+
+static int readRoute(FILE *f, RouteWaypoint *wps) {
+	char line[256];
+	int count = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		char *hash = strchr(line, '#');
+		if (hash)
+			*hash = 0;
+
+		double v[3];
+		int n = 0;
+		for (char *tok = strtok(line, ", \t\r\n"); tok && n < 3; tok = strtok(NULL, ", \t\r\n"))
+			v[n++] = atof(tok);
+
+		if (!n)
+			continue;
+
+		if (n < 2 || count == ROUTE_MAX_WAYPOINTS || (n == 3 && (v[2] < 0 || v[2] > 255)))
+			return -1;
+
+		wps[count].lat = NAV_UDEG(v[0]);
+		wps[count].lon = NAV_UDEG(v[1]);
+		wps[count].radius = n == 3 ? (uint8_t) v[2] : 0;
+		count++;
+	}
+
+	return count;
+}
+
+int main(int argc, char **argv) {
+	const char *device = "/dev/ttyUSB0";
+	long baud = 9600;
+	uint8_t mode = ROUTE_LOOP;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:b:m:")) != -1) {
+		switch (opt) {
+			case 'd': device = optarg; break;
+			case 'b': baud = atol(optarg); break;
+			case 'm':
+				if (!strcmp(optarg, "loop"))
+					mode = ROUTE_LOOP;
+				else if (!strcmp(optarg, "pingpong"))
+					mode = ROUTE_PINGPONG;
+				else if (!strcmp(optarg, "once"))
+					mode = ROUTE_ONCE;
+				else
+					goto usage;
+				break;
+			default:
+			usage:
+				fprintf(stderr, "usage: %s [-d device] [-b baud] [-m loop|pingpong|once] [file]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	speed_t speed = baudRate(baud);
+	if (!speed) {
+		fprintf(stderr, "unsupported baud rate %ld\n", baud);
+		return 1;
+	}
+
+	FILE *in = stdin;
+	if (optind < argc && !(in = fopen(argv[optind], "r"))) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	RouteWaypoint wps[ROUTE_MAX_WAYPOINTS];
+	int count = readRoute(in, wps);
+	if (count <= 0) {
+		fprintf(stderr, "no route: a waypoint a line, lat,lon[,radius], up to %d of them\n", ROUTE_MAX_WAYPOINTS);
+		return 1;
+	}
+
+	struct port p;
+	if (!openPort(&p, device, speed)) {
+		perror(device);
+		return 1;
+	}
+
+	struct ru_stats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	struct ru_link link = { &p, portSend, portLine };
+
+	uint64_t start = nowMs();
+	bool live = ru_upload(&link, wps, count, mode, &stats);
+
+	fprintf(stderr, "%s: %d waypoints, %u frames (%u resent, %u waypoints), %u bytes in %.1fs\n",
+		live ? "live" : "failed", count, stats.frames, stats.resent, stats.waypoints, stats.bytes,
+		(nowMs() - start) / 1000.0);
+
+	return live ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <PID_v1.h>
+
+#include "route.h"
+#include "trim.h"
+#include "scenario.h"
+
+// ROUTE_PARAM_ADDRESS in firmware.ino
+#define ROUTE_PARAMS 512
+
+// firmware (pilot.ino, firmware.ino)
+extern RouteWaypoint default_route[];
+extern uint8_t default_route_count;
+extern Route route;
+extern float wp_distance;
+extern double requested_heading;
+extern int16_t irons;
+extern uint32_t tack_every;
+extern uint16_t tack_cost;
+extern uint16_t lookahead;
+extern boolean learning;
+extern boolean trimming;
+extern boolean power_saving;
+extern Power power;
+extern PID steeringPID;
+
+#define EARTH_R 6371000.0
+#define D2R(v) ((v) * M_PI / 180.0)
+
+struct run_ctx {
+	int legs_wanted;
+	int legs;
+	int last_wp;
+	double from[2];
+	double xte_sq;
+	double heading_sq;
+	uint32_t samples;
+	int tack;
+	uint16_t maneuvers;
+	float heel_max;
+	uint32_t heel_over;
+	bool finished;
+};
+
+// distance (m) of p from the line a->b, on a local flat projection
+static double crossTrack(const double a[2], const double b[2], const double p[2]) {
+	double k = cos(D2R(a[0]));
+	double bx = D2R(b[1] - a[1]) * k * EARTH_R, by = D2R(b[0] - a[0]) * EARTH_R;
+	double px = D2R(p[1] - a[1]) * k * EARTH_R, py = D2R(p[0] - a[0]) * EARTH_R;
+	double len = sqrt(bx * bx + by * by);
+
+	if (len < 1)
+		return sqrt(px * px + py * py);
+
+	return fabs(bx * py - by * px) / len;
+}
+
+static bool observe(const struct sim_state *s, void *p) {
+	run_ctx *ctx = (run_ctx *) p;
+
+	const RouteLeg *legs = route.legs;
+
+	if (route.target != ctx->last_wp) {
+		ctx->from[0] = legs[ctx->last_wp].to.lat / 1e6;
+		ctx->from[1] = legs[ctx->last_wp].to.lon / 1e6;
+		ctx->last_wp = route.target;
+
+		if (++ctx->legs >= ctx->legs_wanted) {
+			ctx->finished = true;
+			return false;
+		}
+	}
+
+	double to[2] = { legs[route.target].to.lat / 1e6, legs[route.target].to.lon / 1e6 };
+	double at[2] = { s->lat, s->lon };
+	double xte = crossTrack(ctx->from, to, at);
+
+	double herr = fmod(fabs(requested_heading - s->heading), 360.0);
+	if (herr > 180)
+		herr = 360 - herr;
+
+	ctx->xte_sq += xte * xte;
+	ctx->heading_sq += herr * herr;
+	ctx->samples++;
+
+	ctx->heel_max = max(ctx->heel_max, fabs(s->heel));
+	ctx->heel_over += fabs(s->heel) > TRIM_MAX_HEEL;
+
+	// a change of the side the wind comes over is a tack or a gybe
+	if (s->speed > 0.3) {
+		int tack = s->awa < 180 ? 1 : -1;
+		if (ctx->tack && tack != ctx->tack)
+			ctx->maneuvers++;
+		ctx->tack = tack;
+	}
+
+	return true;
+}
+
+void scenario_defaults(struct scenario *s) {
+	memset(s, 0, sizeof(*s));
+
+	sim_default_config(&s->sim);
+
+	s->tunings[0] = steeringPID.GetKp();
+	s->tunings[1] = steeringPID.GetKi();
+	s->tunings[2] = steeringPID.GetKd();
+	s->irons = irons;
+	s->tack_every = tack_every;
+	s->tack_cost = tack_cost;
+	s->lookahead = lookahead;
+	s->learning = learning;
+	s->trimming = trimming;
+	s->power_saving = power_saving;
+	s->waypoint_count = default_route_count;
+	for (int i = 0; i < default_route_count; i++) {
+		s->waypoints[i * 2] = default_route[i].lat / 1e6;
+		s->waypoints[i * 2 + 1] = default_route[i].lon / 1e6;
+	}
+	s->limit = 3600;
+}
+
+void scenario_run(const struct scenario *s, struct scenario_result *r) {
+	sim_begin(&s->sim);
+	sim_store_pid_tunings(s->tunings);
+
+	irons = s->irons;
+	tack_every = s->tack_every;
+	tack_cost = s->tack_cost;
+	lookahead = s->lookahead;
+	learning = s->learning;
+	trimming = s->trimming;
+	power_saving = s->power_saving;
+
+	// back and forth, arriving as close as the firmware likes
+	RouteWaypoint wps[SCENARIO_MAX_WAYPOINTS];
+	for (int i = 0; i < s->waypoint_count; i++) {
+		wps[i].lat = NAV_UDEG(s->waypoints[i * 2]);
+		wps[i].lon = NAV_UDEG(s->waypoints[i * 2 + 1]);
+		wps[i].radius = 0;
+	}
+	routeStore(ROUTE_PARAMS, wps, s->waypoint_count, ROUTE_PINGPONG);
+
+	run_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.legs_wanted = s->legs ? s->legs : s->waypoint_count;
+	ctx.from[0] = s->sim.start_lat;
+	ctx.from[1] = s->sim.start_lon;
+
+	sim_run(s->limit, observe, &ctx);
+
+	const struct sim_state *st = sim_get_state();
+
+	memset(r, 0, sizeof(*r));
+	r->finished = ctx.finished;
+	r->legs = ctx.legs;
+	r->elapsed = st->time / 1e6;
+	r->xte_rms = ctx.samples ? sqrt(ctx.xte_sq / ctx.samples) : 0;
+	r->heading_rms = ctx.samples ? sqrt(ctx.heading_sq / ctx.samples) : 0;
+	r->maneuvers = ctx.maneuvers;
+	r->rudder_travel = st->rudder_travel;
+	r->distance = st->distance;
+	r->remaining = ctx.finished ? 0 : wp_distance;
+	r->heel_max = ctx.heel_max;
+	r->heel_over = ctx.samples ? (float) ctx.heel_over / ctx.samples : 0;
+
+	uint32_t ms = power.ms[POWER_AWAKE] + power.ms[POWER_ASLEEP];
+	for (int i = 0; i < POWER_LOADS; i++)
+		r->used[i] = powerUsed(&power, i);
+	r->awake = ms ? (float) power.ms[POWER_AWAKE] / ms : 0;
+	r->gps_on = ms ? (float) power.ms[POWER_GPS] / ms : 0;
+	r->done = 1;
+}
+
+bool scenario_run_all(const struct scenario *s, struct scenario_result *r, int count, int jobs, scenario_progress on_done) {
+	size_t size = count * sizeof(struct scenario_result);
+
+	struct scenario_result *shared = (struct scenario_result *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		perror("mmap");
+		return false;
+	}
+
+	memset(shared, 0, size);
+	fflush(NULL);
+
+	int next = 0, running = 0, finished = 0;
+	while (next < count || running > 0) {
+		while (running < jobs && next < count) {
+			pid_t pid = fork();
+
+			if (pid == 0) {
+				scenario_run(&s[next], &shared[next]);
+				_exit(0);
+			}
+
+			if (pid < 0) {
+				perror("fork");
+				if (running == 0) {
+					munmap(shared, size);
+					return false;
+				}
+				break;
+			}
+
+			next++;
+			running++;
+		}
+
+		if (wait(NULL) > 0) {
+			running--;
+			finished++;
+
+			if (on_done)
+				on_done(finished, count);
+		}
+	}
+
+	memcpy(r, shared, size);
+	munmap(shared, size);
+
+	return true;
+}
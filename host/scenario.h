@@ -0,0 +1,71 @@
+/*
+ * scenario.h: one simulated pilot run, and a pool that runs many in parallel.
+ *
+ * The sketch keeps its state in globals with no way to reset them, so every
+ * scenario runs in its own forked process, starting from the firmware's
+ * power-on state. The pool starts a new scenario as soon as any running one
+ * exits, keeping all jobs busy however much run times vary.
+ */
+
+#ifndef scenario_h
+#define scenario_h
+
+#include <stdint.h>
+
+#include "power.h"
+#include "route.h"
+#include "sim/sim.h"
+
+// capacity of the firmware's route
+#define SCENARIO_MAX_WAYPOINTS ROUTE_MAX_WAYPOINTS
+
+struct scenario {
+	struct sim_config sim;
+
+	double tunings[3];
+	int16_t irons;
+	uint32_t tack_every;  // ms, 0 to leave tacking to the tactics
+	uint16_t tack_cost;   // s
+	uint16_t lookahead;   // m, 0 to steer straight for each waypoint
+	bool learning;        // learn the polar as it goes (learn.h)
+	bool trimming;        // trim by what goes fastest (trim.h)
+	bool power_saving;    // run things only as often as the power plan wants (power.h)
+
+	// waypoints as lat,lon pairs; the boat starts at sim.start_lat/lon
+	float waypoints[SCENARIO_MAX_WAYPOINTS * 2];
+	uint8_t waypoint_count;
+
+	// waypoints to reach before the run is done (0: one of each), and the virtual time limit
+	int legs;
+	double limit;
+};
+
+struct scenario_result {
+	uint8_t done;
+	uint8_t finished;     // reached all its legs within the limit
+	uint8_t legs;
+	float elapsed;        // seconds
+	float xte_rms;        // meters off the line between waypoints
+	float heading_rms;    // degrees between requested and actual heading
+	uint16_t maneuvers;   // tacks and gybes
+	float rudder_travel;  // degrees
+	float distance;       // meters over ground
+	float remaining;      // meters to the next waypoint, if not finished
+	float heel_max;       // degrees
+	float heel_over;      // fraction of the time heeled past TRIM_MAX_HEEL
+	float used[POWER_LOADS];      // mAh, by what it went on (power.h)
+	float awake;          // fraction of the time the mcu was
+	float gps_on;         // fraction of the time the gps was on
+};
+
+// the firmware's defaults (gains, tunables, waypoints) on the default simulation
+void scenario_defaults(struct scenario *s);
+
+// runs in the calling process. only safe once per process
+void scenario_run(const struct scenario *s, struct scenario_result *r);
+
+// runs count scenarios, jobs at a time. on_done (if set) is called in the parent as each finishes
+typedef void (*scenario_progress)(int finished, int count);
+bool scenario_run_all(const struct scenario *s, struct scenario_result *r, int count, int jobs, scenario_progress on_done);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * schedbench.cpp: the main loop's task scheduler (sched.h), in closed loop
+ * against the boat simulation, on virtual time.
+ *
+ * The firmware sails the test waypoints as usual, with every task run traced
+ * as it finishes: how late it started after its release. Lateness is shown
+ * as a distribution per task, in ms.
+ *
+ * The tasks cost next to nothing on the host, so each is made to take a
+ * random time, up to each of the loads below times its budget, or what it
+ * took if that's longer. Up to their budgets, the heading and the pilot have
+ * to run every time, with nothing missed, and the pilot may only be late by
+ * the heading, read first at the same release, and a pass of what's seen to
+ * between tasks. Past them, what's missed is only reported.
+ *
+ * usage: ardusailor_schedbench [-t seconds] [-r seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "sched.h"
+#include "sketch.h"
+#include "sim/sim.h"
+#include "tasks.h"
+
+// firmware.ino's task table, in TaskId's order
+static const char *names[] = { "ahrs", "pilot", "wind", "gps", "menu", "trim", "data", "battery", "report" };
+#define NAMES (sizeof(names) / sizeof(names[0]))
+static_assert(NAMES == TASK_COUNT, "a name for each TaskId");
+
+// late after the heading's budget: the servos, the log and the mpu's queue
+#define MAX_PILOT_LATE 2000
+
+// extra time per run, at most, as a fraction of the task's budget. the last
+// is more than they're allowed
+static const double loads[] = { 0, 0.5, 1, 1.5 };
+#define SAFE_LOADS 3
+
+// upper bounds of the lateness buckets, us
+static const uint32_t buckets[] = { 500, 1000, 2000, 5000, 10000, 20000 };
+#define BUCKETS (sizeof(buckets) / sizeof(buckets[0]) + 1)
+
+#define MAX_TASKS 12
+
+// firmware.ino
+extern Sched sched;
+
+static std::vector<uint32_t> late[MAX_TASKS];
+// the tasks themselves, from the first setup(): the firmware's table keeps
+// the wrappers after that
+static SchedFn originals[MAX_TASKS];
+static double load;
+static uint32_t rng_state;
+
+static double rnd() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state & 0xffffff) / (double) 0x1000000;
+}
+
+template <int i> static void loaded() {
+	uint64_t start = hal_now_us();
+	uint64_t took = (uint64_t) (load * sched.tasks[i].budget * rnd());
+
+	originals[i]();
+
+	if (hal_now_us() < start + took)
+		hal_advance_us(start + took - hal_now_us());
+}
+
+static const SchedFn wrappers[MAX_TASKS] = {
+	loaded<0>, loaded<1>, loaded<2>, loaded<3>, loaded<4>, loaded<5>,
+	loaded<6>, loaded<7>, loaded<8>, loaded<9>, loaded<10>, loaded<11>
+};
+
+static void onTask(uint8_t task, uint32_t release, uint32_t start, uint32_t end) {
+	late[task].push_back(start - release);
+}
+
+static double percentile(const std::vector<uint32_t> &v, double p) {
+	return v.empty() ? 0 : v[min(v.size() - 1, (size_t) (p * v.size()))] / 1000.0;
+}
+
+int main(int argc, char **argv) {
+	double seconds = 600;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:r:")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-t seconds] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (seconds <= 0)
+		return 1;
+
+	int failed = 0;
+	for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+		struct sim_config cfg;
+		sim_default_config(&cfg);
+		cfg.seed = seed;
+		sim_begin(&cfg);
+		rng_state = seed ? seed : 1;
+
+		setup();
+
+		if (sched.count > MAX_TASKS) {
+			fprintf(stderr, "%u tasks, only room for %u\n", sched.count, MAX_TASKS);
+			return 1;
+		}
+
+		load = loads[l];
+		for (uint8_t i = 0; i < sched.count; i++) {
+			if (!l)
+				originals[i] = sched.tasks[i].run;
+			sched.tasks[i].run = wrappers[i];
+			late[i].clear();
+		}
+		sched.trace = onTask;
+
+		uint64_t start = hal_now_us();
+		uint64_t until = start + (uint64_t) (seconds * 1e6);
+
+		while (hal_now_us() < until) {
+			sim_advance();
+			hal_loop_once();
+		}
+
+		printf("%sload %.1f x budget: lateness, ms, and %% of runs late by up to\n", l ? "\n" : "", load);
+		printf("task      period    runs   p50    p99    max  missed overran |");
+		for (size_t b = 0; b < BUCKETS - 1; b++)
+			printf(" %5.1f", buckets[b] / 1000.0);
+		printf("  more\n");
+
+		for (uint8_t i = 0; i < sched.count; i++) {
+			const SchedTask *t = &sched.tasks[i];
+			std::sort(late[i].begin(), late[i].end());
+
+			uint32_t counts[BUCKETS] = { 0 };
+			for (size_t n = 0; n < late[i].size(); n++) {
+				size_t b = 0;
+				while (b < BUCKETS - 1 && late[i][n] > buckets[b])
+					b++;
+				counts[b]++;
+			}
+
+			printf("%-8s %7.0f %7u %5.2f  %5.2f  %5.1f  %6u %7u |",
+				i < NAMES ? names[i] : "?", t->period / 1000.0, t->runs,
+				percentile(late[i], 0.5), percentile(late[i], 0.99), percentile(late[i], 1),
+				t->misses, t->overruns);
+			for (size_t b = 0; b < BUCKETS; b++)
+				printf(" %5.1f", late[i].empty() ? 0 : counts[b] * 100.0 / late[i].size());
+			printf("\n");
+		}
+
+		const SchedTask *ahrs = &sched.tasks[TASK_AHRS], *pilot = &sched.tasks[TASK_PILOT];
+		uint32_t expected = (hal_now_us() - start) / pilot->period;
+
+		printf("pilot ran %u times in %.0fs, %u expected\n", pilot->runs, seconds, expected);
+
+		if (l < SAFE_LOADS && (ahrs->misses || pilot->misses || pilot->runs + 1 < expected ||
+				percentile(late[TASK_PILOT], 1) * 1000 > ahrs->budget + MAX_PILOT_LATE)) {
+			fprintf(stderr, "load %.1f: pilot off its rate\n", load);
+			failed++;
+		}
+	}
+
+	return failed ? 1 : 0;
+}
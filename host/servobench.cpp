@@ -0,0 +1,213 @@
+/*
+ * servobench.cpp: the servo state machine (servo_ctl.h) under the firmware's
+ * main loop, on virtual time: moving the rudder mustn't hold the loop up.
+ *
+ * The first move after boot is timed on its own, before setup(): where the
+ * servo is isn't known, so it's sent straight to its target in one write,
+ * and kept powered for a whole travel from 0 and the settle time after.
+ *
+ * Then, booted, with the pilot on manual override so nothing else moves
+ * the rudder, it's held still, moved 5 degrees, and moved across its whole
+ * travel: each move's made from the pilot's task, as the pilot makes them. Each time, the longest loop() pass and the longest time between
+ * pilot runs have to be what they are held still, within SLACK. And
+ * rudderSettled() has to stay false until the move's travel time has gone
+ * by, and be true once it's been powered up, moved and settled.
+ *
+ * usage: ardusailor_servobench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "sched.h"
+#include "servo_ctl.h"
+#include "sketch.h"
+#include "sim/sim.h"
+#include "tasks.h"
+
+// servo_ctl.cpp
+#define RUDDER_PORT 10
+#define RUDDER_SPEED 300.0
+#define POWER_UP_TIME 10
+#define SETTLE_TIME 150
+
+// us the loop and the pilot may be later moving than held still
+#define SLACK 100
+
+// how long each move's watched, ms
+#define WATCH 1000
+
+// firmware.ino
+extern Sched sched;
+extern SchedTask tasks[];
+extern boolean manual_override;
+
+// the move for the pilot's next run to make, or -1, and when it made it
+static int move_to = -1;
+static uint64_t moved_at;
+static SchedFn pilot;
+
+static void pilotAndMove() {
+	pilot();
+
+	if (move_to >= 0) {
+		moved_at = hal_now_us();
+		rudderTo(move_to);
+		move_to = -1;
+	}
+}
+
+static int failed;
+
+static uint64_t pilot_last;
+static uint32_t pilot_gap;
+
+static void tracePilot(uint8_t task, uint32_t release, uint32_t start, uint32_t end) {
+	if (task != TASK_PILOT)
+		return;
+
+	if (pilot_last)
+		pilot_gap = max(pilot_gap, (uint32_t) (start - pilot_last));
+	pilot_last = start;
+}
+
+// the boot move's writes to the rudder, and when the first was
+#define BOOT_TO 100
+
+static uint32_t rudder_writes;
+static uint64_t rudder_written;
+
+static void countWrite(uint8_t pin, int angle) {
+	if (pin != RUDDER_PORT)
+		return;
+
+	if (!rudder_writes++)
+		rudder_written = hal_now_us();
+}
+
+struct watched {
+	uint32_t loop;          // longest loop() pass, us
+	uint32_t pilot;         // longest between pilot runs, us
+	uint32_t settled;       // ms from the move till rudderSettled()
+	uint32_t early;         // ms into the move rudderSettled() was first wrongly true, or 0
+};
+
+// to from wherever the rudder is, made by the pilot's next run, then WATCH
+// ms of the main loop. every pass is timed, the one the move's made in too
+static watched watch(int to, float travel) {
+	watched w = { 0, 0, 0, 0 };
+
+	pilot_last = 0;
+	pilot_gap = 0;
+	move_to = to;
+	moved_at = 0;
+
+	while (!moved_at || hal_now_us() - moved_at < WATCH * 1000ULL) {
+		uint64_t before = hal_now_us();
+
+		sim_advance();
+		hal_loop_once();
+
+		w.loop = max(w.loop, (uint32_t) (hal_now_us() - before));
+
+		if (!moved_at)
+			continue;
+
+		uint32_t ms = (hal_now_us() - moved_at) / 1000;
+		if (rudderSettled()) {
+			if (!w.settled)
+				w.settled = max(ms, 1U);
+			if (ms < travel && !w.early)
+				w.early = max(ms, 1U);
+		}
+	}
+	w.pilot = pilot_gap;
+
+	return w;
+}
+
+static void report(const char *name, bool ok, const char *detail) {
+	printf("%-10s %-6s %s\n", name, ok ? "ok" : "FAILED", detail);
+	if (!ok)
+		failed++;
+}
+
+static void checkBoot(const struct sim_config *cfg) {
+	char detail[128];
+
+	sim_begin(cfg);
+	hal_servo_watch(countWrite);
+	rudder_writes = 0;
+
+	uint64_t start = hal_now_us();
+	uint64_t settled = 0;
+
+	servoInit();
+	rudderTo(BOOT_TO);
+
+	while (hal_now_us() - start < 2000000 && !settled) {
+		hal_advance_us(1000);
+		servoTick();
+
+		if (rudderSettled())
+			settled = hal_now_us();
+	}
+
+	// a whole travel from 0, then settled
+	uint32_t hold = SETTLE_TIME + 1000 * BOOT_TO / RUDDER_SPEED;
+	uint32_t written = (rudder_written - start) / 1000;
+	uint32_t held = settled > rudder_written ? (settled - rudder_written) / 1000 : 0;
+
+	snprintf(detail, sizeof(detail), "%u write to %d after %ums, settled %ums later (%u wanted)",
+		rudder_writes, hal_servo_angle(RUDDER_PORT), written, held, hold);
+	report("boot", rudder_writes == 1 && hal_servo_angle(RUDDER_PORT) == BOOT_TO && settled && held >= hold, detail);
+
+	hal_servo_watch(NULL);
+}
+
+int main(int argc, char **argv) {
+	struct sim_config cfg;
+	char detail[160];
+
+	sim_default_config(&cfg);
+
+	// before setup() has moved the rudder
+	checkBoot(&cfg);
+
+	sim_begin(&cfg);
+	setup();
+	manual_override = true;
+	sched.trace = tracePilot;
+	pilot = tasks[TASK_PILOT].run;
+	tasks[TASK_PILOT].run = pilotAndMove;
+
+	int center = 90 + heel_offset;
+	watched still = watch(center, 0);
+
+	printf("held still: loop() at most %uus, the pilot every %uus at most\n", still.loop, still.pilot);
+
+	// 5 degrees off center, then from one end to the other
+	const char *names[2] = { "small", "full" };
+	int from[2] = { center, RUDDER_MIN };
+	int to[2] = { center + 5, RUDDER_MAX };
+
+	for (int i = 0; i < 2; i++) {
+		watch(from[i], 0);
+
+		float travel = 1000 * (to[i] - from[i]) / RUDDER_SPEED;
+		watched w = watch(to[i], travel);
+
+		// powered up (the rail and the servo), moved and settled, and a
+		// loop pass to see it
+		uint32_t due = 2 * POWER_UP_TIME + travel + SETTLE_TIME + still.loop / 1000 + 1;
+
+		snprintf(detail, sizeof(detail), "%d degrees: loop() at most %uus, pilot every %uus; settled after %ums (travel %.0fms, due by %ums)",
+			to[i] - from[i], w.loop, w.pilot, w.settled, travel, due);
+		report(names[i], w.loop <= still.loop + SLACK && w.pilot <= still.pilot + SLACK &&
+			!w.early && w.settled >= travel && w.settled <= due, detail);
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * sensors.cpp: the firmware's sensor entry points, backed by the simulation.
+ * Replaces the AHRS and wind vane drivers (and the old PILOT_DEBUG stubs).
+ *
+ * The MPU is simulated down to its FIFO: the DMP queues a packet every
+ * MPU_PERIOD and raises the data-ready interrupt, and mpuPoll() reads them
+ * over a modelled I2C into imu.h's queue, the way ahrs.cpp does on the boat.
+ */
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "imu.h"
+#include "profile.h"
+#include "sim.h"
+#include "sketch.h"
+
+// roughly what the wind vane driver spends reading it once it's powered up
+// (wind.ino: four analogRead()s, about 112us each on the mega), us; and
+// waiting for it to come up first, as readSteadyWind() does, ms
+#define WIND_SAMPLE_TIME 450
+#define WIND_SETTLE_TIME 50
+
+// the dmp's output rate, and its fifo: 1024 bytes of 42 byte packets
+#define MPU_PERIOD 20000
+#define MPU_FIFO 24
+
+// a 42 byte packet at 400kHz, and the status and count reads before them
+#define MPU_PACKET_READ_US 1100
+#define MPU_COUNT_READ_US 150
+
+// how far off a sample's time may be from when its packet was made: the
+// interrupt's own call to micros()
+#define MPU_STAMP_SLACK 10
+
+#define MPU_INTERRUPT 0
+
+float current_pitch = 0;
+float current_roll = 0;
+float mag_offset = 0;
+uint32_t heading_time = 0;
+
+// packets in the mpu's fifo, with the time they were made
+static ImuSample fifo[MPU_FIFO];
+static uint8_t fifo_first, fifo_count;
+static bool fifo_overflow;
+
+// packets read into the firmware's queue, to check the samples that come out
+static ImuSample sent[IMU_QUEUE_SIZE];
+static uint8_t sent_first, sent_count;
+
+static float last_heading = 0;
+static struct sim_imu imu;
+
+static void dmpPacket() {
+	sim_advance();
+
+	const struct sim_state *st = sim_get_state();
+	float yaw = (sim_compass() * PI / 180.0 + mag_offset) / 2;
+	float roll = st->roll * PI / 180.0 / 2;
+
+	ImuSample p;
+	p.time = hal_now_us();
+	p.quat[0] = lround(cos(yaw) * cos(roll) * 16384);
+	p.quat[1] = lround(cos(yaw) * sin(roll) * 16384);
+	p.quat[2] = lround(sin(yaw) * sin(roll) * 16384);
+	p.quat[3] = lround(sin(yaw) * cos(roll) * 16384);
+	p.mag[0] = lround(cos(2 * yaw) * 400);
+	p.mag[1] = lround(-sin(2 * yaw) * 400);
+	p.mag[2] = -300;
+	p.acc[0] = 0;
+	p.acc[1] = lround(sin(2 * roll) * 8192);
+	p.acc[2] = lround(cos(2 * roll) * 8192);
+
+	imu.packets++;
+
+	// like the mpu with its fifo full: the packet is lost, and overflow is
+	// flagged until the fifo is reset
+	if (fifo_count == MPU_FIFO) {
+		fifo_overflow = true;
+		imu.lost++;
+	} else
+		fifo[(fifo_first + fifo_count++) % MPU_FIFO] = p;
+
+	hal_raise_interrupt(MPU_INTERRUPT);
+}
+
+int mpuInit(Config *) {
+	fifo_first = fifo_count = 0;
+	fifo_overflow = false;
+	sent_first = sent_count = 0;
+	memset(&imu, 0, sizeof(imu));
+
+	imuInit();
+	attachInterrupt(MPU_INTERRUPT, imuDataReady, RISING);
+	hal_timer(MPU_PERIOD, dmpPacket);
+
+	// wait for the first packet, so there's a heading from the start
+	uint32_t start = millis();
+	while (!imuQueued() && millis() - start < 100) {
+		delay(1);
+		mpuPoll();
+	}
+
+	return 0;
+}
+
+void mpuPoll() {
+	if (!imuPending())
+		return;
+
+	delayMicroseconds(MPU_COUNT_READ_US);
+	imu.read_time += MPU_COUNT_READ_US;
+
+	if (fifo_overflow) {
+		imu.lost += fifo_count;
+		fifo_first = fifo_count = 0;
+		fifo_overflow = false;
+		imuFifoReset();
+		return;
+	}
+
+	for (uint8_t waiting = fifo_count; waiting && imuQueued() < IMU_QUEUE_SIZE; waiting--) {
+		ImuSample p = fifo[fifo_first];
+		fifo_first = (fifo_first + 1) % MPU_FIFO;
+		fifo_count--;
+
+		ImuSample s = p;
+		s.time = imuPacketTime(waiting);
+
+		// more packets can come in while this one's read
+		delayMicroseconds(MPU_PACKET_READ_US);
+		imu.read_time += MPU_PACKET_READ_US;
+
+		imuPush(&s);
+		sent[(sent_first + sent_count++) % IMU_QUEUE_SIZE] = p;
+	}
+}
+
+void calibrateMag(bool) {}
+
+void windInit() {}
+
+// the sample against the packet it should have come from
+static void check(const ImuSample *s) {
+	const ImuSample *p = &sent[sent_first];
+	sent_first = (sent_first + 1) % IMU_QUEUE_SIZE;
+	sent_count--;
+
+	imu.taken++;
+	if (s->time - p->time > MPU_STAMP_SLACK || memcmp(s->quat, p->quat, sizeof(*s) - sizeof(s->time)))
+		imu.mistimed++;
+
+	uint32_t age = micros() - p->time;
+	if (age > imu.max_age)
+		imu.max_age = age;
+}
+
+// radians, like the ahrs
+float readSteadyHeading() {
+	PROFILE_SCOPE(PROF_HEADING);
+
+	ImuSample s, newest;
+	bool fresh = false;
+
+	// a full queue may have left packets in the fifo, so poll until it's dry
+	for (mpuPoll(); imuQueued(); mpuPoll())
+		while (imuPop(&s)) {
+			check(&s);
+			newest = s;
+			fresh = true;
+		}
+
+	if (!fresh)
+		return last_heading;
+
+	float w = newest.quat[0] / 16384.0, x = newest.quat[1] / 16384.0;
+	float y = newest.quat[2] / 16384.0, z = newest.quat[3] / 16384.0;
+
+	current_roll = atan2(2 * (w * x + y * z), 1 - 2 * (x * x + y * y)) * 180.0 / PI;
+	current_pitch = 0;
+	heading_time = newest.time;
+
+	float heading = atan2(2 * (w * z + x * y), 1 - 2 * (y * y + z * z));
+	last_heading = heading < 0 ? heading + 2 * PI : heading;
+
+	return last_heading;
+}
+
+void windPowerUp() {}
+
+// radians, relative to the bow
+float windSample() {
+	PROFILE_SCOPE(PROF_WIND);
+
+	delayMicroseconds(WIND_SAMPLE_TIME);
+	sim_advance();
+
+	return sim_wind_angle() * PI / 180.0;
+}
+
+float readSteadyWind() {
+	delay(WIND_SETTLE_TIME);
+
+	return windSample();
+}
+
+const struct sim_imu *sim_get_imu() {
+	return &imu;
+}
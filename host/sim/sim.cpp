@@ -0,0 +1,356 @@
+#include "Arduino.h"
+#include "config.h"
+#include "hal_host.h"
+#include "servo_ctl.h"
+#include "sim.h"
+
+// physics step, seconds
+#define SIM_DT 0.02
+
+// gps power pin, active low (GPS_EN in gps.ino)
+#define SIM_GPS_EN 30
+
+// the battery divider's pin and resistors, and the adc's reference
+// (battery.ino)
+#define SIM_BATT_VAL 10
+#define SIM_BATT_R1 324000.0
+#define SIM_BATT_R2 100000.0
+#define SIM_BATT_REF 3.3
+
+#define EARTH_R 6371000.0
+#define KTS 0.514444
+
+// CONFIG_PARAM_ADDRESS in firmware.ino
+#define SIM_CONFIG_PARAMS 0
+
+// sim starts the clock at noon
+#define SIM_START_OF_DAY (12 * 3600)
+
+#define D2R(v) ((v) * PI / 180.0)
+#define R2D(v) ((v) * 180.0 / PI)
+
+extern bool motor_running;
+
+static struct sim_config cfg;
+static struct sim_state st;
+
+static uint32_t rng;
+static double gust = 0;
+static double shift = 0;
+static uint64_t next_fix = 0;
+static bool gps_powered = false;
+static uint64_t gps_since = 0;
+
+//
+// helpers
+//
+static float wrap360(float v) {
+	v = fmod(v, 360.0f);
+	return v < 0 ? v + 360.0f : v;
+}
+
+// xorshift32, so runs don't depend on the firmware's own use of random()
+static uint32_t next_random() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static double uniform() {
+	return (next_random() >> 8) / (double) (1 << 24);
+}
+
+static double gaussian() {
+	double u1 = uniform();
+	double u2 = uniform();
+	if (u1 < 1e-12)
+		u1 = 1e-12;
+
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * PI * u2);
+}
+
+#ifndef NO_SAIL
+static float polar(float twa) {
+	twa = constrain(twa, 0, 180);
+
+	int i = (int) (twa / 15);
+	if (i >= 12)
+		return cfg.boat.polar[12];
+
+	float f = (twa - i * 15) / 15;
+	return cfg.boat.polar[i] * (1 - f) + cfg.boat.polar[i + 1] * f;
+}
+#endif
+
+//
+// nmea
+//
+static void emit(const char *body) {
+	uint8_t checksum = 0;
+	for (const char *p = body; *p; p++)
+		checksum ^= *p;
+
+	char sentence[96];
+	int n = snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, checksum);
+
+	Serial2.inject(sentence, n);
+}
+
+static void emitFix() {
+	double lat = st.lat + R2D(cfg.noise.gps_position * gaussian() / EARTH_R);
+	double lon = st.lon + R2D(cfg.noise.gps_position * gaussian() / (EARTH_R * cos(D2R(st.lat))));
+	// not inside max(), which would draw the noise twice
+	float sog = st.sog + cfg.noise.gps_speed * gaussian();
+	sog = max(0.0, sog);
+
+	// course gets noisy as we slow down
+	float course_sd = cfg.noise.gps_course * (st.sog > 0.5 ? 1 : 1 + (0.5 - st.sog) * 40);
+	float cog = wrap360(st.cog + course_sd * gaussian());
+
+	uint32_t tod = SIM_START_OF_DAY + st.time / 1000000;
+	uint16_t ms = (st.time / 1000) % 1000;
+	char time[16];
+	snprintf(time, sizeof(time), "%02u%02u%02u.%03u",
+		(unsigned) (tod / 3600 % 24), (unsigned) (tod / 60 % 60), (unsigned) (tod % 60), ms);
+
+	double alat = fabs(lat), alon = fabs(lon);
+	int lat_d = (int) alat, lon_d = (int) alon;
+
+	char body[96];
+	snprintf(body, sizeof(body), "GPRMC,%s,A,%02d%07.4f,%c,%03d%07.4f,%c,%.1f,%.1f,010116,,,A",
+		time,
+		lat_d, (alat - lat_d) * 60, lat < 0 ? 'S' : 'N',
+		lon_d, (alon - lon_d) * 60, lon < 0 ? 'W' : 'E',
+		sog, cog);
+	emit(body);
+
+	snprintf(body, sizeof(body), "GPGGA,%s,%02d%07.4f,%c,%03d%07.4f,%c,1,08,1.0,180.0,M,-34.0,M,,",
+		time,
+		lat_d, (alat - lat_d) * 60, lat < 0 ? 'S' : 'N',
+		lon_d, (alon - lon_d) * 60, lon < 0 ? 'W' : 'E');
+	emit(body);
+}
+
+//
+// physics
+//
+static void step(float dt) {
+	// true wind at the boat
+	gust += -gust * dt / cfg.wind.gust_time + sqrt(2 * dt / cfg.wind.gust_time) * gaussian();
+	shift += cfg.wind.shift_walk * sqrt(dt) * gaussian();
+
+	float t = st.time / 1e6;
+	st.wind_speed = max(0.0, cfg.wind.speed * (1 + cfg.wind.gust_factor * gust));
+	st.wind_direction = wrap360(cfg.wind.direction + shift +
+		(cfg.wind.shift_period > 0 ? cfg.wind.shift_amplitude * sin(2 * PI * t / cfg.wind.shift_period) : 0));
+
+	// controls. a servo that's never been written reads 0
+	float rudder = current_rudder ? current_rudder - 90 : 0;
+	st.rudder_travel += fabs(rudder - st.rudder);
+	st.rudder = rudder;
+	st.sheet = current_winch ? constrain((float) (current_winch - WINCH_MAX) / (WINCH_MIN - WINCH_MAX), 0, 1) : 0;
+
+	// apparent wind: air velocity relative to the boat (east, north)
+	float ax = -st.wind_speed * sin(D2R(st.wind_direction)) - st.speed * sin(D2R(st.heading));
+	float ay = -st.wind_speed * cos(D2R(st.wind_direction)) - st.speed * cos(D2R(st.heading));
+	st.aws = sqrt(ax * ax + ay * ay);
+	st.awa = wrap360(R2D(atan2(-ax, -ay)) - st.heading);
+
+	float twa = wrap360(st.wind_direction - st.heading);
+	if (twa > 180)
+		twa = 360 - twa;
+
+	// speed through the water
+	float target;
+#ifdef NO_SAIL
+	target = motor_running ? cfg.boat.motor_speed : 0;
+	float trim = 0;
+#else
+	// sail works best eased in proportion to how far off the wind we are
+	float ideal = constrain((twa - 40) / 140, 0, 1);
+	float trim = max(0.0, 1 - 1.5 * fabs(st.sheet - ideal));
+	target = min(cfg.boat.hull_speed, polar(twa) * st.wind_speed * trim * cos(D2R(st.heel)));
+#endif
+	st.speed += (target - st.speed) * dt / cfg.boat.speed_time;
+
+	// heel away from the wind, more when sheeted in
+	float heel = -cfg.boat.heel_gain * st.aws * st.aws * sin(D2R(st.awa)) * (1 - 0.7 * st.sheet) * trim;
+	heel = constrain(heel, -70, 70);
+	st.heel += (heel - st.heel) * dt / cfg.boat.heel_time;
+
+	// yaw rate follows the rudder, scaled by speed through the water
+	float rate = R2D(st.speed * KTS * sin(D2R(st.rudder)) / cfg.boat.length);
+
+#ifndef NO_SAIL
+	// in irons the bow gets blown off to whichever side the wind is on
+	if (twa < cfg.boat.irons_angle)
+		rate += (st.awa < 180 ? -1 : 1) * cfg.boat.irons_falloff * st.wind_speed * (1 - twa / cfg.boat.irons_angle);
+#endif
+	st.turn_rate += (rate - st.turn_rate) * dt / cfg.boat.yaw_time;
+	st.heading = wrap360(st.heading + st.turn_rate * dt);
+
+	if (cfg.sea.period > 0) {
+		float a = 2 * PI * t / cfg.sea.period;
+		float wave = 0.7 * sin(a) + 0.3 * sin(a / 1.37 + 1);
+
+		st.heading = wrap360(st.heading + cfg.sea.yaw * (0.7 * cos(a) + 0.3 * cos(a / 1.61 + 2)) * dt);
+		st.roll = st.heel + cfg.sea.roll * wave;
+	} else
+		st.roll = st.heel;
+
+	// over ground: leeway towards the low side, plus current
+	float through = D2R(st.heading + cfg.boat.leeway * st.heel / 45);
+	float vx = st.speed * sin(through) + cfg.current_speed * sin(D2R(cfg.current_direction));
+	float vy = st.speed * cos(through) + cfg.current_speed * cos(D2R(cfg.current_direction));
+
+	st.sog = sqrt(vx * vx + vy * vy);
+	st.cog = wrap360(R2D(atan2(vx, vy)));
+
+	st.lat += R2D(vy * KTS * dt / EARTH_R);
+	st.lon += R2D(vx * KTS * dt / (EARTH_R * cos(D2R(st.lat))));
+	st.distance += st.sog * KTS * dt;
+
+	st.time += (uint64_t) (dt * 1e6);
+}
+
+//
+// exported
+//
+void sim_default_config(struct sim_config *c) {
+	memset(c, 0, sizeof(*c));
+
+	// just south of the test waypoints
+	c->start_lat = 41.9200;
+	c->start_lon = -87.6305;
+	c->start_heading = 0;
+
+	c->wind.direction = 270;
+	c->wind.speed = 8;
+	c->wind.gust_factor = 0.2;
+	c->wind.gust_time = 20;
+	c->wind.shift_amplitude = 10;
+	c->wind.shift_period = 300;
+	c->wind.shift_walk = 0.5;
+
+	c->noise.compass = 3;
+	c->noise.wind = 5;
+	c->noise.gps_position = 2;
+	c->noise.gps_speed = 0.1;
+	c->noise.gps_course = 3;
+	c->noise.gps_period = 1000;
+	c->noise.gps_warmup = 1000;
+
+	c->boat.length = 1.0;
+	c->boat.yaw_time = 0.5;
+	c->boat.speed_time = 3;
+	c->boat.hull_speed = 3;
+	c->boat.motor_speed = 1.5;
+	c->boat.heel_gain = 0.4;
+	c->boat.heel_time = 1;
+	c->boat.leeway = 8;
+	c->boat.irons_falloff = 0.5;
+	c->boat.irons_angle = 35;
+
+	static const float default_polar[13] = {
+		0, 0, 0.05, 0.35, 0.5, 0.58, 0.6, 0.58, 0.55, 0.5, 0.45, 0.4, 0.38
+	};
+	memcpy(c->boat.polar, default_polar, sizeof(default_polar));
+
+	c->battery = 12.4;
+
+	c->seed = 1;
+}
+
+void sim_begin(const struct sim_config *c) {
+	hal_reset();
+
+	cfg = *c;
+	rng = cfg.seed ? cfg.seed : 1;
+	gust = 0;
+	shift = 0;
+
+	memset(&st, 0, sizeof(st));
+	st.lat = cfg.start_lat;
+	st.lon = cfg.start_lon;
+	st.heading = cfg.start_heading;
+	st.cog = cfg.start_heading;
+	st.wind_direction = cfg.wind.direction;
+	st.wind_speed = cfg.wind.speed;
+
+	next_fix = (uint64_t) cfg.noise.gps_period * 1000;
+	gps_powered = false;
+	gps_since = 0;
+
+	hal_set_analog(SIM_BATT_VAL, lround(cfg.battery * SIM_BATT_R2 / (SIM_BATT_R1 + SIM_BATT_R2) / SIM_BATT_REF * 1023));
+}
+
+void sim_advance() {
+	uint64_t now = hal_now_us();
+
+	// the gps only has a fix gps_warmup after it's powered up
+	bool on = hal_pin(SIM_GPS_EN) == LOW;
+	if (on && !gps_powered)
+		gps_since = st.time;
+	gps_powered = on;
+
+	while (st.time + SIM_DT * 1e6 <= now) {
+		step(SIM_DT);
+
+		if (cfg.noise.gps_period && st.time >= next_fix) {
+			if (gps_powered && st.time - gps_since >= (uint64_t) cfg.noise.gps_warmup * 1000)
+				emitFix();
+
+			next_fix += (uint64_t) cfg.noise.gps_period * 1000;
+		}
+	}
+}
+
+const struct sim_state *sim_get_state() {
+	return &st;
+}
+
+const struct sim_config *sim_get_config() {
+	return &cfg;
+}
+
+void sim_run(double seconds, sim_observer on_second, void *ctx) {
+	uint64_t until = hal_now_us() + (uint64_t) (seconds * 1e6);
+	uint64_t next_report = 0;
+
+	setup();
+
+	while (hal_now_us() < until) {
+		sim_advance();
+		hal_loop_once();
+
+		if (on_second && st.time >= next_report) {
+			if (!on_second(&st, ctx))
+				return;
+
+			next_report += 1000000;
+		}
+	}
+}
+
+void sim_store_pid_tunings(const double tunings[3]) {
+	// saved over whatever settings the image has, as updateCurrentPIDTunings() does
+	Config c;
+	configInit(&c, SIM_CONFIG_PARAMS);
+	configLoad(&c);
+
+	for (int i = 0; i < 3; i++)
+		c.pid[i] = tunings[i];
+	configSave(&c, CONFIG_PID);
+}
+
+float sim_compass() {
+	const float *d = cfg.noise.deviation;
+	float dev = d[0] + d[1] * sin(D2R(st.heading)) + d[2] * cos(D2R(st.heading));
+
+	return wrap360(st.heading + dev + cfg.noise.compass * gaussian());
+}
+
+float sim_wind_angle() {
+	return wrap360(st.awa + cfg.noise.wind * gaussian());
+}
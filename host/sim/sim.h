@@ -0,0 +1,148 @@
+/*
+ * sim.h: boat and wind simulation for closed-loop runs of the pilot.
+ *
+ * The simulation sits behind the firmware's sensor functions
+ * (readSteadyHeading, readSteadyWind) and the GPS serial port, and reads the
+ * servo/motor outputs back from servo_ctl. Physics are stepped on the HAL's
+ * virtual clock, so a run is as fast as the control code allows.
+ *
+ * Angles are degrees, true, clockwise from north. Wind directions are where
+ * the wind comes *from*. Speeds are knots.
+ */
+
+#ifndef sim_h
+#define sim_h
+
+#include <stdint.h>
+
+struct sim_wind {
+	float direction;
+	float speed;
+
+	// gusts: speed multiplier noise (fraction of speed), with a correlation time in seconds
+	float gust_factor;
+	float gust_time;
+
+	// shifts: periodic oscillation plus a random walk (degrees per sqrt(second))
+	float shift_amplitude;
+	float shift_period;
+	float shift_walk;
+};
+
+struct sim_noise {
+	float compass;        // sd, degrees
+	float wind;           // sd, degrees
+	float gps_position;   // sd, meters
+	float gps_speed;      // sd, knots
+	float gps_course;     // sd, degrees (at speed; grows as speed drops)
+	uint16_t gps_period;  // ms between fixes
+	uint16_t gps_warmup;  // ms from powering the gps up to its first fix
+
+	// compass deviation: a + b * sin(heading) + c * cos(heading)
+	float deviation[3];
+};
+
+struct sim_boat {
+	float length;         // effective steering length, meters
+	float yaw_time;       // seconds for yaw rate to follow the rudder
+	float speed_time;     // seconds for speed to follow the polar
+	float hull_speed;     // knots
+	float motor_speed;    // knots, NO_SAIL builds
+	float heel_gain;      // degrees of heel per knot^2 of beam wind at full sheet
+	float heel_time;      // seconds
+	float leeway;         // degrees of leeway at full heel
+	float irons_falloff;  // degrees/s per knot of wind that the bow is pushed off when head to wind
+	float irons_angle;    // TWA below which the sail stops driving
+
+	// polar: fraction of true wind speed made good, every 15 degrees of TWA from 0 to 180
+	float polar[13];
+};
+
+// waves: they roll the boat either way of its heel and push the bow about,
+// over two periods out of step, so it's never quite regular
+struct sim_sea {
+	float roll;           // degrees
+	float yaw;            // degrees per second
+	float period;         // seconds
+};
+
+struct sim_config {
+	double start_lat;
+	double start_lon;
+	float start_heading;
+
+	struct sim_wind wind;
+	struct sim_noise noise;
+	struct sim_boat boat;
+	struct sim_sea sea;
+
+	// water current, direction it flows *towards*
+	float current_direction;
+	float current_speed;
+
+	// volts at the battery, as the firmware's divider sees it
+	float battery;
+
+	uint32_t seed;
+};
+
+struct sim_state {
+	double lat;
+	double lon;
+	float heading;
+	float turn_rate;      // degrees per second
+	float speed;          // through the water
+	float heel;           // degrees, positive to starboard
+	float roll;           // the heel and the waves' rolling, what the imu sees
+	float sog;
+	float cog;
+
+	float wind_direction; // true, at the boat
+	float wind_speed;
+	float awa;            // apparent, relative to the bow, clockwise
+	float aws;
+
+	float rudder;         // degrees from center, as commanded by the servo
+	float sheet;          // 0 sheeted in, 1 all the way out
+
+	uint64_t time;        // us
+	float distance;       // meters sailed over ground
+	float rudder_travel;  // total degrees the rudder servo has moved
+};
+
+void sim_default_config(struct sim_config *cfg);
+
+// resets the HAL and the simulation. call before setup()
+void sim_begin(const struct sim_config *cfg);
+
+// steps the physics up to the current virtual time and feeds the gps
+void sim_advance();
+
+const struct sim_state *sim_get_state();
+const struct sim_config *sim_get_config();
+
+// runs setup() and then loop() for the given virtual time. on_second (if
+// set) is called once per simulated second, and can stop the run by returning false
+typedef bool (*sim_observer)(const struct sim_state *state, void *ctx);
+void sim_run(double seconds, sim_observer on_second, void *ctx);
+
+// saves steering gains in config.h's store, where setup() reads them. call between sim_begin() and setup()
+void sim_store_pid_tunings(const double tunings[3]);
+
+// sensor readings with noise applied, in the units the firmware expects
+float sim_compass();
+float sim_wind_angle();
+
+// the simulated mpu's packets, and what became of them (sensors.cpp)
+struct sim_imu {
+	uint32_t packets;     // made by the dmp
+	uint32_t lost;        // to the mpu's fifo filling up
+	uint32_t taken;       // samples readSteadyHeading() took off the queue
+	uint32_t mistimed;    // ...that weren't the next packet, or had the wrong time
+	uint32_t max_age;     // us, longest from a packet being made to it being taken
+	uint32_t read_time;   // us spent on i2c reads
+};
+
+const struct sim_imu *sim_get_imu();
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * sketch.cpp: host build of the firmware sketch.
+ *
+ * Mirrors what the Arduino IDE does with the .ino tabs: the main tab first,
+ * then the rest in alphabetical order, in a single translation unit.
+ */
+
+#include "Arduino.h"
+#include "sketch.h"
+
+#include "firmware.ino"
+#include "battery.ino"
+#include "gps.ino"
+#include "menu.ino"
+#include "pilot.ino"
+#include "util.ino"
+#include "wind.ino"
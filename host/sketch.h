@@ -0,0 +1,123 @@
+/*
+ * sketch.h: prototypes for the functions defined in the .ino tabs.
+ *
+ * The Arduino IDE generates these when it merges the tabs into one translation
+ * unit; the host build does the same merge in sketch.cpp, so they're listed
+ * here by hand. Keep in sync when adding functions to a tab.
+ */
+
+#ifndef sketch_h
+#define sketch_h
+
+#include "Arduino.h"
+#include "bam.h"
+#include "config.h"
+
+// firmware.ino
+float readSteadyHeading();
+int mpuInit(Config *settings);
+void mpuPoll();
+void calibrateMag(bool waitForSetup);
+void windInit();
+void windPowerUp();
+float windSample();
+float readSteadyWind();
+void initTrail();
+void updateHeading();
+void updateWind(float wind_dir);
+void logPosition();
+void updateSensors(boolean skip_gps);
+void requestSensors();
+void getMagOffset();
+void printDataLine();
+void sendTelemetry();
+uint16_t dataFreq();
+void ahrsTask();
+void pilotTask();
+void windTask();
+uint32_t gpsDue();
+void gpsTask();
+void menuTask();
+void trimTask();
+void dataTask();
+void batteryTask();
+void reportTask();
+uint16_t powerLoads(boolean awake);
+
+// battery.ino
+void batteryInit();
+void batteryPowerUp();
+float batterySample();
+
+// gps.ino
+unsigned char from_hex(char a);
+int32_t parse_fixed(const char *token, uint8_t decimals);
+void parse_sentence_type(const char *token);
+void parse_time(const char *token);
+void parse_status(const char *token);
+void parse_lat(const char *token);
+void parse_lat_hemi(const char *token);
+void parse_lon(const char *token);
+void parse_lon_hemi(const char *token);
+void parse_speed(const char *token);
+void parse_course(const char *token);
+void parse_altitude(const char *token);
+void parse_hdop(const char *token);
+void parse_satellites(const char *token);
+void gpsInit();
+bool gps_decode(char c);
+void warnGPS();
+boolean gpsPowered();
+void serialEvent2();
+
+// menu.ino
+boolean rcInput(uint8_t c);
+void uploadInit(int16_t routeAddress);
+void uploadReply(uint8_t r);
+boolean uploadInput(uint8_t c);
+void uploadTick();
+void processRCCommands();
+void checkInput();
+void processManualCommands();
+void getPIDTunings();
+void getTelemetryFields();
+void showRoute();
+void exportPolar();
+void showPower();
+void doMenu();
+
+// pilot.ino
+inline void toPort(int amt);
+inline void toSbord(int amt);
+inline void fuseHeading();
+void loadRoute();
+void updateWaypointLeg();
+Bam legCourse();
+boolean passedWaypoint();
+uint8_t windSheet(Bam apparent);
+void adjustSails();
+float trueWindAngle();
+void updatePolar();
+void checkpointPolar();
+void autotune();
+void beatOnTimer();
+void adjustHeading();
+void pilotInit(int16_t routeAddress, int16_t learnAddress);
+void getCurrentPIDTunings(double* tuningsOut);
+void updateCurrentPIDTunings(double* tunings);
+void waypointSelected();
+void setNextWaypoint();
+void newRoute();
+uint8_t arrivalRadius(uint8_t wp);
+void updateSituation();
+void doPilot();
+void trimSails();
+
+// util.ino
+float toCircle(float value);
+float toCircleDeg(float value);
+void blink(uint8_t pin, uint8_t duration, uint8_t count, uint8_t finalState);
+bool waitForData(int timeout);
+void sleepMillis(int amount);
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * tackbench.cpp: the tactics (tactics.h) against tacking on a timer, in
+ * closed loop against the boat simulation.
+ *
+ * Each run sails back and forth between two marks 300m apart, one dead
+ * upwind of the other give or take 20 degrees, so every other leg's a beat
+ * and the rest are runs: 6 to 12 knots of wind, gusting and shifting by up
+ * to 15 degrees either way, up to a quarter knot of current, the usual
+ * sensor noise. Every run is sailed twice, the same seed each time: tacking
+ * every 30s close hauled at irons, as before, and with the tactics.
+ *
+ * Reported per leg, over the runs both sailings finished: the median
+ * seconds and tacks and gybes. Medians, as in trackbench. The tactics have
+ * to beat the timer on both.
+ *
+ * usage: ardusailor_tackbench [-n runs] [-l legs] [-j jobs] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "scenario.h"
+
+#define EARTH_R 6371000.0
+#define D2R(v) ((v) * M_PI / 180.0)
+
+// m from the bottom mark to the top one
+#define COURSE_LENGTH 300
+
+// the old timer
+#define TIMER_TACK_EVERY 30000
+
+#define TUNED_KP 0.85
+#define TUNED_KI 0.012
+#define TUNED_KD 0.011
+
+static uint32_t rng_state;
+
+static double uniform() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state >> 8) / (double) (1 << 24);
+}
+
+static void buildScenario(struct scenario *s, uint32_t seed, int legs) {
+	scenario_defaults(s);
+
+	struct sim_config *cfg = &s->sim;
+	cfg->seed = seed;
+	cfg->wind.direction = 360 * uniform();
+	cfg->wind.speed = 6 + 6 * uniform();
+	cfg->wind.gust_factor = 0.3 * uniform();
+	cfg->wind.shift_amplitude = 15 * uniform();
+	cfg->current_speed = 0.25 * uniform();
+	cfg->current_direction = 360 * uniform();
+
+	// the top mark up the wind from the start, the bottom one at it
+	double up = D2R(cfg->wind.direction + 40 * uniform() - 20);
+
+	s->waypoints[0] = cfg->start_lat + COURSE_LENGTH * cos(up) / EARTH_R * 180 / M_PI;
+	s->waypoints[1] = cfg->start_lon + COURSE_LENGTH * sin(up) / (EARTH_R * cos(D2R(cfg->start_lat))) * 180 / M_PI;
+	s->waypoints[2] = cfg->start_lat;
+	s->waypoints[3] = cfg->start_lon;
+	s->waypoint_count = 2;
+
+	// what ardusailor_tune finds for the simulated boat. the firmware's
+	// defaults barely steer it
+	s->tunings[0] = TUNED_KP;
+	s->tunings[1] = TUNED_KI;
+	s->tunings[2] = TUNED_KD;
+	s->legs = legs;
+	s->limit = legs * 600;
+	s->tack_every = 0;
+}
+
+// per leg, for each run both sailings finished
+struct totals {
+	int finished;
+	int paired;
+	float *seconds;
+	float *turns;
+};
+
+static int cmpFloat(const void *a, const void *b) {
+	float x = *(const float *) a, y = *(const float *) b;
+
+	return (x > y) - (x < y);
+}
+
+static float median(float *v, int n) {
+	if (!n)
+		return 0;
+
+	qsort(v, n, sizeof(float), cmpFloat);
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static void add(struct totals *t, const struct scenario_result *r) {
+	t->seconds[t->paired] = r->elapsed / r->legs;
+	t->turns[t->paired] = (float) r->maneuvers / r->legs;
+	t->paired++;
+}
+
+static void report(const char *name, struct totals *t, int runs) {
+	printf("%-10s %4d/%-4d %8.1f %9.2f\n", name, t->finished, runs,
+		median(t->seconds, t->paired), median(t->turns, t->paired));
+}
+
+int main(int argc, char **argv) {
+	int runs = 64;
+	int legs = 8;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:l:j:r:")) != -1) {
+		switch (opt) {
+			case 'n': runs = atoi(optarg); break;
+			case 'l': legs = atoi(optarg); break;
+			case 'j': jobs = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-l legs] [-j jobs] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (runs < 1 || legs < 1 || jobs < 1)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	// the timer first, then the same again with the tactics
+	struct scenario *s = (struct scenario *) calloc(runs * 2, sizeof(struct scenario));
+	struct scenario_result *r = (struct scenario_result *) calloc(runs * 2, sizeof(struct scenario_result));
+
+	for (int i = 0; i < runs; i++) {
+		buildScenario(&s[i], seed * 1000 + i, legs);
+		s[runs + i] = s[i];
+		s[i].tack_every = TIMER_TACK_EVERY;
+	}
+
+	if (!scenario_run_all(s, r, runs * 2, jobs, NULL))
+		return 1;
+
+	struct totals timer, tactics;
+	memset(&timer, 0, sizeof(timer));
+	memset(&tactics, 0, sizeof(tactics));
+	timer.seconds = (float *) calloc(runs, sizeof(float));
+	timer.turns = (float *) calloc(runs, sizeof(float));
+	tactics.seconds = (float *) calloc(runs, sizeof(float));
+	tactics.turns = (float *) calloc(runs, sizeof(float));
+
+	// runs the tactics sailed faster
+	int faster = 0;
+
+	for (int i = 0; i < runs; i++) {
+		const struct scenario_result *a = &r[i], *b = &r[runs + i];
+
+		timer.finished += a->finished;
+		tactics.finished += b->finished;
+
+		if (a->finished && b->finished) {
+			add(&timer, a);
+			add(&tactics, b);
+			faster += b->elapsed < a->elapsed;
+		}
+	}
+
+	printf("tacking    finished     s/leg  turns/leg\n");
+	report("timer", &timer, runs);
+	report("tactics", &tactics, runs);
+	printf("the tactics were faster in %d of %d runs\n", faster, tactics.paired);
+
+	int failed = 0;
+
+	if (!tactics.paired || median(tactics.seconds, tactics.paired) >= median(timer.seconds, timer.paired)) {
+		fprintf(stderr, "the tactics weren't faster\n");
+		failed++;
+	}
+
+	if (!tactics.paired || median(tactics.turns, tactics.paired) >= median(timer.turns, timer.paired)) {
+		fprintf(stderr, "the tactics turned more often\n");
+		failed++;
+	}
+
+	free(timer.seconds);
+	free(timer.turns);
+	free(tactics.seconds);
+	free(tactics.turns);
+	free(s);
+	free(r);
+
+	return failed ? 1 : 0;
+}
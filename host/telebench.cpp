@@ -0,0 +1,171 @@
+/*
+ * telebench.cpp: the data line as text against binary telemetry frames
+ * (telemetry.h), over the same simulated run, on virtual time.
+ *
+ * The default run's sailed twice, the same seed each time: with the text
+ * data line, every DATA_FREQ, then with binary frames, every TELEMETRY_FREQ.
+ * What the firmware sends over serial is captured: the text lines are
+ * counted, and the frames are run through the ground station's decoder.
+ * Reported for each: the updates sent, the bytes they took, bytes per
+ * update, updates a second and bytes a second, and the host's time per
+ * send. Every frame has to decode, with no bad crc and nothing dropped,
+ * and each has to be smaller than a text line.
+ *
+ * usage: ardusailor_telebench [-t seconds] [-r seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "hal_host.h"
+#include "sched.h"
+#include "sketch.h"
+#include "sim/sim.h"
+#include "tasks.h"
+#include "telemetry/decoder.h"
+
+// firmware.ino
+extern SchedTask tasks[];
+extern boolean binary_telemetry;
+
+// the data line's fields, and the commas between them
+#define DATA_COMMAS 17
+
+static SchedFn data;
+static uint32_t sends;
+static double send_ns;
+
+static double wallNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void timedData() {
+	double start = wallNs();
+	data();
+	send_ns += wallNs() - start;
+	sends++;
+}
+
+struct sent {
+	uint32_t updates;
+	uint32_t bytes;       // in the updates, not whatever else went out
+	double ns;            // host time per send
+	struct tm_stats stats;
+};
+
+// the default run, with what went out over serial captured
+static sent run(bool binary, double seconds, uint32_t seed) {
+	sent s;
+	memset(&s, 0, sizeof(s));
+
+	char *out = NULL;
+	size_t len = 0;
+	FILE *sink = open_memstream(&out, &len);
+
+	struct sim_config cfg;
+	sim_default_config(&cfg);
+	cfg.seed = seed;
+	sim_begin(&cfg);
+	Serial.setSink(sink);
+
+	binary_telemetry = binary;
+	sends = 0;
+	send_ns = 0;
+
+	sim_run(seconds, NULL, NULL);
+
+	Serial.setSink(NULL);
+	fclose(sink);
+
+	s.ns = sends ? send_ns / sends : 0;
+
+	if (binary) {
+		struct tm_decoder d;
+		struct tm_frame frame;
+
+		tm_decoder_init(&d);
+		for (size_t i = 0; i < len; i++)
+			tm_decoder_feed(&d, out[i], &frame);
+
+		s.stats = d.stats;
+		s.updates = d.stats.frames;
+		s.bytes = d.stats.bytes - d.stats.skipped;
+	} else {
+		// whole data lines, not the boot messages
+		for (char *line = out; line < out + len; ) {
+			char *end = (char *) memchr(line, '\n', out + len - line);
+			if (!end)
+				break;
+
+			int commas = 0;
+			for (char *c = line; c < end; c++)
+				commas += *c == ',';
+
+			if (commas == DATA_COMMAS) {
+				s.updates++;
+				s.bytes += end - line + 1;
+			}
+			line = end + 1;
+		}
+	}
+
+	free(out);
+
+	return s;
+}
+
+static void report(const char *name, const sent &s, double seconds) {
+	printf("%-8s %6u updates %8u bytes %6.1f bytes/update %5.2f updates/s %6.1f bytes/s %6.0fns/send\n",
+		name, s.updates, s.bytes, s.updates ? (double) s.bytes / s.updates : 0,
+		s.updates / seconds, s.bytes / seconds, s.ns);
+}
+
+int main(int argc, char **argv) {
+	double seconds = 600;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:r:")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-t seconds] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (seconds <= 0)
+		return 1;
+
+	data = tasks[TASK_DATA].run;
+	tasks[TASK_DATA].run = timedData;
+
+	sent text = run(false, seconds, seed);
+	sent binary = run(true, seconds, seed);
+
+	report("text", text, seconds);
+	report("binary", binary, seconds);
+
+	if (!text.updates || !binary.updates) {
+		printf("\nFAILED: nothing sent\n");
+		return 1;
+	}
+
+	bool ok = !binary.stats.bad_crc && !binary.stats.dropped &&
+		(double) binary.bytes / binary.updates < (double) text.bytes / text.updates;
+
+	printf("\n%s: %u bad crc, %u dropped; a frame is %.0f%% of a line, %.1fx the updates for %.0f%% of the bytes\n",
+		ok ? "ok" : "FAILED", binary.stats.bad_crc, binary.stats.dropped,
+		100.0 * binary.bytes / binary.updates / ((double) text.bytes / text.updates),
+		(double) binary.updates / text.updates, 100.0 * binary.bytes / text.bytes);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+/*
+ * teledump.cpp: decodes binary telemetry captured from the serial/radio link
+ * into csv, one row per frame, with the fields the frames carry.
+ *
+ * usage: ardusailor_teledump [file]   (default: stdin)
+ *
+ * Link statistics (bytes per frame, crc failures, frames lost) go to stderr.
+ */
+
+#include <stdio.h>
+
+#include "telemetry/decoder.h"
+
+int main(int argc, char **argv) {
+	FILE *in = stdin;
+	if (argc > 1 && !(in = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	struct tm_decoder d;
+	struct tm_frame frame;
+	uint16_t header = 0;
+	int c;
+
+	tm_decoder_init(&d);
+
+	while ((c = fgetc(in)) != EOF) {
+		if (!tm_decoder_feed(&d, c, &frame))
+			continue;
+
+		if (frame.fields != header) {
+			printf("seq");
+			for (int i = 0; i < TM_FIELD_COUNT; i++)
+				if (frame.fields & (1 << i))
+					printf(",%s", tm_field_name(i));
+			printf("\n");
+
+			header = frame.fields;
+		}
+
+		printf("%u", frame.seq);
+		for (int i = 0; i < TM_FIELD_COUNT; i++)
+			if (frame.fields & (1 << i))
+				printf(",%.*f", tm_field_decimals(i), frame.values[i]);
+		printf("\n");
+	}
+
+	uint32_t framed = d.stats.bytes - d.stats.skipped;
+	fprintf(stderr, "%u frames, %u bytes (%.1f per frame), %u skipped, %u bad crc, %u dropped\n",
+		d.stats.frames, framed, d.stats.frames ? (double) framed / d.stats.frames : 0,
+		d.stats.skipped, d.stats.bad_crc, d.stats.dropped);
+
+	return 0;
+}
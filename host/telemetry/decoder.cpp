@@ -0,0 +1,152 @@
+#include <string.h>
+
+#include "telemetry/decoder.h"
+
+static const double scales[TM_FIELD_COUNT] = TM_SCALES;
+
+static const char *names[TM_FIELD_COUNT] = {
+	"lat", "lon", "gps_age", "speed", "course", "heading", "requested_heading",
+	"roll", "heel_adjust", "wind", "wp_heading", "wp_distance", "rudder",
+	"winch", "voltage", "cycle"
+};
+
+void tm_decoder_init(struct tm_decoder *d) {
+	memset(d, 0, sizeof(*d));
+}
+
+const char *tm_field_name(int field) {
+	return field >= 0 && field < TM_FIELD_COUNT ? names[field] : "?";
+}
+
+int tm_field_decimals(int field) {
+	if (field < 0 || field >= TM_FIELD_COUNT)
+		return 0;
+
+	int decimals = 0;
+	for (double s = scales[field]; s >= 10; s /= 10)
+		decimals++;
+
+	return decimals;
+}
+
+static bool readVarint(const uint8_t **p, const uint8_t *end, int32_t *v) {
+	uint32_t z = 0;
+
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (*p >= end)
+			return false;
+
+		uint8_t b = *(*p)++;
+		z |= (uint32_t) (b & 0x7f) << shift;
+
+		if (!(b & 0x80)) {
+			*v = (int32_t) (z >> 1) ^ -(int32_t) (z & 1);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// buf holds a whole frame with a good crc
+static bool decode(struct tm_decoder *d, struct tm_frame *out) {
+	const uint8_t *p = d->buf + 2;
+	const uint8_t *end = p + d->buf[1];
+
+	uint8_t seq = p[0];
+	bool key = p[1] & TM_KEYFRAME;
+	uint16_t fields = p[2] | (p[3] << 8);
+	p += 4;
+
+	int32_t raw[TM_FIELD_COUNT];
+	memset(raw, 0, sizeof(raw));
+
+	for (int i = 0; i < TM_FIELD_COUNT; i++) {
+		if (!(fields & (1 << i)))
+			continue;
+
+		if (!readVarint(&p, end, &raw[i])) {
+			d->stats.skipped += d->buf[1] + 4;
+			return false;
+		}
+	}
+
+	if (!key) {
+		if (!d->synced || seq != (uint8_t) (d->last_seq + 1) || fields != d->last_fields) {
+			d->synced = false;
+			d->stats.dropped++;
+			return false;
+		}
+
+		for (int i = 0; i < TM_FIELD_COUNT; i++)
+			if (fields & (1 << i))
+				raw[i] += d->last[i];
+	}
+
+	d->synced = true;
+	d->last_seq = seq;
+	d->last_fields = fields;
+	memcpy(d->last, raw, sizeof(raw));
+
+	out->seq = seq;
+	out->keyframe = key;
+	out->fields = fields;
+	for (int i = 0; i < TM_FIELD_COUNT; i++) {
+		out->raw[i] = raw[i];
+		out->values[i] = raw[i] / scales[i];
+	}
+
+	d->stats.frames++;
+	return true;
+}
+
+static bool feed(struct tm_decoder *d, uint8_t b, struct tm_frame *out);
+
+// the sync byte we locked onto wasn't a frame; look for one in what came after it
+static bool resync(struct tm_decoder *d, struct tm_frame *out) {
+	uint8_t rest[TM_MAX_FRAME];
+	uint8_t count = d->used - 1;
+	bool got = false;
+
+	memcpy(rest, d->buf + 1, count);
+	d->used = 0;
+	d->stats.skipped++;
+
+	for (uint8_t i = 0; i < count; i++)
+		got = feed(d, rest[i], out) || got;
+
+	return got;
+}
+
+static bool feed(struct tm_decoder *d, uint8_t b, struct tm_frame *out) {
+	if (d->used == 0 && b != TM_SYNC) {
+		d->stats.skipped++;
+		return false;
+	}
+
+	d->buf[d->used++] = b;
+
+	if (d->used == 2 && (b < 4 || b + 4 > TM_MAX_FRAME))
+		return resync(d, out);
+
+	if (d->used < 2 || d->used < d->buf[1] + 4)
+		return false;
+
+	uint8_t len = d->buf[1];
+	uint16_t crc = 0xffff;
+	for (uint8_t i = 1; i < len + 2; i++)
+		crc = telemetryCrc(crc, d->buf[i]);
+
+	if (crc != (d->buf[len + 2] | (d->buf[len + 3] << 8))) {
+		d->stats.bad_crc++;
+		return resync(d, out);
+	}
+
+	d->used = 0;
+	return decode(d, out);
+}
+
+bool tm_decoder_feed(struct tm_decoder *d, uint8_t b, struct tm_frame *out) {
+	d->stats.bytes++;
+	return feed(d, b, out);
+}
@@ -0,0 +1,56 @@
+/*
+ * decoder.h: receiving side of the firmware's binary telemetry (telemetry.h).
+ *
+ * Bytes from the link are fed in one at a time; noise and text between
+ * frames (log lines, menu output) is skipped. Delta frames are only applied
+ * on top of the frame right before them, so after a lost or corrupted frame
+ * nothing is reported until the next keyframe.
+ */
+
+#ifndef tm_decoder_h
+#define tm_decoder_h
+
+#include <stdint.h>
+
+#include "telemetry.h"
+
+struct tm_frame {
+	uint8_t seq;
+	bool keyframe;
+	uint16_t fields;                 // mask of the fields this frame carried
+	int32_t raw[TM_FIELD_COUNT];     // as sent, fixed point
+	double values[TM_FIELD_COUNT];   // in degrees, knots, meters, volts...
+};
+
+struct tm_stats {
+	uint32_t bytes;
+	uint32_t frames;
+	uint32_t skipped;     // bytes outside of valid frames
+	uint32_t bad_crc;
+	uint32_t dropped;     // delta frames with nothing to apply them to
+};
+
+struct tm_decoder {
+	uint8_t buf[TM_MAX_FRAME];
+	uint8_t used;
+
+	bool synced;          // last holds the sender's state
+	uint8_t last_seq;
+	uint16_t last_fields;
+	int32_t last[TM_FIELD_COUNT];
+
+	struct tm_stats stats;
+};
+
+void tm_decoder_init(struct tm_decoder *d);
+
+// returns true when b completes a frame, which is decoded into out
+bool tm_decoder_feed(struct tm_decoder *d, uint8_t b, struct tm_frame *out);
+
+// short name of a field, as used in printDataLine()'s column order
+const char *tm_field_name(int field);
+
+// decimal places the field is sent with
+int tm_field_decimals(int field);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * trackbench.cpp: the pilot following its legs (guide.h) against steering
+ * straight for each waypoint, in closed loop against the boat simulation.
+ *
+ * Each run sails a zig-zag of reaches back and forth across the wind, so
+ * it's about holding a line rather than getting upwind: the wind from
+ * within 30 degrees of north or south, gusting and shifting, a current of
+ * up to half a knot setting the boat off its legs, the usual sensor noise.
+ * Every run is sailed twice, the same seed each time: with lookahead 0
+ * (straight for the waypoint, as before) and with the firmware's lookahead.
+ * Both steer flat out, not to the power plan (power.h, powerbench), which
+ * lets the rudder be off by a degree or two to save powering it up.
+ *
+ * Reported per leg, over the runs both sailings finished: the median
+ * seconds and rudder travel (degrees), and the mean rms cross-track error
+ * (m). Medians, because a run that ends up in irons for a while (the pilot
+ * can still get stuck there, following legs or not) swamps a mean. Following
+ * the legs has to beat steering for the waypoint on both medians.
+ *
+ * usage: ardusailor_trackbench [-n runs] [-l legs] [-j jobs] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "scenario.h"
+
+#define EARTH_R 6371000.0
+#define D2R(v) ((v) * M_PI / 180.0)
+
+// the zig-zag: m east and north of the start
+static const double course[][2] = {
+	{ 40, 10 }, { 160, -15 }, { 280, 10 }, { 400, -15 }
+};
+
+#define COURSE_POINTS (sizeof(course) / sizeof(course[0]))
+
+#define TUNED_KP 0.85
+#define TUNED_KI 0.012
+#define TUNED_KD 0.011
+
+static uint32_t rng_state;
+
+static double uniform() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state >> 8) / (double) (1 << 24);
+}
+
+static void buildScenario(struct scenario *s, uint32_t seed, int legs) {
+	scenario_defaults(s);
+
+	struct sim_config *cfg = &s->sim;
+	cfg->seed = seed;
+	cfg->wind.direction = (uniform() < 0.5 ? 0 : 180) + 60 * uniform() - 30;
+	cfg->wind.speed = 6 + 6 * uniform();
+	cfg->wind.gust_factor = 0.3 * uniform();
+	cfg->wind.shift_amplitude = 10 * uniform();
+	cfg->current_speed = 0.5 * uniform();
+	cfg->current_direction = 360 * uniform();
+
+	for (size_t i = 0; i < COURSE_POINTS; i++) {
+		s->waypoints[i * 2] = cfg->start_lat + course[i][1] / EARTH_R * 180 / M_PI;
+		s->waypoints[i * 2 + 1] = cfg->start_lon + course[i][0] / (EARTH_R * cos(D2R(cfg->start_lat))) * 180 / M_PI;
+	}
+	s->waypoint_count = COURSE_POINTS;
+
+	// what ardusailor_tune finds for the simulated boat. the firmware's
+	// defaults barely steer it
+	s->tunings[0] = TUNED_KP;
+	s->tunings[1] = TUNED_KI;
+	s->tunings[2] = TUNED_KD;
+	s->legs = legs;
+	s->limit = legs * 300;
+}
+
+// per leg, for each run both sailings finished
+struct totals {
+	int finished;
+	int paired;
+	float *seconds;
+	float *rudder;
+	double xte;
+};
+
+static int cmpFloat(const void *a, const void *b) {
+	float x = *(const float *) a, y = *(const float *) b;
+
+	return (x > y) - (x < y);
+}
+
+static float median(float *v, int n) {
+	if (!n)
+		return 0;
+
+	qsort(v, n, sizeof(float), cmpFloat);
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static void add(struct totals *t, const struct scenario_result *r) {
+	t->seconds[t->paired] = r->elapsed / r->legs;
+	t->rudder[t->paired] = r->rudder_travel / r->legs;
+	t->xte += r->xte_rms;
+	t->paired++;
+}
+
+static void report(const char *name, struct totals *t, int runs) {
+	printf("%-10s %4d/%-4d %8.1f %10.0f %8.2f\n", name, t->finished, runs,
+		median(t->seconds, t->paired), median(t->rudder, t->paired), t->paired ? t->xte / t->paired : 0);
+}
+
+int main(int argc, char **argv) {
+	int runs = 64;
+	int legs = 8;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:l:j:r:")) != -1) {
+		switch (opt) {
+			case 'n': runs = atoi(optarg); break;
+			case 'l': legs = atoi(optarg); break;
+			case 'j': jobs = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-l legs] [-j jobs] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (runs < 1 || legs < 1 || jobs < 1)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	// the waypoint runs first, then the same again following the legs
+	struct scenario *s = (struct scenario *) calloc(runs * 2, sizeof(struct scenario));
+	struct scenario_result *r = (struct scenario_result *) calloc(runs * 2, sizeof(struct scenario_result));
+
+	for (int i = 0; i < runs; i++) {
+		buildScenario(&s[i], seed * 1000 + i, legs);
+		s[i].power_saving = false;
+		s[runs + i] = s[i];
+		s[i].lookahead = 0;
+	}
+
+	if (!scenario_run_all(s, r, runs * 2, jobs, NULL))
+		return 1;
+
+	struct totals waypoint, leg;
+	memset(&waypoint, 0, sizeof(waypoint));
+	memset(&leg, 0, sizeof(leg));
+	waypoint.seconds = (float *) calloc(runs, sizeof(float));
+	waypoint.rudder = (float *) calloc(runs, sizeof(float));
+	leg.seconds = (float *) calloc(runs, sizeof(float));
+	leg.rudder = (float *) calloc(runs, sizeof(float));
+
+	// runs the legs sailed faster
+	int faster = 0;
+
+	for (int i = 0; i < runs; i++) {
+		const struct scenario_result *a = &r[i], *b = &r[runs + i];
+
+		waypoint.finished += a->finished;
+		leg.finished += b->finished;
+
+		if (a->finished && b->finished) {
+			add(&waypoint, a);
+			add(&leg, b);
+			faster += b->elapsed < a->elapsed;
+		}
+	}
+
+	printf("steering   finished     s/leg  rudder/leg  xte rms\n");
+	report("waypoint", &waypoint, runs);
+	report("leg", &leg, runs);
+	printf("following the legs was faster in %d of %d runs\n", faster, leg.paired);
+
+	int failed = 0;
+
+	if (!leg.paired || median(leg.seconds, leg.paired) >= median(waypoint.seconds, waypoint.paired)) {
+		fprintf(stderr, "following the legs wasn't faster\n");
+		failed++;
+	}
+
+	if (!leg.paired || median(leg.rudder, leg.paired) >= median(waypoint.rudder, waypoint.paired)) {
+		fprintf(stderr, "following the legs took more rudder\n");
+		failed++;
+	}
+
+	free(waypoint.seconds);
+	free(waypoint.rudder);
+	free(leg.seconds);
+	free(leg.rudder);
+	free(s);
+	free(r);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * trailbench.cpp: cost of one heading trail update against the window length,
+ * for the trails in trail.h and the re-sum-everything average they replaced.
+ *
+ * Times are host nanoseconds per update, which only compare the methods with
+ * each other; on the avr, float sin/cos/atan2 are far dearer next to adds
+ * than here. The error columns are the largest difference from a mean taken
+ * in double precision over the same window, in degrees.
+ *
+ * usage: ardusailor_trailbench [-u updates] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "trail.h"
+
+static const int windows[] = { 10, 16, 32, 64, 128, 256 };
+
+static uint32_t rng_state;
+
+static float rnd() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state & 0xffffff) / (float) 0x1000000;
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// firmware.ino's newTrailingHeadingValue() before trail.h
+static float resum(AngleCmp *trail, int count, long cycle, float new_val) {
+	trail[cycle % count].s = sin(new_val);
+	trail[cycle % count].c = cos(new_val);
+
+	float x = 0;
+	float y = 0;
+
+	for (int i = 0; i < count; i++) {
+		x += trail[i].c;
+		y += trail[i].s;
+	}
+
+	float a = atan2(y, x);
+	return a < 0 ? a + TWO_PI : a;
+}
+
+static double angleError(double a, double b) {
+	double d = fmod(fabs(a - b), 2 * M_PI);
+	return (d > M_PI ? 2 * M_PI - d : d) * 180 / M_PI;
+}
+
+// a heading wandering about north, so the trail keeps crossing 0/360
+static void makeSamples(std::vector<float> &v) {
+	float h = 0;
+	for (size_t i = 0; i < v.size(); i++) {
+		h += (rnd() - 0.5) * 0.05;
+		float a = h + (rnd() - 0.5) * 0.6;
+		v[i] = a < 0 ? a + TWO_PI : a;
+	}
+}
+
+int main(int argc, char **argv) {
+	int updates = 2000000;
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "u:r:")) != -1) {
+		switch (opt) {
+			case 'u': updates = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-u updates] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (updates <= 0)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	std::vector<float> samples(updates);
+	makeSamples(samples);
+
+	printf("window   resum ns   trail ns   fixed ns     ema ns   trail err   fixed err\n");
+
+	for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+		int n = windows[w];
+		std::vector<AngleCmp> old_buf(n), buf(n);
+		std::vector<AngleCmpFix> fix_buf(n);
+		AngleTrail trail;
+		AngleTrailFix fix;
+		AngleEma ema;
+
+		for (int i = 0; i < n; i++)
+			old_buf[i].s = 0, old_buf[i].c = 1;
+		trailInit(&trail, &buf[0], n, 0);
+		trailFixInit(&fix, &fix_buf[0], n, 0);
+		emaInit(&ema, EMA_ALPHA(n), 0);
+
+		// volatile sink, so the updates aren't optimized away
+		volatile float sink = 0;
+		double t0, ns[4];
+
+		t0 = now_ns();
+		for (int i = 0; i < updates; i++)
+			sink = resum(&old_buf[0], n, i, samples[i]);
+		ns[0] = (now_ns() - t0) / updates;
+
+		t0 = now_ns();
+		for (int i = 0; i < updates; i++)
+			sink = bamToRad(trailAdd(&trail, samples[i]));
+		ns[1] = (now_ns() - t0) / updates;
+
+		t0 = now_ns();
+		for (int i = 0; i < updates; i++)
+			sink = bamToRad(trailFixAdd(&fix, samples[i]));
+		ns[2] = (now_ns() - t0) / updates;
+
+		t0 = now_ns();
+		for (int i = 0; i < updates; i++)
+			sink = bamToRad(emaAdd(&ema, samples[i]));
+		ns[3] = (now_ns() - t0) / updates;
+
+		// accuracy, on fresh trails against a double precision window
+		trailInit(&trail, &buf[0], n, 0);
+		trailFixInit(&fix, &fix_buf[0], n, 0);
+
+		double ds = 0, dc = n;
+		double trail_err = 0, fix_err = 0;
+		for (int i = 0; i < updates; i++) {
+			float old = i >= n ? samples[i - n] : 0;
+			ds += sin((double) samples[i]) - sin((double) old);
+			dc += cos((double) samples[i]) - cos((double) old);
+
+			double exact = atan2(ds, dc);
+			trail_err = fmax(trail_err, angleError(bamToRad(trailAdd(&trail, samples[i])), exact));
+			fix_err = fmax(fix_err, angleError(bamToRad(trailFixAdd(&fix, samples[i])), exact));
+		}
+
+		printf("%6d %10.1f %10.1f %10.1f %10.1f %11.5f %11.5f\n",
+			n, ns[0], ns[1], ns[2], ns[3], trail_err, fix_err);
+	}
+
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * trimbench.cpp: the sheet trimmed by what goes fastest (trim.h) against
+ * setting it by the wind angle, in closed loop against the boat
+ * simulation.
+ *
+ * Each run sails round a triangle of marks 250m apart, back and forth, so
+ * it beats, reaches and runs: 4 to 14 knots of wind, gusting and shifting,
+ * up to a quarter knot of current, the usual sensor noise. Every run is
+ * sailed three times, the same seed each time: the sheet set by the wind
+ * angle (the map, easing when heeled), as before; picked from what's been
+ * learned (learn.h); and trimmed, learning the polar as well.
+ *
+ * Reported over the runs all three finished: the median speed made good
+ * along the legs (knots), over them all and over the ones the map kept its
+ * heel under TRIM_MAX_HEEL, the median of each run's greatest heel, and
+ * the mean time spent heeled past TRIM_MAX_HEEL. In a breeze the map lays
+ * the boat over as far as it goes, and keeping it up costs speed, so the
+ * runs it kept the boat up in are where it's a fair race. Trimming has to
+ * make more good than the map over those, and spend less time over.
+ *
+ * usage: ardusailor_trimbench [-n runs] [-l legs] [-j jobs] [-r seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "scenario.h"
+#include "trim.h"
+
+#define EARTH_R 6371000.0
+#define D2R(v) ((v) * M_PI / 180.0)
+
+// m between the marks
+#define COURSE_LENGTH 250
+
+#define TUNED_KP 0.85
+#define TUNED_KI 0.012
+#define TUNED_KD 0.011
+
+#define KNOT 0.5144
+
+// fraction of the time the map can be over and still count as kept up
+#define HELD 0.01
+
+static uint32_t rng_state;
+
+static double uniform() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+
+	return (rng_state >> 8) / (double) (1 << 24);
+}
+
+static void buildScenario(struct scenario *s, uint32_t seed, int legs) {
+	scenario_defaults(s);
+
+	struct sim_config *cfg = &s->sim;
+	cfg->seed = seed;
+	cfg->wind.direction = 360 * uniform();
+	cfg->wind.speed = 4 + 10 * uniform();
+	cfg->wind.gust_factor = 0.3 * uniform();
+	cfg->wind.shift_amplitude = 15 * uniform();
+	cfg->current_speed = 0.25 * uniform();
+	cfg->current_direction = 360 * uniform();
+
+	// the other two corners of the triangle, turned any way to the wind.
+	// the start's the third
+	double turn = 360 * uniform();
+
+	for (int i = 0; i < 2; i++) {
+		double b = D2R(turn + 60 * i);
+
+		s->waypoints[i * 2] = cfg->start_lat + COURSE_LENGTH * cos(b) / EARTH_R * 180 / M_PI;
+		s->waypoints[i * 2 + 1] = cfg->start_lon + COURSE_LENGTH * sin(b) / (EARTH_R * cos(D2R(cfg->start_lat))) * 180 / M_PI;
+	}
+	s->waypoints[4] = cfg->start_lat;
+	s->waypoints[5] = cfg->start_lon;
+	s->waypoint_count = 3;
+
+	s->tunings[0] = TUNED_KP;
+	s->tunings[1] = TUNED_KI;
+	s->tunings[2] = TUNED_KD;
+	s->legs = legs;
+	s->limit = legs * 600;
+	s->tack_every = 0;
+}
+
+// for each run all three sailings finished
+struct totals {
+	int finished;
+	int paired;
+	float *smg;
+	float *held;
+	int helds;
+	float *heel;
+	float over;
+};
+
+static int cmpFloat(const void *a, const void *b) {
+	float x = *(const float *) a, y = *(const float *) b;
+
+	return (x > y) - (x < y);
+}
+
+static float median(float *v, int n) {
+	if (!n)
+		return 0;
+
+	qsort(v, n, sizeof(float), cmpFloat);
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static void add(struct totals *t, const struct scenario_result *r, bool held) {
+	t->smg[t->paired] = COURSE_LENGTH * r->legs / r->elapsed / KNOT;
+	if (held)
+		t->held[t->helds++] = t->smg[t->paired];
+	t->heel[t->paired] = r->heel_max;
+	t->over += r->heel_over;
+	t->paired++;
+}
+
+static void report(const char *name, struct totals *t, int runs) {
+	printf("%-10s %4d/%-4d %8.2f %8.2f %9.1f %8.1f%%\n", name, t->finished, runs,
+		median(t->smg, t->paired), median(t->held, t->helds), median(t->heel, t->paired),
+		t->paired ? 100 * t->over / t->paired : 0);
+}
+
+int main(int argc, char **argv) {
+	int runs = 48;
+	int legs = 9;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t seed = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:l:j:r:")) != -1) {
+		switch (opt) {
+			case 'n': runs = atoi(optarg); break;
+			case 'l': legs = atoi(optarg); break;
+			case 'j': jobs = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-l legs] [-j jobs] [-r seed]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (runs < 1 || legs < 1 || jobs < 1)
+		return 1;
+
+	rng_state = seed ? seed : 1;
+
+	// the map, the learned sheet, then trimmed
+	struct scenario *s = (struct scenario *) calloc(runs * 3, sizeof(struct scenario));
+	struct scenario_result *r = (struct scenario_result *) calloc(runs * 3, sizeof(struct scenario_result));
+
+	for (int i = 0; i < runs; i++) {
+		buildScenario(&s[i], seed * 1000 + i, legs);
+		s[i].learning = false;
+		s[i].trimming = false;
+
+		s[runs + i] = s[i];
+		s[runs + i].learning = true;
+
+		s[runs * 2 + i] = s[runs + i];
+		s[runs * 2 + i].trimming = true;
+	}
+
+	if (!scenario_run_all(s, r, runs * 3, jobs, NULL))
+		return 1;
+
+	struct totals t[3];
+	memset(t, 0, sizeof(t));
+	for (int k = 0; k < 3; k++) {
+		t[k].smg = (float *) calloc(runs, sizeof(float));
+		t[k].held = (float *) calloc(runs, sizeof(float));
+		t[k].heel = (float *) calloc(runs, sizeof(float));
+	}
+
+	// runs trimming made more good than the map, of all and of those it
+	// kept the boat up in
+	int faster = 0, faster_held = 0;
+
+	for (int i = 0; i < runs; i++) {
+		const struct scenario_result *a = &r[i], *b = &r[runs + i], *c = &r[runs * 2 + i];
+
+		t[0].finished += a->finished;
+		t[1].finished += b->finished;
+		t[2].finished += c->finished;
+
+		if (a->finished && b->finished && c->finished) {
+			bool held = a->heel_over < HELD;
+
+			add(&t[0], a, held);
+			add(&t[1], b, held);
+			add(&t[2], c, held);
+			faster += c->elapsed < a->elapsed;
+			faster_held += held && c->elapsed < a->elapsed;
+		}
+	}
+
+	printf("sheet      finished      smg  kept up  max heel  past %d  (kt, degrees)\n", TRIM_MAX_HEEL);
+	report("map", &t[0], runs);
+	report("learned", &t[1], runs);
+	report("trimmed", &t[2], runs);
+	printf("trimming made more good than the map in %d of %d runs, %d of the %d it kept the boat up in\n",
+		faster, t[2].paired, faster_held, t[2].helds);
+
+	int failed = 0;
+
+	if (!t[2].helds || median(t[2].held, t[2].helds) <= median(t[0].held, t[0].helds)) {
+		fprintf(stderr, "trimming didn't make more good than the map\n");
+		failed++;
+	}
+
+	if (t[2].over >= t[0].over) {
+		fprintf(stderr, "trimming spent as long heeled too far as the map\n");
+		failed++;
+	}
+
+	for (int k = 0; k < 3; k++) {
+		free(t[k].smg);
+		free(t[k].held);
+		free(t[k].heel);
+	}
+	free(s);
+	free(r);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,430 @@
+/*
+ * tune.cpp: offline tuning of the steering PID gains.
+ *
+ * Nelder-Mead over log(kp, ki, kd), starting from the firmware's gains. Each
+ * candidate is sailed through a fixed set of simulated scenarios (same seeds
+ * for every candidate, wind from all round the compass) run in parallel, and
+ * optionally through the heading requests replayed from a logged run.
+ *
+ * usage: ardusailor_tune [options]
+ *   -n count      simulated scenarios per candidate (default 8)
+ *   -j jobs       scenarios run in parallel (default: one per core)
+ *   -t seconds    virtual time per scenario (default 600)
+ *   -i count      optimizer iterations (default 40)
+ *   -r seed       base random seed (default 1)
+ *   -l file       a logged run (e.g. logs/run.txt) to replay heading requests from
+ *   -o file       gains for the board, as an avrdude eeprom image (default gains.eep)
+ *   -e file       gains for the host build, written into this eeprom image
+ *
+ * Flash the gains with avrdude -p m2560 ... -U eeprom:w:gains.eep:i; setup()
+ * picks them up on the next boot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <vector>
+
+#include <PID_v1.h>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "config.h"
+#include "hal_host.h"
+#include "servo_ctl.h"
+#include "scenario.h"
+
+// where configLoad() looks for the gains (firmware.ino)
+#define CONFIG_PARAM_ADDRESS 0
+
+// cost: degrees rms heading error, plus this much per degree of rudder per minute
+#define RUDDER_WEIGHT 0.02
+
+// gains are searched in log space, between these
+#define GAIN_MIN 1e-5
+#define GAIN_MAX 100.0
+
+// replay: printDataLine() rate, pilot PID rate, and the speed assumed when the log has no gps speed
+#define REPLAY_DATA_PERIOD 1.5
+#define REPLAY_STEP 0.1
+#define REPLAY_MIN_SPEED 0.5
+#define REPLAY_SPEED 1.5
+
+// rudder servo limits around center (servo_ctl.h)
+#define RUDDER_PORT_LIMIT (RUDDER_MIN - 90)
+#define RUDDER_SBORD_LIMIT (RUDDER_MAX - 90)
+
+#define KTS 0.514444
+
+struct trace_point {
+	float heading;
+	float requested;
+	float speed;
+};
+
+static std::vector<struct scenario> scenarios;
+static std::vector<trace_point> trace;
+static struct sim_config replay_cfg;
+static uint32_t replay_seed;
+static int jobs;
+static int evaluations;
+
+static double wrap360(double v) {
+	v = fmod(v, 360.0);
+	return v < 0 ? v + 360 : v;
+}
+
+static double headingError(double a, double b) {
+	double d = fabs(wrap360(a - b));
+	return d > 180 ? 360 - d : d;
+}
+
+// data lines from printDataLine(): 18 fields, or 15 in older logs that had no
+// requested heading (the pilot steered straight for wp_heading then)
+static bool readTrace(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return false;
+
+	char line[512];
+	while (fgets(line, sizeof(line), f)) {
+		double v[18];
+		int n = 0;
+
+		// gps_aprs_lat is e.g. 4155.28N
+		char *comma = strchr(line, ',');
+		if (!comma || (comma[-1] != 'N' && comma[-1] != 'S'))
+			continue;
+
+		char *p = line;
+		for (char *tok = strsep(&p, ","); tok && n < 19; tok = strsep(&p, ","), n++)
+			if (n < 18)
+				v[n] = atof(tok);
+
+		trace_point t;
+		if (n == 18) {
+			t.heading = v[7];
+			t.requested = v[8];
+		} else if (n == 15) {
+			t.heading = v[7];
+			t.requested = v[9];
+		} else
+			continue;
+
+		t.speed = v[5] > REPLAY_MIN_SPEED ? v[5] : REPLAY_SPEED;
+		trace.push_back(t);
+	}
+
+	fclose(f);
+	return !trace.empty();
+}
+
+static double gaussian() {
+	// box-muller on a xorshift, so the replay noise is the same for every candidate
+	replay_seed ^= replay_seed << 13;
+	replay_seed ^= replay_seed >> 17;
+	replay_seed ^= replay_seed << 5;
+	double u1 = ((replay_seed >> 8) + 1) / (double) (1 << 24);
+
+	replay_seed ^= replay_seed << 13;
+	replay_seed ^= replay_seed >> 17;
+	replay_seed ^= replay_seed << 5;
+	double u2 = (replay_seed >> 8) / (double) (1 << 24);
+
+	return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+// steers the simulation's yaw model through the logged heading requests with
+// the firmware's PID setup. the model heading is wrapped like the compass's,
+// so gains are judged against the same 0/360 handling as on the boat
+static double replayCost(const double gains[3]) {
+	double input, output = 0, setpoint;
+	PID pid(&input, &output, &setpoint, gains[0], gains[1], gains[2], P_ON_E, DIRECT);
+	pid.SetOutputLimits(-45, 45);
+	pid.SetMode(AUTOMATIC);
+
+	const struct sim_boat *boat = &replay_cfg.boat;
+	double heading = trace[0].heading, rate = 0, rudder = 0;
+	double err_sq = 0, travel = 0;
+	uint32_t samples = 0;
+
+	replay_seed = replay_cfg.seed ? replay_cfg.seed : 1;
+
+	for (size_t i = 0; i < trace.size(); i++) {
+		setpoint = trace[i].requested;
+
+		for (double t = 0; t < REPLAY_DATA_PERIOD; t += REPLAY_STEP) {
+			input = wrap360(heading + replay_cfg.noise.compass * gaussian());
+
+			hal_advance_us(REPLAY_STEP * 1e6);
+			pid.Compute();
+
+			double r = constrain(round(output), RUDDER_PORT_LIMIT, RUDDER_SBORD_LIMIT);
+			travel += fabs(r - rudder);
+			rudder = r;
+
+			double target = trace[i].speed * KTS * sin(rudder * M_PI / 180) / boat->length * 180 / M_PI;
+			rate += (target - rate) * REPLAY_STEP / boat->yaw_time;
+			heading = wrap360(heading + rate * REPLAY_STEP);
+
+			double e = headingError(setpoint, heading);
+			err_sq += e * e;
+			samples++;
+		}
+	}
+
+	double minutes = trace.size() * REPLAY_DATA_PERIOD / 60;
+	return sqrt(err_sq / samples) + RUDDER_WEIGHT * travel / minutes;
+}
+
+static double simCost(const double gains[3]) {
+	size_t count = scenarios.size();
+	std::vector<struct scenario_result> results(count);
+
+	for (size_t i = 0; i < count; i++)
+		memcpy(scenarios[i].tunings, gains, sizeof(scenarios[i].tunings));
+
+	if (!scenario_run_all(&scenarios[0], &results[0], count, jobs, NULL))
+		exit(1);
+
+	double total = 0;
+	for (size_t i = 0; i < count; i++) {
+		const struct scenario_result *r = &results[i];
+
+		if (!r->done) {
+			fprintf(stderr, "scenario %zu failed\n", i);
+			exit(1);
+		}
+
+		double minutes = r->elapsed / 60;
+		total += r->heading_rms + (minutes > 0 ? RUDDER_WEIGHT * r->rudder_travel / minutes : 0);
+	}
+
+	return total / count;
+}
+
+static void toGains(const double x[3], double gains[3]) {
+	for (int i = 0; i < 3; i++)
+		gains[i] = exp(constrain(x[i], log(GAIN_MIN), log(GAIN_MAX)));
+}
+
+// the logged run counts as much as one simulated scenario
+static double cost(const double x[3]) {
+	double gains[3];
+	toGains(x, gains);
+
+	size_t n = scenarios.size();
+	double c = n ? simCost(gains) * n : 0;
+	if (!trace.empty()) {
+		c += replayCost(gains);
+		n++;
+	}
+	c /= n;
+
+	evaluations++;
+	fprintf(stderr, "%4d  kp %.4g  ki %.4g  kd %.4g  cost %.3f\n", evaluations, gains[0], gains[1], gains[2], c);
+
+	return c;
+}
+
+struct vertex {
+	double x[3];
+	double cost;
+};
+
+static void blend(const double *a, const double *b, double t, double *out) {
+	for (int i = 0; i < 3; i++)
+		out[i] = a[i] + t * (b[i] - a[i]);
+}
+
+// v must come in with its costs evaluated
+static void nelderMead(vertex *v, int iterations) {
+	for (int it = 0; it < iterations; it++) {
+		// best first
+		for (int i = 1; i < 4; i++)
+			for (int j = i; j > 0 && v[j].cost < v[j - 1].cost; j--) {
+				vertex t = v[j];
+				v[j] = v[j - 1];
+				v[j - 1] = t;
+			}
+
+		double centroid[3] = { 0, 0, 0 };
+		for (int i = 0; i < 3; i++)
+			for (int d = 0; d < 3; d++)
+				centroid[d] += v[i].x[d] / 3;
+
+		vertex r;
+		blend(centroid, v[3].x, -1, r.x);
+		r.cost = cost(r.x);
+
+		if (r.cost < v[0].cost) {
+			vertex e;
+			blend(centroid, v[3].x, -2, e.x);
+			e.cost = cost(e.x);
+			v[3] = e.cost < r.cost ? e : r;
+		} else if (r.cost < v[2].cost) {
+			v[3] = r;
+		} else {
+			vertex c;
+			if (r.cost < v[3].cost)
+				blend(centroid, r.x, 0.5, c.x);
+			else
+				blend(centroid, v[3].x, 0.5, c.x);
+			c.cost = cost(c.x);
+
+			if (c.cost < min(r.cost, v[3].cost))
+				v[3] = c;
+			else
+				for (int i = 1; i < 4; i++) {
+					blend(v[0].x, v[i].x, 0.5, v[i].x);
+					v[i].cost = cost(v[i].x);
+				}
+		}
+	}
+
+	for (int i = 1; i < 4; i++)
+		if (v[i].cost < v[0].cost) {
+			vertex t = v[0];
+			v[0] = v[i];
+			v[i] = t;
+		}
+}
+
+static void hexRecord(FILE *f, uint16_t addr, uint8_t type, const uint8_t *data, uint8_t len) {
+	uint8_t sum = len + (addr >> 8) + (addr & 0xff) + type;
+
+	fprintf(f, ":%02X%04X%02X", len, addr, type);
+	for (int i = 0; i < len; i++) {
+		fprintf(f, "%02X", data[i]);
+		sum += data[i];
+	}
+	fprintf(f, "%02X\n", (uint8_t) -sum);
+}
+
+// the gains in every one of config.h's slots for them, so they're the newest
+// whatever the board has saved, leaving its other settings be
+static bool writeEep(const char *path, const double gains[3]) {
+	Config c;
+
+	hal_reset();
+	configInit(&c, CONFIG_PARAM_ADDRESS);
+	for (int i = 0; i < 3; i++)
+		c.pid[i] = gains[i];
+	for (int i = 0; i < CONFIG_PID_SLOTS; i++)
+		configSave(&c, CONFIG_PID);
+
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return false;
+
+	uint16_t from = configAddress(&c, CONFIG_PID), size = configSize(CONFIG_PID);
+	for (uint16_t at = 0; at < size; at += 16)
+		hexRecord(f, from + at, 0, &hal_eeprom[from + at], min(16, size - at));
+	hexRecord(f, 0, 1, NULL, 0);
+
+	return fclose(f) == 0;
+}
+
+static bool writeHostEeprom(const char *path, const double gains[3]) {
+	// keep whatever else the image holds (the compass calibration, the route)
+	hal_reset();
+	hal_eeprom_load(path);
+	sim_store_pid_tunings(gains);
+
+	return hal_eeprom_save(path);
+}
+
+int main(int argc, char **argv) {
+	int count = 8;
+	double limit = 600;
+	int iterations = 40;
+	uint32_t seed = 1;
+	const char *log_file = NULL;
+	const char *out = "gains.eep";
+	const char *eeprom = NULL;
+
+	jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:j:t:i:r:l:o:e:")) != -1) {
+		switch (opt) {
+			case 'n': count = atoi(optarg); break;
+			case 'j': jobs = atoi(optarg); break;
+			case 't': limit = atof(optarg); break;
+			case 'i': iterations = atoi(optarg); break;
+			case 'r': seed = strtoul(optarg, NULL, 10); break;
+			case 'l': log_file = optarg; break;
+			case 'o': out = optarg; break;
+			case 'e': eeprom = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-n count] [-j jobs] [-t seconds] [-i iterations] [-r seed] [-l log] [-o gains.eep] [-e eeprom]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (count < 0 || jobs <= 0 || (count == 0 && !log_file))
+		return 1;
+
+	struct scenario base;
+	scenario_defaults(&base);
+	base.limit = limit;
+	// keep sailing the course for the whole run
+	base.legs = 1000;
+
+	for (int i = 0; i < count; i++) {
+		struct scenario s = base;
+		s.sim.wind.direction = wrap360(base.sim.wind.direction + i * 360.0 / count);
+		s.sim.seed = seed * 100003 + i;
+		scenarios.push_back(s);
+	}
+
+	sim_default_config(&replay_cfg);
+	replay_cfg.seed = seed;
+
+	if (log_file) {
+		if (!readTrace(log_file)) {
+			fprintf(stderr, "no data lines in %s\n", log_file);
+			return 1;
+		}
+		fprintf(stderr, "replaying %zu heading requests from %s\n", trace.size(), log_file);
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	vertex v[4];
+	for (int i = 0; i < 4; i++)
+		for (int d = 0; d < 3; d++)
+			v[i].x[d] = log(constrain(base.tunings[d], GAIN_MIN, GAIN_MAX)) + (i == d + 1 ? 1.0 : 0);
+
+	for (int i = 0; i < 4; i++)
+		v[i].cost = cost(v[i].x);
+
+	double default_cost = v[0].cost;
+	nelderMead(v, iterations);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	double gains[3];
+	toGains(v[0].x, gains);
+
+	printf("kp %.6g ki %.6g kd %.6g: cost %.3f (firmware gains %.3f), %d evaluations in %.0fs\n",
+		gains[0], gains[1], gains[2], v[0].cost, default_cost, evaluations, wall);
+
+	if (!writeEep(out, gains)) {
+		perror(out);
+		return 1;
+	}
+
+	if (eeprom && !writeHostEeprom(eeprom, gains)) {
+		perror(eeprom);
+		return 1;
+	}
+
+	return 0;
+}